@@ -0,0 +1,300 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file adminserver.cpp
+ *
+ * Contains the implementation of the admin endpoint
+ */
+#include "adminserver.h"
+#include "socket.h"
+#include "logging.h"
+#include "metrics.h"
+#include "latency.h"
+
+#include <sstream>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// a client hanging up early must not kill the daemon
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+extern Deception::Logging globLog;
+
+/// keep a descriptor from blocking and from the processes exec()uted by modules
+static void setFlags(int _fd)
+{
+	::fcntl(_fd, F_SETFL, ::fcntl(_fd, F_GETFL) | O_NONBLOCK);
+	::fcntl(_fd, F_SETFD, ::fcntl(_fd, F_GETFD) | FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	::setsockopt(_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+// {{{1 DXG DOC
+/**
+ * Constructor, nothing is served until open() is called
+ *
+ * \param _module Name for logging
+ */
+// }}}1 DXG DOC
+Deception::AdminServer::AdminServer(const std::string &_module) :
+	module(_module),
+	listener(NULL)
+{ // {{{1
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor, closes the listener and all clients
+ */
+// }}}1 DXG DOC
+Deception::AdminServer::~AdminServer()
+{ // {{{1
+	this->closeAll();
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Listen for scrapers
+ *
+ * \param _ipAddr Address to listen on
+ * \param _port Port to listen on
+ *
+ * \exception Exception The socket could not be bound
+ */
+// }}}1 DXG DOC
+void Deception::AdminServer::open(const std::string &_ipAddr, int _port)
+{ // {{{1
+	Socket *socket = new Socket(_ipAddr, _port);
+	try {
+		socket->init();
+	} catch (Exception &e) {
+		delete socket;
+		throw;
+	}
+	// select() may report a client that has reset before accept()
+	setFlags(socket->getFd());
+	this->listener = socket;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Add the listener and the clients to the sets of a select(), clients
+ * are waited for to read their request, then to write their answer
+ *
+ * \return Highest descriptor added, -1 if none
+ */
+// }}}1 DXG DOC
+int Deception::AdminServer::setFds(fd_set &_read, fd_set &_write) const
+{ // {{{1
+	if (this->listener == NULL) {
+		return -1;
+	}
+	int maxFd = this->listener->getFd();
+	FD_SET(maxFd, &_read);
+	for (std::map<int, Client>::const_iterator it = this->clients.begin(); it != this->clients.end(); ++it) {
+		FD_SET(it->first, it->second.answer.empty() ? &_read : &_write);
+		if (it->first > maxFd) {
+			maxFd = it->first;
+		}
+	}
+	return maxFd;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Serve the descriptors select() has found ready and close the clients
+ * whose time is up. Has to be called after every select(), also if it
+ * timed out.
+ *
+ * \param _read Descriptors ready for reading
+ * \param _write Descriptors ready for writing
+ * \param _now Current time
+ *
+ * \return Number of ready descriptors that were ours
+ */
+// }}}1 DXG DOC
+int Deception::AdminServer::handle(const fd_set &_read, const fd_set &_write, time_t _now)
+{ // {{{1
+	if (this->listener == NULL) {
+		return 0;
+	}
+	int handled = 0;
+	std::vector<int> done;
+	for (std::map<int, Client>::iterator it = this->clients.begin(); it != this->clients.end(); ++it) {
+		int fd = it->first;
+		Client &client = it->second;
+		bool open = true;
+		if (FD_ISSET(fd, &_read)) {
+			handled++;
+			open = this->readRequest(fd, client);
+		} else if (FD_ISSET(fd, &_write)) {
+			handled++;
+			open = this->writeAnswer(fd, client);
+		} else if (_now >= client.deadline) {
+			LOGMSG(this->module, Debug, "closing admin client " << fd << " after " << timeout << " s");
+			open = false;
+		}
+		if (!open) {
+			done.push_back(fd);
+		}
+	}
+	for (size_t i = 0; i < done.size(); i++) {
+		::close(done[i]);
+		this->clients.erase(done[i]);
+	}
+	if (FD_ISSET(this->listener->getFd(), &_read)) {
+		handled++;
+		this->accept(_now);
+	}
+	return handled;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Close the listener and all clients, e.g. in a forked session process
+ */
+// }}}1 DXG DOC
+void Deception::AdminServer::closeAll()
+{ // {{{1
+	for (std::map<int, Client>::iterator it = this->clients.begin(); it != this->clients.end(); ++it) {
+		::close(it->first);
+	}
+	this->clients.clear();
+	delete this->listener;
+	this->listener = NULL;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Accept the pending clients
+ */
+// }}}1 DXG DOC
+void Deception::AdminServer::accept(time_t _now)
+{ // {{{1
+	int fd;
+	while ((fd = ::accept(this->listener->getFd(), NULL, NULL)) != -1) {
+		if (this->clients.size() >= maxClients) {
+			LOGMSG(this->module, Error, "too many admin clients, closing a new one");
+			::close(fd);
+			continue;
+		}
+		setFlags(fd);
+		Client &client = this->clients[fd];
+		client.sent = 0;
+		client.deadline = _now + timeout;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Read what a client has sent, and prepare the answer once the request
+ * is complete
+ *
+ * \retval true If the client stays open
+ * \retval false If it has to be closed
+ */
+// }}}1 DXG DOC
+bool Deception::AdminServer::readRequest(int _fd, Client &_client)
+{ // {{{1
+	char buf[1024];
+	ssize_t got = ::recv(_fd, buf, sizeof(buf), 0);
+	if (got == -1) {
+		return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+	}
+	if ((got > 0) && (_client.request.size() < maxRequest)) {
+		_client.request.append(buf, got);
+	}
+	// the header fields end with an empty line, we only need the request line
+	if ((got == 0) || (_client.request.size() >= maxRequest)
+			|| (_client.request.find("\r\n\r\n") != std::string::npos)
+			|| (_client.request.find("\n\n") != std::string::npos)) {
+		if (_client.request.empty()) {
+			return false;
+		}
+		_client.answer = answer(_client.request);
+		// most answers fit into the socket buffer right away
+		return this->writeAnswer(_fd, _client);
+	}
+	return true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write as much of the answer as the socket takes
+ *
+ * \retval true If there is more to write
+ * \retval false If the client has to be closed
+ */
+// }}}1 DXG DOC
+bool Deception::AdminServer::writeAnswer(int _fd, Client &_client)
+{ // {{{1
+	while (_client.sent < _client.answer.size()) {
+		ssize_t written = ::send(_fd, _client.answer.data() + _client.sent,
+				_client.answer.size() - _client.sent, MSG_NOSIGNAL);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+		}
+		_client.sent += written;
+	}
+	return false;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Build the answer of a request: the metrics for / and /metrics, not
+ * found for the rest
+ */
+// }}}1 DXG DOC
+std::string Deception::AdminServer::answer(const std::string &_request)
+{ // {{{1
+	std::string status = "200 OK";
+	std::string body;
+	if ((_request.compare(0, 13, "GET /metrics ") == 0) || (_request.compare(0, 6, "GET / ") == 0)) {
+		body = globMetrics.format() + globLatency.format();
+	} else {
+		status = "404 Not Found";
+		body = "not found\n";
+	}
+	std::ostringstream out;
+	out << "HTTP/1.0 " << status << "\r\n"
+		<< "Content-Type: text/plain; version=0.0.4\r\n"
+		<< "Content-Length: " << body.size() << "\r\n"
+		<< "Connection: close\r\n\r\n"
+		<< body;
+	return out.str();
+} // }}}1
@@ -0,0 +1,112 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _ADMINSERVER_H
+#define _ADMINSERVER_H
+
+/**
+ * \file adminserver.h
+ *
+ * Declares the admin endpoint scrapers fetch the metrics from.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C++ Headers
+#include <string>
+#include <map>
+
+// C Headers
+#include <time.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+class Socket;
+
+// {{{1 DXG DOC
+/**
+ * \class AdminServer
+ *
+ * Answers HTTP requests for the metrics in the text format of
+ * Prometheus, from within the select() of the daemon main loop. Clients
+ * are read and written without blocking as their descriptors become
+ * ready, so a slow or idle client never stalls the accepts of the decoy
+ * listeners or the reaping of the sessions. A client is closed once it
+ * has been answered, after a few seconds, or if too many are connected.
+ *
+ * The descriptors are closed on exec and the session processes close
+ * the listener, so a module never holds on to the admin port.
+ */
+// }}}1 DXG DOC
+class AdminServer
+{ // {{{1
+	public:
+		AdminServer(const std::string &_module);
+		~AdminServer();
+		void open(const std::string &_ipAddr, int _port);
+		int setFds(fd_set &_read, fd_set &_write) const;
+		int handle(const fd_set &_read, const fd_set &_write, time_t _now);
+		void closeAll();
+	private:
+		/// seconds a client may take for its request and our answer
+		static const time_t timeout = 2;
+		/// clients served at the same time, more are closed at once
+		static const size_t maxClients = 16;
+		/// longest request read, the rest is ignored
+		static const size_t maxRequest = 4096;
+
+		// {{{2 DXG DOC
+		/**
+		 * A connected client
+		 */
+		// }}}2 DXG DOC
+		struct Client
+		{
+			std::string request;			///< bytes of the request read so far
+			std::string answer;				///< answer, empty while reading the request
+			size_t sent;					///< bytes of the answer written
+			time_t deadline;				///< when the client is closed anyway
+		};
+
+		std::string module;					///< name for logging
+		Socket *listener;					///< listening socket, NULL if not opened
+		std::map<int, Client> clients;		///< clients by descriptor
+
+		void accept(time_t _now);
+		bool readRequest(int _fd, Client &_client);
+		bool writeAnswer(int _fd, Client &_client);
+		static std::string answer(const std::string &_request);
+		// hidden
+		AdminServer(const AdminServer &rhs);
+		AdminServer &operator=(const AdminServer &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _ADMINSERVER_H
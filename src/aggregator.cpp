@@ -0,0 +1,382 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file aggregator.cpp
+ *
+ * Contains the implementation of the event aggregation
+ */
+#include "aggregator.h"
+#include "logging.h"
+#include "eventpipeline.h"
+
+#include <new>
+
+#include <stdlib.h>
+#include <string.h>
+
+time_t Deception::EventAggregator::window = 10;
+unsigned int Deception::EventAggregator::rate = 10;
+unsigned int Deception::EventAggregator::burst = 50;
+
+/// names of the event types, in the order of EventAggregator::EventType
+static const char *eventTypeNames[] = {
+	"syn",
+	"connect",
+	"udp",
+	"icmp",
+};
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _module Name to log summaries with
+ * \param _buckets Number of buckets in each table, every bucket holds
+ * a few entries
+ */
+// }}}1 DXG DOC
+Deception::EventAggregator::EventAggregator(const std::string &_module, size_t _buckets) :
+	module(_module),
+	pipeline(NULL),
+	buckets(_buckets > 0 ? _buckets : 1),
+	lastExpire(0)
+{ // {{{1
+	this->tuples = static_cast<Tuple*>(::calloc(this->buckets * bucketSlots, sizeof(Tuple)));
+	this->sources = static_cast<Source*>(::calloc(this->buckets * bucketSlots, sizeof(Source)));
+	if ((this->tuples == NULL) || (this->sources == NULL)) {
+		::free(this->tuples);
+		::free(this->sources);
+		throw std::bad_alloc();
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor. Entries that are left are not reported, since a copy
+ * inherited by a child process would report them twice; call flush()
+ * for that.
+ */
+// }}}1 DXG DOC
+Deception::EventAggregator::~EventAggregator()
+{ // {{{1
+	::free(this->tuples);
+	::free(this->sources);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the parameters used by all aggregators
+ *
+ * \param _window Length of the aggregation window in seconds
+ * \param _rate Raw events per second that are logged for each source
+ * \param _burst Raw events in a row that are logged for each source
+ */
+// }}}1 DXG DOC
+void Deception::EventAggregator::configure(time_t _window, unsigned int _rate, unsigned int _burst)
+{ // {{{1
+	window = (_window > 0) ? _window : 1;
+	rate = _rate;
+	burst = (_burst > _rate) ? _burst : _rate;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Start loading the buckets admit() will look at into the cache, e.g.
+ * for a batch of packets before the first of them is admitted
+ *
+ * \param _type Type of the event
+ * \param _src Source address in network byte order
+ * \param _dstPort Destination port in network byte order
+ */
+// }}}1 DXG DOC
+void Deception::EventAggregator::prefetch(EventType _type, in_addr_t _src, in_port_t _dstPort) const
+{ // {{{1
+	__builtin_prefetch(this->tuples + (hash(_src, _dstPort, _type) % this->buckets) * bucketSlots, 1);
+	__builtin_prefetch(this->sources + (hash(_src, 0, EventTypeCount) % this->buckets) * bucketSlots, 1);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Push summaries into a pipeline instead of writing them right away,
+ * e.g. if the aggregator is used by a capture thread
+ *
+ * \param _pipeline The pipeline, NULL to write summaries right away
+ */
+// }}}1 DXG DOC
+void Deception::EventAggregator::setPipeline(EventPipeline *_pipeline)
+{ // {{{1
+	this->pipeline = _pipeline;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Hash a tuple or a source into a bucket number
+ */
+// }}}1 DXG DOC
+size_t Deception::EventAggregator::hash(in_addr_t _src, in_port_t _dstPort, unsigned char _type)
+{ // {{{1
+	// every input bit has to reach the low bits used for the bucket
+	u_int32_t h = _src ^ (static_cast<u_int32_t>(_dstPort) << 8) ^ _type;
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Find the entry of a tuple. If there is none, a new one is set up,
+ * replacing the oldest entry of the bucket if needed.
+ *
+ * \return Entry of the tuple, its count is 0 if the window has just begun
+ */
+// }}}1 DXG DOC
+Deception::EventAggregator::Tuple* Deception::EventAggregator::findTuple(EventType _type,
+		in_addr_t _src, in_port_t _dstPort, time_t _now)
+{ // {{{1
+	Tuple *slot = this->tuples + (hash(_src, _dstPort, _type) % this->buckets) * bucketSlots;
+	Tuple *free = NULL;
+	Tuple *oldest = slot;
+	for (size_t i = 0; i < bucketSlots; i++, slot++) {
+		if (!slot->used) {
+			if (free == NULL) {
+				free = slot;
+			}
+			continue;
+		}
+		if ((slot->src == _src) && (slot->dstPort == _dstPort) && (slot->type == _type)) {
+			if (_now - slot->first >= window) {
+				// the window has passed, start a new one
+				this->report(*slot);
+				slot->first = _now;
+				slot->count = 0;
+			}
+			return slot;
+		}
+		if (slot->first < oldest->first) {
+			oldest = slot;
+		}
+	}
+	if (free == NULL) {
+		this->report(*oldest);
+		free = oldest;
+	}
+	free->used = true;
+	free->src = _src;
+	free->dstPort = _dstPort;
+	free->type = _type;
+	free->first = _now;
+	free->count = 0;
+	return free;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Find the token bucket of a source. If there is none, a new and full
+ * one is set up, replacing the oldest entry of the bucket if needed.
+ */
+// }}}1 DXG DOC
+Deception::EventAggregator::Source* Deception::EventAggregator::findSource(in_addr_t _src, time_t _now)
+{ // {{{1
+	Source *slot = this->sources + (hash(_src, 0, EventTypeCount) % this->buckets) * bucketSlots;
+	Source *free = NULL;
+	Source *oldest = slot;
+	for (size_t i = 0; i < bucketSlots; i++, slot++) {
+		if (!slot->used) {
+			if (free == NULL) {
+				free = slot;
+			}
+			continue;
+		}
+		if (slot->src == _src) {
+			return slot;
+		}
+		if (slot->refilled < oldest->refilled) {
+			oldest = slot;
+		}
+	}
+	if (free == NULL) {
+		this->report(*oldest);
+		free = oldest;
+	}
+	free->used = true;
+	free->src = _src;
+	free->first = _now;
+	free->refilled = _now;
+	free->tokens = burst;
+	free->suppressed = 0;
+	return free;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check if an event should be logged. If not, it has been counted for
+ * a summary that is logged later on.
+ *
+ * \param _type Type of the event
+ * \param _src Source address in network byte order
+ * \param _dst Destination address in network byte order
+ * \param _dstPort Destination port in network byte order
+ * \param _now Current time, e.g. the timestamp of a packet
+ *
+ * \retval true If the event should be logged
+ * \retval false If it has been folded into a summary
+ */
+// }}}1 DXG DOC
+bool Deception::EventAggregator::admit(EventType _type, in_addr_t _src, in_addr_t _dst,
+		in_port_t _dstPort, time_t _now)
+{ // {{{1
+	this->expire(_now);
+	Tuple *tuple = this->findTuple(_type, _src, _dstPort, _now);
+	tuple->dst = _dst;
+	if (tuple->count++ > 0) {
+		// repeated within the window
+		return false;
+	}
+	Source *source = this->findSource(_src, _now);
+	if (_now > source->refilled) {
+		unsigned long tokens = source->tokens + (_now - source->refilled) * rate;
+		source->tokens = (tokens > burst) ? burst : tokens;
+		source->refilled = _now;
+	}
+	if (source->tokens > 0) {
+		source->tokens--;
+		return true;
+	}
+	source->suppressed++;
+	return false;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Report and remove all entries whose window has passed. Does its
+ * work at most once a second, so it is cheap to call often.
+ *
+ * \param _now Current time
+ */
+// }}}1 DXG DOC
+void Deception::EventAggregator::expire(time_t _now)
+{ // {{{1
+	if (_now == this->lastExpire) {
+		return;
+	}
+	this->lastExpire = _now;
+	size_t slots = this->buckets * bucketSlots;
+	for (size_t i = 0; i < slots; i++) {
+		Tuple &tuple = this->tuples[i];
+		if (tuple.used && (_now - tuple.first >= window)) {
+			this->report(tuple);
+			tuple.used = false;
+		}
+		Source &source = this->sources[i];
+		if (source.used && (_now - source.first >= window)) {
+			if (source.suppressed > 0) {
+				this->report(source);
+				source.suppressed = 0;
+				source.first = _now;
+			} else if (_now - source.refilled >= window) {
+				// the bucket would be full again anyway
+				source.used = false;
+			}
+		}
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Report and remove all entries, e.g. before shutting down
+ */
+// }}}1 DXG DOC
+void Deception::EventAggregator::flush()
+{ // {{{1
+	size_t slots = this->buckets * bucketSlots;
+	for (size_t i = 0; i < slots; i++) {
+		if (this->tuples[i].used) {
+			this->report(this->tuples[i]);
+			this->tuples[i].used = false;
+		}
+		if (this->sources[i].used) {
+			this->report(this->sources[i]);
+			this->sources[i].used = false;
+		}
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Log the summary of a tuple, if it occurred more than once
+ */
+// }}}1 DXG DOC
+void Deception::EventAggregator::report(const Tuple &_tuple)
+{ // {{{1
+	if (_tuple.count <= 1) {
+		// the only occurrence has been logged or counted by its source
+		return;
+	}
+	PipelineEvent event(this->module.c_str(), Info, eventTypeNames[_tuple.type]);
+	event.kind = PipelineEvent::Summary;
+	event.srcIp = _tuple.src;
+	event.dstIp = _tuple.dst;
+	event.dstPort = _tuple.dstPort;
+	event.count = _tuple.count;
+	event.window = window;
+	this->report(event);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Log the number of events of a source that were not logged
+ */
+// }}}1 DXG DOC
+void Deception::EventAggregator::report(const Source &_source)
+{ // {{{1
+	if (_source.suppressed == 0) {
+		return;
+	}
+	PipelineEvent event(this->module.c_str(), Info, "suppressed");
+	event.kind = PipelineEvent::Suppressed;
+	event.srcIp = _source.src;
+	event.count = _source.suppressed;
+	event.window = window;
+	this->report(event);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Hand a summary to the pipeline or write it right away
+ */
+// }}}1 DXG DOC
+void Deception::EventAggregator::report(const PipelineEvent &_event)
+{ // {{{1
+	if (this->pipeline != NULL) {
+		this->pipeline->push(_event);
+	} else {
+		EventPipeline::emit(_event);
+	}
+} // }}}1
@@ -0,0 +1,157 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _AGGREGATOR_H
+#define _AGGREGATOR_H
+
+/**
+ * \file aggregator.h
+ *
+ * Declares the aggregation of repeated events, which keeps floods of
+ * identical connection requests from flooding the logs as well.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C++ Headers
+#include <string>
+
+// C Headers
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+class EventPipeline;
+struct PipelineEvent;
+
+// {{{1 DXG DOC
+/**
+ * \class EventAggregator
+ *
+ * Decides which events are logged as they are and folds the others
+ * into summary records.
+ *
+ * - Repeated events with the same (source, destination port, type)
+ *   within a time window are only logged the first time. When the window
+ *   has passed, a summary with the number of occurrences is logged.
+ * - Every source has a token bucket that limits the number of raw
+ *   events logged for it. Events beyond the limit are counted and
+ *   reported as one summary per source when the window has passed.
+ *
+ * Both tables have a fixed number of buckets with a few slots each.
+ * A lookup only looks at the slots of one bucket, and if all of them
+ * are in use, the oldest entry is reported and replaced, so memory and
+ * time per event are bounded even under scans from spoofed sources.
+ *
+ * \code
+ * if (aggregator.admit(EventAggregator::SynEvent, src, dst, dport, now)) {
+ *     // log the event
+ * }
+ * \endcode
+ *
+ * Summaries are written right away, or pushed into an EventPipeline if
+ * one has been set with setPipeline().
+ *
+ * \note An object is not thread-safe, every thread needs its own.
+ * The capture engine passes all requests of a source to the same
+ * thread, unless its fanout has to fall back to a hash of the flow.
+ */
+// }}}1 DXG DOC
+class EventAggregator
+{ // {{{1
+	public:
+		/// types of events that are aggregated
+		enum EventType { SynEvent = 0, ConnectEvent, UdpEvent, IcmpEvent, EventTypeCount };
+
+		EventAggregator(const std::string &_module, size_t _buckets = 512);
+		~EventAggregator();
+		static void configure(time_t _window, unsigned int _rate, unsigned int _burst);
+		void setPipeline(EventPipeline *_pipeline);
+		bool admit(EventType _type, in_addr_t _src, in_addr_t _dst, in_port_t _dstPort, time_t _now);
+		void prefetch(EventType _type, in_addr_t _src, in_port_t _dstPort) const;
+		void expire(time_t _now);
+		void flush();
+	private:
+		/// number of slots per bucket
+		static const size_t bucketSlots = 8;
+		// {{{2 DXG DOC
+		/**
+		 * Occurrences of a (source, destination port, type) tuple
+		 */
+		// }}}2 DXG DOC
+		struct Tuple
+		{
+			in_addr_t src;			///< source address
+			in_addr_t dst;			///< last destination address
+			in_port_t dstPort;		///< destination port
+			unsigned char type;		///< EventType
+			bool used;				///< flag, if the slot is in use
+			time_t first;			///< start of the window
+			unsigned long count;	///< occurrences in the window
+		};
+		// {{{2 DXG DOC
+		/**
+		 * Token bucket of a source
+		 */
+		// }}}2 DXG DOC
+		struct Source
+		{
+			in_addr_t src;			///< source address
+			bool used;				///< flag, if the slot is in use
+			time_t first;			///< start of the window
+			time_t refilled;		///< last time tokens were added
+			unsigned int tokens;	///< raw events that may still be logged
+			unsigned long suppressed;	///< raw events not logged in the window
+		};
+
+		static time_t window;		///< length of the aggregation window in seconds
+		static unsigned int rate;	///< raw events per second and source
+		static unsigned int burst;	///< maximum raw events in a row per source
+
+		std::string module;			///< name to log summaries with
+		EventPipeline *pipeline;	///< pipeline to push summaries into, may be NULL
+		size_t buckets;				///< number of buckets in each table
+		Tuple *tuples;				///< tuple table, buckets * bucketSlots entries
+		Source *sources;			///< source table, buckets * bucketSlots entries
+		time_t lastExpire;			///< last time expire() did its work
+
+		static size_t hash(in_addr_t _src, in_port_t _dstPort, unsigned char _type);
+		Tuple* findTuple(EventType _type, in_addr_t _src, in_port_t _dstPort, time_t _now);
+		Source* findSource(in_addr_t _src, time_t _now);
+		void report(const Tuple &_tuple);
+		void report(const Source &_source);
+		void report(const PipelineEvent &_event);
+		// hidden
+		EventAggregator(const EventAggregator &rhs);
+		EventAggregator &operator=(const EventAggregator &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _AGGREGATOR_H
@@ -0,0 +1,381 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file    capbench.cpp
+ *
+ * Replays a pcap file through the capture analyzer and reports its
+ * throughput, per packet latency and heap allocations, e.g. for files
+ * written by gensyn.
+ *
+ * \code
+ * capbench scan.pcap
+ * \endcode
+ *
+ * Only the calls of analyzePacket() are timed, reading the file and
+ * writing the events are not. Every call is timed on its own with the
+ * monotonic clock, which adds a few dozen nanoseconds to each sample.
+ * With -b the packets are collected into batches like in the capture
+ * threads, and every analyzeBatch() is timed instead; its latency is
+ * spread evenly over the packets of the batch.
+ */
+
+// C Headers
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pcap.h>
+
+// C++ Headers
+#include <iostream>
+#include <string>
+
+// Project Headers
+#include "fw_pcap.h"
+#include "logging.h"
+#include "eventlog.h"
+#include "ioexception.h"
+
+/// number of heap allocations so far
+static volatile unsigned long allocations = 0;
+
+#ifdef __GLIBC__
+// count every allocation, including those of operator new
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void*, size_t);
+
+extern "C" void *malloc(size_t _size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_malloc(_size);
+}
+
+extern "C" void *calloc(size_t _count, size_t _size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_calloc(_count, _size);
+}
+
+extern "C" void *realloc(void *_ptr, size_t _size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_realloc(_ptr, _size);
+}
+#else
+// only allocations of operator new can be counted portably
+#include <new>
+
+// dynamic exception specifications are gone since C++17
+#if __cplusplus >= 201103L
+#define NEW_THROWS noexcept(false)
+#define DELETE_THROWS noexcept
+#else
+#define NEW_THROWS throw (std::bad_alloc)
+#define DELETE_THROWS throw ()
+#endif
+
+void *operator new(size_t _size) NEW_THROWS
+{
+	__sync_fetch_and_add(&allocations, 1);
+	void *ptr = malloc(_size ? _size : 1);
+	if (ptr == NULL) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *_ptr) DELETE_THROWS
+{
+	free(_ptr);
+}
+#endif
+
+/// latency histogram, 32 buckets for every power of 2 above 64 ns
+static const size_t histogramSize = 64 + 58 * 32;
+static unsigned long histogram[histogramSize];
+
+/// bucket of a latency in nanoseconds
+static size_t bucketOf(u_int64_t _ns)
+{
+	if (_ns < 64) {
+		return _ns;
+	}
+	int exponent = 63 - __builtin_clzll(_ns);
+	return 64 + (exponent - 6) * 32 + ((_ns >> (exponent - 5)) & 31);
+}
+
+/// smallest latency in nanoseconds of a bucket
+static u_int64_t valueOf(size_t _bucket)
+{
+	if (_bucket < 64) {
+		return _bucket;
+	}
+	size_t exponent = (_bucket - 64) / 32 + 6;
+	return static_cast<u_int64_t>(32 + (_bucket - 64) % 32) << (exponent - 5);
+}
+
+/// latency below which a fraction of the samples are
+static u_int64_t percentile(unsigned long _samples, double _fraction)
+{
+	unsigned long rank = static_cast<unsigned long>(_samples * _fraction);
+	unsigned long seen = 0;
+	for (size_t i = 0; i < histogramSize; i++) {
+		seen += histogram[i];
+		if (seen > rank) {
+			return valueOf(i);
+		}
+	}
+	return valueOf(histogramSize - 1);
+}
+
+/// current time of the monotonic clock in nanoseconds
+static inline u_int64_t nanoTime()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<u_int64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// {{{1 DXG DOC
+/**
+ * Prints out information about command line switches
+ **/
+// }}}1 DXG DOC
+void printHelp()
+{
+	std::cout << "capbench: replay a pcap file through the capture analyzer\n"
+		<< "usage: capbench [-a] [-s] [-p] [-l loops] [-e events] [-o osdb] [-f flows] [-w dir] [-b] file.pcap\n"
+		<< "-a\tdon't aggregate, every SYN becomes an event\n"
+		<< "-s\tdon't detect scans\n"
+		<< "-p\treplay at the speed of the capture, not as fast as possible\n"
+		<< "-l\treplay the file this many times (default 1)\n"
+		<< "-e\twrite the events to this event log\n"
+		<< "-o\ttell the OS of every SYN with the signatures of this file\n"
+		<< "-f\tstore the SYNs in a flow table of this size\n"
+		<< "-w\tkeep the evidence of scans in pcap-ng files in this directory\n"
+		<< "-b\tclassify batches of packets like the capture threads\n" << std::endl;
+	exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv)
+{
+	bool aggregate = true;
+	bool detectScans = true;
+	bool paced = false;
+	int loops = 1;
+	const char *osdb = NULL;
+	size_t flows = 0;
+	const char *evidenceDir = NULL;
+	bool batched = false;
+	int opt;
+
+	while ((opt = ::getopt(argc, argv, "aspl:e:o:f:w:bh")) > 0) {
+		switch (opt) {
+			case 'a':
+				aggregate = false;
+				break;
+			case 's':
+				detectScans = false;
+				break;
+			case 'p':
+				paced = true;
+				break;
+			case 'l':
+				loops = atoi(optarg);
+				break;
+			case 'e':
+				globEvents.setFile(optarg);
+				break;
+			case 'o':
+				osdb = optarg;
+				break;
+			case 'f':
+				flows = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				evidenceDir = optarg;
+				break;
+			case 'b':
+				batched = true;
+				break;
+			default:
+				printHelp();
+		}
+	}
+	if (optind >= argc) {
+		printHelp();
+	}
+	// only the analyzer is measured, not the text log
+	globLog.setLogLevel("fatalerror");
+	globEvents.init();
+
+	Deception::EventPipeline pipeline(65536);
+	Deception::EventAggregator aggregator("capbench");
+	aggregator.setPipeline(&pipeline);
+	Deception::ScanDetector scanDetector("capbench");
+	CaptureWorker worker;
+	worker.pipeline = &pipeline;
+	worker.aggregator = aggregate ? &aggregator : NULL;
+	worker.scanDetector = detectScans ? &scanDetector : NULL;
+	Deception::OsSignatures signatures;
+	if (osdb != NULL) {
+		try {
+			signatures.load(osdb);
+		} catch (Deception::IOException &e) {
+			std::cerr << "capbench: " << osdb << ": " << e.toString() << std::endl;
+			return EXIT_FAILURE;
+		}
+		worker.osSignatures = &signatures;
+	}
+	Deception::FlowTable *flowTable = NULL;
+	if (flows > 0) {
+		flowTable = new Deception::FlowTable(flows);
+		worker.flowTable = flowTable;
+	}
+
+	Deception::EvidenceWriter *evidenceWriter = NULL;
+	PacketBatch batch(65536);
+	worker.batch = &batch;
+
+	unsigned long packets = 0, events = 0, allocated = 0;
+	u_int64_t busy = 0, batchBusy = 0, started = nanoTime();
+	for (int loop = 0; loop < loops; loop++) {
+		char errbuf[PCAP_ERRBUF_SIZE];
+		pcap_t *handle = pcap_open_offline(argv[optind], errbuf);
+		if (handle == NULL) {
+			std::cerr << "capbench: " << errbuf << std::endl;
+			return EXIT_FAILURE;
+		}
+		worker.linkType = pcap_datalink(handle);
+		if ((evidenceDir != NULL) && (evidenceWriter == NULL)) {
+			// the files take the link type of the replayed one
+			Deception::EvidenceConfig config;
+			config.dir = evidenceDir;
+			evidenceWriter = new Deception::EvidenceWriter(config, &pipeline);
+			try {
+				evidenceWriter->start(worker.linkType, pcap_snapshot(handle));
+			} catch (Deception::IOException &e) {
+				std::cerr << "capbench: " << evidenceDir << ": " << e.toString() << std::endl;
+				return EXIT_FAILURE;
+			}
+			worker.evidence = new Deception::EvidenceRecorder(*evidenceWriter,
+					config.flows, config.packets, pcap_snapshot(handle));
+			worker.evidence->setFlowTable(flowTable);
+		}
+		struct pcap_pkthdr *header;
+		const u_char *data;
+		u_int64_t replayStart = nanoTime();
+		struct timeval first = { 0, 0 };
+		while (pcap_next_ex(handle, &header, &data) == 1) {
+			if (paced) {
+				if (first.tv_sec == 0) {
+					first = header->ts;
+				}
+				u_int64_t due = replayStart
+					+ (header->ts.tv_sec - first.tv_sec) * 1000000000ULL
+					+ (header->ts.tv_usec - first.tv_usec) * 1000LL;
+				u_int64_t now = nanoTime();
+				if (due > now) {
+					struct timespec wait;
+					wait.tv_sec = (due - now) / 1000000000ULL;
+					wait.tv_nsec = (due - now) % 1000000000ULL;
+					::nanosleep(&wait, NULL);
+				}
+			}
+			if (batched) {
+				// collecting copies the packet as in the capture threads,
+				// the packet filling the batch has it classified
+				bool fills = (batch.count == CAPTURE_BATCH - 1);
+				unsigned long allocBefore = allocations;
+				u_int64_t before = nanoTime();
+				collectPacket(reinterpret_cast<u_char*>(&worker), header, data);
+				u_int64_t took = nanoTime() - before;
+				allocated += allocations - allocBefore;
+				busy += took;
+				batchBusy += took;
+				if (fills) {
+					histogram[bucketOf(batchBusy / CAPTURE_BATCH)] += CAPTURE_BATCH;
+					batchBusy = 0;
+				}
+				if ((++packets & 255) == 0) {
+					events += pipeline.drain();
+				}
+				continue;
+			}
+			unsigned long allocBefore = allocations;
+			u_int64_t before = nanoTime();
+			analyzePacket(reinterpret_cast<u_char*>(&worker), header, data);
+			u_int64_t took = nanoTime() - before;
+			allocated += allocations - allocBefore;
+			busy += took;
+			histogram[bucketOf(took)]++;
+			if ((++packets & 255) == 0) {
+				events += pipeline.drain();
+			}
+		}
+		if (batch.count > 0) {
+			// the rest of the file
+			unsigned int rest = batch.count;
+			u_int64_t before = nanoTime();
+			analyzeBatch(&worker);
+			u_int64_t took = nanoTime() - before;
+			batchBusy += took;
+			busy += took;
+			histogram[bucketOf(batchBusy / rest)] += rest;
+			batchBusy = 0;
+		}
+		pcap_close(handle);
+	}
+	aggregator.flush();
+	delete worker.evidence;
+	delete evidenceWriter;
+	events += pipeline.drain();
+	u_int64_t elapsed = nanoTime() - started;
+
+	double busySec = busy / 1e9;
+	printf("packets %lu in %.3f s, %.3f s in the analyzer\n", packets, elapsed / 1e9, busySec);
+	printf("packets/s %.0f\n", (busySec > 0) ? packets / busySec : 0.0);
+	printf("events %lu, events/s %.0f\n", events, (busySec > 0) ? events / busySec : 0.0);
+	printf("latency ns p50 %llu p90 %llu p99 %llu p99.9 %llu\n",
+			static_cast<unsigned long long>(percentile(packets, 0.5)),
+			static_cast<unsigned long long>(percentile(packets, 0.9)),
+			static_cast<unsigned long long>(percentile(packets, 0.99)),
+			static_cast<unsigned long long>(percentile(packets, 0.999)));
+	printf("allocations %lu, per packet %.4f\n", allocated,
+			(packets > 0) ? static_cast<double>(allocated) / packets : 0.0);
+	if (batched) {
+		printf("batch classifier %s\n", batchClassifierName());
+	}
+	if (osdb != NULL) {
+		printf("os signatures %lu\n", static_cast<unsigned long>(signatures.size()));
+	}
+	delete flowTable;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file    gensyn.cpp
+ *
+ * Writes a pcap file with a synthetic SYN scan, to benchmark and
+ * regression test the capture engine without live traffic (see
+ * capbench.cpp). The file is written directly, libpcap is not needed.
+ *
+ * \code
+ * gensyn -n 1000000 -s 256 -d 10.0.0.1 -o scan.pcap
+ * \endcode
+ */
+
+// C Headers
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// C++ Headers
+#include <iostream>
+#include <string>
+
+/// classic pcap file header
+struct FileHeader
+{
+	u_int32_t magic;
+	u_int16_t versionMajor;
+	u_int16_t versionMinor;
+	int32_t thisZone;
+	u_int32_t sigFigs;
+	u_int32_t snapLen;
+	u_int32_t linkType;
+};
+
+/// classic pcap record header
+struct RecordHeader
+{
+	u_int32_t tsSec;
+	u_int32_t tsUsec;
+	u_int32_t capLen;
+	u_int32_t len;
+};
+
+// {{{1 DXG DOC
+/**
+ * Prints out information about command line switches
+ **/
+// }}}1 DXG DOC
+void printHelp()
+{
+	std::cout << "gensyn: write a synthetic SYN scan to a pcap file\n"
+		<< "-n\tnumber of packets (default 100000)\n"
+		<< "-s\tnumber of scanning sources (default 16)\n"
+		<< "-d\tdestination address (default 10.0.0.1)\n"
+		<< "-r\tpackets per second in the timestamps (default 100000)\n"
+		<< "-v\ttag every packet with this vlan id\n"
+		<< "-o\toutput file (default stdout)\n" << std::endl;
+	exit(EXIT_SUCCESS);
+}
+
+// {{{1 DXG DOC
+/**
+ * Compute the internet checksum of an ip header
+ **/
+// }}}1 DXG DOC
+u_int16_t ipChecksum(const u_char *_header, size_t _len)
+{
+	u_int32_t sum = 0;
+	for (size_t i = 0; i + 1 < _len; i += 2) {
+		sum += (_header[i] << 8) | _header[i + 1];
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return static_cast<u_int16_t>(~sum);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long packets = 100000;
+	unsigned long sources = 16;
+	unsigned long rate = 100000;
+	int vlan = -1;
+	std::string dst = "10.0.0.1";
+	FILE *out = stdout;
+	int opt;
+
+	while ((opt = ::getopt(argc, argv, "n:s:d:r:v:o:h")) > 0) {
+		switch (opt) {
+			case 'n':
+				packets = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				sources = strtoul(optarg, NULL, 10);
+				break;
+			case 'd':
+				dst = optarg;
+				break;
+			case 'r':
+				rate = strtoul(optarg, NULL, 10);
+				break;
+			case 'v':
+				vlan = atoi(optarg) & 0x0fff;
+				break;
+			case 'o':
+				if ((out = fopen(optarg, "wb")) == NULL) {
+					perror(optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				printHelp();
+		}
+	}
+	if ((sources == 0) || (rate == 0)) {
+		printHelp();
+	}
+	in_addr_t dstIp = inet_addr(dst.c_str());
+
+	FileHeader fileHeader = { 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1 };
+	fwrite(&fileHeader, sizeof(fileHeader), 1, out);
+
+	// ethernet, optional vlan tag, ip and tcp with the options of a
+	// common SYN: mss, sack permitted, timestamps, nop, window scale
+	static const u_char tcpOptions[] = {
+		0x02, 0x04, 0x05, 0xb4, 0x04, 0x02, 0x08, 0x0a,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x01, 0x03, 0x03, 0x07
+	};
+	u_char packet[14 + 4 + 20 + 20 + sizeof(tcpOptions)];
+	memset(packet, 0, sizeof(packet));
+	size_t l2Len = 14;
+	packet[6] = 0x02;
+	packet[11] = 0x01;
+	if (vlan >= 0) {
+		packet[12] = 0x81;
+		packet[14] = vlan >> 8;
+		packet[15] = vlan & 0xff;
+		l2Len += 4;
+	}
+	packet[l2Len - 2] = 0x08;
+	u_char *ip = packet + l2Len;
+	u_char *tcp = ip + 20;
+	size_t tcpLen = 20 + sizeof(tcpOptions);
+	size_t packetLen = l2Len + 20 + tcpLen;
+	ip[0] = 0x45;
+	ip[2] = (20 + tcpLen) >> 8;
+	ip[3] = (20 + tcpLen) & 0xff;
+	ip[6] = 0x40;
+	ip[9] = IPPROTO_TCP;
+	memcpy(ip + 16, &dstIp, 4);
+	tcp[12] = (tcpLen / 4) << 4;
+	tcp[13] = 0x02;
+	tcp[14] = 0xfa;
+	tcp[15] = 0xf0;
+	memcpy(tcp + 20, tcpOptions, sizeof(tcpOptions));
+
+	// every source scans the ports in order, the sources take turns
+	u_int32_t seed = 4711;
+	for (unsigned long i = 0; i < packets; i++) {
+		unsigned long source = i % sources;
+		unsigned long port = (i / sources) % 65535 + 1;
+		u_int32_t srcIp = htonl(0xc0a80000 + source);	// 192.168.x.y
+		memcpy(ip + 12, &srcIp, 4);
+		ip[4] = i >> 8;
+		ip[5] = i & 0xff;
+		ip[8] = (source & 1) ? 64 : 128;
+		ip[10] = ip[11] = 0;
+		u_int16_t sum = ipChecksum(ip, 20);
+		ip[10] = sum >> 8;
+		ip[11] = sum & 0xff;
+		seed = seed * 1103515245 + 12345;
+		u_int16_t srcPort = 32768 + ((seed >> 16) & 0x7fff);
+		tcp[0] = srcPort >> 8;
+		tcp[1] = srcPort & 0xff;
+		tcp[2] = port >> 8;
+		tcp[3] = port & 0xff;
+		memcpy(tcp + 4, &seed, 4);
+
+		RecordHeader recordHeader;
+		recordHeader.tsSec = 1049558400 + i / rate;
+		recordHeader.tsUsec = (i % rate) * 1000000 / rate;
+		recordHeader.capLen = packetLen;
+		recordHeader.len = packetLen;
+		fwrite(&recordHeader, sizeof(recordHeader), 1, out);
+		fwrite(packet, packetLen, 1, out);
+	}
+	if (fclose(out) != 0) {
+		perror("fclose");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#!/bin/sh
+# Runs the daemon against the loopback configuration and puts load on
+# it with loadgen, as a gate for performance work. Run it from the
+# source directory after "make all bench":
+#
+#   bench/loadbench.sh [-b baseline] [-t tolerance] [-- loadgen options]
+#
+# The report of loadgen is printed. With -b it is compared to the
+# report of an earlier run, and the script fails if connections/s or
+# transactions/s dropped, or the p99 latency of the transactions grew,
+# by more than tolerance percent (default 10). Without loadgen options
+# 1000 connections are driven for 30 seconds on all loopback ports.
+
+baseline=""
+tolerance=10
+while getopts "b:t:h" opt; do
+	case $opt in
+		b) baseline=$OPTARG ;;
+		t) tolerance=$OPTARG ;;
+		*) sed -n '2,13p' "$0" | sed 's/^# \{0,1\}//'; exit 1 ;;
+	esac
+done
+shift `expr $OPTIND - 1`
+if [ $# -eq 0 ]; then
+	set -- -c 1000 -s 30 -t 20021:bench/loopback/ftp.dialogue -t 20022 -t 20079
+fi
+
+# every connection takes a descriptor here and one in the daemon
+ulimit -n 65536 2>/dev/null || ulimit -n `ulimit -H -n`
+
+report=`mktemp /tmp/loadbench.XXXXXX` || exit 1
+./deceptiond -c bench/loopback/deceptiond.xml &
+daemon=$!
+trap 'kill $daemon 2>/dev/null; rm -f $report' 0 INT TERM
+# wait for the sockets
+sleep 2
+if ! kill -0 $daemon 2>/dev/null; then
+	echo "loadbench: deceptiond did not start, see bench/loopback/deceptiond.log" >&2
+	exit 1
+fi
+
+bench/loadgen -P $daemon "$@" > $report
+status=$?
+cat $report
+if [ $status -ne 0 ] || [ -z "$baseline" ]; then
+	exit $status
+fi
+
+# compare a value of the report to the baseline, up if higher is better
+compare() {
+	old=`awk "$2" "$baseline"`
+	new=`awk "$2" "$report"`
+	awk -v name="$1" -v old="$old" -v new="$new" -v up="$3" -v tolerance="$tolerance" 'BEGIN {
+		if (old == 0) {
+			printf("%s: %s, no baseline\n", name, new);
+			exit 0;
+		}
+		change = (new - old) * 100 / old;
+		worse = up ? -change : change;
+		printf("%s: %s -> %s (%+.1f%%)%s\n", name, old, new, change,
+			(worse > tolerance) ? " REGRESSION" : "");
+		exit (worse > tolerance);
+	}'
+}
+
+echo
+echo "compared to $baseline, tolerance $tolerance%:"
+failed=0
+compare "connections/s" '$1 == "connections/s" { print $2 }' 1 || failed=1
+compare "transactions/s" '$1 == "transactions/s" { print $2 }' 1 || failed=1
+compare "p99 transaction us" '$1 == "transaction" { print $5 }' 0 || failed=1
+exit $failed
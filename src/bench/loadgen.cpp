@@ -0,0 +1,667 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file    loadgen.cpp
+ *
+ * Keeps many connections to the decoy ports of a running daemon open
+ * and drives a scripted dialogue on each of them, to measure the
+ * daemon under load, e.g. before and after a change (see
+ * loadbench.sh). A connection that has ended is replaced by a new one
+ * right away, so there are always -c connections open; the targets
+ * take turns. The connections are waited for with epoll(7), so this
+ * runs on Linux only.
+ *
+ * \code
+ * loadgen -c 1000 -s 30 -t 20021:bench/loopback/ftp.dialogue -t 20079 -P 4711
+ * \endcode
+ *
+ * A dialogue is a file with a step per line: "< text" waits until the
+ * text has been received, "> text" sends the text with CRLF; empty
+ * lines and lines starting with # are skipped. Every wait is timed as
+ * a transaction, from the end of the previous step; the first byte and
+ * the session are timed from connect(). Without a dialogue
+ * a connection waits for the first bytes and is closed, like a banner
+ * grab. Connections are closed with a reset, so thousands of them per
+ * second don't use up the local ports with TIME_WAIT.
+ *
+ * With -P the cpu time of the daemon, including the session processes
+ * it has reaped, and its resident set are read from /proc.
+ */
+
+// C Headers
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// C++ Headers
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/// one line of a dialogue
+struct Step
+{
+	bool send;						///< send the text, else wait for it
+	std::string text;				///< text, empty to wait for any byte
+};
+
+/// a port to connect to and the dialogue to drive on it
+struct Target
+{
+	in_port_t port;					///< port, in network byte order
+	std::vector<Step> steps;		///< the dialogue
+};
+
+/// an open connection
+struct Connection
+{
+	int fd;							///< socket, -1 if none is open
+	size_t target;					///< index of the target
+	size_t step;					///< next step of the dialogue
+	bool connected;					///< flag, if connect() has finished
+	bool answered;					///< flag, if a byte has been received
+	bool failed;					///< flag, if the last one failed
+	u_int64_t started;				///< microseconds at connect()
+	u_int64_t stepStarted;			///< microseconds at the end of the previous step
+	std::string received;			///< received, but not matched yet
+	std::string pending;			///< to be sent
+};
+
+/// reasons a connection failed
+enum Failure
+{
+	Refused,
+	Reset,
+	Timeout,
+	Closed,
+	Other,
+	Failures
+};
+
+static const char *failureNames[] = { "refused", "reset", "timeout", "closed", "other" };
+
+// {{{1 DXG DOC
+/**
+ * Latency histogram in microseconds, 32 buckets for every power of 2
+ * above 64 us
+ */
+// }}}1 DXG DOC
+class Histogram
+{
+	public:
+		Histogram() : counts(64 + 58 * 32, 0), samples(0), max(0) { }
+		void record(u_int64_t _us)
+		{
+			size_t bucket = _us;
+			if (_us >= 64) {
+				int exponent = 63 - __builtin_clzll(_us);
+				bucket = 64 + (exponent - 6) * 32 + ((_us >> (exponent - 5)) & 31);
+			}
+			this->counts[bucket]++;
+			this->samples++;
+			if (_us > this->max) {
+				this->max = _us;
+			}
+		}
+		/// latency below which a fraction of the samples are
+		u_int64_t percentile(double _fraction) const
+		{
+			unsigned long rank = static_cast<unsigned long>(this->samples * _fraction);
+			unsigned long seen = 0;
+			for (size_t i = 0; i < this->counts.size(); i++) {
+				seen += this->counts[i];
+				if (seen > rank) {
+					if (i < 64) {
+						return i;
+					}
+					size_t exponent = (i - 64) / 32 + 6;
+					return static_cast<u_int64_t>(32 + (i - 64) % 32) << (exponent - 5);
+				}
+			}
+			return this->max;
+		}
+		void print(const char *_name) const
+		{
+			printf("%-12s %8lu %8llu %8llu %8llu %8llu %8llu\n", _name, this->samples,
+					static_cast<unsigned long long>(this->percentile(0.5)),
+					static_cast<unsigned long long>(this->percentile(0.9)),
+					static_cast<unsigned long long>(this->percentile(0.99)),
+					static_cast<unsigned long long>(this->percentile(0.999)),
+					static_cast<unsigned long long>(this->max));
+		}
+	private:
+		std::vector<unsigned long> counts;
+		unsigned long samples;
+		u_int64_t max;
+};
+
+/// cpu time and resident set of the daemon
+struct DaemonUsage
+{
+	double cpuSeconds;				///< user and system time, with the reaped children
+	unsigned long rssKb;			///< resident set
+};
+
+/// current time of the monotonic clock in microseconds
+static inline u_int64_t microTime()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<u_int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// {{{1 DXG DOC
+/**
+ * Prints out information about command line switches
+ **/
+// }}}1 DXG DOC
+void printHelp()
+{
+	std::cout << "loadgen: drive dialogues on many concurrent connections to the daemon\n"
+		<< "usage: loadgen [-a address] [-c connections] [-s seconds] [-n count] [-w seconds] [-P pid] -t port[:dialogue] ...\n"
+		<< "-a\taddress of the daemon (default 127.0.0.1)\n"
+		<< "-c\tconnections kept open (default 100)\n"
+		<< "-s\tseconds to run (default 10)\n"
+		<< "-n\tstop after this many connections instead\n"
+		<< "-w\tseconds a connection may take (default 10)\n"
+		<< "-P\tprocess id of the daemon, to report its cpu time and memory\n"
+		<< "-t\tport to connect to and the dialogue to drive, may be repeated\n" << std::endl;
+	exit(EXIT_SUCCESS);
+}
+
+// {{{1 DXG DOC
+/**
+ * Read a dialogue file
+ **/
+// }}}1 DXG DOC
+bool readDialogue(const std::string &_file, std::vector<Step> &_steps)
+{
+	std::ifstream in(_file.c_str());
+	if (!in) {
+		return false;
+	}
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && (line[line.size() - 1] == '\r')) {
+			line.erase(line.size() - 1);
+		}
+		if (line.empty() || (line[0] == '#')) {
+			continue;
+		}
+		if ((line.size() < 2) || ((line[0] != '<') && (line[0] != '>')) || (line[1] != ' ')) {
+			std::cerr << "loadgen: " << _file << ": not a step: " << line << std::endl;
+			return false;
+		}
+		Step step;
+		step.send = (line[0] == '>');
+		step.text = line.substr(2);
+		_steps.push_back(step);
+	}
+	return true;
+}
+
+// {{{1 DXG DOC
+/**
+ * Read the cpu time and resident set of a process from /proc
+ **/
+// }}}1 DXG DOC
+bool readUsage(pid_t _pid, DaemonUsage &_usage)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(_pid));
+	std::ifstream in(path);
+	std::string stat;
+	if (!std::getline(in, stat)) {
+		return false;
+	}
+	// the command may contain blanks and parentheses
+	std::string::size_type end = stat.rfind(')');
+	if (end == std::string::npos) {
+		return false;
+	}
+	unsigned long utime, stime;
+	long cutime, cstime, rss;
+	if (sscanf(stat.c_str() + end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld"
+			" %*d %*d %*d %*d %*u %*u %ld", &utime, &stime, &cutime, &cstime, &rss) != 5) {
+		return false;
+	}
+	_usage.cpuSeconds = static_cast<double>(utime + stime + cutime + cstime) / ::sysconf(_SC_CLK_TCK);
+	_usage.rssKb = rss * (::sysconf(_SC_PAGESIZE) / 1024);
+	return true;
+}
+
+#ifdef __linux__
+/// state of the run
+static std::vector<Target> targets;
+static std::vector<Connection> connections;
+static struct sockaddr_in daemonAddress;
+static int epollFd;
+static size_t nextTarget = 0;
+static unsigned long completed = 0, transactions = 0;
+static unsigned long failed[Failures];
+static Histogram connectLatency, firstByteLatency, transactionLatency, sessionLatency;
+
+// {{{1 DXG DOC
+/**
+ * Close the socket of a connection
+ **/
+// }}}1 DXG DOC
+void closeConnection(Connection &_conn)
+{
+	if (_conn.fd >= 0) {
+		::close(_conn.fd);
+		_conn.fd = -1;
+	}
+	_conn.received.erase();
+	_conn.pending.erase();
+}
+
+// {{{1 DXG DOC
+/**
+ * Count a failed connection and close it
+ **/
+// }}}1 DXG DOC
+void failConnection(Connection &_conn, int _error)
+{
+	Failure failure = Other;
+	switch (_error) {
+		case ECONNREFUSED:
+			failure = Refused;
+			break;
+		case ECONNRESET:
+		case EPIPE:
+			failure = Reset;
+			break;
+		case ETIMEDOUT:
+			failure = Timeout;
+			break;
+		case 0:
+			failure = Closed;
+			break;
+	}
+	failed[failure]++;
+	_conn.failed = true;
+	closeConnection(_conn);
+}
+
+// {{{1 DXG DOC
+/**
+ * Open a connection to the next target, failures are counted and leave
+ * the connection closed
+ **/
+// }}}1 DXG DOC
+void openConnection(size_t _index, u_int64_t _now)
+{
+	Connection &conn = connections[_index];
+	conn.target = nextTarget;
+	nextTarget = (nextTarget + 1) % targets.size();
+	conn.step = 0;
+	conn.connected = false;
+	conn.answered = false;
+	conn.failed = false;
+	conn.started = _now;
+	conn.stepStarted = _now;
+	conn.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (conn.fd == -1) {
+		perror("loadgen: socket (raise ulimit -n?)");
+		exit(EXIT_FAILURE);
+	}
+	struct linger linger = { 1, 0 };
+	::setsockopt(conn.fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+	struct sockaddr_in address = daemonAddress;
+	address.sin_port = targets[conn.target].port;
+	if ((::connect(conn.fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1)
+			&& (errno != EINPROGRESS)) {
+		failConnection(conn, errno);
+		return;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT;
+	event.data.u32 = _index;
+	::epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &event);
+}
+
+// {{{1 DXG DOC
+/**
+ * Send what is pending, waits for EPOLLOUT if the socket is full
+ *
+ * \return false if the connection failed
+ **/
+// }}}1 DXG DOC
+bool flushConnection(Connection &_conn, size_t _index)
+{
+	while (!_conn.pending.empty()) {
+		ssize_t n = ::send(_conn.fd, _conn.pending.data(), _conn.pending.size(), MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN) {
+				failConnection(_conn, errno);
+				return false;
+			}
+			break;
+		}
+		_conn.pending.erase(0, n);
+	}
+	struct epoll_event event;
+	// EPOLLIN and EPOLLOUT are enumerators, the mask is unsigned
+	u_int32_t mask = EPOLLIN;
+	if (!_conn.pending.empty()) {
+		mask |= EPOLLOUT;
+	}
+	event.events = mask;
+	event.data.u32 = _index;
+	::epoll_ctl(epollFd, EPOLL_CTL_MOD, _conn.fd, &event);
+	return true;
+}
+
+// {{{1 DXG DOC
+/**
+ * Run the steps of the dialogue as far as the received data allows
+ *
+ * \return true once the dialogue has ended
+ **/
+// }}}1 DXG DOC
+bool advanceDialogue(Connection &_conn, size_t _index, u_int64_t _now)
+{
+	const std::vector<Step> &steps = targets[_conn.target].steps;
+	while (_conn.step < steps.size()) {
+		const Step &step = steps[_conn.step];
+		if (step.send) {
+			_conn.pending += step.text + "\r\n";
+		} else if (step.text.empty() && !_conn.received.empty()) {
+			_conn.received.erase();
+			transactionLatency.record(_now - _conn.stepStarted);
+			transactions++;
+		} else {
+			std::string::size_type found = step.text.empty() ? std::string::npos : _conn.received.find(step.text);
+			if (found == std::string::npos) {
+				break;
+			}
+			_conn.received.erase(0, found + step.text.size());
+			transactionLatency.record(_now - _conn.stepStarted);
+			transactions++;
+		}
+		_conn.step++;
+		_conn.stepStarted = _now;
+	}
+	if (!_conn.pending.empty() && !flushConnection(_conn, _index)) {
+		return false;
+	}
+	if (_conn.step < steps.size()) {
+		return false;
+	}
+	sessionLatency.record(_now - _conn.started);
+	completed++;
+	closeConnection(_conn);
+	return true;
+}
+
+// {{{1 DXG DOC
+/**
+ * Handle the events of a connection
+ **/
+// }}}1 DXG DOC
+void handleConnection(size_t _index, u_int32_t _events, u_int64_t _now)
+{
+	Connection &conn = connections[_index];
+	if (!conn.connected) {
+		int error = 0;
+		socklen_t length = sizeof(error);
+		::getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+		if ((error != 0) || ((_events & EPOLLOUT) == 0)) {
+			failConnection(conn, (error != 0) ? error : ECONNRESET);
+			return;
+		}
+		conn.connected = true;
+		connectLatency.record(_now - conn.started);
+		conn.stepStarted = _now;
+		if (advanceDialogue(conn, _index, _now) || (conn.fd == -1)) {
+			return;
+		}
+		// stop waiting for EPOLLOUT unless there's more to send
+		if (!flushConnection(conn, _index)) {
+			return;
+		}
+	} else if ((_events & EPOLLOUT) && !flushConnection(conn, _index)) {
+		return;
+	}
+	if ((_events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0) {
+		return;
+	}
+	char buf[4096];
+	for (;;) {
+		ssize_t n = ::recv(conn.fd, buf, sizeof(buf), 0);
+		if (n > 0) {
+			if (!conn.answered) {
+				conn.answered = true;
+				firstByteLatency.record(_now - conn.started);
+			}
+			conn.received.append(buf, n);
+			// a dialogue never waits for more than this
+			if (conn.received.size() > 65536) {
+				conn.received.erase(0, conn.received.size() - 4096);
+			}
+			continue;
+		}
+		if ((n == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if ((n == -1) && (errno == EAGAIN)) {
+			advanceDialogue(conn, _index, _now);
+			return;
+		}
+		// the daemon has closed, that's fine if it had nothing more to say
+		if (!advanceDialogue(conn, _index, _now) && (conn.fd != -1)) {
+			failConnection(conn, (n == 0) ? 0 : errno);
+		}
+		return;
+	}
+}
+#endif
+
+int main(int argc, char **argv)
+{
+#ifndef __linux__
+	std::cerr << "loadgen: needs epoll(7), which is Linux only" << std::endl;
+	return EXIT_FAILURE;
+#else
+	std::string address = "127.0.0.1";
+	size_t concurrency = 100;
+	unsigned long seconds = 10;
+	unsigned long count = 0;
+	unsigned long timeout = 10;
+	pid_t daemonPid = 0;
+	int opt;
+
+	while ((opt = ::getopt(argc, argv, "a:c:s:n:w:P:t:h")) > 0) {
+		switch (opt) {
+			case 'a':
+				address = optarg;
+				break;
+			case 'c':
+				concurrency = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				seconds = strtoul(optarg, NULL, 10);
+				break;
+			case 'n':
+				count = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				timeout = strtoul(optarg, NULL, 10);
+				break;
+			case 'P':
+				daemonPid = atoi(optarg);
+				break;
+			case 't': {
+				Target target;
+				std::string spec = optarg;
+				std::string::size_type colon = spec.find(':');
+				target.port = htons(atoi(spec.substr(0, colon).c_str()));
+				if (colon != std::string::npos) {
+					if (!readDialogue(spec.substr(colon + 1), target.steps)) {
+						std::cerr << "loadgen: could not read dialogue " << spec.substr(colon + 1) << std::endl;
+						return EXIT_FAILURE;
+					}
+				} else {
+					// a banner grab
+					Step step;
+					step.send = false;
+					target.steps.push_back(step);
+				}
+				targets.push_back(target);
+				break;
+			}
+			default:
+				printHelp();
+		}
+	}
+	if (targets.empty() || (concurrency == 0)) {
+		printHelp();
+	}
+	memset(&daemonAddress, 0, sizeof(daemonAddress));
+	daemonAddress.sin_family = AF_INET;
+	if (::inet_pton(AF_INET, address.c_str(), &daemonAddress.sin_addr) != 1) {
+		std::cerr << "loadgen: not an address: " << address << std::endl;
+		return EXIT_FAILURE;
+	}
+	if ((epollFd = ::epoll_create(concurrency)) == -1) {
+		perror("loadgen: epoll_create");
+		return EXIT_FAILURE;
+	}
+
+	DaemonUsage before = { 0, 0 }, after = { 0, 0 };
+	unsigned long peakRssKb = 0;
+	if ((daemonPid > 0) && !readUsage(daemonPid, before)) {
+		std::cerr << "loadgen: no process " << daemonPid << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	u_int64_t started = microTime();
+	u_int64_t stop = started + static_cast<u_int64_t>(seconds) * 1000000;
+	u_int64_t lastSweep = started, lastSample = started;
+	connections.resize(concurrency);
+	for (size_t i = 0; i < concurrency; i++) {
+		openConnection(i, started);
+	}
+	std::vector<struct epoll_event> events(1024);
+	u_int64_t now = started;
+	for (;;) {
+		int n = ::epoll_wait(epollFd, &events[0], events.size(), 100);
+		if ((n == -1) && (errno != EINTR)) {
+			perror("loadgen: epoll_wait");
+			return EXIT_FAILURE;
+		}
+		now = microTime();
+		for (int e = 0; e < n; e++) {
+			size_t index = events[e].data.u32;
+			if (connections[index].fd == -1) {
+				continue;
+			}
+			handleConnection(index, events[e].events, now);
+		}
+		unsigned long ended = completed;
+		for (int f = 0; f < Failures; f++) {
+			ended += failed[f];
+		}
+		if ((count > 0) ? (ended >= count) : (now >= stop)) {
+			break;
+		}
+		bool sweep = (now - lastSweep >= 100000);
+		if (sweep) {
+			lastSweep = now;
+		}
+		// replace the connections that have ended, failed ones only once
+		// in a while, so a refusing daemon isn't hammered
+		for (size_t i = 0; i < concurrency; i++) {
+			Connection &conn = connections[i];
+			if ((conn.fd >= 0) && sweep && (now - conn.started > timeout * 1000000)) {
+				failConnection(conn, ETIMEDOUT);
+			}
+			if ((conn.fd == -1) && (sweep || !conn.failed)) {
+				openConnection(i, now);
+			}
+		}
+		if ((daemonPid > 0) && (now - lastSample >= 1000000)) {
+			DaemonUsage sample;
+			if (readUsage(daemonPid, sample) && (sample.rssKb > peakRssKb)) {
+				peakRssKb = sample.rssKb;
+			}
+			lastSample = now;
+		}
+	}
+	double elapsed = (now - started) / 1e6;
+	if (daemonPid > 0) {
+		readUsage(daemonPid, after);
+		if (after.rssKb > peakRssKb) {
+			peakRssKb = after.rssKb;
+		}
+	}
+
+	unsigned long failures = 0;
+	for (int f = 0; f < Failures; f++) {
+		failures += failed[f];
+	}
+	printf("duration %.3f s, %lu connections open, %lu targets\n", elapsed,
+			static_cast<unsigned long>(concurrency), static_cast<unsigned long>(targets.size()));
+	printf("connections %lu completed, %lu failed (", completed, failures);
+	for (int f = 0; f < Failures; f++) {
+		printf("%s%s %lu", (f > 0) ? ", " : "", failureNames[f], failed[f]);
+	}
+	printf(")\n");
+	printf("connections/s %.0f\n", (elapsed > 0) ? completed / elapsed : 0.0);
+	printf("transactions/s %.0f\n", (elapsed > 0) ? transactions / elapsed : 0.0);
+	printf("%-12s %8s %8s %8s %8s %8s %8s\n", "latency us", "samples", "p50", "p90", "p99", "p99.9", "max");
+	connectLatency.print("connect");
+	firstByteLatency.print("first_byte");
+	transactionLatency.print("transaction");
+	sessionLatency.print("session");
+	if (daemonPid > 0) {
+		double cpu = after.cpuSeconds - before.cpuSeconds;
+		printf("daemon cpu %.2f s, %.1f%% of a core, %.1f us per connection\n", cpu,
+				(elapsed > 0) ? cpu * 100 / elapsed : 0.0,
+				(completed > 0) ? cpu * 1e6 / completed : 0.0);
+		printf("daemon rss %lu kB, peak %lu kB\n", after.rssKb, peakRssKb);
+	}
+	return (completed > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
+}
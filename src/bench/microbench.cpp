@@ -0,0 +1,724 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file    microbench.cpp
+ *
+ * Times the hot paths of the daemon one by one: the lookups of the
+ * module registry, the parsing of module options, the initialisation
+ * and the input parsing of the dtk-script state machine, reading and
+ * writing the streams of a client, writing the log and analyzing
+ * captured frames. Every result is written as one JSON object per
+ * line, so runs of different releases can be kept and compared.
+ *
+ * \code
+ * microbench -t 0.5 -f fsm > fsm.json
+ * \endcode
+ *
+ * The iterations of a case are doubled until a run takes at least -t
+ * seconds, then -r runs are timed with the monotonic clock and the
+ * median and the fastest are reported, with the heap allocations per
+ * operation. The first line describes the host and the build. Setup,
+ * e.g. writing the scripts of the state machine, is not timed; the
+ * steps a case needs to go on, e.g. filling the socket it reads from,
+ * are, and are named in the comment of the case.
+ */
+
+// C Headers
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pcap.h>
+
+// C++ Headers
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Project Headers
+#include "moduleregistry.h"
+#include "moduleoptions.h"
+#include "inputstream.h"
+#include "outputstream.h"
+#include "logging.h"
+#include "eventlog.h"
+#include "fw_pcap.h"
+#include "modules/dtk-scriptfsm.h"
+
+/// name the state machine logs with, defined by dtk-script.cpp in the module
+std::string moduleName = "microbench";
+
+/// number of heap allocations so far
+static volatile unsigned long allocations = 0;
+
+#ifdef __GLIBC__
+// count every allocation, including those of operator new
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void*, size_t);
+
+extern "C" void *malloc(size_t _size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_malloc(_size);
+}
+
+extern "C" void *calloc(size_t _count, size_t _size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_calloc(_count, _size);
+}
+
+extern "C" void *realloc(void *_ptr, size_t _size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_realloc(_ptr, _size);
+}
+#else
+// only allocations of operator new can be counted portably
+#include <new>
+
+// dynamic exception specifications are gone since C++17
+#if __cplusplus >= 201103L
+#define NEW_THROWS noexcept(false)
+#define DELETE_THROWS noexcept
+#else
+#define NEW_THROWS throw (std::bad_alloc)
+#define DELETE_THROWS throw ()
+#endif
+
+void *operator new(size_t _size) NEW_THROWS
+{
+	__sync_fetch_and_add(&allocations, 1);
+	void *ptr = malloc(_size ? _size : 1);
+	if (ptr == NULL) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *_ptr) DELETE_THROWS
+{
+	free(_ptr);
+}
+#endif
+
+/// current time of the monotonic clock in nanoseconds
+static inline u_int64_t nanoTime()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<u_int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// {{{1 DXG DOC
+/**
+ * A timed run of a case. The case does its setup, calls start(), runs
+ * the operation iterations times and calls stop().
+ */
+// }}}1 DXG DOC
+struct BenchState
+{
+	unsigned long iterations;		///< operations to run
+	u_int64_t started;				///< nanoseconds at start()
+	u_int64_t nanos;				///< nanoseconds from start() to stop()
+	unsigned long allocated;		///< allocations from start() to stop()
+
+	void start()
+	{
+		this->allocated = allocations;
+		this->started = nanoTime();
+	}
+	void stop()
+	{
+		this->nanos = nanoTime() - this->started;
+		this->allocated = allocations - this->allocated;
+	}
+};
+
+typedef void BenchFunc(BenchState &_state);
+
+/// directory of the synthetic scripts
+static std::string scriptDir;
+
+/// keeps the compiler from optimizing a result away
+static volatile size_t sink;
+
+// {{{1 DXG DOC
+/**
+ * Write a script for the state machine: state 0 answers the given
+ * number of words and regular expressions, the last word is QUIT
+ **/
+// }}}1 DXG DOC
+static void writeScript(const std::string &_file, int _words, int _patterns)
+{
+	std::ofstream out(_file.c_str());
+	out << "# synthetic script of microbench\n"
+		<< "!\tmaxloops\t65535\n"
+		<< "0\tSTART\t0\t1\t1\t220 decoy FTP server ready.\n"
+		<< "0\tERROR\t0\t1\t1\t500 Command not understood.\n";
+	for (int i = 0; i < _patterns; i++) {
+		out << "0\t/^SITE EXEC " << i << " .*$/\t0\t1\t1\t200-" << i << " Command okay.\n";
+	}
+	for (int i = 0; i < _words; i++) {
+		out << "0\tCMD" << i << "\t0\t1\t1\t200 CMD" << i << " okay.\n";
+	}
+	out << "0\tQUIT\t0\t1\t1\t221 Goodbye.\n";
+	// the other states, as long as real scripts
+	for (int state = 1; state < STATECOUNT; state++) {
+		for (int i = 0; i < 8; i++) {
+			out << state << "\tWORD" << i << "\t0\t1\t1\t331 Password required.\n";
+		}
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Open a connected pair of unix sockets, like a client and a session
+ **/
+// }}}1 DXG DOC
+static void openPair(int _fds[2])
+{
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, _fds) == -1) {
+		perror("microbench: socketpair");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Fill the module registry like a configuration of 40 ports on two
+ * hosts, its data is shared by all registries
+ **/
+// }}}1 DXG DOC
+static void fillRegistry(Deception::ModuleRegistry &_registry)
+{
+	static bool filled = false;
+	if (filled) {
+		return;
+	}
+	filled = true;
+	static const unsigned int ports[] = { 11, 17, 19, 21, 23, 25, 37, 53, 65, 66, 69, 79, 80, 110,
+		111, 365, 421, 507, 508, 512, 513, 514, 893, 1111, 2049, 5631, 5632, 5699, 6001, 8000,
+		10000, 10572, 12000, 12345, 12346, 14000, 17027, 28000, 20021, 31337 };
+	for (size_t i = 0; i < sizeof(ports) / sizeof(ports[0]); i++) {
+		_registry.addModule("127.0.0.1", ports[i], "dtk-script.so", "dtkScript",
+				"dtkscriptdir=./dtkscripts/");
+		_registry.addModule("10.0.0.1", ports[i], "dtk-script.so", "dtkScript",
+				"dtkscriptdir=./dtkscripts/");
+	}
+}
+
+/// ModuleRegistry::find() of a configured address and port
+static void registryFind(BenchState &_state)
+{
+	Deception::ModuleRegistry registry;
+	fillRegistry(registry);
+	std::string idx = "10.0.0.1:31337";
+	_state.start();
+	for (unsigned long i = 0; i < _state.iterations; i++) {
+		sink += (registry.find(idx) == NULL);
+	}
+	_state.stop();
+}
+
+/// ModuleRegistry::getOption() of a configured address and port
+static void registryGetOption(BenchState &_state)
+{
+	Deception::ModuleRegistry registry;
+	fillRegistry(registry);
+	std::string idx = "10.0.0.1:31337";
+	_state.start();
+	for (unsigned long i = 0; i < _state.iterations; i++) {
+		sink += registry.getOption(idx).size();
+	}
+	_state.stop();
+}
+
+/// ModuleOptions of an option string and a getOption() on it
+static void moduleOptionsParse(BenchState &_state)
+{
+	std::string option = "dtkscriptdir=./dtkscripts/";
+	_state.start();
+	for (unsigned long i = 0; i < _state.iterations; i++) {
+		Deception::ModuleOptions options(option);
+		sink += options.getOption("dtkscriptdir").size();
+	}
+	_state.stop();
+}
+
+DTKSCRIPT_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * The cases of the state machine, a friend of it to reach its private
+ * steps
+ **/
+// }}}1 DXG DOC
+class FsmBench
+{
+	public:
+		/// initState() of all states of a script, including freeing the tables again
+		static void initState(BenchState &_state, const std::string &_file)
+		{
+			Deception::InputStream in;
+			Deception::OutputStream out;
+			std::string path = scriptDir + "/" + _file;
+			_state.start();
+			for (unsigned long i = 0; i < _state.iterations; i++) {
+				DtkScriptFSM fsm(in, out);
+				for (int s = 0; s < STATECOUNT; s++) {
+					fsm.initState(path, s);
+				}
+				clear(fsm.matchAction);
+				clear(fsm.matchDtk);
+				clear(fsm.matchPattern);
+				clear(fsm.matchWord);
+			}
+			_state.stop();
+		}
+
+		/// parse() of a line matching the last word, including writing the lines to the socket
+		static void parse(BenchState &_state, const std::string &_file, const std::string &_line)
+		{
+			int fds[2];
+			openPair(fds);
+			Deception::InputStream in;
+			in.doInit(fds[1]);
+			in.setTimeout(5, 0);
+			// the responses aren't read
+			Deception::OutputStream out;
+			out.doInit(::open("/dev/null", O_WRONLY));
+			DtkScriptFSM fsm(in, out);
+			fsm.initState(scriptDir + "/" + _file, 0);
+			DtkScriptFSM::curState = 0;
+			DtkScriptFSM::confDelay = 0;
+			DtkScriptFSM::confMaxLoops = static_cast<unsigned int>(-1);
+			std::string lines;
+			for (int i = 0; i < 64; i++) {
+				lines += _line + "\n";
+			}
+			_state.start();
+			for (unsigned long i = 0; i < _state.iterations; i++) {
+				if ((i & 63) == 0) {
+					(void) ::write(fds[0], lines.data(), lines.size());
+				}
+				DtkScriptFSM::curLoop = 0;
+				fsm.parse();
+			}
+			_state.stop();
+			clear(fsm.matchAction);
+			clear(fsm.matchDtk);
+			clear(fsm.matchPattern);
+			clear(fsm.matchWord);
+			::close(fds[0]);
+			::close(fds[1]);
+			::close(out.getFd());
+		}
+	private:
+		static void clear(DtkScriptFSM::StateTransitionTable &_table)
+		{
+			for (DtkScriptFSM::StateTransitionTableIterator it = _table.begin(); it != _table.end(); ++it) {
+				delete it->second;
+			}
+			_table.clear();
+		}
+};
+
+DTKSCRIPT_NAMESPACE_END
+
+static void fsmInitState(BenchState &_state)
+{
+	Dtkscript::FsmBench::initState(_state, "words.response");
+}
+
+static void fsmParseWords(BenchState &_state)
+{
+	Dtkscript::FsmBench::parse(_state, "words.response", "QUIT");
+}
+
+static void fsmParsePatterns(BenchState &_state)
+{
+	Dtkscript::FsmBench::parse(_state, "patterns.response", "QUIT");
+}
+
+/// getline() of a line of a client, including writing 64 lines at a time to the socket
+static void inputStreamGetline(BenchState &_state)
+{
+	int fds[2];
+	openPair(fds);
+	Deception::InputStream in;
+	in.doInit(fds[1]);
+	in.setTimeout(5, 0);
+	std::string lines;
+	for (int i = 0; i < 64; i++) {
+		lines += "USER anonymous\r\n";
+	}
+	char buf[1024];
+	_state.start();
+	for (unsigned long i = 0; i < _state.iterations; i++) {
+		if ((i & 63) == 0) {
+			(void) ::write(fds[0], lines.data(), lines.size());
+		}
+		in.getline(buf, sizeof(buf) - 1, '\n');
+		sink += buf[0];
+	}
+	_state.stop();
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+/// write a response to a client, including reading every 64 responses from the socket
+static void outputStream(BenchState &_state, bool _endl)
+{
+	int fds[2];
+	openPair(fds);
+	::fcntl(fds[1], F_SETFL, ::fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	Deception::OutputStream out;
+	out.doInit(fds[0]);
+	char buf[8192];
+	_state.start();
+	for (unsigned long i = 0; i < _state.iterations; i++) {
+		if (_endl) {
+			out << "220 decoy FTP server ready." << std::endl;
+		} else {
+			out << "220 decoy FTP server ready.\r\n";
+		}
+		if ((i & 63) == 63) {
+			while (::read(fds[1], buf, sizeof(buf)) > 0) {
+			}
+		}
+	}
+	_state.stop();
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+static void outputStreamWrite(BenchState &_state)
+{
+	outputStream(_state, false);
+}
+
+static void outputStreamEndl(BenchState &_state)
+{
+	outputStream(_state, true);
+}
+
+/// Logging::toLog() of a message to /dev/null
+static void loggingToLog(BenchState &_state)
+{
+	std::string module = "microbench";
+	std::string message = "client 192.168.0.1 has connected";
+	globLog.setLogLevel("info");
+	_state.start();
+	for (unsigned long i = 0; i < _state.iterations; i++) {
+		globLog.toLog(module, Deception::Info, message);
+	}
+	_state.stop();
+	globLog.setLogLevel("fatalerror");
+}
+
+/// LOGMSG() of a message above the verbosity
+static void loggingFiltered(BenchState &_state)
+{
+	std::string module = "microbench";
+	_state.start();
+	for (unsigned long i = 0; i < _state.iterations; i++) {
+		LOGMSG(module, Deception::Info, "client " << i << " has connected");
+	}
+	_state.stop();
+}
+
+/// frames for the capture analyzer
+static const size_t frameCount = 4096;
+static const size_t frameLen = 14 + 20 + 20;
+static u_char frames[frameCount][frameLen];
+
+// {{{1 DXG DOC
+/**
+ * Build ethernet frames with ipv4 and tcp or udp from 256 sources to
+ * 16 ports each
+ **/
+// }}}1 DXG DOC
+static void buildFrames(u_char _protocol, u_char _tcpFlags)
+{
+	memset(frames, 0, sizeof(frames));
+	for (size_t i = 0; i < frameCount; i++) {
+		u_char *frame = frames[i];
+		frame[6] = 0x02;
+		frame[11] = 0x01;
+		frame[12] = 0x08;
+		u_char *ip = frame + 14;
+		u_char *transport = ip + 20;
+		ip[0] = 0x45;
+		ip[3] = 40;
+		ip[8] = 64;
+		ip[9] = _protocol;
+		u_int32_t srcIp = htonl(0xc0a80000 + i % 256);
+		u_int32_t dstIp = htonl(0x0a000001);
+		memcpy(ip + 12, &srcIp, 4);
+		memcpy(ip + 16, &dstIp, 4);
+		u_int16_t srcPort = htons(32768 + i);
+		u_int16_t dstPort = htons(20 + i / 256);
+		memcpy(transport, &srcPort, 2);
+		memcpy(transport + 2, &dstPort, 2);
+		if (_protocol == IPPROTO_TCP) {
+			transport[12] = 5 << 4;
+			transport[13] = _tcpFlags;
+			transport[14] = 0xfa;
+			transport[15] = 0xf0;
+		} else {
+			transport[5] = 8;
+		}
+	}
+}
+
+/// analyzePacket() of frames, including draining the events every 256 frames
+static void analyzeFrames(BenchState &_state, u_char _protocol, u_char _tcpFlags)
+{
+	buildFrames(_protocol, _tcpFlags);
+	Deception::EventPipeline pipeline(65536);
+	Deception::EventAggregator aggregator("microbench");
+	aggregator.setPipeline(&pipeline);
+	Deception::ScanDetector scanDetector("microbench");
+	CaptureWorker worker;
+	worker.pipeline = &pipeline;
+	worker.aggregator = &aggregator;
+	worker.scanDetector = &scanDetector;
+	struct pcap_pkthdr header;
+	memset(&header, 0, sizeof(header));
+	header.caplen = frameLen;
+	header.len = frameLen;
+	_state.start();
+	for (unsigned long i = 0; i < _state.iterations; i++) {
+		::gettimeofday(&header.ts, NULL);
+		analyzePacket(reinterpret_cast<u_char*>(&worker), &header, frames[i % frameCount]);
+		if ((i & 255) == 255) {
+			pipeline.drain();
+		}
+	}
+	_state.stop();
+	pipeline.drain();
+}
+
+static void analyzeSyn(BenchState &_state)
+{
+	analyzeFrames(_state, IPPROTO_TCP, 0x02);
+}
+
+static void analyzeAck(BenchState &_state)
+{
+	analyzeFrames(_state, IPPROTO_TCP, 0x10);
+}
+
+static void analyzeUdp(BenchState &_state)
+{
+	analyzeFrames(_state, IPPROTO_UDP, 0);
+}
+
+/// a case
+struct Benchmark
+{
+	const char *name;
+	BenchFunc *run;
+};
+
+static const Benchmark benchmarks[] = {
+	{ "registry_find", registryFind },
+	{ "registry_get_option", registryGetOption },
+	{ "module_options_parse", moduleOptionsParse },
+	{ "fsm_init_state", fsmInitState },
+	{ "fsm_parse_words", fsmParseWords },
+	{ "fsm_parse_patterns", fsmParsePatterns },
+	{ "input_stream_getline", inputStreamGetline },
+	{ "output_stream_write", outputStreamWrite },
+	{ "output_stream_endl", outputStreamEndl },
+	{ "logging_to_log", loggingToLog },
+	{ "logging_filtered", loggingFiltered },
+	{ "analyze_packet_syn", analyzeSyn },
+	{ "analyze_packet_ack", analyzeAck },
+	{ "analyze_packet_udp", analyzeUdp }
+};
+
+// {{{1 DXG DOC
+/**
+ * Quote a string for JSON
+ **/
+// }}}1 DXG DOC
+static std::string jsonString(const std::string &_value)
+{
+	std::string result = "\"";
+	for (size_t i = 0; i < _value.size(); i++) {
+		unsigned char c = _value[i];
+		if ((c == '"') || (c == '\\')) {
+			result += '\\';
+			result += c;
+		} else if (c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			result += escaped;
+		} else {
+			result += c;
+		}
+	}
+	return result + "\"";
+}
+
+// {{{1 DXG DOC
+/**
+ * Prints out information about command line switches
+ **/
+// }}}1 DXG DOC
+void printHelp()
+{
+	std::cout << "microbench: time the hot paths of the daemon, one JSON object per line\n"
+		<< "usage: microbench [-f filter] [-t seconds] [-r runs] [-l]\n"
+		<< "-f\tonly run the cases whose name contains this\n"
+		<< "-t\tseconds a run takes at least (default 0.2)\n"
+		<< "-r\truns per case (default 5)\n"
+		<< "-l\tlist the cases\n" << std::endl;
+	exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv)
+{
+	std::string filter;
+	double minSeconds = 0.2;
+	int runs = 5;
+	bool list = false;
+	int opt;
+
+	while ((opt = ::getopt(argc, argv, "f:t:r:lh")) > 0) {
+		switch (opt) {
+			case 'f':
+				filter = optarg;
+				break;
+			case 't':
+				minSeconds = atof(optarg);
+				break;
+			case 'r':
+				runs = atoi(optarg);
+				break;
+			case 'l':
+				list = true;
+				break;
+			default:
+				printHelp();
+		}
+	}
+	if (runs < 1) {
+		printHelp();
+	}
+	size_t cases = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	if (list) {
+		for (size_t b = 0; b < cases; b++) {
+			std::cout << benchmarks[b].name << std::endl;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// the log is a case of its own, it must not slow down the others
+	globLog.setLogFile("/dev/null");
+	globLog.init();
+	globLog.setLogLevel("fatalerror");
+	globEvents.init();
+	char dir[] = "/tmp/microbench.XXXXXX";
+	if (::mkdtemp(dir) == NULL) {
+		perror("microbench: mkdtemp");
+		return EXIT_FAILURE;
+	}
+	scriptDir = dir;
+	writeScript(scriptDir + "/words.response", 40, 0);
+	writeScript(scriptDir + "/patterns.response", 40, 4);
+
+	// describe the host and the build, so results can be told apart
+	struct utsname host;
+	::uname(&host);
+	char date[32];
+	time_t now = ::time(NULL);
+	::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", ::gmtime(&now));
+	std::ostringstream compiler;
+#ifdef __VERSION__
+	compiler << __VERSION__;
+#endif
+	printf("{\"context\":\"microbench\",\"date\":\"%s\",\"host\":%s,\"system\":%s,\"machine\":%s,"
+			"\"cpus\":%ld,\"compiler\":%s,\"min_seconds\":%g,\"runs\":%d}\n", date,
+			jsonString(host.nodename).c_str(), jsonString(std::string(host.sysname) + " " + host.release).c_str(),
+			jsonString(host.machine).c_str(), ::sysconf(_SC_NPROCESSORS_ONLN),
+			jsonString(compiler.str()).c_str(), minSeconds, runs);
+	fflush(stdout);
+
+	u_int64_t minNanos = static_cast<u_int64_t>(minSeconds * 1e9);
+	for (size_t b = 0; b < cases; b++) {
+		const Benchmark &bench = benchmarks[b];
+		if (!filter.empty() && (std::string(bench.name).find(filter) == std::string::npos)) {
+			continue;
+		}
+		// find the iterations taking at least minSeconds
+		BenchState state;
+		state.iterations = 1;
+		for (;;) {
+			bench.run(state);
+			if ((state.nanos >= minNanos) || (state.iterations >= 1UL << 30)) {
+				break;
+			}
+			double factor = (state.nanos > 0) ? 1.4 * minNanos / state.nanos : 10;
+			factor = std::max(2.0, std::min(10.0, factor));
+			state.iterations = static_cast<unsigned long>(state.iterations * factor);
+		}
+		std::vector<double> perOp;
+		unsigned long allocated = 0;
+		for (int r = 0; r < runs; r++) {
+			bench.run(state);
+			perOp.push_back(static_cast<double>(state.nanos) / state.iterations);
+			allocated += state.allocated;
+		}
+		std::sort(perOp.begin(), perOp.end());
+		double median = perOp[perOp.size() / 2];
+		printf("{\"benchmark\":\"%s\",\"iterations\":%lu,\"runs\":%d,\"ns_per_op\":%.2f,"
+				"\"ns_per_op_min\":%.2f,\"ns_per_op_max\":%.2f,\"ops_per_s\":%.0f,\"allocs_per_op\":%.3f}\n",
+				bench.name, state.iterations, runs, median, perOp.front(), perOp.back(),
+				(median > 0) ? 1e9 / median : 0.0,
+				static_cast<double>(allocated) / (static_cast<double>(state.iterations) * runs));
+		fflush(stdout);
+	}
+
+	::unlink((scriptDir + "/words.response").c_str());
+	::unlink((scriptDir + "/patterns.response").c_str());
+	::rmdir(dir);
+	return EXIT_SUCCESS;
+}
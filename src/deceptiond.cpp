@@ -51,13 +51,23 @@
 #include <grp.h>
 #include <fcntl.h>
 
+// C++ Headers
+#include <map>
+#include <algorithm>
+
 // Project Headers
 #include "deceptiond.h"
 #include "moduleconfig.h"
 #include "socket.h"
 #include "logging.h"
+#include "eventlog.h"
+#include "aggregator.h"
 #include "signals.h"
 #include "fw_pcap.h"
+#include "sessionaccounting.h"
+#include "metrics.h"
+#include "latency.h"
+#include "adminserver.h"
 
 #include "exception.h"
 #include "bindexception.h"
@@ -78,6 +88,11 @@ std::string runGroup;
 std::string capDevice;
 // from config file - flag to en-/disable capturing
 bool enableCapture = false;
+// from config file - snaplen, buffer and timeout of the capture engine
+CaptureConfig capConfig;
+// from config file - address and port of the metrics, 0 for none
+std::string adminIpAddr = "127.0.0.1";
+int adminPort = 0;
 // for daemonize()
 int fdIn, fdOut;
 // child id of capture engine
@@ -183,6 +198,35 @@ void checkFile(std::string &_fileName)
 	}
 }
 
+// {{{1 DXG DOC
+/**
+ * Check whether the capture engine sees the SYN of a session, only then
+ * the session waits for it to show up in the flow table
+ *
+ * \param _listeners The listeners the capture filter covers
+ * \param _local Local address of the session
+ * \param _capEngine The capture threads, NULL if capture runs in its own process
+ **/
+// }}}1 DXG DOC
+bool captureSees(const Deception::PortFilter &_listeners, const struct sockaddr_in &_local,
+		const CaptureEngine *_capEngine)
+{
+	// 0.0.0.0 listeners and addresses not configured are not in the
+	// filter; matches() would tell about the ports nobody listens on
+	if (!_listeners.hasHost(_local.sin_addr.s_addr)) {
+		return false;
+	}
+	// the loopback only shows up on its own device
+	if (((ntohl(_local.sin_addr.s_addr) >> 24) == 127) && (capDevice != "lo") && (capDevice != "any")) {
+		return false;
+	}
+	if (_capEngine != NULL) {
+		return _capEngine->isRunning();
+	}
+	// the capture process keeps the privileges the session dropped
+	return (capChld > 0) && ((::kill(capChld, 0) == 0) || (errno == EPERM));
+}
+
 int main(int argc, char **argv)
 {
 #ifdef DO_MCHECK
@@ -231,10 +275,11 @@ int main(int argc, char **argv)
 	bool doDaemonize = false;
 	// variable to fetch getopt stuff from command line
 	char opt;
-	// set our nice signal handler
-	// no more zombies in here
+	// exits of children are events of the main loop, they are reaped
+	// there, so no more zombies in here
+	int childFd = -1;
 	try {
-		setSigHandler(SIGCHLD, chldHandler);
+		childFd = openChildEvents();
 	} catch (Deception::Exception &e) {
 		std::cerr << "error while setting signal handler: " << e.toString();
 		::exit(EXIT_FAILURE);
@@ -304,6 +349,20 @@ int main(int argc, char **argv)
 	} catch (Deception::LogFileException &e) {
 		std::cerr << "error in logfile init: " << e.toString() << std::endl;
 	}
+	try {
+		globEvents.init();
+	} catch (Deception::LogFileException &e) {
+		std::cerr << "error in event log init: " << e.toString() << std::endl;
+	}
+	// the rotation thread has to be started after daemonize(), since
+	// threads don't survive fork()
+	try {
+		globLog.startRotator();
+		setSigHandler(SIGHUP, hupHandler);
+		setSigHandler(SIGUSR1, usr1Handler);
+	} catch (Deception::Exception &e) {
+		std::cerr << "error while starting logfile rotation: " << e.toString() << std::endl;
+	}
 
 	// write startup message
 	logMsg = "deceptiond starting";
@@ -333,10 +392,27 @@ int main(int argc, char **argv)
 	// load modules
 	ml.loadAllModules();
 
+	// counters shared with the session and capture processes
+	try {
+		globMetrics.init();
+	} catch (std::bad_alloc &e) {
+		globLog.toLog(logName, Deception::Error, "could not map metrics, none are kept");
+	}
+	// accepted connections per decoy socket, by its descriptor
+	std::map<int, int> acceptMetrics;
+	// latency histograms of the sessions, shared like the metrics
+	try {
+		globLatency.init();
+	} catch (std::bad_alloc &e) {
+		globLog.toLog(logName, Deception::Error, "could not map latency histograms, none are kept");
+	}
+	// listener of the histograms per decoy socket, by its descriptor
+	std::map<int, int> latencyListeners;
+
 	// fetch iterators for ModuleRegistry
 	Deception::ModuleRegistry::ModuleRegistryMapIterator itBegin = mr.begin();
 	Deception::ModuleRegistry::ModuleRegistryMapIterator itEnd = mr.end();
-	fd_set sockFdSet, selectSet;
+	fd_set sockFdSet, selectSet, writeSet;
 	FD_ZERO(&sockFdSet);
 	int maxfd = 0;
 
@@ -364,19 +440,83 @@ int main(int argc, char **argv)
 		maxfd = sockobj->getFd();
 		FD_SET(maxfd, &sockFdSet);
 		mr.insert(ipaddr, port, sockobj);
+		acceptMetrics[maxfd] = globMetrics.addCounter("deceptiond_accepts_total", "connections accepted",
+				Deception::Metrics::label("ipaddr", ipaddr) + "," + Deception::Metrics::label("port", intToString(port)));
+		latencyListeners[maxfd] = globLatency.addListener(ipaddr, port);
 	}
 	sockobj = NULL;
+	// scrapers fetch the metrics here
+	Deception::AdminServer adminServer(logName);
+	if (adminPort > 0) {
+		logMsg = "creating admin socket for " + adminIpAddr + ":" + intToString(adminPort);
+		globLog.toLog(logName, Deception::Info, logMsg);
+		try {
+			adminServer.open(adminIpAddr, adminPort);
+		} catch (Deception::Exception &e) {
+			logMsg = e.getType() + "error in admin socket init: " + e.toString();
+			globLog.toLog(logName, Deception::FatalError, logMsg);
+			::exit(EXIT_FAILURE);
+		}
+	}
+	FD_SET(childFd, &sockFdSet);
+	if (childFd > maxfd) {
+		maxfd = childFd;
+	}
 
 	// and now for the capturing stuff
-	// first fork a new process
-	if (enableCapture) {
+	// SYNs seen by capture, shared with the session processes
+	Deception::FlowTable *flowTable = NULL;
+	if (enableCapture && (capConfig.flows > 0)) {
+		try {
+			flowTable = new Deception::FlowTable(capConfig.flows);
+		} catch (std::bad_alloc &e) {
+			globLog.toLog(logName, Deception::Error, "could not map flow table, SYNs are not kept");
+		}
+	}
+	// tells the operating system of clients
+	Deception::OsSignatures *osSignatures = NULL;
+	if (enableCapture && !capConfig.osdb.empty()) {
+		osSignatures = new Deception::OsSignatures();
+		try {
+			osSignatures->load(capConfig.osdb);
+		} catch (Deception::IOException &e) {
+			logMsg = "error while loading os signatures: " + e.toString();
+			globLog.toLog(logName, Deception::Error, logMsg);
+			delete osSignatures;
+			osSignatures = NULL;
+		}
+	}
+	// events of capture threads, written by the main loop
+	Deception::EventPipeline capPipeline;
+	CaptureEngine *capEngine = NULL;
+	if (enableCapture && capConfig.inProcess) {
+		// the threads only read the registry, which is complete by now
+		capEngine = new CaptureEngine(capConfig, capPipeline, flowTable, osSignatures);
+		try {
+			capEngine->start(mr, capDevice);
+		} catch (Deception::CaptureException &e) {
+			logMsg = "error while initializing packet capture engine: " + e.toString();
+			globLog.toLog(logName, Deception::FatalError, logMsg);
+			::exit(EXIT_FAILURE);
+		}
+	} else if (enableCapture) {
+		// first fork a new process
 		try {
 			switch (child = ::fork()) {
 				case 0:
 					// child
+					closeChildEvents(childFd);
+					adminServer.closeAll();
+					// the rotation thread stayed with the daemon
+					try {
+						globLog.followRotation();
+					} catch (Deception::LogFileException &e) {
+						logMsg = "could not follow logfile rotation: " + e.toString();
+						globLog.toLog(logName, Deception::Error, logMsg);
+					}
 					// call capturing routine*/
 					try {
-						capture(mr, capDevice);
+						capture(mr, capDevice, capConfig, flowTable, osSignatures);
 					} catch (Deception::CaptureException &e) {
 						logMsg = "error in capture engine: " + e.toString();
 						globLog.toLog(logName, Deception::Error, logMsg);
@@ -400,16 +540,49 @@ int main(int argc, char **argv)
 		}
 	}
 
+	// the listeners the capture filter covers, see captureSees()
+	Deception::PortFilter capturedListeners;
+	if (flowTable != NULL) {
+		capturedListeners.add(mr);
+	}
+
+	// folds repeated connects of a client to the same port
+	Deception::EventAggregator connectAggregator(logName);
+	// resources used by the session processes
+	Deception::SessionAccounting sessions(logName);
+	if (capChld > 0) {
+		sessions.adopt(capChld);
+	}
 	struct timeval timeout = { 0, 0 };
 	// main event-loop
 	for(int i = 0; ; i++) {
+		// report summaries of events whose window has passed
+		connectAggregator.expire(::time(NULL));
+		sessions.report(::time(NULL));
+		if (globLatency.dumpRequested()) {
+			globLatency.dump(logName);
+		}
+		if (capEngine != NULL) {
+			capEngine->report(::time(NULL));
+			capPipeline.drain();
+			if (!capEngine->isRunning()) {
+				capEngine->stop();
+				capPipeline.drain();
+				logMsg = "capture engine has stopped: " + capEngine->getError();
+				globLog.toLog(logName, Deception::Error, logMsg);
+				delete capEngine;
+				capEngine = NULL;
+			}
+		}
 		// NOTE:
 		// timeout and selectSet are modified by select() and therefore
 		// need to be reset before another call to select()!
 		timeout.tv_usec = 100000;
 		selectSet = sockFdSet;
+		FD_ZERO(&writeSet);
+		int topFd = std::max(maxfd, adminServer.setFds(selectSet, writeSet));
 
-		int n = ::select(maxfd + 1, &selectSet, NULL, NULL, &timeout);
+		int n = ::select(topFd + 1, &selectSet, &writeSet, NULL, &timeout);
 		if (n == -1) {
 			// interrupted system call
 			// pops up, if a child exits
@@ -422,10 +595,20 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		// serves the scrapers and closes the idle ones
+		n -= adminServer.handle(selectSet, writeSet, ::time(NULL));
+
 		if (n == 0)
 			// no file descriptpors ready timeout triggered
 			continue;
 
+		if (FD_ISSET(childFd, &selectSet)) {
+			readChildEvents(childFd);
+			sessions.reap();
+			if (--n == 0) {
+				continue;
+			}
+		}
 		// test which fd's are ready 
 		Deception::ModuleRegistry::ModuleRegistryMapIterator itBegin = mr.begin();
 		Deception::ModuleRegistry::ModuleRegistryMapIterator itEnd = mr.end();
@@ -437,8 +620,26 @@ int main(int argc, char **argv)
 
 			try {
 				sockobj->doAccept();
-				logMsg = "client " + sockobj->getClientAddress() + " has connected";
-				globLog.toLog(logName, Deception::Info, logMsg);
+				struct timespec accepted;
+				::clock_gettime(CLOCK_MONOTONIC, &accepted);
+				int listener = latencyListeners[sockobj->getFd()];
+				globMetrics.add(acceptMetrics[sockobj->getFd()]);
+				struct sockaddr_in localAddress = sockobj->getLocalSockAddr();
+				bool admitted = connectAggregator.admit(Deception::EventAggregator::ConnectEvent,
+						sockobj->getClientSockAddr().sin_addr.s_addr, localAddress.sin_addr.s_addr,
+						localAddress.sin_port, ::time(NULL));
+				if (admitted) {
+					logMsg = "client " + sockobj->getClientAddress() + " has connected";
+					globLog.toLog(logName, Deception::Info, logMsg);
+				}
+				if (admitted && globEvents.isEnabled()) {
+					Deception::LogEvent event(logName.c_str(), Deception::Info, "connect");
+					event.srcIp = sockobj->getClientSockAddr().sin_addr.s_addr;
+					event.srcPort = sockobj->getClientSockAddr().sin_port;
+					event.dstIp = localAddress.sin_addr.s_addr;
+					event.dstPort = localAddress.sin_port;
+					globEvents.log(event);
+				}
 				child = ::fork();
 				if (child == -1) {
 					// Error
@@ -449,12 +650,16 @@ int main(int argc, char **argv)
 				}
 				if (child > 0) {
 					// Parent
+					sessions.started(child, (*itBegin).second->getModName(),
+							sockobj->getClientSockAddr().sin_addr.s_addr, localAddress.sin_port, listener);
 					if(sockobj->isConnected()) {
 						sockobj->close(); // close connection
 					}
 				} else {
 					// Child (Module)
 					// TODO: child cleanup
+					closeChildEvents(childFd);
+					adminServer.closeAll();
 
 					// now loose those unnecessary privileges
 					// first group privileges, since if we would loose them after loosing the
@@ -474,6 +679,38 @@ int main(int argc, char **argv)
 						}
 					}
 
+					// all events of this child belong to this session
+					globEvents.setSession(sockobj->getClientSockAddr(), localAddress);
+					if (flowTable != NULL) {
+						// the SYN may still wait in the capture ring, which is
+						// delivered within the capture timeout. sessions capture
+						// never sees look up once and go on.
+						int maxWait = 0;
+						if (captureSees(capturedListeners, localAddress, capEngine)) {
+							maxWait = capConfig.immediate ? 10 : capConfig.timeout;
+						}
+						Deception::SynFingerprint syn;
+						for (int waited = 0; ; waited += 10) {
+							if (flowTable->lookup(sockobj->getClientSockAddr().sin_addr.s_addr,
+									sockobj->getClientSockAddr().sin_port, localAddress.sin_addr.s_addr,
+									localAddress.sin_port, syn)) {
+								const char *os = (osSignatures != NULL) ? osSignatures->match(syn) : NULL;
+								sockobj->setSynFingerprint(syn);
+								if (os != NULL) {
+									sockobj->setClientOs(os);
+								}
+								globEvents.setSessionSyn(syn, os);
+								break;
+							}
+							if (waited >= maxWait) {
+								break;
+							}
+							::usleep(10000);
+						}
+					}
+					// scripts may ask the capture engine to keep this session
+					Deception::EvidenceRecorder::setSession(flowTable, sockobj->getClientSockAddr(), localAddress);
+
 					Deception::ModuleFactoryBase *fb = NULL;
 					mod = NULL;
 					optionstring = "";
@@ -497,8 +734,14 @@ int main(int argc, char **argv)
 
 					optionstring = mr.getOption(modAddress);
 
+					// time the start of the module and its first answer
+					Deception::Latency::Session latency(listener, accepted);
+					latency.moduleStarted();
+					sockobj->getOutputStream().setObserver(&latency);
+
 					// run module
 					mod->modMain(sockobj, optionstring);
+					sockobj->getOutputStream().setObserver(NULL);
 
 					// close connection
 					if(sockobj->isConnected()) {
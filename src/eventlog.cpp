@@ -0,0 +1,476 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file eventlog.cpp
+ *
+ * Contains the implementation of the structured event log
+ */
+#include "eventlog.h"
+#include "timecache.h"
+
+#include <new>
+
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// {{{1 DXG DOC
+/**
+ * Constructor, the event log is disabled until init() is called
+ */
+// }}}1 DXG DOC
+Deception::EventLog::EventLog() :
+	fd(-1),
+	reopenRequested(0),
+	buf(NULL),
+	bufSize(0),
+	bufLen(0),
+	hasSessionSyn(false),
+	sessionState(-1)
+{ // {{{1
+	::memset(&this->sessionSrc, 0, sizeof(this->sessionSrc));
+	::memset(&this->sessionDst, 0, sizeof(this->sessionDst));
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor, releases the line buffer
+ */
+// }}}1 DXG DOC
+Deception::EventLog::~EventLog()
+{ // {{{1
+	::free(this->buf);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the file to write events to. Takes effect with init() or the
+ * next reopen.
+ *
+ * \param _fileName Name of the event log
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::setFile(const std::string &_fileName)
+{ // {{{1
+	this->fileName = _fileName;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Open the event log for appending. Does nothing if no file has been
+ * configured, the event log stays disabled then.
+ *
+ * \exception LogFileException Event log could not be opened
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::init()
+{ // {{{1
+	if (this->fileName.empty()) {
+		return;
+	}
+	int newFd = ::open(this->fileName.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0640);
+	if (newFd == -1) {
+		throw LogFileException(errno);
+	}
+	::fcntl(newFd, F_SETFD, FD_CLOEXEC);
+	if (this->fd == -1) {
+		this->fd = newFd;
+	} else {
+		// keep the descriptor number, see Logging::reopen()
+		::dup2(newFd, this->fd);
+		::close(newFd);
+	}
+	// start with a buffer that fits most events
+	this->reserve(1024);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Reopen the event log before the next event is written. Safe to be
+ * called from a signal handler.
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::requestReopen()
+{ // {{{1
+	this->reopenRequested = 1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the endpoints of the session handled by this process
+ *
+ * \param _src Address of the client
+ * \param _dst Address the client connected to
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::setSession(const struct sockaddr_in &_src, const struct sockaddr_in &_dst)
+{ // {{{1
+	this->sessionSrc = _src;
+	this->sessionDst = _dst;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the SYN the session handled by this process has been opened with
+ *
+ * \param _syn Fingerprint of the SYN
+ * \param _os Operating system of the client, NULL if unknown
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::setSessionSyn(const SynFingerprint &_syn, const char *_os)
+{ // {{{1
+	this->sessionSyn = _syn;
+	this->hasSessionSyn = true;
+	this->sessionOs = (_os != NULL) ? _os : "";
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the script handling the session of this process and its state
+ *
+ * \param _script Name of the script
+ * \param _state Current state
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::setScript(const char *_script, int _state)
+{ // {{{1
+	this->sessionScript = _script;
+	this->sessionState = _state;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Make sure the line buffer can take another _len bytes
+ *
+ * \param _len Number of bytes to append
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::reserve(size_t _len)
+{ // {{{1
+	if (this->bufLen + _len <= this->bufSize) {
+		return;
+	}
+	size_t newSize = (this->bufSize > 0) ? this->bufSize : 1024;
+	while (newSize < this->bufLen + _len) {
+		newSize *= 2;
+	}
+	char *newBuf = static_cast<char*>(::realloc(this->buf, newSize));
+	if (newBuf == NULL) {
+		throw std::bad_alloc();
+	}
+	this->buf = newBuf;
+	this->bufSize = newSize;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Append raw bytes to the line buffer
+ */
+// }}}1 DXG DOC
+inline void Deception::EventLog::put(const char *_str, size_t _len)
+{ // {{{1
+	this->reserve(_len);
+	::memcpy(this->buf + this->bufLen, _str, _len);
+	this->bufLen += _len;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Append a key followed by a colon, preceded by a comma unless it is
+ * the first one
+ *
+ * \param _key Name of the key, must not need escaping
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::putKey(const char *_key)
+{ // {{{1
+	size_t keyLen = ::strlen(_key);
+	this->reserve(keyLen + 4);
+	if (this->buf[this->bufLen - 1] != '{') {
+		this->buf[this->bufLen++] = ',';
+	}
+	this->buf[this->bufLen++] = '"';
+	::memcpy(this->buf + this->bufLen, _key, keyLen);
+	this->bufLen += keyLen;
+	this->buf[this->bufLen++] = '"';
+	this->buf[this->bufLen++] = ':';
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Append a string as a quoted and escaped JSON string. Quotes,
+ * backslashes and all bytes outside of printable ASCII are escaped,
+ * the latter as \\u00XX.
+ *
+ * \param _str String to append, null if NULL
+ * \param _len Length of _str
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::putString(const char *_str, size_t _len)
+{ // {{{1
+	static const char hex[] = "0123456789abcdef";
+	if (_str == NULL) {
+		this->put("null", 4);
+		return;
+	}
+	// worst case every byte becomes \u00XX
+	this->reserve(_len * 6 + 2);
+	char *out = this->buf + this->bufLen;
+	*out++ = '"';
+	for (size_t i = 0; i < _len; i++) {
+		unsigned char c = static_cast<unsigned char>(_str[i]);
+		if ((c >= 0x20) && (c < 0x7f) && (c != '"') && (c != '\\')) {
+			*out++ = c;
+			continue;
+		}
+		*out++ = '\\';
+		switch (c) {
+			case '"':  *out++ = '"'; break;
+			case '\\': *out++ = '\\'; break;
+			case '\n': *out++ = 'n'; break;
+			case '\r': *out++ = 'r'; break;
+			case '\t': *out++ = 't'; break;
+			default:
+				*out++ = 'u';
+				*out++ = '0';
+				*out++ = '0';
+				*out++ = hex[c >> 4];
+				*out++ = hex[c & 0x0f];
+				break;
+		}
+	}
+	*out++ = '"';
+	this->bufLen = out - this->buf;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * \overload void Deception::EventLog::putString(const char *_str, size_t _len)
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::putString(const char *_str)
+{ // {{{1
+	this->putString(_str, (_str != NULL) ? ::strlen(_str) : 0);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Append an unsigned number
+ *
+ * \param _num Number to append
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::putNumber(unsigned long _num)
+{ // {{{1
+	char digits[24];
+	char *ptr = digits + sizeof(digits);
+	do {
+		*--ptr = '0' + (_num % 10);
+		_num /= 10;
+	} while (_num > 0);
+	this->put(ptr, digits + sizeof(digits) - ptr);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Append an IPv4 address as quoted dotted quad, null if 0
+ *
+ * \param _ip Address in network byte order
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::putIp(in_addr_t _ip)
+{ // {{{1
+	if (_ip == 0) {
+		this->put("null", 4);
+		return;
+	}
+	const unsigned char *octets = reinterpret_cast<const unsigned char*>(&_ip);
+	this->put("\"", 1);
+	for (int i = 0; i < 4; i++) {
+		if (i > 0) {
+			this->put(".", 1);
+		}
+		this->putNumber(octets[i]);
+	}
+	this->put("\"", 1);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write an event as a single JSON line. Fields that are unknown in the
+ * event are taken from the session of this process, if set.
+ *
+ * \param _event Event to write
+ */
+// }}}1 DXG DOC
+void Deception::EventLog::log(const LogEvent &_event)
+{ // {{{1
+	if (this->fd == -1) {
+		return;
+	}
+	if (this->reopenRequested) {
+		this->reopenRequested = 0;
+		try {
+			this->init();
+		} catch (Deception::LogFileException &e) {
+			// keep writing to the old file
+		}
+	}
+	struct timeval now;
+	TimeCache::getTime(now, 6);
+	char usec[8];
+	usec[0] = '.';
+	long frac = now.tv_usec;
+	for (int i = 6; i > 0; i--) {
+		usec[i] = '0' + (frac % 10);
+		frac /= 10;
+	}
+
+	this->bufLen = 0;
+	this->put("{", 1);
+	this->putKey("ts");
+	this->putNumber(now.tv_sec);
+	this->put(usec, 7);
+	this->putKey("pid");
+	this->putNumber(::getpid());
+	this->putKey("module");
+	this->putString(_event.module);
+	this->putKey("level");
+	// strip the brackets of the text log's level names
+	const std::string &level = logTypes[_event.level];
+	this->putString(level.data() + 1, level.length() - 2);
+	this->putKey("event");
+	this->putString(_event.event);
+
+	bool useSession = (_event.srcIp == 0) && (_event.dstIp == 0);
+	this->putKey("src_ip");
+	this->putIp(useSession ? this->sessionSrc.sin_addr.s_addr : _event.srcIp);
+	in_port_t port = useSession ? this->sessionSrc.sin_port : _event.srcPort;
+	this->putKey("src_port");
+	if (port != 0) {
+		this->putNumber(ntohs(port));
+	} else {
+		this->put("null", 4);
+	}
+	this->putKey("dst_ip");
+	this->putIp(useSession ? this->sessionDst.sin_addr.s_addr : _event.dstIp);
+	port = useSession ? this->sessionDst.sin_port : _event.dstPort;
+	this->putKey("dst_port");
+	if (port != 0) {
+		this->putNumber(ntohs(port));
+	} else {
+		this->put("null", 4);
+	}
+
+	const char *script = _event.script;
+	int state = _event.state;
+	if ((script == NULL) && !this->sessionScript.empty()) {
+		script = this->sessionScript.c_str();
+		state = this->sessionState;
+	}
+	this->putKey("script");
+	this->putString(script);
+	this->putKey("state");
+	if (state >= 0) {
+		this->putNumber(state);
+	} else {
+		this->put("null", 4);
+	}
+	this->putKey("payload");
+	this->putString(_event.payload, _event.payloadLen);
+	this->putKey("count");
+	this->putNumber(_event.count);
+	if (_event.scanType != NULL) {
+		this->putKey("scan_type");
+		this->putString(_event.scanType, ::strlen(_event.scanType));
+		this->putKey("ports");
+		this->putNumber(_event.ports);
+		this->putKey("hosts");
+		this->putNumber(_event.hosts);
+		this->putKey("rate");
+		this->putNumber(_event.rate);
+	}
+	if (useSession && this->hasSessionSyn) {
+		const SynFingerprint &syn = this->sessionSyn;
+		char options[MAX_SYN_OPTIONS * 6];
+		size_t optionsLen = syn.formatOptions(options, sizeof(options));
+		this->putKey("syn_ttl");
+		this->putNumber(syn.ttl);
+		this->putKey("syn_window");
+		this->putNumber(syn.window);
+		this->putKey("syn_mss");
+		if (syn.mss != 0) {
+			this->putNumber(syn.mss);
+		} else {
+			this->put("null", 4);
+		}
+		this->putKey("syn_wscale");
+		if (syn.wscale != 0xff) {
+			this->putNumber(syn.wscale);
+		} else {
+			this->put("null", 4);
+		}
+		this->putKey("syn_options");
+		this->putString(options, optionsLen);
+		this->putKey("syn_tsval");
+		if (syn.hasTimestamp) {
+			this->putNumber(syn.tsVal);
+		} else {
+			this->put("null", 4);
+		}
+	}
+	const char *os = _event.os;
+	if ((os == NULL) && useSession && !this->sessionOs.empty()) {
+		os = this->sessionOs.c_str();
+	}
+	if (os != NULL) {
+		this->putKey("os");
+		this->putString(os);
+	}
+	this->put("}\n", 2);
+
+	// write the line at once, so concurrent writers don't mix lines
+	const char *ptr = this->buf;
+	size_t left = this->bufLen;
+	while (left > 0) {
+		ssize_t n = ::write(this->fd, ptr, left);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		ptr += n;
+		left -= n;
+	}
+} // }}}1
+
+Deception::EventLog globEvents;
@@ -0,0 +1,198 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _EVENTLOG_H
+#define _EVENTLOG_H
+
+/**
+ * \file eventlog.h
+ *
+ * Declares the structured event log, which writes one JSON object per
+ * line for consumption by other programs. It is independent of the
+ * text log written by Logging and can be enabled alongside it.
+ */
+
+// Project Headers
+#include "defs.h"
+#include "logging.h"
+#include "flowtable.h"
+
+// C++ Headers
+#include <string>
+
+// C Headers
+#include <signal.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * \struct LogEvent
+ *
+ * A single event as passed to EventLog::log(). All pointers may be NULL
+ * and all numbers 0 if unknown, these fields are written as null.
+ * Addresses and ports are in network byte order, as they are found in
+ * packets and socket addresses.
+ */
+// }}}1 DXG DOC
+struct LogEvent
+{
+	const char *module;			///< name of the module or engine
+	enum logLevels level;		///< severity
+	const char *event;			///< type of the event, e.g. "syn" or "connect"
+	in_addr_t srcIp;			///< source address
+	in_port_t srcPort;			///< source port
+	in_addr_t dstIp;			///< destination address
+	in_port_t dstPort;			///< destination port
+	const char *script;			///< dtk-script that handles the session
+	int state;					///< state of the script, -1 if none
+	const char *payload;		///< data sent by the client, may contain any byte
+	size_t payloadLen;			///< length of payload
+	unsigned long count;		///< number of occurrences this event stands for
+	const char *scanType;		///< "horizontal", "vertical" or "block" for scan events
+	unsigned long ports;		///< distinct destination ports of a scan
+	unsigned long hosts;		///< distinct destination hosts of a scan
+	unsigned long rate;			///< packets per second of a scan
+	const char *os;				///< operating system of the source, see OsSignatures
+
+	// {{{2 DXG DOC
+	/**
+	 * Constructor, initializes all fields as unknown
+	 *
+	 * \param _module Name of the module
+	 * \param _level Loglevel
+	 * \param _event Type of event
+	 */
+	// }}}2 DXG DOC
+	LogEvent(const char *_module, enum logLevels _level, const char *_event) :
+		module(_module),
+		level(_level),
+		event(_event),
+		srcIp(0),
+		srcPort(0),
+		dstIp(0),
+		dstPort(0),
+		script(NULL),
+		state(-1),
+		payload(NULL),
+		payloadLen(0),
+		count(1),
+		scanType(NULL),
+		ports(0),
+		hosts(0),
+		rate(0),
+		os(NULL)
+	{ }
+};
+
+// {{{1 DXG DOC
+/**
+ * \class EventLog
+ *
+ * Writes LogEvents as JSON lines like
+ * \code
+ * {"ts":1049558928.123456,"pid":4711,"module":"dtkScript","level":"mod.info",
+ *  "event":"input","src_ip":"10.0.0.1","src_port":34567,"dst_ip":"10.0.0.2",
+ *  "dst_port":21,"script":"21.response","state":1,"payload":"USER root",
+ *  "count":1}
+ * \endcode
+ * All of these keys are always present; count is above 1 for summaries
+ * of aggregated events, see EventAggregator. Scan events have the keys
+ * scan_type, ports, hosts and rate in addition, see ScanDetector.
+ * Events of a session whose SYN has been seen by the capture engine
+ * have the keys syn_ttl, syn_window, syn_mss, syn_wscale, syn_options
+ * and syn_tsval, see FlowTable; unknown values are null. The key os is
+ * present if the operating system of the source is known, see
+ * OsSignatures.
+ * Every line is encoded into a buffer that is reused between calls and
+ * written with a single write(2), so there are no allocations once the
+ * buffer has grown to fit the longest line.
+ * Strings are escaped for JSON; bytes outside of printable ASCII are
+ * written as \\u00XX, so the output is valid UTF-8 whatever a client
+ * sends.
+ *
+ * A process handling a single session can set its endpoints and script
+ * once with setSession(), setSessionSyn() and setScript(), they are used
+ * for all events that don't specify their own.
+ *
+ * \note The object is not thread-safe.
+ */
+// }}}1 DXG DOC
+class EventLog
+{ // {{{1
+	public:
+		EventLog();
+		~EventLog();
+		void setFile(const std::string &_fileName);
+		void init();
+		// {{{2 DXG DOC
+		/**
+		 * Check if events are written at all. Use this before collecting
+		 * data for an event.
+		 */
+		// }}}2 DXG DOC
+		bool isEnabled() const
+		{
+			return (this->fd != -1);
+		}
+		void requestReopen();
+		void setSession(const struct sockaddr_in &_src, const struct sockaddr_in &_dst);
+		void setSessionSyn(const SynFingerprint &_syn, const char *_os = NULL);
+		void setScript(const char *_script, int _state);
+		void log(const LogEvent &_event);
+	private:
+		int fd;						///< descriptor of the event log, -1 if disabled
+		std::string fileName;		///< file to write events to
+		volatile sig_atomic_t reopenRequested;	///< set by requestReopen()
+		char *buf;					///< line buffer, reused for every event
+		size_t bufSize;				///< allocated size of buf
+		size_t bufLen;				///< used length of buf
+		struct sockaddr_in sessionSrc;	///< default source of events
+		struct sockaddr_in sessionDst;	///< default destination of events
+		SynFingerprint sessionSyn;	///< SYN of the session
+		bool hasSessionSyn;			///< flag, if sessionSyn is known
+		std::string sessionOs;		///< operating system of the client, empty if unknown
+		std::string sessionScript;	///< default script of events
+		int sessionState;			///< default script state of events
+		void reserve(size_t _len);
+		void put(const char *_str, size_t _len);
+		void putKey(const char *_key);
+		void putString(const char *_str, size_t _len);
+		void putString(const char *_str);
+		void putNumber(unsigned long _num);
+		void putIp(in_addr_t _ip);
+		EventLog(const EventLog &rhs);
+		EventLog &operator=(const EventLog &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+
+extern Deception::EventLog globEvents;
+
+#endif // _EVENTLOG_H
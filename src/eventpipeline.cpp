@@ -0,0 +1,234 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file eventpipeline.cpp
+ *
+ * Contains the implementation of the event pipeline
+ */
+#include "eventpipeline.h"
+#include "eventlog.h"
+#include "metrics.h"
+
+#include <new>
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+std::string Deception::EventPipeline::className = "EventPipeline";
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _capacity Number of events the pipeline can hold, rounded up
+ * to a power of 2
+ */
+// }}}1 DXG DOC
+Deception::EventPipeline::EventPipeline(size_t _capacity) :
+	head(0),
+	tail(0),
+	dropped(0)
+{ // {{{1
+	this->depthMetric = globMetrics.addGauge("deceptiond_pipeline_depth",
+			"events waiting in the pipeline when it was last drained");
+	this->droppedMetric = globMetrics.addCounter("deceptiond_pipeline_dropped_total",
+			"events dropped, the pipeline was full");
+	size_t size = 2;
+	while (size < _capacity) {
+		size <<= 1;
+	}
+	this->mask = size - 1;
+	this->slots = new Slot[size];
+	for (size_t i = 0; i < size; i++) {
+		this->slots[i].sequence = i;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor, events that have not been drained are lost
+ */
+// }}}1 DXG DOC
+Deception::EventPipeline::~EventPipeline()
+{ // {{{1
+	delete[] this->slots;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Add an event, may be called from any thread
+ *
+ * \param _event The event, it is copied
+ *
+ * \retval true If the event has been queued
+ * \retval false If the pipeline is full and the event has been dropped
+ */
+// }}}1 DXG DOC
+bool Deception::EventPipeline::push(const PipelineEvent &_event)
+{ // {{{1
+	size_t pos = this->head;
+	Slot *slot;
+	for (;;) {
+		slot = &this->slots[pos & this->mask];
+		size_t sequence = slot->sequence;
+		__sync_synchronize();
+		long diff = static_cast<long>(sequence - pos);
+		if (diff == 0) {
+			// the slot is free, try to claim it
+			if (__sync_bool_compare_and_swap(&this->head, pos, pos + 1)) {
+				break;
+			}
+			pos = this->head;
+		} else if (diff < 0) {
+			// the consumer has not drained this slot yet, we're full
+			__sync_fetch_and_add(&this->dropped, 1);
+			return false;
+		} else {
+			// another producer was faster
+			pos = this->head;
+		}
+	}
+	slot->event = _event;
+	// the event has to be visible before the slot is published
+	__sync_synchronize();
+	slot->sequence = pos + 1;
+	return true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write all queued events, must only be called by one thread
+ *
+ * \return Number of events written
+ */
+// }}}1 DXG DOC
+size_t Deception::EventPipeline::drain()
+{ // {{{1
+	size_t count = 0;
+	for (;;) {
+		Slot *slot = &this->slots[this->tail & this->mask];
+		size_t sequence = slot->sequence;
+		__sync_synchronize();
+		if (sequence != this->tail + 1) {
+			// empty, or the producer has not finished copying yet
+			break;
+		}
+		emit(slot->event);
+		__sync_synchronize();
+		// free the slot for the producer one round later
+		slot->sequence = this->tail + this->mask + 1;
+		this->tail++;
+		count++;
+	}
+	globMetrics.set(this->depthMetric, count);
+	unsigned long lost = __sync_fetch_and_and(&this->dropped, 0);
+	if (lost > 0) {
+		globMetrics.add(this->droppedMetric, lost);
+		LOGMSG(className, Error, "dropped " << lost << " events, pipeline full");
+	}
+	return count;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write an event to the text log and the event log right away
+ *
+ * \param _event The event
+ */
+// }}}1 DXG DOC
+void Deception::EventPipeline::emit(const PipelineEvent &_event)
+{ // {{{1
+	if (globEvents.isEnabled()) {
+		LogEvent event(_event.module, _event.level, _event.event);
+		event.srcIp = _event.srcIp;
+		event.srcPort = _event.srcPort;
+		event.dstIp = _event.dstIp;
+		event.dstPort = _event.dstPort;
+		event.count = _event.count;
+		event.scanType = _event.scanType;
+		event.ports = _event.ports;
+		event.hosts = _event.hosts;
+		event.rate = _event.rate;
+		event.os = _event.os;
+		if (_event.payloadLen > 0) {
+			event.payload = _event.payload;
+			event.payloadLen = _event.payloadLen;
+		}
+		globEvents.log(event);
+	}
+	// skip formatting altogether if nobody reads it
+	if (!globLog.isEnabled(_event.level)) {
+		return;
+	}
+	char srcIp[INET_ADDRSTRLEN], dstIp[INET_ADDRSTRLEN];
+	char line[224];
+	::inet_ntop(AF_INET, &_event.srcIp, srcIp, sizeof(srcIp));
+	::inet_ntop(AF_INET, &_event.dstIp, dstIp, sizeof(dstIp));
+	switch (_event.kind) {
+		case PipelineEvent::Summary:
+			if (_event.dstPort == 0) {
+				// icmp has no ports
+				::snprintf(line, sizeof(line), "%lu times %s from %s to %s within %ld sec.",
+						_event.count, _event.text, srcIp, dstIp, static_cast<long>(_event.window));
+				break;
+			}
+			::snprintf(line, sizeof(line), "%lu times %s from %s to %s:%u within %ld sec.",
+					_event.count, _event.text, srcIp, dstIp, ntohs(_event.dstPort),
+					static_cast<long>(_event.window));
+			break;
+		case PipelineEvent::Suppressed:
+			::snprintf(line, sizeof(line), "suppressed %lu events from %s within %ld sec.",
+					_event.count, srcIp, static_cast<long>(_event.window));
+			break;
+		case PipelineEvent::Scan:
+			::snprintf(line, sizeof(line), "%s scan from %s: %lu ports on %lu hosts, %lu packets/s",
+					_event.scanType, srcIp, _event.ports, _event.hosts, _event.rate);
+			break;
+		case PipelineEvent::Message:
+			if (_event.count > 1) {
+				::snprintf(line, sizeof(line), "%s (%lu times)", _event.text, _event.count);
+			} else {
+				::snprintf(line, sizeof(line), "%s", _event.text);
+			}
+			break;
+		default:
+			if (_event.dstPort == 0) {
+				::snprintf(line, sizeof(line), "%s from %s to %s", _event.text, srcIp, dstIp);
+				break;
+			}
+			::snprintf(line, sizeof(line), "%s from %s:%u to %s:%u", _event.text,
+					srcIp, ntohs(_event.srcPort), dstIp, ntohs(_event.dstPort));
+			break;
+	}
+	if (_event.os != NULL) {
+		size_t len = ::strlen(line);
+		::snprintf(line + len, sizeof(line) - len, " (%s)", _event.os);
+	}
+	std::string module = (_event.module != NULL) ? _event.module : "";
+	globLog.toLog(module, _event.level, line);
+} // }}}1
@@ -0,0 +1,174 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _EVENTPIPELINE_H
+#define _EVENTPIPELINE_H
+
+/**
+ * \file eventpipeline.h
+ *
+ * Declares the event pipeline, which lets several threads hand their
+ * events to a single thread that writes the logs.
+ */
+
+// Project Headers
+#include "defs.h"
+#include "logging.h"
+
+// C Headers
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+/// bytes of a payload an event carries
+#define PIPELINE_PAYLOAD_LEN	64
+
+// {{{1 DXG DOC
+/**
+ * \struct PipelineEvent
+ *
+ * An event with everything needed to write it to the text log and the
+ * event log later on. It is copied by value, so all strings have to be
+ * static or live as long as the pipeline, but the first bytes of a
+ * payload are copied along. Addresses and ports are in network byte
+ * order.
+ */
+// }}}1 DXG DOC
+struct PipelineEvent
+{
+	/// what the event stands for
+	enum Kind {
+		Single,						///< one occurrence
+		Summary,					///< count occurrences of a tuple within window
+		Suppressed,					///< count events of a source not logged within window
+		Scan,						///< a scan from srcIp, see ScanDetector
+		Message						///< text without endpoints, count times
+	};
+
+	Kind kind;						///< what the event stands for
+	const char *module;				///< name of the module
+	enum logLevels level;			///< log level
+	const char *event;				///< short event name, e.g. "syn"
+	const char *text;				///< description for the text log, e.g. "connection request"
+	in_addr_t srcIp;				///< source address
+	in_port_t srcPort;				///< source port
+	in_addr_t dstIp;				///< destination address
+	in_port_t dstPort;				///< destination port
+	unsigned long count;			///< number of occurrences
+	time_t window;					///< aggregation window of summaries in seconds
+	const char *scanType;			///< type of a scan, e.g. "vertical"
+	unsigned long ports;			///< distinct destination ports of a scan
+	unsigned long hosts;			///< distinct destination hosts of a scan
+	unsigned long rate;				///< packets per second of a scan
+	const char *os;					///< operating system of the source, NULL if unknown
+	size_t payloadLen;				///< bytes used in payload
+	char payload[PIPELINE_PAYLOAD_LEN];	///< first bytes sent by the source
+
+	// {{{2 DXG DOC
+	/**
+	 * Constructor for a single event with unknown endpoints
+	 */
+	// }}}2 DXG DOC
+	PipelineEvent(const char *_module = NULL, enum logLevels _level = Info,
+			const char *_event = NULL) :
+		kind(Single),
+		module(_module),
+		level(_level),
+		event(_event),
+		text(_event),
+		srcIp(0),
+		srcPort(0),
+		dstIp(0),
+		dstPort(0),
+		count(1),
+		window(0),
+		scanType(NULL),
+		ports(0),
+		hosts(0),
+		rate(0),
+		os(NULL),
+		payloadLen(0)
+	{ }
+};
+
+// {{{1 DXG DOC
+/**
+ * \class EventPipeline
+ *
+ * A bounded queue of PipelineEvent records with any number of
+ * producers and a single consumer. Producers, e.g. capture threads,
+ * push() events without taking a lock or allocating memory; the
+ * consumer drain()s them and writes them with emit(), so the logs are
+ * only ever written by one thread.
+ *
+ * The queue is a ring of slots with sequence numbers. A producer claims
+ * a slot by advancing the head with compare-and-swap, copies the event
+ * and publishes it by setting the sequence number. If the ring is full,
+ * the event is dropped and counted instead of blocking the producer;
+ * the number of dropped events is logged by the next drain().
+ */
+// }}}1 DXG DOC
+class EventPipeline
+{ // {{{1
+	public:
+		EventPipeline(size_t _capacity = 4096);
+		~EventPipeline();
+		bool push(const PipelineEvent &_event);
+		size_t drain();
+		static void emit(const PipelineEvent &_event);
+	private:
+		// {{{2 DXG DOC
+		/**
+		 * A slot of the ring. It is free for the producer at position
+		 * pos, if sequence == pos, and holds an event for the consumer,
+		 * if sequence == pos + 1.
+		 */
+		// }}}2 DXG DOC
+		struct Slot
+		{
+			volatile size_t sequence;	///< position the slot is ready for
+			PipelineEvent event;		///< the event
+		};
+
+		static std::string className;	///< name for logging
+		Slot *slots;					///< the ring
+		size_t mask;					///< number of slots - 1, a power of 2 - 1
+		volatile size_t head;			///< next position to push to
+		size_t tail;					///< next position to drain, consumer only
+		volatile unsigned long dropped;	///< events dropped since the last drain()
+		int depthMetric;				///< id of the gauge of the events drained at once
+		int droppedMetric;				///< id of the counter of dropped events
+
+		// hidden
+		EventPipeline(const EventPipeline &rhs);
+		EventPipeline &operator=(const EventPipeline &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _EVENTPIPELINE_H
@@ -0,0 +1,879 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file evidence.cpp
+ *
+ * Contains the implementation of the evidence recorder and its writer
+ */
+#include "evidence.h"
+#include "eventpipeline.h"
+#include "flowtable.h"
+#include "ioexception.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// pcap-ng block types
+#define PCAPNG_SECTION_HEADER		0x0a0d0d0a
+#define PCAPNG_INTERFACE			0x00000001
+#define PCAPNG_ENHANCED_PACKET		0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC		0x1a2b3c4d
+// fixed part of an enhanced packet block, without data and trailer
+#define PCAPNG_EPB_HEADER_LEN		28
+// DLT_RAW differs between platforms, the files use the portable value
+#define PCAPNG_LINKTYPE_RAW			101
+
+/// prefix and suffix of the evidence files
+static const char filePrefix[] = "evidence-";
+static const char fileSuffix[] = ".pcapng";
+
+u_int32_t Deception::EvidenceRecorder::stateMask = 0;
+Deception::FlowTable* Deception::EvidenceRecorder::sessionFlows = NULL;
+struct sockaddr_in Deception::EvidenceRecorder::sessionClient;
+struct sockaddr_in Deception::EvidenceRecorder::sessionLocal;
+
+// {{{1 DXG DOC
+/**
+ * Constructor, nothing is written until start() is called
+ *
+ * \param _config Directory, rotation and size of the files
+ * \param _pipeline Pipeline to report errors to, may be NULL
+ */
+// }}}1 DXG DOC
+Deception::EvidenceWriter::EvidenceWriter(const EvidenceConfig &_config, EventPipeline *_pipeline) :
+	config(_config),
+	pipeline(_pipeline),
+	linkType(0),
+	snaplen(0),
+	running(false),
+	started(false),
+	freeCount(0),
+	fullHead(0),
+	fullCount(0),
+	current(-1),
+	dropped(0),
+	fd(-1),
+	opened(0),
+	sequence(0),
+	totalSize(0)
+{ // {{{1
+	::pthread_mutex_init(&this->lock, NULL);
+	::pthread_cond_init(&this->wakeup, NULL);
+	for (int i = 0; i < bufferCount; i++) {
+		this->buffers[i] = NULL;
+		this->lengths[i] = 0;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor, writes what is left and releases the buffers
+ */
+// }}}1 DXG DOC
+Deception::EvidenceWriter::~EvidenceWriter()
+{ // {{{1
+	this->stop();
+	for (int i = 0; i < bufferCount; i++) {
+		::free(this->buffers[i]);
+	}
+	::pthread_cond_destroy(&this->wakeup);
+	::pthread_mutex_destroy(&this->lock);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Allocate the buffers and start the writer thread
+ *
+ * \param _linkType Link layer type of the packets from pcap_datalink()
+ * \param _snaplen Maximum length of the packets
+ *
+ * \exception IOException Directory is not writable or thread could not
+ * be started
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::start(int _linkType, int _snaplen)
+{ // {{{1
+	if (::access(this->config.dir.c_str(), W_OK) == -1) {
+		throw IOException(errno);
+	}
+	this->linkType = _linkType;
+#ifdef DLT_RAW
+	if (this->linkType == DLT_RAW) {
+		this->linkType = PCAPNG_LINKTYPE_RAW;
+	}
+#endif
+	this->snaplen = _snaplen;
+	for (int i = 0; i < bufferCount; i++) {
+		if ((this->buffers[i] == NULL)
+				&& (::posix_memalign(reinterpret_cast<void**>(&this->buffers[i]), 4096, bufferSize) != 0)) {
+			this->buffers[i] = NULL;
+			throw std::bad_alloc();
+		}
+		this->freeList[i] = i;
+	}
+	this->freeCount = bufferCount;
+	this->scanDir();
+	this->removeOldFiles();
+
+	this->running = true;
+	if (::pthread_create(&this->thread, NULL, threadMain, this) != 0) {
+		this->running = false;
+		throw IOException("could not start evidence writer");
+	}
+	this->started = true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write what is left and stop the writer thread
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::stop()
+{ // {{{1
+	if (!this->started) {
+		return;
+	}
+	::pthread_mutex_lock(&this->lock);
+	this->running = false;
+	::pthread_cond_signal(&this->wakeup);
+	::pthread_mutex_unlock(&this->lock);
+	::pthread_join(this->thread, NULL);
+	this->started = false;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get an empty buffer, lock must be held
+ *
+ * \return Index of the buffer, -1 if there is none
+ */
+// }}}1 DXG DOC
+int Deception::EvidenceWriter::takeBuffer()
+{ // {{{1
+	return (this->freeCount > 0) ? this->freeList[--this->freeCount] : -1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Queue a packet to be written. Called by the capture threads, it
+ * copies the packet into the current buffer and never waits for the
+ * disk.
+ *
+ * \param _header Header of the packet
+ * \param _data Captured data
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::write(const struct pcap_pkthdr *_header, const u_char *_data)
+{ // {{{1
+	u_int32_t padded = (_header->caplen + 3) & ~3U;
+	u_int32_t blockLen = PCAPNG_EPB_HEADER_LEN + padded + 4;
+	if (blockLen > bufferSize) {
+		return;
+	}
+	::pthread_mutex_lock(&this->lock);
+	if ((this->current != -1) && (this->lengths[this->current] + blockLen > bufferSize)) {
+		this->fullQueue[(this->fullHead + this->fullCount) % bufferCount] = this->current;
+		this->fullCount++;
+		this->current = -1;
+		::pthread_cond_signal(&this->wakeup);
+	}
+	if ((this->current == -1) && ((this->current = this->takeBuffer()) == -1)) {
+		this->dropped++;
+		::pthread_mutex_unlock(&this->lock);
+		return;
+	}
+	char *out = this->buffers[this->current] + this->lengths[this->current];
+	u_int64_t ts = static_cast<u_int64_t>(_header->ts.tv_sec) * 1000000 + _header->ts.tv_usec;
+	u_int32_t block[7];
+	block[0] = PCAPNG_ENHANCED_PACKET;
+	block[1] = blockLen;
+	block[2] = 0;	// interface
+	block[3] = static_cast<u_int32_t>(ts >> 32);
+	block[4] = static_cast<u_int32_t>(ts);
+	block[5] = _header->caplen;
+	block[6] = _header->len;
+	::memcpy(out, block, sizeof(block));
+	::memcpy(out + PCAPNG_EPB_HEADER_LEN, _data, _header->caplen);
+	::memset(out + PCAPNG_EPB_HEADER_LEN + _header->caplen, 0, padded - _header->caplen);
+	::memcpy(out + PCAPNG_EPB_HEADER_LEN + padded, &blockLen, sizeof(blockLen));
+	this->lengths[this->current] += blockLen;
+	::pthread_mutex_unlock(&this->lock);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Main function of the writer thread
+ */
+// }}}1 DXG DOC
+void* Deception::EvidenceWriter::threadMain(void *_writer)
+{ // {{{1
+	// signals are handled by the main thread
+	sigset_t allSignals;
+	sigfillset(&allSignals);
+	::pthread_sigmask(SIG_BLOCK, &allSignals, NULL);
+	static_cast<EvidenceWriter*>(_writer)->run();
+	return NULL;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write full buffers as they come and the current one once a second,
+ * until stop() is called and everything is written
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::run()
+{ // {{{1
+	int batch[bufferCount];
+	::pthread_mutex_lock(&this->lock);
+	for (;;) {
+		if (this->running && (this->fullCount == 0)) {
+			struct timespec deadline;
+			::clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec++;
+			::pthread_cond_timedwait(&this->wakeup, &this->lock, &deadline);
+		}
+		// what has been collected within the last second
+		if ((this->fullCount == 0) && (this->current != -1) && (this->lengths[this->current] > 0)) {
+			this->fullQueue[this->fullHead] = this->current;
+			this->fullCount = 1;
+			this->current = -1;
+		}
+		bool stopping = !this->running;
+		unsigned long lost = this->dropped;
+		this->dropped = 0;
+		int count = 0;
+		while (this->fullCount > 0) {
+			batch[count++] = this->fullQueue[this->fullHead];
+			this->fullHead = (this->fullHead + 1) % bufferCount;
+			this->fullCount--;
+		}
+		::pthread_mutex_unlock(&this->lock);
+
+		for (int i = 0; i < count; i++) {
+			this->writeBuffer(batch[i]);
+		}
+		if (lost > 0) {
+			this->report("evidence packets dropped, all buffers full", lost);
+		}
+
+		::pthread_mutex_lock(&this->lock);
+		for (int i = 0; i < count; i++) {
+			this->lengths[batch[i]] = 0;
+			this->freeList[this->freeCount++] = batch[i];
+		}
+		if (stopping && (this->fullCount == 0)
+				&& ((this->current == -1) || (this->lengths[this->current] == 0))) {
+			break;
+		}
+	}
+	::pthread_mutex_unlock(&this->lock);
+	this->closeFile();
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write a buffer to the current file, rotating it first if it is too
+ * large or too old
+ *
+ * \param _buffer Index of the buffer
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::writeBuffer(int _buffer)
+{ // {{{1
+	time_t now = ::time(NULL);
+	if ((this->fd != -1) && ((this->files.back().second >= this->config.maxSize)
+				|| (now - this->opened >= this->config.interval))) {
+		this->closeFile();
+	}
+	if ((this->fd == -1) && !this->openFile(now)) {
+		this->report("could not open evidence file", 1);
+		return;
+	}
+	const char *ptr = this->buffers[_buffer];
+	size_t left = this->lengths[_buffer];
+	while (left > 0) {
+		ssize_t n = ::write(this->fd, ptr, left);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			this->report("could not write evidence file", 1);
+			this->closeFile();
+			break;
+		}
+		ptr += n;
+		left -= n;
+		this->files.back().second += n;
+		this->totalSize += n;
+	}
+	this->removeOldFiles();
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Open a new file and write the section header and interface blocks
+ *
+ * \param _now Current time, part of the name
+ * \retval true If the file has been opened
+ * \retval false Otherwise
+ */
+// }}}1 DXG DOC
+bool Deception::EvidenceWriter::openFile(time_t _now)
+{ // {{{1
+	struct tm local;
+	char stamp[32];
+	::localtime_r(&_now, &local);
+	::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+	char name[64];
+	::snprintf(name, sizeof(name), "%s%s-%u%s", filePrefix, stamp, this->sequence++, fileSuffix);
+	std::string fileName = this->config.dir + "/" + name;
+
+	this->fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (this->fd == -1) {
+		return false;
+	}
+	::fcntl(this->fd, F_SETFD, FD_CLOEXEC);
+	u_int32_t header[12];
+	// version and link type are pairs of 16 bit fields
+	u_int16_t version[2] = { 1, 0 };
+	u_int16_t link[2] = { static_cast<u_int16_t>(this->linkType), 0 };
+	// section header block, the length of the section is unknown
+	header[0] = PCAPNG_SECTION_HEADER;
+	header[1] = 28;
+	header[2] = PCAPNG_BYTE_ORDER_MAGIC;
+	::memcpy(&header[3], version, sizeof(version));
+	header[4] = 0xffffffff;
+	header[5] = 0xffffffff;
+	header[6] = 28;
+	// interface description block without options, so timestamps are
+	// in microseconds
+	header[7] = PCAPNG_INTERFACE;
+	header[8] = 20;
+	::memcpy(&header[9], link, sizeof(link));
+	header[10] = this->snaplen;
+	header[11] = 20;
+	if (::write(this->fd, header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+		::close(this->fd);
+		this->fd = -1;
+		::unlink(fileName.c_str());
+		return false;
+	}
+	this->opened = _now;
+	this->files.push_back(std::make_pair(fileName, static_cast<off_t>(sizeof(header))));
+	this->totalSize += sizeof(header);
+	return true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Close the current file
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::closeFile()
+{ // {{{1
+	if (this->fd != -1) {
+		::close(this->fd);
+		this->fd = -1;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Remove the oldest files until all of them fit into the total size.
+ * The current file is never removed.
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::removeOldFiles()
+{ // {{{1
+	size_t keep = (this->fd != -1) ? 1 : 0;
+	while ((this->totalSize > this->config.total) && (this->files.size() > keep)) {
+		::unlink(this->files.front().first.c_str());
+		this->totalSize -= this->files.front().second;
+		this->files.pop_front();
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Account the files of earlier runs, the names sort by age
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::scanDir()
+{ // {{{1
+	DIR *dir = ::opendir(this->config.dir.c_str());
+	if (dir == NULL) {
+		return;
+	}
+	std::vector<std::pair<std::string, off_t> > found;
+	struct dirent *entry;
+	while ((entry = ::readdir(dir)) != NULL) {
+		std::string name = entry->d_name;
+		if ((name.compare(0, sizeof(filePrefix) - 1, filePrefix) != 0)
+				|| (name.length() < sizeof(fileSuffix) - 1)
+				|| (name.compare(name.length() - (sizeof(fileSuffix) - 1), std::string::npos, fileSuffix) != 0)) {
+			continue;
+		}
+		std::string fileName = this->config.dir + "/" + name;
+		struct stat info;
+		if (::stat(fileName.c_str(), &info) == 0) {
+			found.push_back(std::make_pair(fileName, info.st_size));
+		}
+	}
+	::closedir(dir);
+	std::sort(found.begin(), found.end());
+	this->files.assign(found.begin(), found.end());
+	this->totalSize = 0;
+	for (size_t i = 0; i < found.size(); i++) {
+		this->totalSize += found[i].second;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Report an error through the pipeline
+ *
+ * \param _text Description, must be static
+ * \param _count Number of occurrences
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceWriter::report(const char *_text, unsigned long _count)
+{ // {{{1
+	if (this->pipeline == NULL) {
+		return;
+	}
+	PipelineEvent event("evidence", Error, "evidence");
+	event.kind = PipelineEvent::Message;
+	event.text = _text;
+	event.count = _count;
+	this->pipeline->push(event);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ */
+// }}}1 DXG DOC
+Deception::SourceMarks::SourceMarks() :
+	seq(0),
+	count(0)
+{ // {{{1
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Mark a client. If too many clients are marked, the mark ending first
+ * is replaced. May be called by any thread.
+ *
+ * \param _client Address of the client in network byte order
+ * \param _until End of the mark
+ */
+// }}}1 DXG DOC
+void Deception::SourceMarks::mark(in_addr_t _client, time_t _until)
+{ // {{{1
+	// writers take turns by making the sequence number odd
+	u_int32_t seq;
+	do {
+		seq = this->seq;
+	} while ((seq & 1) || !__sync_bool_compare_and_swap(&this->seq, seq, seq + 1));
+	Mark *victim = NULL;
+	for (size_t i = 0; i < this->count; i++) {
+		if (this->marks[i].client == _client) {
+			victim = &this->marks[i];
+			break;
+		}
+		if ((victim == NULL) || (this->marks[i].until < victim->until)) {
+			victim = &this->marks[i];
+		}
+	}
+	if ((victim == NULL) || ((victim->client != _client) && (this->count < slots))) {
+		victim = &this->marks[this->count++];
+	}
+	victim->client = _client;
+	victim->until = _until;
+	__sync_synchronize();
+	this->seq = seq + 2;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Copy the marks, retrying while a mark is written
+ *
+ * \param _marks Array of at least slots marks to copy to
+ * \param _version Is set to the version copied
+ *
+ * \return Number of marks copied
+ */
+// }}}1 DXG DOC
+size_t Deception::SourceMarks::copy(Mark *_marks, u_int32_t &_version) const
+{ // {{{1
+	u_int32_t seq;
+	size_t count;
+	do {
+		seq = this->seq;
+		__sync_synchronize();
+		count = this->count;
+		for (size_t i = 0; i < count; i++) {
+			_marks[i] = this->marks[i];
+		}
+		__sync_synchronize();
+	} while ((seq & 1) || (seq != this->seq));
+	_version = seq;
+	return count;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _writer Writer of the interesting packets
+ * \param _flows Number of flows to keep track of, rounded up to a power
+ * of 2
+ * \param _packets Number of packets kept per flow
+ * \param _snaplen Bytes kept of a packet
+ *
+ * \exception std::bad_alloc Rings could not be allocated
+ */
+// }}}1 DXG DOC
+Deception::EvidenceRecorder::EvidenceRecorder(EvidenceWriter &_writer, size_t _flows, size_t _packets,
+		size_t _snaplen) :
+	writer(_writer),
+	flowTable(NULL),
+	ringSize((_packets > 0) ? _packets : 1),
+	snaplen(_snaplen),
+	sourceCount(0),
+	marksVersion(0)
+{ // {{{1
+	this->marks = &this->ownMarks;
+	size_t size = ways;
+	while (size < _flows) {
+		size <<= 1;
+	}
+	this->mask = size - 1;
+	// the header at the start of a slot has to be aligned
+	this->slotSize = (sizeof(struct pcap_pkthdr) + _snaplen + 7) & ~static_cast<size_t>(7);
+	this->flows = static_cast<Flow*>(::calloc(size, sizeof(Flow)));
+	this->packets = static_cast<u_char*>(::malloc(size * this->ringSize * this->slotSize));
+	if ((this->flows == NULL) || (this->packets == NULL)) {
+		::free(this->flows);
+		::free(this->packets);
+		throw std::bad_alloc();
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor
+ */
+// }}}1 DXG DOC
+Deception::EvidenceRecorder::~EvidenceRecorder()
+{ // {{{1
+	::free(this->flows);
+	::free(this->packets);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the table the sessions mark their connections in
+ *
+ * \param _flows The table, NULL if there is none
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::setFlowTable(const FlowTable *_flows)
+{ // {{{1
+	this->flowTable = _flows;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Mix addresses and ports of a flow, the low bits are used as index
+ */
+// }}}1 DXG DOC
+u_int32_t Deception::EvidenceRecorder::hash(in_addr_t _client, in_port_t _clientPort, in_addr_t _server,
+		in_port_t _serverPort)
+{ // {{{1
+	u_int32_t value = _client ^ (_server * 0x9e3779b1U)
+		^ ((static_cast<u_int32_t>(_clientPort) << 16) | _serverPort);
+	value ^= value >> 16;
+	value *= 0x85ebca6bU;
+	value ^= value >> 13;
+	value *= 0xc2b2ae35U;
+	value ^= value >> 16;
+	return value;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Find a flow. A new one replaces a free slot or the flow seen least
+ * recently in its set.
+ *
+ * \param _create Flag, if the flow is set up if it is not found
+ * \return The flow, NULL if it is not found and _create is false
+ */
+// }}}1 DXG DOC
+Deception::EvidenceRecorder::Flow* Deception::EvidenceRecorder::find(in_addr_t _client, in_port_t _clientPort,
+		in_addr_t _server, in_port_t _serverPort, time_t _now, bool _create)
+{ // {{{1
+	Flow *set = this->flows + (hash(_client, _clientPort, _server, _serverPort) & this->mask & ~(ways - 1));
+	Flow *victim = NULL;
+	for (size_t i = 0; i < ways; i++) {
+		Flow *flow = set + i;
+		if (flow->used && (flow->client == _client) && (flow->clientPort == _clientPort)
+				&& (flow->server == _server) && (flow->serverPort == _serverPort)) {
+			return flow;
+		}
+		if ((victim == NULL) || (victim->used && (!flow->used || (flow->last < victim->last)))) {
+			victim = flow;
+		}
+	}
+	if (!_create) {
+		return NULL;
+	}
+	::memset(victim, 0, sizeof(*victim));
+	victim->used = true;
+	victim->client = _client;
+	victim->clientPort = _clientPort;
+	victim->server = _server;
+	victim->serverPort = _serverPort;
+	victim->last = _now;
+	return victim;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Keep a packet of a flow. If the flow is interesting, its packets are
+ * handed to the writer.
+ *
+ * \param _header Header of the packet
+ * \param _data Captured data
+ * \param _client Address of the client in network byte order
+ * \param _clientPort Port of the client in network byte order
+ * \param _server Address of the server in network byte order
+ * \param _serverPort Port of the server in network byte order
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::record(const struct pcap_pkthdr *_header, const u_char *_data,
+		in_addr_t _client, in_port_t _clientPort, in_addr_t _server, in_port_t _serverPort)
+{ // {{{1
+	time_t now = _header->ts.tv_sec;
+	Flow *flow = this->find(_client, _clientPort, _server, _serverPort, now, true);
+	flow->last = now;
+	if (flow->streaming) {
+		this->writer.write(_header, _data);
+		return;
+	}
+	u_char *slot = this->packets + ((flow - this->flows) * this->ringSize + flow->head) * this->slotSize;
+	struct pcap_pkthdr *stored = reinterpret_cast<struct pcap_pkthdr*>(slot);
+	*stored = *_header;
+	if (stored->caplen > this->snaplen) {
+		stored->caplen = this->snaplen;
+	}
+	::memcpy(slot + sizeof(struct pcap_pkthdr), _data, stored->caplen);
+	flow->head = (flow->head + 1) % this->ringSize;
+	if (flow->count < this->ringSize) {
+		flow->count++;
+	}
+
+	bool marked = this->isSourceMarked(_client, now);
+	// sessions are asked once a second
+	if (!marked && (this->flowTable != NULL) && (flow->checked != now)) {
+		flow->checked = now;
+		marked = this->flowTable->isMarked(_client, _clientPort, _server, _serverPort);
+	}
+	if (marked) {
+		this->flush(flow);
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Hand the ring of a flow to the writer, its following packets are
+ * written right away
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::flush(Flow *_flow)
+{ // {{{1
+	size_t ring = (_flow - this->flows) * this->ringSize;
+	unsigned int index = (_flow->head + this->ringSize - _flow->count) % this->ringSize;
+	for (unsigned int i = 0; i < _flow->count; i++) {
+		const u_char *slot = this->packets + (ring + index) * this->slotSize;
+		this->writer.write(reinterpret_cast<const struct pcap_pkthdr*>(slot), slot + sizeof(struct pcap_pkthdr));
+		index = (index + 1) % this->ringSize;
+	}
+	_flow->count = 0;
+	_flow->streaming = true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Mark a flow as interesting
+ *
+ * \param _client Address of the client in network byte order
+ * \param _clientPort Port of the client in network byte order
+ * \param _server Address of the server in network byte order
+ * \param _serverPort Port of the server in network byte order
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::markFlow(in_addr_t _client, in_port_t _clientPort, in_addr_t _server,
+		in_port_t _serverPort)
+{ // {{{1
+	Flow *flow = this->find(_client, _clientPort, _server, _serverPort, 0, false);
+	if ((flow != NULL) && !flow->streaming) {
+		this->flush(flow);
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Mark all flows of a client as interesting for a while, in the
+ * recorders of all threads sharing the marks
+ *
+ * \param _client Address of the client in network byte order
+ * \param _until End of the mark
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::markSource(in_addr_t _client, time_t _until)
+{ // {{{1
+	this->marks->mark(_client, _until);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Share the marks of markSource() with other recorders
+ *
+ * \param _marks Marks of all recorders, has to live as long as this one
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::setSourceMarks(SourceMarks *_marks)
+{ // {{{1
+	this->marks = _marks;
+	this->sourceCount = this->marks->copy(this->sources, this->marksVersion);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check if a client is marked, expired marks are removed from the copy
+ */
+// }}}1 DXG DOC
+bool Deception::EvidenceRecorder::isSourceMarked(in_addr_t _client, time_t _now)
+{ // {{{1
+	if (this->marks->version() != this->marksVersion) {
+		this->sourceCount = this->marks->copy(this->sources, this->marksVersion);
+	}
+	for (size_t i = 0; i < this->sourceCount; ) {
+		if (this->sources[i].until < _now) {
+			this->sources[i] = this->sources[--this->sourceCount];
+			continue;
+		}
+		if (this->sources[i].client == _client) {
+			return true;
+		}
+		i++;
+	}
+	return false;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the dtk-script states that make a session interesting
+ *
+ * \param _states Comma separated list of state numbers, e.g. "2,3"
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::configureStates(const std::string &_states)
+{ // {{{1
+	stateMask = 0;
+	std::string::size_type begin = 0;
+	while (begin < _states.length()) {
+		std::string::size_type end = _states.find(',', begin);
+		if (end == std::string::npos) {
+			end = _states.length();
+		}
+		int state = ::atoi(_states.substr(begin, end - begin).c_str());
+		if ((state >= 0) && (state < 32)) {
+			stateMask |= 1U << state;
+		}
+		begin = end + 1;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the connection of the session handled by this process
+ *
+ * \param _flows Table to mark the connection in, NULL if there is none
+ * \param _client Address of the client
+ * \param _local Address the client connected to
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::setSession(FlowTable *_flows, const struct sockaddr_in &_client,
+		const struct sockaddr_in &_local)
+{ // {{{1
+	sessionFlows = _flows;
+	sessionClient = _client;
+	sessionLocal = _local;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Mark the session handled by this process as interesting, the capture
+ * engine writes its packets to the evidence files
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::markSession()
+{ // {{{1
+	if (sessionFlows != NULL) {
+		sessionFlows->mark(sessionClient.sin_addr.s_addr, sessionClient.sin_port,
+				sessionLocal.sin_addr.s_addr, sessionLocal.sin_port, ::time(NULL));
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Tell that the session handled by this process has reached a
+ * dtk-script state, it is marked if the state is one of those set with
+ * configureStates()
+ *
+ * \param _state Number of the state
+ */
+// }}}1 DXG DOC
+void Deception::EvidenceRecorder::stateReached(int _state)
+{ // {{{1
+	if ((_state >= 0) && (_state < 32) && (stateMask & (1U << _state))) {
+		markSession();
+	}
+} // }}}1
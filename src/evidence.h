@@ -0,0 +1,306 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _EVIDENCE_H
+#define _EVIDENCE_H
+
+/**
+ * \file evidence.h
+ *
+ * Declares the recorder that keeps the packets of interesting flows in
+ * pcap-ng files.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C++ Headers
+#include <string>
+#include <deque>
+#include <utility>
+
+// C Headers
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <pcap.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+class EventPipeline;
+class FlowTable;
+
+// {{{1 DXG DOC
+/**
+ * \struct EvidenceConfig
+ *
+ * Settings of the evidence files, see EvidenceWriter and
+ * EvidenceRecorder
+ */
+// }}}1 DXG DOC
+struct EvidenceConfig
+{
+	std::string dir;			///< directory of the files, no evidence is kept if empty
+	int flows;					///< flows whose last packets are kept in memory
+	int packets;				///< packets kept per flow
+	off_t maxSize;				///< size of a file in bytes before it is rotated
+	time_t interval;			///< seconds before a file is rotated
+	off_t total;				///< size of all files in bytes, the oldest are removed
+
+	EvidenceConfig() :
+		flows(1024),
+		packets(16),
+		maxSize(64 * 1024 * 1024),
+		interval(3600),
+		total(1024 * 1024 * 1024)
+	{ }
+};
+
+// {{{1 DXG DOC
+/**
+ * \class EvidenceWriter
+ *
+ * Writes packets to pcap-ng files in a thread of its own, so capture
+ * threads never wait for the disk. write() appends an enhanced packet
+ * block to the current buffer, the thread writes full buffers and
+ * flushes the current one once a second. The buffers are allocated
+ * once, page aligned and large, so a file gets few large writes. If
+ * all buffers are full, packets are dropped and counted.
+ *
+ * The files are named evidence-YYYYmmdd-HHMMSS-N.pcapng and are rotated
+ * by size and age. Once all files in the directory, including those of
+ * earlier runs, exceed the total size, the oldest ones are removed.
+ *
+ * Errors are reported through the pipeline, as the thread must not log
+ * by itself.
+ */
+// }}}1 DXG DOC
+class EvidenceWriter
+{ // {{{1
+	public:
+		EvidenceWriter(const EvidenceConfig &_config, EventPipeline *_pipeline);
+		~EvidenceWriter();
+		void start(int _linkType, int _snaplen);
+		void stop();
+		void write(const struct pcap_pkthdr *_header, const u_char *_data);
+	private:
+		/// size of a buffer
+		static const size_t bufferSize = 1024 * 1024;
+		/// number of buffers
+		static const int bufferCount = 8;
+
+		EvidenceConfig config;				///< where and how large the files are
+		EventPipeline *pipeline;			///< errors go here
+		int linkType;						///< link layer type of the packets
+		int snaplen;						///< maximum length of the packets
+		pthread_mutex_t lock;				///< guards the buffers and running
+		pthread_cond_t wakeup;				///< signals full buffers and stop()
+		pthread_t thread;					///< the writer thread
+		bool running;						///< flag, if the thread should go on
+		bool started;						///< flag, if the thread has been started
+		char *buffers[bufferCount];			///< the buffers
+		size_t lengths[bufferCount];		///< bytes used in the buffers
+		int freeList[bufferCount];			///< buffers that can be filled
+		int freeCount;						///< number of entries in freeList
+		int fullQueue[bufferCount];			///< buffers waiting to be written, in order
+		int fullHead;						///< first entry of fullQueue
+		int fullCount;						///< number of entries in fullQueue
+		int current;						///< buffer being filled, -1 if none
+		unsigned long dropped;				///< packets dropped for lack of buffers
+
+		// only used by the thread
+		int fd;								///< current file, -1 if none
+		time_t opened;						///< time the current file was opened
+		unsigned int sequence;				///< number of files opened
+		std::deque<std::pair<std::string, off_t> > files;	///< all files, oldest first
+		off_t totalSize;					///< size of all files
+
+		static void* threadMain(void *_writer);
+		void run();
+		int takeBuffer();
+		void writeBuffer(int _buffer);
+		bool openFile(time_t _now);
+		void closeFile();
+		void removeOldFiles();
+		void scanDir();
+		void report(const char *_text, unsigned long _count);
+		// hidden
+		EvidenceWriter(const EvidenceWriter &rhs);
+		EvidenceWriter &operator=(const EvidenceWriter &rhs);
+}; // }}}1
+
+// {{{1 DXG DOC
+/**
+ * \class SourceMarks
+ *
+ * Clients marked as interesting for a while, e.g. as scanners. A scan
+ * is detected by one capture thread, while the flows of the scanner
+ * may be kept by the recorders of all threads, so they share the
+ * marks.
+ *
+ * Marks are rare, but the recorders look them up for every packet they
+ * keep. A recorder only compares version() with the version of its
+ * last copy(), a sequence number that is odd while a mark is written
+ * and changes with every mark.
+ */
+// }}}1 DXG DOC
+class SourceMarks
+{ // {{{1
+	public:
+		/// clients that can be marked at once
+		static const size_t slots = 16;
+		// {{{2 DXG DOC
+		/**
+		 * A marked client
+		 */
+		// }}}2 DXG DOC
+		struct Mark
+		{
+			in_addr_t client;			///< address of the client
+			time_t until;				///< end of the mark
+		};
+
+		SourceMarks();
+		void mark(in_addr_t _client, time_t _until);
+		// {{{2 DXG DOC
+		/**
+		 * Get the version of the marks
+		 */
+		// }}}2 DXG DOC
+		u_int32_t version() const
+		{
+			return this->seq;
+		}
+		size_t copy(Mark *_marks, u_int32_t &_version) const;
+	private:
+		volatile u_int32_t seq;			///< odd while a mark is written
+		Mark marks[slots];				///< marked clients
+		size_t count;					///< number of used entries in marks
+		// hidden
+		SourceMarks(const SourceMarks &rhs);
+		SourceMarks &operator=(const SourceMarks &rhs);
+}; // }}}1
+
+// {{{1 DXG DOC
+/**
+ * \class EvidenceRecorder
+ *
+ * Keeps the last packets of every flow of a capture thread in a ring
+ * of fixed size, so nothing is allocated per packet. Once a flow is
+ * marked as interesting its ring is handed to the EvidenceWriter and
+ * all of its following packets are written right away.
+ *
+ * A flow becomes interesting
+ * - if its session marks it in the FlowTable, e.g. once its dtk-script
+ *   reaches one of the states set with configureStates(), which is
+ *   checked once a second per flow,
+ * - if markFlow() is called, e.g. for the SYN of a scan, or
+ * - if its client has been marked with markSource(), e.g. as scanner.
+ *   The marks are shared with the recorders of the other threads, if
+ *   set with setSourceMarks().
+ *
+ * The flows live in a set associative table; a new flow replaces the
+ * one seen least recently in its set.
+ *
+ * The static members are used by the process serving a session, to
+ * mark its connection in the FlowTable.
+ *
+ * \note An object is not thread-safe, every capture thread needs its
+ * own. The fanout of the capture engine passes both directions of a
+ * flow to the same thread.
+ */
+// }}}1 DXG DOC
+class EvidenceRecorder
+{ // {{{1
+	public:
+		EvidenceRecorder(EvidenceWriter &_writer, size_t _flows, size_t _packets, size_t _snaplen);
+		~EvidenceRecorder();
+		void setFlowTable(const FlowTable *_flows);
+		void setSourceMarks(SourceMarks *_marks);
+		void record(const struct pcap_pkthdr *_header, const u_char *_data,
+				in_addr_t _client, in_port_t _clientPort, in_addr_t _server, in_port_t _serverPort);
+		void markFlow(in_addr_t _client, in_port_t _clientPort, in_addr_t _server, in_port_t _serverPort);
+		void markSource(in_addr_t _client, time_t _until);
+
+		static void configureStates(const std::string &_states);
+		static void setSession(FlowTable *_flows, const struct sockaddr_in &_client,
+				const struct sockaddr_in &_local);
+		static void markSession();
+		static void stateReached(int _state);
+	private:
+		/// slots a flow may be stored in
+		static const size_t ways = 4;
+		// {{{2 DXG DOC
+		/**
+		 * A flow and the ring of its last packets
+		 */
+		// }}}2 DXG DOC
+		struct Flow
+		{
+			in_addr_t client;			///< address of the client
+			in_addr_t server;			///< address of the server
+			in_port_t clientPort;		///< port of the client
+			in_port_t serverPort;		///< port of the server
+			bool used;					///< flag, if the slot is in use
+			bool streaming;				///< flag, if packets are written right away
+			time_t last;				///< last packet
+			time_t checked;				///< last check of the flow table
+			unsigned int head;			///< ring slot of the next packet
+			unsigned int count;			///< packets in the ring
+		};
+		EvidenceWriter &writer;			///< interesting packets go here
+		const FlowTable *flowTable;		///< marks of the sessions, may be NULL
+		Flow *flows;					///< the flows
+		size_t mask;					///< number of flows - 1, a power of 2 - 1
+		u_char *packets;				///< rings of all flows
+		size_t ringSize;				///< packets per flow
+		size_t slotSize;				///< bytes of a packet slot
+		size_t snaplen;					///< bytes kept of a packet
+		SourceMarks ownMarks;			///< marks if none are shared
+		SourceMarks *marks;				///< marks of all threads
+		SourceMarks::Mark sources[SourceMarks::slots];	///< copy of the marks
+		size_t sourceCount;				///< number of used entries in sources
+		u_int32_t marksVersion;			///< version of the marks copied
+
+		static u_int32_t stateMask;		///< dtk-script states that mark a session
+		static FlowTable *sessionFlows;	///< flow table of the session, NULL if none
+		static struct sockaddr_in sessionClient;	///< client of the session
+		static struct sockaddr_in sessionLocal;		///< local end of the session
+
+		static u_int32_t hash(in_addr_t _client, in_port_t _clientPort, in_addr_t _server, in_port_t _serverPort);
+		Flow* find(in_addr_t _client, in_port_t _clientPort, in_addr_t _server, in_port_t _serverPort,
+				time_t _now, bool _create);
+		bool isSourceMarked(in_addr_t _client, time_t _now);
+		void flush(Flow *_flow);
+		// hidden
+		EvidenceRecorder(const EvidenceRecorder &rhs);
+		EvidenceRecorder &operator=(const EvidenceRecorder &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _EVIDENCE_H
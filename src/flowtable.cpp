@@ -0,0 +1,324 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file flowtable.cpp
+ *
+ * Contains the implementation of the table of connection requests
+ */
+#include "flowtable.h"
+
+#include <new>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/// names of the tcp option kinds, by kind
+static const char *optionNames[] = { "eol", "nop", "mss", "ws", "sok", "sack", "echo", "echor", "ts" };
+
+// {{{1 DXG DOC
+/**
+ * Write the kinds of the options as comma separated list, e.g.
+ * "mss,sok,ts,nop,ws". Kinds without a name are written as "?" and
+ * their number.
+ *
+ * \param _buf Buffer to write to, always terminated
+ * \param _len Size of _buf
+ * \return Length of the list, truncated to fit into _buf
+ */
+// }}}1 DXG DOC
+size_t Deception::SynFingerprint::formatOptions(char *_buf, size_t _len) const
+{ // {{{1
+	size_t pos = 0;
+	if (_len == 0) {
+		return 0;
+	}
+	_buf[0] = '\0';
+	for (unsigned int i = 0; i < this->optionCount; i++) {
+		u_int8_t kind = this->options[i];
+		int written;
+		if (kind < sizeof(optionNames) / sizeof(optionNames[0])) {
+			written = ::snprintf(_buf + pos, _len - pos, "%s%s", (i > 0) ? "," : "", optionNames[kind]);
+		} else {
+			written = ::snprintf(_buf + pos, _len - pos, "%s?%u", (i > 0) ? "," : "", kind);
+		}
+		if ((written < 0) || (pos + written >= _len)) {
+			return ::strlen(_buf);
+		}
+		pos += written;
+	}
+	return pos;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the kind of a tcp option by the name formatOptions() writes
+ *
+ * \param _name Name of the option, need not be terminated
+ * \param _len Length of _name
+ * \return The kind, -1 if the name is unknown
+ */
+// }}}1 DXG DOC
+int Deception::SynFingerprint::optionKind(const char *_name, size_t _len)
+{ // {{{1
+	for (size_t i = 0; i < sizeof(optionNames) / sizeof(optionNames[0]); i++) {
+		if ((::strlen(optionNames[i]) == _len) && (::strncmp(optionNames[i], _name, _len) == 0)) {
+			return i;
+		}
+	}
+	if ((_len > 1) && (_len < 5) && (_name[0] == '?')) {
+		int kind = 0;
+		for (size_t i = 1; i < _len; i++) {
+			if ((_name[i] < '0') || (_name[i] > '9')) {
+				return -1;
+			}
+			kind = kind * 10 + (_name[i] - '0');
+		}
+		return (kind < 256) ? kind : -1;
+	}
+	return -1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Constructor, maps the table
+ *
+ * \param _flows Number of connections to keep, rounded up to a power
+ * of 2. Every connection takes about 64 bytes.
+ *
+ * \exception std::bad_alloc Shared memory could not be mapped
+ */
+// }}}1 DXG DOC
+Deception::FlowTable::FlowTable(size_t _flows)
+{ // {{{1
+	size_t size = ways;
+	while (size < _flows) {
+		size <<= 1;
+	}
+	this->mask = size - 1;
+	this->mapSize = size * sizeof(Slot);
+	// anonymous mappings are zeroed, which marks all slots unused
+	void *mem = ::mmap(NULL, this->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+	this->table = static_cast<Slot*>(mem);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor, unmaps the table of this process
+ */
+// }}}1 DXG DOC
+Deception::FlowTable::~FlowTable()
+{ // {{{1
+	::munmap(this->table, this->mapSize);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Mix addresses and ports of a connection, the low bits are used as
+ * index
+ */
+// }}}1 DXG DOC
+u_int32_t Deception::FlowTable::hash(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort)
+{ // {{{1
+	u_int32_t value = _src ^ (_dst * 0x9e3779b1U) ^ ((static_cast<u_int32_t>(_srcPort) << 16) | _dstPort);
+	value ^= value >> 16;
+	value *= 0x85ebca6bU;
+	value ^= value >> 13;
+	value *= 0xc2b2ae35U;
+	value ^= value >> 16;
+	return value;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Store the SYN of a connection request. A retransmitted SYN replaces
+ * the one stored before. If the slot is being written by someone else,
+ * the SYN is dropped.
+ *
+ * \param _src Source address in network byte order
+ * \param _srcPort Source port in network byte order
+ * \param _dst Destination address in network byte order
+ * \param _dstPort Destination port in network byte order
+ * \param _now Time of the SYN
+ * \param _syn The SYN
+ */
+// }}}1 DXG DOC
+void Deception::FlowTable::insert(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort,
+		time_t _now, const SynFingerprint &_syn)
+{ // {{{1
+	Slot *set = this->table + (hash(_src, _srcPort, _dst, _dstPort) & this->mask & ~(ways - 1));
+	Slot *victim = set;
+	// the fields are read without the lock, they only choose the slot
+	for (size_t i = 0; i < ways; i++) {
+		Slot *slot = set + i;
+		if ((slot->src == _src) && (slot->srcPort == _srcPort)
+				&& (slot->dst == _dst) && (slot->dstPort == _dstPort)) {
+			victim = slot;
+			break;
+		}
+		if (slot->seen < victim->seen) {
+			victim = slot;
+		}
+	}
+
+	u_int32_t seq = victim->seq;
+	if ((seq & 1) || !__sync_bool_compare_and_swap(&victim->seq, seq, seq + 1)) {
+		return;
+	}
+	if ((victim->src != _src) || (victim->srcPort != _srcPort)
+			|| (victim->dst != _dst) || (victim->dstPort != _dstPort)) {
+		// a new connection isn't interesting yet
+		victim->marked = 0;
+	}
+	victim->src = _src;
+	victim->dst = _dst;
+	victim->srcPort = _srcPort;
+	victim->dstPort = _dstPort;
+	victim->seen = _now;
+	victim->syn = _syn;
+	__sync_synchronize();
+	victim->seq = seq + 2;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Look up the SYN of a connection
+ *
+ * \param _src Source address in network byte order
+ * \param _srcPort Source port in network byte order
+ * \param _dst Destination address in network byte order
+ * \param _dstPort Destination port in network byte order
+ * \param _syn Is filled with the SYN, if true is returned
+ *
+ * \retval true If the SYN has been found
+ * \retval false If it has not been seen, has been replaced or is being
+ * written right now
+ */
+// }}}1 DXG DOC
+bool Deception::FlowTable::lookup(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort,
+		SynFingerprint &_syn) const
+{ // {{{1
+	const Slot *set = this->table + (hash(_src, _srcPort, _dst, _dstPort) & this->mask & ~(ways - 1));
+	for (size_t i = 0; i < ways; i++) {
+		const Slot *slot = set + i;
+		// a few attempts, a writer is done within nanoseconds
+		for (int attempt = 0; attempt < 4; attempt++) {
+			u_int32_t seq = slot->seq;
+			if (seq & 1) {
+				continue;
+			}
+			__sync_synchronize();
+			bool found = (slot->seen != 0) && (slot->src == _src) && (slot->srcPort == _srcPort)
+				&& (slot->dst == _dst) && (slot->dstPort == _dstPort);
+			if (found) {
+				_syn = slot->syn;
+			}
+			__sync_synchronize();
+			if (slot->seq != seq) {
+				continue;
+			}
+			if (found) {
+				return true;
+			}
+			break;
+		}
+	}
+	return false;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Find the slot of a connection, without taking its lock
+ *
+ * \return The slot, NULL if the connection is not stored
+ */
+// }}}1 DXG DOC
+Deception::FlowTable::Slot* Deception::FlowTable::find(in_addr_t _src, in_port_t _srcPort,
+		in_addr_t _dst, in_port_t _dstPort) const
+{ // {{{1
+	Slot *set = this->table + (hash(_src, _srcPort, _dst, _dstPort) & this->mask & ~(ways - 1));
+	for (size_t i = 0; i < ways; i++) {
+		Slot *slot = set + i;
+		if ((slot->seen != 0) && (slot->src == _src) && (slot->srcPort == _srcPort)
+				&& (slot->dst == _dst) && (slot->dstPort == _dstPort)) {
+			return slot;
+		}
+	}
+	return NULL;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Mark a connection as interesting, e.g. by the session serving it, so
+ * the capture engine keeps evidence of it. If the connection is not
+ * stored (any more), it is stored without a SYN.
+ *
+ * \param _src Source address in network byte order
+ * \param _srcPort Source port in network byte order
+ * \param _dst Destination address in network byte order
+ * \param _dstPort Destination port in network byte order
+ * \param _now Current time
+ */
+// }}}1 DXG DOC
+void Deception::FlowTable::mark(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort,
+		time_t _now)
+{ // {{{1
+	Slot *slot = this->find(_src, _srcPort, _dst, _dstPort);
+	if (slot == NULL) {
+		SynFingerprint none;
+		::memset(&none, 0, sizeof(none));
+		none.wscale = 0xff;
+		this->insert(_src, _srcPort, _dst, _dstPort, _now, none);
+		if ((slot = this->find(_src, _srcPort, _dst, _dstPort)) == NULL) {
+			return;
+		}
+	}
+	slot->marked = 1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check if a connection has been marked as interesting
+ *
+ * \param _src Source address in network byte order
+ * \param _srcPort Source port in network byte order
+ * \param _dst Destination address in network byte order
+ * \param _dstPort Destination port in network byte order
+ */
+// }}}1 DXG DOC
+bool Deception::FlowTable::isMarked(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort) const
+{ // {{{1
+	const Slot *slot = this->find(_src, _srcPort, _dst, _dstPort);
+	return (slot != NULL) && (slot->marked != 0);
+} // }}}1
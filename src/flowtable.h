@@ -0,0 +1,157 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _FLOWTABLE_H
+#define _FLOWTABLE_H
+
+/**
+ * \file flowtable.h
+ *
+ * Declares the table that hands the SYNs seen by the capture engine to
+ * the processes serving the connections.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C Headers
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+/// tcp options of a SYN that are kept in order
+#define MAX_SYN_OPTIONS		16
+
+/// peculiarities of the headers of a SYN, see SynFingerprint::quirks
+enum SynQuirks {
+	QuirkDf			= 0x01,		///< don't fragment is set
+	QuirkIdPlus		= 0x02,		///< don't fragment is set and the ip id is not zero
+	QuirkIdMinus	= 0x04,		///< don't fragment is not set and the ip id is zero
+	QuirkEcn		= 0x08,		///< explicit congestion notification is requested
+	QuirkTs1Minus	= 0x10,		///< own timestamp is zero
+	QuirkTs2Plus	= 0x20		///< peer timestamp is not zero, though there is no peer yet
+};
+
+// {{{1 DXG DOC
+/**
+ * \struct SynFingerprint
+ *
+ * The fields of a SYN that tell about the stack of its sender. The
+ * options are kept by kind in the order they were sent, the values of
+ * those that matter are extracted.
+ */
+// }}}1 DXG DOC
+struct SynFingerprint
+{
+	u_int8_t ttl;						///< ip time to live
+	u_int8_t wscale;					///< window scale, 0xff if not sent
+	u_int16_t window;					///< tcp window in host byte order
+	u_int16_t mss;						///< maximum segment size, 0 if not sent
+	u_int8_t optionCount;				///< number of options in options
+	u_int8_t options[MAX_SYN_OPTIONS];	///< kinds of the options in order
+	bool sackOk;						///< flag, if selective acks are permitted
+	bool hasTimestamp;					///< flag, if the timestamp option was sent
+	u_int32_t tsVal;					///< timestamp value, host byte order
+	u_int32_t tsEcr;					///< timestamp echo reply, host byte order
+	u_int8_t quirks;					///< SynQuirks
+
+	size_t formatOptions(char *_buf, size_t _len) const;
+	static int optionKind(const char *_name, size_t _len);
+};
+
+// {{{1 DXG DOC
+/**
+ * \class FlowTable
+ *
+ * Connection requests seen by the capture engine, keyed by their
+ * addresses and ports, so the process accepting a connection can look
+ * up how its SYN looked like.
+ *
+ * The table is a fixed number of slots in anonymous shared memory. It
+ * has to be created before the capture process or the session processes
+ * are forked, they all see the same memory then, whether capture runs
+ * in a process of its own or as threads of the daemon. A connection is
+ * stored in one of a few slots selected by a hash of its key, replacing
+ * the oldest one, so a lookup costs a hash and a few compares and the
+ * table never grows.
+ *
+ * Every slot is guarded by a sequence counter that is odd while the
+ * slot is written. Writers take a slot with a compare and swap and skip
+ * the SYN if another one holds it; readers copy a slot and retry if the
+ * counter has changed meanwhile. Neither side ever blocks, which allows
+ * capture threads in different processes to write concurrently.
+ *
+ * Sessions can mark their connection as interesting with mark(), the
+ * capture engine then keeps evidence of it, see EvidenceRecorder.
+ */
+// }}}1 DXG DOC
+class FlowTable
+{ // {{{1
+	public:
+		FlowTable(size_t _flows);
+		~FlowTable();
+		void insert(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort,
+				time_t _now, const SynFingerprint &_syn);
+		bool lookup(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort,
+				SynFingerprint &_syn) const;
+		void mark(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort, time_t _now);
+		bool isMarked(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort) const;
+	private:
+		/// slots a connection may be stored in
+		static const size_t ways = 4;
+		// {{{2 DXG DOC
+		/**
+		 * A connection request and its SYN
+		 */
+		// }}}2 DXG DOC
+		struct Slot
+		{
+			volatile u_int32_t seq;		///< odd while the slot is written
+			volatile u_int32_t marked;	///< set if the connection is interesting
+			in_addr_t src;				///< source address
+			in_addr_t dst;				///< destination address
+			in_port_t srcPort;			///< source port
+			in_port_t dstPort;			///< destination port
+			time_t seen;				///< time of the SYN, 0 if unused
+			SynFingerprint syn;			///< the SYN
+		};
+
+		Slot *table;					///< the slots, shared by all processes
+		size_t mask;					///< number of slots - 1, a power of 2 - 1
+		size_t mapSize;					///< bytes mapped
+
+		static u_int32_t hash(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort);
+		Slot* find(in_addr_t _src, in_port_t _srcPort, in_addr_t _dst, in_port_t _dstPort) const;
+		// hidden
+		FlowTable(const FlowTable &rhs);
+		FlowTable &operator=(const FlowTable &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _FLOWTABLE_H
@@ -42,26 +42,43 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <net/if.h>
-#include <netinet/if_ether.h>
 #include <netinet/in_systm.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <stdlib.h>
 #include <pcap.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#if defined(__linux__)
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#endif
+// batches are classified with sse2 or avx2 if the cpu has them, the
+// intrinsics need gcc 4.9 or later within target functions
+#if defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))) \
+	&& (defined(__x86_64__) || defined(__i386__))
+#define CAPTURE_VECTOR_X86
+#include <immintrin.h>
+#endif
 
 // c++ stuff
 #include <string>
+#include <vector>
+#include <iomanip>
 
 // framework includes
 #include "logging.h"
+#include "eventlog.h"
+#include "aggregator.h"
 #include "fw_pcap.h"
 #include "exception.h"
 #include "captureexception.h"
+#include "metrics.h"
 
 std::string name = "pcap_engine";
-std::string logMsg = "";
 extern Deception::Logging globLog;
 
 // {{{1 DXG DOC
@@ -70,133 +87,1575 @@ extern Deception::Logging globLog;
  *
  * \param toConvert Integer to be converted
  *
- * \retval "const char*" String containing converted integer
+ * \retval "std::string" String containing converted integer
  **/
 // }}}1 DXG DOC
-const char* intToString(unsigned int toConvert)
+std::string intToString(unsigned int toConvert)
 {
 	// enough space for unsigned int and \0
-	char *buf = static_cast<char*>(calloc(sizeof(char), 11));
+	char buf[11];
 	
-	if (snprintf(buf, 11, "%d", toConvert) < 0) {
+	if (snprintf(buf, sizeof(buf), "%u", toConvert) < 0) {
 		throw Deception::Exception("error while converting int to string");
 	}
-	return strdup(buf);
+	return buf;
 }
-	
+
+// link layer protocol numbers, not all systems define them
+#define PKT_ETHERTYPE_IP	0x0800
+#define PKT_ETHERTYPE_VLAN	0x8100
+#define PKT_ETHERTYPE_QINQ	0x88a8
+#define PKT_ETHERTYPE_QINQ1	0x9100
+
+// header sizes
+#define PKT_ETHER_LEN		14
+#define PKT_VLAN_LEN		4
+#define PKT_SLL_LEN			16
+#define PKT_NULL_LEN		4
+#define PKT_IP_MINLEN		20
+#define PKT_TCP_MINLEN		20
+#define PKT_UDP_LEN			8
+#define PKT_ICMP_MINLEN		8
+
+// icmp requests sent by scanners, not all systems define them
+#define PKT_ICMP_ECHO		8
+#define PKT_ICMP_TSTAMP		13
+#define PKT_ICMP_IREQ		15
+#define PKT_ICMP_MASKREQ	17
+
+// tcp flags for explicit congestion notification, not defined everywhere
+#define PKT_TH_ECE			0x40
+#define PKT_TH_CWR			0x80
+
+// ring bytes per packet besides the captured ones, the tpacket3_hdr and
+// the sockaddr_ll with their padding
+#define PKT_RING_OVERHEAD	96
+
+/// read a 16 bit value in network byte order, packet data may be unaligned
+static inline u_int16_t readShort(const u_char *p)
+{
+	return static_cast<u_int16_t>((p[0] << 8) | p[1]);
+}
+
+/// read a 32 bit value in network byte order, unsigned before shifting
+static inline u_int32_t readLong(const u_char *p)
+{
+	return (static_cast<u_int32_t>(readShort(p)) << 16) | readShort(p + 2);
+}
+
+// {{{1 DXG DOC
+/**
+ * Find the IPv4 header behind the link layer header
+ *
+ * \param packet Captured data
+ * \param caplen Number of captured bytes
+ * \param linkType Link layer type from pcap_datalink()
+ *
+ * \return Offset of the IPv4 header, -1 if the packet is no IPv4
+ * packet or too short
+ */
+// }}}1 DXG DOC
+static long linkOffset(const u_char *packet, bpf_u_int32 caplen, int linkType)
+{
+	bpf_u_int32 offset;
+	u_int32_t family;
+	u_int16_t type;
+	switch (linkType) {
+		case DLT_EN10MB:
+			if (caplen < PKT_ETHER_LEN) {
+				return -1;
+			}
+			offset = PKT_ETHER_LEN;
+			type = readShort(packet + 12);
+			// skip 802.1Q and 802.1ad (QinQ) tags, however many there are
+			while ((type == PKT_ETHERTYPE_VLAN) || (type == PKT_ETHERTYPE_QINQ)
+					|| (type == PKT_ETHERTYPE_QINQ1)) {
+				if (caplen < offset + PKT_VLAN_LEN) {
+					return -1;
+				}
+				type = readShort(packet + offset + 2);
+				offset += PKT_VLAN_LEN;
+			}
+			return (type == PKT_ETHERTYPE_IP) ? static_cast<long>(offset) : -1;
+		case DLT_LINUX_SLL:
+			// linux cooked capture, e.g. on the "any" device
+			if (caplen < PKT_SLL_LEN) {
+				return -1;
+			}
+			return (readShort(packet + 14) == PKT_ETHERTYPE_IP) ? PKT_SLL_LEN : -1;
+		case DLT_NULL:
+			// loopback, the address family is in host byte order
+			if (caplen < PKT_NULL_LEN) {
+				return -1;
+			}
+			memcpy(&family, packet, sizeof(family));
+			return (family == AF_INET) ? PKT_NULL_LEN : -1;
+		case DLT_RAW:
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Parse the headers of a captured packet. Every length is checked
+ * against the captured length, so truncated and malformed packets are
+ * rejected instead of being read beyond their end. Nothing is allocated.
+ *
+ * \param packet Captured data
+ * \param caplen Number of captured bytes
+ * \param linkType Link layer type from pcap_datalink()
+ * \param info Is filled with the header fields
+ *
+ * \retval true If the packet is the first fragment of an IPv4 packet
+ * with complete headers; the transport header is only parsed for TCP,
+ * UDP and ICMP
+ * \retval false Otherwise, info is undefined then
+ */
+// }}}1 DXG DOC
+bool parsePacket(const u_char *packet, bpf_u_int32 caplen, int linkType, PacketInfo &info)
+{
+	if (packet == NULL) {
+		return false;
+	}
+	long offset = linkOffset(packet, caplen, linkType);
+	if ((offset < 0) || (caplen < offset + PKT_IP_MINLEN)) {
+		return false;
+	}
+	const u_char *ip = packet + offset;
+	caplen -= offset;
+	// version 4 only, the header length includes options
+	if ((ip[0] >> 4) != 4) {
+		return false;
+	}
+	bpf_u_int32 ipLen = (ip[0] & 0x0f) * 4;
+	if ((ipLen < PKT_IP_MINLEN) || (caplen < ipLen)) {
+		return false;
+	}
+	// only the first fragment carries the transport header
+	if ((readShort(ip + 6) & 0x1fff) != 0) {
+		return false;
+	}
+	info.protocol = ip[9];
+	info.ttl = ip[8];
+	info.dontFragment = (ip[6] & 0x40) != 0;
+	info.ipId = readShort(ip + 4);
+	memcpy(&info.srcIp, ip + 12, sizeof(info.srcIp));
+	memcpy(&info.dstIp, ip + 16, sizeof(info.dstIp));
+	info.srcPort = 0;
+	info.dstPort = 0;
+
+	const u_char *transport = ip + ipLen;
+	caplen -= ipLen;
+	if (info.protocol != IPPROTO_TCP) {
+		switch (info.protocol) {
+			case IPPROTO_UDP:
+				if (caplen < PKT_UDP_LEN) {
+					return false;
+				}
+				memcpy(&info.srcPort, transport, sizeof(info.srcPort));
+				memcpy(&info.dstPort, transport + 2, sizeof(info.dstPort));
+				break;
+			case IPPROTO_ICMP:
+				if (caplen < PKT_ICMP_MINLEN) {
+					return false;
+				}
+				info.icmpType = transport[0];
+				info.icmpCode = transport[1];
+				break;
+		}
+		return true;
+	}
+	const u_char *tcp = transport;
+	if (caplen < PKT_TCP_MINLEN) {
+		return false;
+	}
+	bpf_u_int32 tcpLen = (tcp[12] >> 4) * 4;
+	if (tcpLen < PKT_TCP_MINLEN) {
+		return false;
+	}
+	memcpy(&info.srcPort, tcp, sizeof(info.srcPort));
+	memcpy(&info.dstPort, tcp + 2, sizeof(info.dstPort));
+	info.tcpFlags = tcp[13];
+	info.seq = readLong(tcp + 4);
+	info.ack = readLong(tcp + 8);
+	info.window = readShort(tcp + 14);
+	// options may have been cut off by the snaplen
+	info.tcpOptions = tcp + PKT_TCP_MINLEN;
+	info.tcpOptionsLen = ((tcpLen < caplen) ? tcpLen : caplen) - PKT_TCP_MINLEN;
+	// the payload as sent is told by the ip header, less may be captured
+	bpf_u_int32 totalLen = readShort(ip + 2);
+	info.payload = tcp + tcpLen;
+	info.payloadLen = (totalLen > ipLen + tcpLen) ? totalLen - ipLen - tcpLen : 0;
+	info.payloadCaptured = (caplen > tcpLen) ? caplen - tcpLen : 0;
+	if (info.payloadCaptured > info.payloadLen) {
+		// ethernet padding
+		info.payloadCaptured = info.payloadLen;
+	}
+	return true;
+}
+
+// {{{1 DXG DOC
+/**
+ * Take the fingerprint of a SYN from its headers. The options are
+ * walked with the same care as the headers, a truncated option ends the
+ * list.
+ *
+ * \param info Header fields from parsePacket()
+ * \param syn Is filled with the fingerprint
+ */
+// }}}1 DXG DOC
+void parseSynOptions(const PacketInfo &info, Deception::SynFingerprint &syn)
+{
+	memset(&syn, 0, sizeof(syn));
+	syn.ttl = info.ttl;
+	syn.window = info.window;
+	syn.wscale = 0xff;
+	if (info.dontFragment) {
+		syn.quirks |= (info.ipId != 0) ? (Deception::QuirkDf | Deception::QuirkIdPlus) : Deception::QuirkDf;
+	} else if (info.ipId == 0) {
+		syn.quirks |= Deception::QuirkIdMinus;
+	}
+	if (info.tcpFlags & (PKT_TH_ECE | PKT_TH_CWR)) {
+		syn.quirks |= Deception::QuirkEcn;
+	}
+	const u_char *opt = info.tcpOptions;
+	const u_char *end = info.tcpOptions + info.tcpOptionsLen;
+	while ((opt < end) && (syn.optionCount < MAX_SYN_OPTIONS)) {
+		u_int8_t kind = opt[0];
+		syn.options[syn.optionCount++] = kind;
+		if (kind == TCPOPT_EOL) {
+			break;
+		}
+		if (kind == TCPOPT_NOP) {
+			opt++;
+			continue;
+		}
+		if ((end - opt < 2) || (opt[1] < 2) || (end - opt < opt[1])) {
+			break;
+		}
+		switch (kind) {
+			case TCPOPT_MAXSEG:
+				if (opt[1] == TCPOLEN_MAXSEG) {
+					syn.mss = readShort(opt + 2);
+				}
+				break;
+			case TCPOPT_WINDOW:
+				if (opt[1] == TCPOLEN_WINDOW) {
+					syn.wscale = opt[2];
+				}
+				break;
+			case TCPOPT_SACK_PERMITTED:
+				syn.sackOk = true;
+				break;
+			case TCPOPT_TIMESTAMP:
+				if (opt[1] == TCPOLEN_TIMESTAMP) {
+					syn.hasTimestamp = true;
+					syn.tsVal = readLong(opt + 2);
+					syn.tsEcr = readLong(opt + 6);
+					if (syn.tsVal == 0) {
+						syn.quirks |= Deception::QuirkTs1Minus;
+					}
+					if (syn.tsEcr != 0) {
+						syn.quirks |= Deception::QuirkTs2Plus;
+					}
+				}
+				break;
+		}
+		opt += opt[1];
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Hand an event to the pipeline of a capture thread, or write it right
+ * away if there is none
+ */
+// }}}1 DXG DOC
+static inline void dispatch(CaptureWorker *_worker, const Deception::PipelineEvent &_event)
+{
+	_worker->stats.events++;
+	if (_worker->pipeline != NULL) {
+		_worker->pipeline->push(_event);
+	} else {
+		Deception::EventPipeline::emit(_event);
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Report a request to one of our hosts: feed the scan detector, then
+ * log the request unless the aggregator folds it into a summary
+ *
+ * \param worker The calling thread
+ * \param pkthdr The header of the fetched packet
+ * \param info Header fields of the packet
+ * \param type Type of the request for the aggregator
+ * \param service Port or icmp type the request is for, in network byte
+ * order, for the scan detector
+ * \param eventName Short event name, e.g. "syn"
+ * \param text Description for the text log
+ * \param os Operating system of the source, NULL if unknown
+ */
+// }}}1 DXG DOC
+static void reportRequest(CaptureWorker *worker, const struct pcap_pkthdr *pkthdr, const PacketInfo &info,
+		Deception::EventAggregator::EventType type, in_port_t service, const char *eventName,
+		const char *text, const char *os)
+{
+	Deception::PipelineEvent event;
+	if ((worker->scanDetector != NULL) && worker->scanDetector->observe(info.srcIp,
+			info.dstIp, service, pkthdr->ts.tv_sec, event, info.protocol)) {
+		event.os = os;
+		dispatch(worker, event);
+		// keep evidence of the scanner for the rest of the window
+		if (worker->evidence != NULL) {
+			worker->evidence->markSource(info.srcIp, pkthdr->ts.tv_sec + event.window);
+			if (info.protocol == IPPROTO_TCP) {
+				worker->evidence->markFlow(info.srcIp, info.srcPort, info.dstIp, info.dstPort);
+			}
+		}
+	}
+	// scans and floods end up in a summary instead
+	if ((worker->aggregator != NULL) && !worker->aggregator->admit(type,
+			info.srcIp, info.dstIp, info.dstPort, pkthdr->ts.tv_sec)) {
+		return;
+	}
+	event = Deception::PipelineEvent(name.c_str(), Deception::Info, eventName);
+	event.text = text;
+	event.srcIp = info.srcIp;
+	event.dstIp = info.dstIp;
+	event.srcPort = info.srcPort;
+	event.dstPort = info.dstPort;
+	event.os = os;
+	dispatch(worker, event);
+}
+
+// {{{1 DXG DOC
+/**
+ * Look at data sent to a phantom port. If the segment completes a
+ * handshake begun by the responder, the connection is reset and logged
+ * with the first bytes of its data, as far as they are captured.
+ *
+ * \param worker The calling thread, it has a responder
+ * \param pkthdr The header of the fetched packet
+ * \param info Header fields of the packet
+ */
+// }}}1 DXG DOC
+static void classifyPhantom(CaptureWorker *worker, const struct pcap_pkthdr *pkthdr, const PacketInfo &info)
+{
+	// the responder only has SYNs to hosts of the filter answered
+	if ((worker->portFilter == NULL) || !worker->portFilter->isPhantom(info.dstPort)
+			|| !worker->portFilter->matches(info.dstIp, info.dstPort)) {
+		return;
+	}
+	if (!worker->responder->complete(info.srcIp, info.srcPort, info.dstIp, info.dstPort,
+			info.seq, info.ack, info.payloadLen, pkthdr->ts.tv_sec)) {
+		return;
+	}
+	worker->stats.classified[PhantomClass]++;
+	if ((worker->aggregator != NULL) && !worker->aggregator->admit(Deception::EventAggregator::ConnectEvent,
+			info.srcIp, info.dstIp, info.dstPort, pkthdr->ts.tv_sec)) {
+		return;
+	}
+	Deception::PipelineEvent event(name.c_str(), Deception::Info, "phantom");
+	event.text = "phantom connection";
+	event.srcIp = info.srcIp;
+	event.dstIp = info.dstIp;
+	event.srcPort = info.srcPort;
+	event.dstPort = info.dstPort;
+	event.payloadLen = (info.payloadCaptured < sizeof(event.payload)) ? info.payloadCaptured : sizeof(event.payload);
+	memcpy(event.payload, info.payload, event.payloadLen);
+	dispatch(worker, event);
+}
+
 // {{{1 DXG DOC
 /**
- * Analyze a single packet, if it's of any use for us (i.e. we only look for connections being opened
- * from somewhere else, so only packets with syn = 1 and ack = 0 are interesting here. It's being called
- * from pcap_loop() or pcap_dispatch(), because of that the parameters are fixed
+ * Classify a tcp segment, we only look for connections being opened
+ * from somewhere else, so only segments with syn = 1 and ack = 0 are
+ * interesting here
  *
- * \param useless ???
+ * \param worker The calling thread
  * \param pkthdr The header of the fetched packet
  * \param packet Pointer to the actual package
+ * \param info Header fields of the packet
  */
 // }}}1 DXG DOC
-void analyzePacket(u_char* useless, const struct pcap_pkthdr* pkthdr, const u_char* packet)
+static void classifyTcp(CaptureWorker *worker, const struct pcap_pkthdr *pkthdr, const u_char *packet,
+		const PacketInfo &info)
 {
-	const struct ip *sniffip;
-	const struct tcphdr *snifftcp;
-	const struct ether_header *sniffether;
-	// grab ethernet header
-	sniffether = reinterpret_cast<const struct ether_header*>(packet);
-	// if we got a bad pointer, get the hell out of here
-	if (!sniffether) {
+	worker->stats.classified[TcpClass]++;
+	// every packet of our hosts is kept for a while, in case its flow
+	// turns out to be interesting
+	if (worker->evidence != NULL) {
+		if ((worker->portFilter == NULL) || worker->portFilter->hasHost(info.dstIp)) {
+			worker->evidence->record(pkthdr, packet, info.srcIp, info.srcPort, info.dstIp, info.dstPort);
+		} else if (worker->portFilter->hasHost(info.srcIp)) {
+			worker->evidence->record(pkthdr, packet, info.dstIp, info.dstPort, info.srcIp, info.srcPort);
+		}
+	}
+	// we are only interested in connection request, i.e. syn-flag must be set and ack flag is not set
+	if ((info.tcpFlags & (TH_SYN | TH_ACK)) != TH_SYN) {
+		if ((worker->responder != NULL) && (info.payloadLen > 0)
+				&& ((info.tcpFlags & (TH_SYN | TH_ACK | TH_RST)) == TH_ACK)) {
+			classifyPhantom(worker, pkthdr, info);
+		}
 		return;
 	}
-	// check if it's an ip packet, since we're only interested in that
-	if (ntohs(sniffether->ether_type) == ETHERTYPE_IP) {
-		// now that we're at it, only tcp is interesting
-		// fetch ip structure
-		sniffip = reinterpret_cast<const struct ip*>(packet + sizeof(struct ether_header));
-		if (sniffip->ip_p == IPPROTO_TCP) {
-			// fetch tcp structure
-			snifftcp = reinterpret_cast<const struct tcphdr*>(packet + sizeof(struct ether_header)
-					+ sizeof(struct ip));
-			// we are only interested in connection request, i.e. syn-flag must be set and ack flag is not set
-#if defined(__sun__) || defined(__sun) || defined(__FreeBSD__) || defined(Darwin)
-			if ((snifftcp->th_flags & TH_SYN) & ~(snifftcp->th_flags & TH_ACK)) {
-#else
-			if ((snifftcp->syn == 1) && (snifftcp->ack == 0)) {
-#endif
-				const char *inIpBuf = inet_ntoa(sniffip->ip_src);
-				const char *outIpBuf = inet_ntoa(sniffip->ip_dst);
-				// fetch source and destination ip
-				// print out connection request
-				logMsg.append("connection request from ").append(inIpBuf).append(":")
-#if defined(__sun__) || defined(__sun) || defined(__FreeBSD__) || defined(Darwin)
-					.append(intToString(ntohs(snifftcp->th_sport)))
-#else
-					.append(intToString(ntohs(snifftcp->source)))
+	if ((worker->portFilter != NULL) && !worker->portFilter->hasHost(info.dstIp)) {
+		return;
+	}
+	const char *os = NULL;
+	if ((worker->flowTable != NULL) || (worker->osSignatures != NULL)) {
+		Deception::SynFingerprint syn;
+		parseSynOptions(info, syn);
+		// the process accepting the connection picks this up
+		if (worker->flowTable != NULL) {
+			worker->flowTable->insert(info.srcIp, info.srcPort, info.dstIp, info.dstPort,
+					pkthdr->ts.tv_sec, syn);
+		}
+		if (worker->osSignatures != NULL) {
+			os = worker->osSignatures->match(syn);
+		}
+	}
+	// requests to listening ports are logged by the daemon
+	if ((worker->portFilter != NULL) && !worker->portFilter->matches(info.dstIp, info.dstPort)) {
+		return;
+	}
+	if ((worker->responder != NULL) && (worker->portFilter != NULL)
+			&& worker->portFilter->isPhantom(info.dstPort)) {
+		worker->responder->answer(info.srcIp, info.srcPort, info.dstIp, info.dstPort, info.seq,
+				pkthdr->ts.tv_sec);
+	}
+	reportRequest(worker, pkthdr, info, Deception::EventAggregator::SynEvent, info.dstPort,
+			"syn", "connection request", os);
+}
+
+// {{{1 DXG DOC
+/**
+ * Classify a udp datagram, no module listens on udp, so every datagram
+ * to our hosts is a probe
+ *
+ * \param worker The calling thread
+ * \param pkthdr The header of the fetched packet
+ * \param packet Pointer to the actual package
+ * \param info Header fields of the packet
+ */
+// }}}1 DXG DOC
+static void classifyUdp(CaptureWorker *worker, const struct pcap_pkthdr *pkthdr, const u_char *packet,
+		const PacketInfo &info)
+{
+	worker->stats.classified[UdpClass]++;
+	if ((worker->portFilter != NULL) && !worker->portFilter->hasHost(info.dstIp)) {
+		return;
+	}
+	reportRequest(worker, pkthdr, info, Deception::EventAggregator::UdpEvent, info.dstPort,
+			"udp", "udp probe", NULL);
+}
+
+// {{{1 DXG DOC
+/**
+ * Classify an icmp message, only the requests scanners use to find
+ * hosts are interesting, replies and errors are not
+ *
+ * \param worker The calling thread
+ * \param pkthdr The header of the fetched packet
+ * \param packet Pointer to the actual package
+ * \param info Header fields of the packet
+ */
+// }}}1 DXG DOC
+static void classifyIcmp(CaptureWorker *worker, const struct pcap_pkthdr *pkthdr, const u_char *packet,
+		const PacketInfo &info)
+{
+	worker->stats.classified[IcmpClass]++;
+	const char *text;
+	switch (info.icmpType) {
+		case PKT_ICMP_ECHO:
+			text = "echo request";
+			break;
+		case PKT_ICMP_TSTAMP:
+			text = "timestamp request";
+			break;
+		case PKT_ICMP_IREQ:
+			text = "information request";
+			break;
+		case PKT_ICMP_MASKREQ:
+			text = "address mask request";
+			break;
+		default:
+			return;
+	}
+	if ((worker->portFilter != NULL) && !worker->portFilter->hasHost(info.dstIp)) {
+		return;
+	}
+	// a sweep with echo and timestamp requests counts two services
+	reportRequest(worker, pkthdr, info, Deception::EventAggregator::IcmpEvent, htons(info.icmpType),
+			"icmp", text, NULL);
+}
+
+/// mask of the first count packets of a batch
+static inline unsigned int batchMask(unsigned int count)
+{
+	return (count >= 32) ? 0xffffffffU : ((1U << count) - 1);
+}
+
+// {{{1 DXG DOC
+/**
+ * Find the packets of a batch that analyzePacket() has to look at:
+ * tcp SYNs (every tcp segment if allTcp is set), udp datagrams and icmp
+ * requests, and all packets whose fields could not be gathered, which
+ * leaves them to the full parser. The other packets are dropped
+ * without parsing them any further.
+ *
+ * \param batch The batch with gathered fields
+ * \param allTcp Flag, if every tcp segment survives, e.g. for evidence
+ *
+ * \return Bit i is set if packet i survives
+ */
+// }}}1 DXG DOC
+static unsigned int classifyBatchScalar(const PacketBatch &batch, bool allTcp)
+{
+	unsigned int keep = 0;
+	for (unsigned int i = 0; i < batch.count; i++) {
+		bool fast = batch.sane[i] && (batch.etherHi[i] == 0x08) && (batch.etherLo[i] == 0x00);
+		u_int8_t flags = batch.flags[i];
+		bool interesting;
+		switch (batch.protocol[i]) {
+			case IPPROTO_TCP:
+				interesting = allTcp || ((flags & (TH_SYN | TH_ACK)) == TH_SYN);
+				break;
+			case IPPROTO_UDP:
+				interesting = true;
+				break;
+			case IPPROTO_ICMP:
+				interesting = (flags == PKT_ICMP_ECHO) || (flags == PKT_ICMP_TSTAMP)
+					|| (flags == PKT_ICMP_IREQ) || (flags == PKT_ICMP_MASKREQ);
+				break;
+			default:
+				interesting = false;
+				break;
+		}
+		if (!fast || interesting) {
+			keep |= 1U << i;
+		}
+	}
+	return keep;
+}
+
+#ifdef CAPTURE_VECTOR_X86
+// {{{1 DXG DOC
+/**
+ * classifyBatchScalar() with sse2, 16 packets per compare
+ */
+// }}}1 DXG DOC
+__attribute__((target("sse2")))
+static unsigned int classifyBatchSse2(const PacketBatch &batch, bool allTcp)
+{
+	unsigned int keep = 0;
+	for (unsigned int half = 0; half < CAPTURE_BATCH; half += 16) {
+		__m128i sane = _mm_loadu_si128(reinterpret_cast<const __m128i*>(batch.sane + half));
+		__m128i etherHi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(batch.etherHi + half));
+		__m128i etherLo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(batch.etherLo + half));
+		__m128i protocol = _mm_loadu_si128(reinterpret_cast<const __m128i*>(batch.protocol + half));
+		__m128i flags = _mm_loadu_si128(reinterpret_cast<const __m128i*>(batch.flags + half));
+
+		__m128i fast = _mm_and_si128(_mm_cmpeq_epi8(sane, _mm_set1_epi8(1)),
+				_mm_and_si128(_mm_cmpeq_epi8(etherHi, _mm_set1_epi8(0x08)),
+					_mm_cmpeq_epi8(etherLo, _mm_setzero_si128())));
+		__m128i tcp = _mm_cmpeq_epi8(protocol, _mm_set1_epi8(IPPROTO_TCP));
+		if (!allTcp) {
+			tcp = _mm_and_si128(tcp, _mm_cmpeq_epi8(_mm_and_si128(flags, _mm_set1_epi8(TH_SYN | TH_ACK)),
+					_mm_set1_epi8(TH_SYN)));
+		}
+		__m128i udp = _mm_cmpeq_epi8(protocol, _mm_set1_epi8(IPPROTO_UDP));
+		__m128i request = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(flags, _mm_set1_epi8(PKT_ICMP_ECHO)),
+					_mm_cmpeq_epi8(flags, _mm_set1_epi8(PKT_ICMP_TSTAMP))),
+				_mm_or_si128(_mm_cmpeq_epi8(flags, _mm_set1_epi8(PKT_ICMP_IREQ)),
+					_mm_cmpeq_epi8(flags, _mm_set1_epi8(PKT_ICMP_MASKREQ))));
+		__m128i icmp = _mm_and_si128(_mm_cmpeq_epi8(protocol, _mm_set1_epi8(IPPROTO_ICMP)), request);
+		__m128i interesting = _mm_or_si128(tcp, _mm_or_si128(udp, icmp));
+		// andnot(a, b) is ~a & b
+		__m128i survivors = _mm_or_si128(_mm_andnot_si128(fast, _mm_set1_epi8(-1)), interesting);
+		keep |= static_cast<unsigned int>(_mm_movemask_epi8(survivors)) << half;
+	}
+	return keep & batchMask(batch.count);
+}
+
+// {{{1 DXG DOC
+/**
+ * classifyBatchScalar() with avx2, the whole batch per compare
+ */
+// }}}1 DXG DOC
+__attribute__((target("avx2")))
+static unsigned int classifyBatchAvx2(const PacketBatch &batch, bool allTcp)
+{
+	__m256i sane = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch.sane));
+	__m256i etherHi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch.etherHi));
+	__m256i etherLo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch.etherLo));
+	__m256i protocol = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch.protocol));
+	__m256i flags = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch.flags));
+
+	__m256i fast = _mm256_and_si256(_mm256_cmpeq_epi8(sane, _mm256_set1_epi8(1)),
+			_mm256_and_si256(_mm256_cmpeq_epi8(etherHi, _mm256_set1_epi8(0x08)),
+				_mm256_cmpeq_epi8(etherLo, _mm256_setzero_si256())));
+	__m256i tcp = _mm256_cmpeq_epi8(protocol, _mm256_set1_epi8(IPPROTO_TCP));
+	if (!allTcp) {
+		tcp = _mm256_and_si256(tcp, _mm256_cmpeq_epi8(_mm256_and_si256(flags, _mm256_set1_epi8(TH_SYN | TH_ACK)),
+				_mm256_set1_epi8(TH_SYN)));
+	}
+	__m256i udp = _mm256_cmpeq_epi8(protocol, _mm256_set1_epi8(IPPROTO_UDP));
+	__m256i request = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(flags, _mm256_set1_epi8(PKT_ICMP_ECHO)),
+				_mm256_cmpeq_epi8(flags, _mm256_set1_epi8(PKT_ICMP_TSTAMP))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(flags, _mm256_set1_epi8(PKT_ICMP_IREQ)),
+				_mm256_cmpeq_epi8(flags, _mm256_set1_epi8(PKT_ICMP_MASKREQ))));
+	__m256i icmp = _mm256_and_si256(_mm256_cmpeq_epi8(protocol, _mm256_set1_epi8(IPPROTO_ICMP)), request);
+	__m256i interesting = _mm256_or_si256(tcp, _mm256_or_si256(udp, icmp));
+	__m256i survivors = _mm256_or_si256(_mm256_andnot_si256(fast, _mm256_set1_epi8(-1)), interesting);
+	return static_cast<unsigned int>(_mm256_movemask_epi8(survivors)) & batchMask(batch.count);
+}
 #endif
-					.append(" to ").append(outIpBuf).append(":")
-#if defined(__sun__) || defined(__sun) || defined(__FreeBSD__) || defined(Darwin)
-					.append(intToString(ntohs(snifftcp->th_dport)));
-#else
-					.append(intToString(ntohs(snifftcp->dest)));
+
+/// classifies a packet of a protocol
+typedef void (*PacketClassifier)(CaptureWorker *worker, const struct pcap_pkthdr *pkthdr,
+		const u_char *packet, const PacketInfo &info);
+/// finds the packets of a batch worth parsing
+typedef unsigned int (*BatchClassifier)(const PacketBatch &batch, bool allTcp);
+
+// {{{1 DXG DOC
+/**
+ * Classifiers by ip protocol, NULL for protocols we don't look at, and
+ * the batch classifier for the cpu we run on
+ */
+// }}}1 DXG DOC
+struct ClassifierTable
+{
+	PacketClassifier classify[256];		///< classifier of every ip protocol
+	BatchClassifier classifyBatch;		///< fastest batch classifier of the cpu
+	const char *batchName;				///< name of classifyBatch
+
+	ClassifierTable() :
+		classifyBatch(classifyBatchScalar),
+		batchName("scalar")
+	{
+		for (size_t i = 0; i < 256; i++) {
+			this->classify[i] = NULL;
+		}
+		this->classify[IPPROTO_TCP] = classifyTcp;
+		this->classify[IPPROTO_UDP] = classifyUdp;
+		this->classify[IPPROTO_ICMP] = classifyIcmp;
+#ifdef CAPTURE_VECTOR_X86
+		// static constructors may run before the cpu has been probed
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			this->classifyBatch = classifyBatchAvx2;
+			this->batchName = "avx2";
+		} else if (__builtin_cpu_supports("sse2")) {
+			this->classifyBatch = classifyBatchSse2;
+			this->batchName = "sse2";
+		}
 #endif
-				globLog.toLog(name, Deception::Info, logMsg);
-				logMsg.erase();
+	}
+};
+
+static const ClassifierTable classifiers;
+
+// {{{1 DXG DOC
+/**
+ * Analyze a single packet, if it's of any use for us, by handing it to
+ * the classifier of its protocol. It's being called from pcap_loop() or
+ * pcap_dispatch(), because of that the parameters are fixed
+ *
+ * \param user Pointer to the CaptureWorker of the calling thread
+ * \param pkthdr The header of the fetched packet
+ * \param packet Pointer to the actual package
+ */
+// }}}1 DXG DOC
+void analyzePacket(u_char* user, const struct pcap_pkthdr* pkthdr, const u_char* packet)
+{
+	CaptureWorker *worker = reinterpret_cast<CaptureWorker*>(user);
+	PacketInfo info;
+	if (worker == NULL) {
+		return;
+	}
+	if (!parsePacket(packet, pkthdr->caplen, worker->linkType, info)) {
+		worker->stats.parseErrors++;
+		return;
+	}
+	PacketClassifier classify = classifiers.classify[info.protocol];
+	if (classify != NULL) {
+		classify(worker, pkthdr, packet, info);
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _snaplen Largest packet to be collected
+ */
+// }}}1 DXG DOC
+PacketBatch::PacketBatch(size_t _snaplen) :
+	count(0),
+	// whole cache lines per packet
+	slotSize((_snaplen + 63) & ~static_cast<size_t>(63)),
+	data(new u_char[CAPTURE_BATCH * ((_snaplen + 63) & ~static_cast<size_t>(63))])
+{
+	// the vector compares read all lanes, used or not
+	memset(this->sane, 0, sizeof(this->sane));
+	memset(this->etherHi, 0, sizeof(this->etherHi));
+	memset(this->etherLo, 0, sizeof(this->etherLo));
+	memset(this->protocol, 0, sizeof(this->protocol));
+	memset(this->flags, 0, sizeof(this->flags));
+}
+
+// {{{1 DXG DOC
+/**
+ * Destructor
+ */
+// }}}1 DXG DOC
+PacketBatch::~PacketBatch()
+{
+	delete[] this->data;
+}
+
+// {{{1 DXG DOC
+/**
+ * Gather the fields the batch classifiers look at, assuming ipv4 right
+ * behind the link layer header. Packets that don't fit, e.g. with vlan
+ * tags or cut short, are marked as not sane and left to parsePacket().
+ */
+// }}}1 DXG DOC
+static void gatherBatch(PacketBatch &batch, int linkType)
+{
+	long linkLen;
+	switch (linkType) {
+		case DLT_EN10MB:
+			linkLen = PKT_ETHER_LEN;
+			break;
+		case DLT_LINUX_SLL:
+			linkLen = PKT_SLL_LEN;
+			break;
+		case DLT_NULL:
+			linkLen = PKT_NULL_LEN;
+			break;
+		case DLT_RAW:
+			linkLen = 0;
+			break;
+		default:
+			linkLen = -1;
+			break;
+	}
+	// the ethertype of loopback and raw ip is implied
+	bool hasEtherType = (linkType == DLT_EN10MB) || (linkType == DLT_LINUX_SLL);
+	for (unsigned int i = 0; i < batch.count; i++) {
+		const u_char *packet = batch.data + i * batch.slotSize;
+		bpf_u_int32 caplen = batch.headers[i].caplen;
+		batch.sane[i] = 0;
+		if ((linkLen < 0) || (caplen < linkLen + PKT_IP_MINLEN)) {
+			continue;
+		}
+		const u_char *ip = packet + linkLen;
+		bpf_u_int32 ipLen = (ip[0] & 0x0f) * 4;
+		if (caplen < linkLen + ipLen + PKT_TCP_MINLEN) {
+			continue;
+		}
+		const u_char *transport = ip + ipLen;
+		batch.etherHi[i] = hasEtherType ? packet[linkLen - 2] : 0x08;
+		batch.etherLo[i] = hasEtherType ? packet[linkLen - 1] : 0x00;
+		batch.protocol[i] = ip[9];
+		batch.flags[i] = (ip[9] == IPPROTO_TCP) ? transport[13] : transport[0];
+		memcpy(&batch.srcIp[i], ip + 12, sizeof(batch.srcIp[i]));
+		if (ip[9] == IPPROTO_ICMP) {
+			batch.dstPort[i] = 0;
+		} else {
+			memcpy(&batch.dstPort[i], transport + 2, sizeof(batch.dstPort[i]));
+		}
+		batch.sane[i] = 1;
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Classify the packets collected by a capture thread. The header
+ * fields of all packets are gathered and compared at once, only the
+ * survivors are parsed and analyzed one by one with analyzePacket().
+ * Their table slots are prefetched before, so the cache misses of the
+ * batch overlap instead of adding up.
+ *
+ * \param worker The calling thread, its batch is empty afterwards
+ */
+// }}}1 DXG DOC
+void analyzeBatch(CaptureWorker *worker)
+{
+	PacketBatch &batch = *worker->batch;
+	struct timespec begin;
+	::clock_gettime(CLOCK_MONOTONIC, &begin);
+	gatherBatch(batch, worker->linkType);
+	// evidence and phantom handshakes need the segments after the SYN
+	bool allTcp = (worker->evidence != NULL) || (worker->responder != NULL);
+	unsigned int keep = classifiers.classifyBatch(batch, allTcp);
+	worker->stats.packets += batch.count;
+	worker->stats.filtered += batch.count - __builtin_popcount(keep);
+	for (unsigned int left = keep; left != 0; left &= left - 1) {
+		unsigned int i = __builtin_ctz(left);
+		if (!batch.sane[i]) {
+			continue;
+		}
+		if (worker->scanDetector != NULL) {
+			worker->scanDetector->prefetch(batch.srcIp[i]);
+		}
+		if (worker->aggregator != NULL) {
+			Deception::EventAggregator::EventType type = Deception::EventAggregator::SynEvent;
+			if (batch.protocol[i] == IPPROTO_UDP) {
+				type = Deception::EventAggregator::UdpEvent;
+			} else if (batch.protocol[i] == IPPROTO_ICMP) {
+				type = Deception::EventAggregator::IcmpEvent;
 			}
+			worker->aggregator->prefetch(type, batch.srcIp[i], batch.dstPort[i]);
 		}
 	}
+	for (; keep != 0; keep &= keep - 1) {
+		unsigned int i = __builtin_ctz(keep);
+		analyzePacket(reinterpret_cast<u_char*>(worker), &batch.headers[i],
+				batch.data + i * batch.slotSize);
+	}
+	batch.count = 0;
+	if (worker->responder != NULL) {
+		worker->responder->flush();
+	}
+	struct timespec end;
+	::clock_gettime(CLOCK_MONOTONIC, &end);
+	u_int64_t nanos = static_cast<u_int64_t>(end.tv_sec - begin.tv_sec) * 1000000000
+		+ end.tv_nsec - begin.tv_nsec;
+	worker->stats.batches++;
+	worker->stats.batchNanos += nanos;
+	if (nanos > worker->stats.maxBatchNanos) {
+		worker->stats.maxBatchNanos = nanos;
+	}
 }
 
 // {{{1 DXG DOC
 /**
- * Initialize capturing engine
+ * Add a packet to the batch of a capture thread and classify the batch
+ * once it is full. It's being called from pcap_dispatch(), because of
+ * that the parameters are fixed
+ *
+ * \param user Pointer to the CaptureWorker of the calling thread
+ * \param pkthdr The header of the fetched packet
+ * \param packet Pointer to the actual package
+ */
+// }}}1 DXG DOC
+void collectPacket(u_char* user, const struct pcap_pkthdr* pkthdr, const u_char* packet)
+{
+	CaptureWorker *worker = reinterpret_cast<CaptureWorker*>(user);
+	PacketBatch &batch = *worker->batch;
+	worker->ringBytes += pkthdr->caplen + PKT_RING_OVERHEAD;
+	struct pcap_pkthdr &header = batch.headers[batch.count];
+	header = *pkthdr;
+	if (header.caplen > batch.slotSize) {
+		header.caplen = batch.slotSize;
+	}
+	memcpy(batch.data + batch.count * batch.slotSize, packet, header.caplen);
+	if (++batch.count == CAPTURE_BATCH) {
+		analyzeBatch(worker);
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Get the name of the batch classifier picked for this cpu
+ *
+ * \return "avx2", "sse2" or "scalar"
+ */
+// }}}1 DXG DOC
+const char* batchClassifierName()
+{
+	return classifiers.batchName;
+}
+
+// {{{1 DXG DOC
+/**
+ * Open and activate a capture handle and apply the filter
  *
- * \param _modReg ModuleRegistry containing all used IPs and ports
  * \param _dev Device to sniff on
+ * \param _config Snaplen, buffer size and timeouts of the handle
+ * \param _filterRule Filter expression
+ *
+ * \return The handle
  **/
 // }}}1 DXG DOC
-void capture(Deception::ModuleRegistry &_modReg, std::string &_dev)
+static pcap_t* openHandle(const std::string &_dev, const CaptureConfig &_config, const std::string &_filterRule)
 {
 	pcap_t *handle;
 	char errbuf[PCAP_ERRBUF_SIZE];
 	struct bpf_program filter;
-	std::string filterRule, ipAddr;
-	unsigned int port;
-	Deception::ModuleRegistry::ModuleRegistryMapIterator mPtr = _modReg.begin();
-	Deception::ModuleRegistry::ModuleRegistryMapIterator mEnd = _modReg.end();
-	for (; mPtr != mEnd; mPtr++) {
-		// FIXME: do something useful in case of 0.0.0.0
-		ipAddr = _modReg.getIpAddr((*mPtr).first);
-		port = _modReg.getPort((*mPtr).first);
-		filterRule.append("(dst host " + _modReg.getIpAddr((*mPtr).first) + " and not dst port " + intToString(port) + ")");
-		if ((++mPtr) != mEnd) {
-			filterRule.append(" or ");
-		}
-		--mPtr;
-	}
-	// keyword tcp has to be escaped for pcap filter
-	filterRule.append(" and ip proto \\tcp");
-	bpf_u_int32 mask;
-	bpf_u_int32 net;
+	bpf_u_int32 net = 0;
+	// create handle, it has to be configured before it is activated
+	if ((handle = pcap_create(_dev.c_str(), errbuf)) == NULL) {
+		throw Deception::CaptureException(errbuf);
+	}
+	// we only look at the headers
+	pcap_set_snaplen(handle, (_config.snaplen > 0) ? _config.snaplen : CAPTURE_HEADER_SNAPLEN);
+	pcap_set_promisc(handle, _config.promisc ? 1 : 0);
+	pcap_set_timeout(handle, _config.timeout);
+	if (_config.bufferSize > 0) {
+		pcap_set_buffer_size(handle, _config.bufferSize);
+	}
+	if (_config.immediate) {
+		pcap_set_immediate_mode(handle, 1);
+	}
+	int status = pcap_activate(handle);
+	if (status < 0) {
+		std::string error = (status == PCAP_ERROR) ? pcap_geterr(handle) : pcap_statustostr(status);
+		pcap_close(handle);
+		throw Deception::CaptureException(error);
+	} else if (status > 0) {
+		// e.g. promiscuous mode is not supported, capture anyway
+		std::string logMsg = "warning while opening " + _dev + ": "
+			+ ((status == PCAP_WARNING) ? pcap_geterr(handle) : pcap_statustostr(status));
+		globLog.toLog(name, Deception::Error, logMsg);
+	}
+	// compile filter (for now from command line)
+	if (pcap_compile(handle, &filter, const_cast<char*>(_filterRule.c_str()), 0, net) == -1) {
+		std::string error = pcap_geterr(handle);
+		pcap_close(handle);
+		throw Deception::CaptureException(error);
+	}
+	// apply filter
+	if (pcap_setfilter(handle, &filter) == -1) {
+		std::string error = pcap_geterr(handle);
+		pcap_freecode(&filter);
+		pcap_close(handle);
+		throw Deception::CaptureException(error);
+	}
+	pcap_freecode(&filter);
+	return handle;
+}
+
+#ifdef PACKET_FANOUT
+#ifdef PACKET_FANOUT_CBPF
+// {{{1 DXG DOC
+/**
+ * Build the program that picks the capture thread of a packet. It
+ * returns a hash of the address of the remote end: the source address,
+ * unless that is one of the configured hosts, then the destination
+ * address. So both directions of a flow and all requests of a source
+ * end up at the same thread.
+ *
+ * \param _hosts Addresses of the configured hosts in network byte order
+ * \param _program Is filled with the program
+ *
+ * \retval true If the program could be built
+ * \retval false If there are too many hosts for a program
+ **/
+// }}}1 DXG DOC
+static bool fanoutProgram(const std::vector<in_addr_t> &_hosts, std::vector<struct sock_filter> &_program)
+{
+	// every host takes two instructions, seven more are needed
+	if (_hosts.size() * 2 + 7 > BPF_MAXINSNS) {
+		return false;
+	}
+	// the loads are relative to the ip header, whatever the link layer
+	struct sock_filter loadSrc = BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+			static_cast<u_int32_t>(SKF_NET_OFF + 12));
+	struct sock_filter skipDst = BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0);
+	struct sock_filter loadDst = BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+			static_cast<u_int32_t>(SKF_NET_OFF + 16));
+	// the kernel takes the result modulo the number of threads, so the
+	// bits of the address are mixed and the high ones folded onto the
+	// low ones
+	struct sock_filter mix = BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1U);
+	struct sock_filter save = BPF_STMT(BPF_MISC | BPF_TAX, 0);
+	struct sock_filter high = BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16);
+	struct sock_filter fold = BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0);
+	struct sock_filter ret = BPF_STMT(BPF_RET | BPF_A, 0);
+	_program.clear();
+	_program.push_back(loadSrc);
+	for (size_t i = 0; i < _hosts.size(); i++) {
+		struct sock_filter isHost = BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(_hosts[i]), 0, 1);
+		// behind the remaining hosts and skipDst
+		struct sock_filter toDst = BPF_JUMP(BPF_JMP | BPF_JA,
+				static_cast<u_int32_t>((_hosts.size() - i - 1) * 2 + 1), 0, 0);
+		_program.push_back(isHost);
+		_program.push_back(toDst);
+	}
+	_program.push_back(skipDst);
+	_program.push_back(loadDst);
+	_program.push_back(mix);
+	_program.push_back(save);
+	_program.push_back(high);
+	_program.push_back(fold);
+	_program.push_back(ret);
+	return true;
+}
+#endif
+
+// {{{1 DXG DOC
+/**
+ * Add a handle to a fanout group. The kernel spreads the packets of the
+ * device over all handles in the group with the program given, see
+ * fanoutProgram(), or else by a hash of addresses and ports.
+ *
+ * Both keep the directions of a flow at the same thread. The hash
+ * spreads the load more evenly, but it also spreads the requests of a
+ * source over all threads, so each of them would only see a part of a
+ * scan. With the program all requests of a source are seen by one
+ * thread, at the price that a single busy source can't be handled by
+ * more than one thread.
+ *
+ * \param _handle Activated capture handle
+ * \param _group Id of the group
+ * \param _program Program of the group, empty to use the hash
+ **/
+// }}}1 DXG DOC
+static void joinFanout(pcap_t *_handle, int _group, const std::vector<struct sock_filter> &_program)
+{
+	int fd = pcap_fileno(_handle);
+	int mode = PACKET_FANOUT_HASH;
+#ifdef PACKET_FANOUT_CBPF
+	if (!_program.empty()) {
+		mode = PACKET_FANOUT_CBPF;
+	}
+#endif
+	int arg = (_group & 0xffff) | (mode << 16);
+	if (::setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == -1) {
+		throw Deception::CaptureException(errno);
+	}
+#ifdef PACKET_FANOUT_CBPF
+	if (!_program.empty()) {
+		struct sock_fprog fprog;
+		fprog.len = _program.size();
+		fprog.filter = const_cast<struct sock_filter*>(&_program[0]);
+		if (::setsockopt(fd, SOL_PACKET, PACKET_FANOUT_DATA, &fprog, sizeof(fprog)) == -1) {
+			throw Deception::CaptureException(errno);
+		}
+	}
+#endif
+}
+#endif
+
+// {{{1 DXG DOC
+/**
+ * Main function of a capture thread
+ *
+ * \param _worker Pointer to the CaptureWorker of the thread
+ **/
+// }}}1 DXG DOC
+static void* workerMain(void *_worker)
+{
+	CaptureWorker *worker = static_cast<CaptureWorker*>(_worker);
+	// signals are handled by the main thread, their handlers log
+	sigset_t allSignals;
+	sigfillset(&allSignals);
+	::pthread_sigmask(SIG_BLOCK, &allSignals, NULL);
+	// pcap_dispatch() returns once the packets at hand are handled, so
+	// a batch waits at most for the timeout of the handle
+	for (;;) {
+		int result = pcap_dispatch(worker->handle, -1, collectPacket, reinterpret_cast<u_char*>(worker));
+		if (worker->batch->count > 0) {
+			analyzeBatch(worker);
+		}
+		// a dispatch hands over all blocks the kernel has filled, so its
+		// bytes tell how full the ring has been
+		if (worker->ringBytes > worker->stats.ringPeak) {
+			worker->stats.ringPeak = worker->ringBytes;
+		}
+		worker->ringBytes = 0;
+		time_t now = ::time(NULL);
+		if (now != worker->statsTime) {
+			struct pcap_stat ps;
+			if (pcap_stats(worker->handle, &ps) == 0) {
+				worker->stats.received = ps.ps_recv;
+				worker->stats.dropped = ps.ps_drop;
+				worker->stats.ifDropped = ps.ps_ifdrop;
+			}
+			worker->statsTime = now;
+			// summaries are due even if no more packets arrive
+			if (worker->aggregator != NULL) {
+				worker->aggregator->expire(now);
+			}
+		}
+		if (result == -1) {
+			worker->error = pcap_geterr(worker->handle);
+			break;
+		} else if (result == -2) {
+			// pcap_breakloop()
+			break;
+		}
+	}
+	// for the last report
+	struct pcap_stat ps;
+	if (pcap_stats(worker->handle, &ps) == 0) {
+		worker->stats.received = ps.ps_recv;
+		worker->stats.dropped = ps.ps_drop;
+		worker->stats.ifDropped = ps.ps_ifdrop;
+	}
+	// summaries of what is left
+	worker->aggregator->flush();
+	__sync_fetch_and_sub(worker->running, 1);
+	return NULL;
+}
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _config Snaplen, buffer size, timeouts and number of threads
+ * \param _pipeline Pipeline the threads push their events into
+ * \param _flows Table to store the SYNs in, none if NULL
+ * \param _signatures Signatures to tell the OS of sources, none if NULL
+ **/
+// }}}1 DXG DOC
+CaptureEngine::CaptureEngine(const CaptureConfig &_config, Deception::EventPipeline &_pipeline,
+		Deception::FlowTable *_flows, const Deception::OsSignatures *_signatures) :
+	config(_config),
+	pipeline(_pipeline),
+	flows(_flows),
+	signatures(_signatures),
+	evidenceWriter(NULL),
+	nextReport(0),
+	published(0),
+	running(0)
+{
+	this->addMetrics();
+}
+
+// {{{1 DXG DOC
+/**
+ * Destructor, stops the threads
+ **/
+// }}}1 DXG DOC
+CaptureEngine::~CaptureEngine()
+{
+	this->stop();
+}
+
+// {{{1 DXG DOC
+/**
+ * Open the handles and start the capture threads, each with its own
+ * handle in one fanout group. Returns as soon as they are running.
+ *
+ * \param _modReg ModuleRegistry containing all used IPs and ports. It is
+ * only read here; the threads use a snapshot of it.
+ * \param _dev Device to sniff on
+ **/
+// }}}1 DXG DOC
+void CaptureEngine::start(Deception::ModuleRegistry &_modReg, std::string &_dev)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	// the kernel only passes SYNs to our hosts, the ports are checked
+	// against a bitmap in analyzePacket()
+	this->portFilter.add(_modReg);
+	if (!this->portFilter.addPhantoms(this->config.phantomPorts)) {
+		std::string logMsg = "ignoring bad phantom ports in " + this->config.phantomPorts;
+		globLog.toLog(name, Deception::Error, logMsg);
+	}
+	bool keepEvidence = !this->config.evidence.dir.empty();
+	std::string filterRule = this->portFilter.expression(keepEvidence, this->config.probes);
 	// get a nice and useful device, but only if none was configured
 	if (_dev.length() == 0) {
 		if ((_dev = pcap_lookupdev(errbuf)).length() == 0) {
 			throw Deception::CaptureException(errbuf);
 		}
 	}
-	// open handle
-	if ((handle = pcap_open_live(const_cast<char*>(_dev.c_str()), BUFSIZ, 1, 0, errbuf)) == NULL) {
-		throw Deception::CaptureException(errbuf);
+
+	int workers = this->config.workers;
+	if (workers <= 0) {
+		long cores = ::sysconf(_SC_NPROCESSORS_ONLN);
+		workers = (cores > 0) ? cores : 1;
 	}
-	// compile filter (for now from command line)
-	if (pcap_compile(handle, &filter, const_cast<char*>(filterRule.c_str()), 0, net) == -1) {
-		throw Deception::CaptureException(errbuf);
+#ifndef PACKET_FANOUT
+	// without fanout every handle would see every packet
+	if (workers > 1) {
+		globLog.toLog(name, Deception::Error, "no PACKET_FANOUT support, using a single capture thread");
 	}
-	// apply filter
-	if (pcap_setfilter(handle, &filter) == -1) {
-		throw Deception::CaptureException(pcap_geterr(handle));
+	workers = 1;
+#endif
+
+#ifdef PACKET_FANOUT
+	// the scan detection and the aggregation need all requests of a
+	// source in one thread
+	std::vector<struct sock_filter> fanout;
+#ifdef PACKET_FANOUT_CBPF
+	if ((workers > 1) && !fanoutProgram(this->portFilter.addresses(), fanout)) {
+		globLog.toLog(name, Deception::Error, "too many hosts to fan out by source, sources are split over the capture threads");
+	}
+#endif
+#endif
+
+	// the handles are opened before any thread starts, so errors are
+	// reported to the caller
+	this->pool.resize(workers);
+	try {
+		for (int i = 0; i < workers; i++) {
+			CaptureWorker &worker = this->pool[i];
+			worker.handle = openHandle(_dev, this->config, filterRule);
+			// the parser needs to know which link layer header to skip
+			worker.linkType = pcap_datalink(worker.handle);
+#ifdef PACKET_FANOUT
+			if ((workers > 1) && !fanout.empty()) {
+				try {
+					joinFanout(worker.handle, ::getpid(), fanout);
+				} catch (Deception::CaptureException &e) {
+					if (i > 0) {
+						throw;
+					}
+					// kernels before 4.2 only know the built-in modes
+					globLog.toLog(name, Deception::Error,
+							"no fanout by source, sources are split over the capture threads");
+					fanout.clear();
+				}
+			}
+			if ((workers > 1) && fanout.empty()) {
+				joinFanout(worker.handle, ::getpid(), fanout);
+			}
+#endif
+			worker.batch = new PacketBatch((this->config.snaplen > 0) ? this->config.snaplen : CAPTURE_HEADER_SNAPLEN);
+			worker.aggregator = new Deception::EventAggregator(name);
+			worker.aggregator->setPipeline(&this->pipeline);
+			if (this->config.scanSources > 0) {
+				// the budget is shared by all threads, which see
+				// different sources unless the fanout falls back to the
+				// hash
+				worker.scanDetector = new Deception::ScanDetector(name,
+						(this->config.scanSources + workers - 1) / workers);
+			}
+			worker.pipeline = &this->pipeline;
+			worker.portFilter = &this->portFilter;
+			worker.flowTable = this->flows;
+			worker.osSignatures = this->signatures;
+			worker.running = &this->running;
+		}
+	} catch (Deception::CaptureException &e) {
+		this->stop();
+		throw;
+	}
+
+	// evidence is nice to have, capture goes on without it
+	if (keepEvidence) {
+		int snaplen = (this->config.snaplen > 0) ? this->config.snaplen : CAPTURE_HEADER_SNAPLEN;
+		this->evidenceWriter = new Deception::EvidenceWriter(this->config.evidence, &this->pipeline);
+		try {
+			this->evidenceWriter->start(this->pool[0].linkType, snaplen);
+			for (int i = 0; i < workers; i++) {
+				this->pool[i].evidence = new Deception::EvidenceRecorder(*this->evidenceWriter,
+						(this->config.evidence.flows + workers - 1) / workers,
+						this->config.evidence.packets, snaplen);
+				this->pool[i].evidence->setFlowTable(this->flows);
+				// a source is detected by one thread, its flows may be
+				// kept by others
+				this->pool[i].evidence->setSourceMarks(&this->sourceMarks);
+			}
+		} catch (Deception::IOException &e) {
+			std::string logMsg = "not keeping evidence: " + e.toString();
+			globLog.toLog(name, Deception::Error, logMsg);
+			for (int i = 0; i < workers; i++) {
+				delete this->pool[i].evidence;
+				this->pool[i].evidence = NULL;
+			}
+			delete this->evidenceWriter;
+			this->evidenceWriter = NULL;
+		}
 	}
+
+	// phantom ports are answered through raw sockets, one per thread
+	if (!this->config.phantomPorts.empty()) {
+		try {
+			for (int i = 0; i < workers; i++) {
+				this->pool[i].responder = new Deception::PhantomResponder();
+				this->pool[i].responder->open();
+			}
+		} catch (Deception::IOException &e) {
+			std::string logMsg = "not answering phantom ports: " + e.toString();
+			globLog.toLog(name, Deception::Error, logMsg);
+			for (int i = 0; i < workers; i++) {
+				delete this->pool[i].responder;
+				this->pool[i].responder = NULL;
+			}
+		}
+	}
+
 	// now let's loop around and snoop around
-	if (pcap_loop(handle, -1, analyzePacket, NULL) == -1) {
-		throw Deception::CaptureException(pcap_geterr(handle));
+	for (int i = 0; i < workers; i++) {
+		CaptureWorker &worker = this->pool[i];
+		__sync_fetch_and_add(&this->running, 1);
+		if (::pthread_create(&worker.thread, NULL, workerMain, &worker) != 0) {
+			__sync_fetch_and_sub(&this->running, 1);
+			worker.error = "could not start capture thread";
+			pcap_close(worker.handle);
+			worker.handle = NULL;
+		} else {
+			worker.started = true;
+		}
+	}
+	if (this->config.statsInterval > 0) {
+		this->nextReport = ::time(NULL) + this->config.statsInterval;
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Stop the capture threads and close their handles
+ **/
+// }}}1 DXG DOC
+void CaptureEngine::stop()
+{
+	for (size_t i = 0; i < this->pool.size(); i++) {
+		if (this->pool[i].started) {
+			pcap_breakloop(this->pool[i].handle);
+		}
+	}
+	for (size_t i = 0; i < this->pool.size(); i++) {
+		CaptureWorker &worker = this->pool[i];
+		if (worker.started) {
+			::pthread_join(worker.thread, NULL);
+			worker.started = false;
+		}
+	}
+	// what has happened since the last report
+	this->publishMetrics();
+	if (this->nextReport != 0) {
+		this->logStats();
+		this->nextReport = 0;
+	}
+	for (size_t i = 0; i < this->pool.size(); i++) {
+		CaptureWorker &worker = this->pool[i];
+		if (worker.handle != NULL) {
+			pcap_close(worker.handle);
+			worker.handle = NULL;
+		}
+		delete worker.aggregator;
+		worker.aggregator = NULL;
+		delete worker.scanDetector;
+		worker.scanDetector = NULL;
+		delete worker.evidence;
+		worker.evidence = NULL;
+		delete worker.batch;
+		worker.batch = NULL;
+		if (worker.responder != NULL) {
+			unsigned long failed = worker.responder->getFailed();
+			delete worker.responder;
+			worker.responder = NULL;
+			if (failed > 0) {
+				std::string logMsg = "could not send " + intToString(failed) + " phantom replies";
+				globLog.toLog(name, Deception::Error, logMsg);
+			}
+		}
+	}
+	// writes what the threads have left
+	delete this->evidenceWriter;
+	this->evidenceWriter = NULL;
+}
+
+// {{{1 DXG DOC
+/**
+ * Check if any capture thread is still running
+ **/
+// }}}1 DXG DOC
+bool CaptureEngine::isRunning() const
+{
+	return this->running > 0;
+}
+
+// {{{1 DXG DOC
+/**
+ * Get the reason why the first capture thread has ended
+ *
+ * \return Error message, empty if none
+ **/
+// }}}1 DXG DOC
+std::string CaptureEngine::getError() const
+{
+	for (size_t i = 0; i < this->pool.size(); i++) {
+		if (!this->pool[i].error.empty()) {
+			return this->pool[i].error;
+		}
+	}
+	return "";
+}
+
+// {{{1 DXG DOC
+/**
+ * Log the counters of the capture threads once the report interval has
+ * passed. Has to be called regularly by the owner of the engine.
+ *
+ * \param _now Current time
+ **/
+// }}}1 DXG DOC
+void CaptureEngine::report(time_t _now)
+{
+	// scrapers get fresh counters every second
+	if (_now != this->published) {
+		this->publishMetrics();
+		this->published = _now;
+	}
+	if ((this->nextReport == 0) || (_now < this->nextReport)) {
+		return;
+	}
+	this->logStats();
+	this->nextReport = _now + this->config.statsInterval;
+}
+
+// {{{1 DXG DOC
+/**
+ * Sum up the counters of the capture threads, without the peaks
+ *
+ * \return The sums
+ **/
+// }}}1 DXG DOC
+CaptureStats CaptureEngine::sumStats() const
+{
+	CaptureStats sum;
+	for (size_t i = 0; i < this->pool.size(); i++) {
+		const CaptureStats &stats = this->pool[i].stats;
+		sum.received += stats.received;
+		sum.dropped += stats.dropped;
+		sum.ifDropped += stats.ifDropped;
+		sum.packets += stats.packets;
+		sum.filtered += stats.filtered;
+		sum.parseErrors += stats.parseErrors;
+		for (int c = 0; c < CaptureClasses; c++) {
+			sum.classified[c] += stats.classified[c];
+		}
+		sum.events += stats.events;
+		sum.batches += stats.batches;
+		sum.batchNanos += stats.batchNanos;
+	}
+	return sum;
+}
+
+// {{{1 DXG DOC
+/**
+ * Register the counters of the capture threads as metrics
+ **/
+// }}}1 DXG DOC
+void CaptureEngine::addMetrics()
+{
+	static const char *classNames[CaptureClasses] = { "tcp", "udp", "icmp", "phantom" };
+	this->metricIds[ReceivedMetric] = globMetrics.addCounter("deceptiond_capture_received_total",
+			"packets passed by the kernel filter");
+	this->metricIds[DroppedMetric] = globMetrics.addCounter("deceptiond_capture_dropped_total",
+			"packets dropped for lack of room in the ring");
+	this->metricIds[IfDroppedMetric] = globMetrics.addCounter("deceptiond_capture_if_dropped_total",
+			"packets dropped by the device or its driver");
+	this->metricIds[FilteredMetric] = globMetrics.addCounter("deceptiond_capture_filtered_total",
+			"packets dropped by the batch classifier");
+	this->metricIds[ParseErrorMetric] = globMetrics.addCounter("deceptiond_capture_parse_errors_total",
+			"packets that could not be parsed");
+	this->metricIds[EventMetric] = globMetrics.addCounter("deceptiond_capture_events_total",
+			"events reported by the capture threads");
+	this->metricIds[BatchNanosMetric] = globMetrics.addCounter("deceptiond_capture_batch_nanoseconds_total",
+			"time spent analyzing batches");
+	for (int c = 0; c < CaptureClasses; c++) {
+		this->classIds[c] = globMetrics.addCounter("deceptiond_capture_classified_total",
+				"packets looked at per classifier", Deception::Metrics::label("class", classNames[c]));
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Copy the counters of the capture threads to the metrics
+ **/
+// }}}1 DXG DOC
+void CaptureEngine::publishMetrics()
+{
+	CaptureStats sum = this->sumStats();
+	globMetrics.set(this->metricIds[ReceivedMetric], sum.received);
+	globMetrics.set(this->metricIds[DroppedMetric], sum.dropped);
+	globMetrics.set(this->metricIds[IfDroppedMetric], sum.ifDropped);
+	globMetrics.set(this->metricIds[FilteredMetric], sum.filtered);
+	globMetrics.set(this->metricIds[ParseErrorMetric], sum.parseErrors);
+	globMetrics.set(this->metricIds[EventMetric], sum.events);
+	globMetrics.set(this->metricIds[BatchNanosMetric], sum.batchNanos);
+	for (int c = 0; c < CaptureClasses; c++) {
+		globMetrics.set(this->classIds[c], sum.classified[c]);
+	}
+}
+
+// {{{1 DXG DOC
+/**
+ * Log what the capture threads have done since the last report: the
+ * drops of the kernel, how full the ring got, the hits of the
+ * classifiers and the time spent per batch. The peaks of the threads
+ * are reset.
+ **/
+// }}}1 DXG DOC
+void CaptureEngine::logStats()
+{
+	CaptureStats sum = this->sumStats();
+	unsigned long ringPeak = 0;
+	u_int64_t maxBatchNanos = 0;
+	for (size_t i = 0; i < this->pool.size(); i++) {
+		CaptureStats &stats = this->pool[i].stats;
+		// the busiest thread is the one to size the ring for
+		if (stats.ringPeak > ringPeak) {
+			ringPeak = stats.ringPeak;
+		}
+		if (stats.maxBatchNanos > maxBatchNanos) {
+			maxBatchNanos = stats.maxBatchNanos;
+		}
+		stats.ringPeak = 0;
+		stats.maxBatchNanos = 0;
+	}
+	CaptureStats &last = this->reported;
+	// the counters of pcap_stats() are 32 bit wide and wrap around
+	unsigned int received = static_cast<unsigned int>(sum.received - last.received);
+	unsigned int dropped = static_cast<unsigned int>(sum.dropped - last.dropped);
+	unsigned int ifDropped = static_cast<unsigned int>(sum.ifDropped - last.ifDropped);
+	unsigned long batches = sum.batches - last.batches;
+	// libpcap falls back to 2 MB if no buffer size is given
+	unsigned long ringSize = (this->config.bufferSize > 0) ? this->config.bufferSize : 2 * 1024 * 1024;
+	LOGMSG(name, Deception::Info, "capture: received " << received
+			<< ", dropped " << dropped << " (" << std::fixed << std::setprecision(2)
+			<< ((received > 0) ? dropped * 100.0 / received : 0.0) << "%)"
+			<< ", dropped by device " << ifDropped
+			<< ", ring peak " << (ringPeak * 100 / ringSize) << "%"
+			<< ", analyzed " << (sum.packets - last.packets) << " in " << batches << " batches"
+			<< ", filtered " << (sum.filtered - last.filtered)
+			<< ", parse errors " << (sum.parseErrors - last.parseErrors)
+			<< ", tcp " << (sum.classified[TcpClass] - last.classified[TcpClass])
+			<< ", udp " << (sum.classified[UdpClass] - last.classified[UdpClass])
+			<< ", icmp " << (sum.classified[IcmpClass] - last.classified[IcmpClass])
+			<< ", phantom " << (sum.classified[PhantomClass] - last.classified[PhantomClass])
+			<< ", events " << (sum.events - last.events)
+			<< ", " << ((batches > 0) ? (sum.batchNanos - last.batchNanos) / batches / 1000 : 0)
+			<< " us per batch, " << (maxBatchNanos / 1000) << " us at most");
+	this->reported = sum;
+}
+
+// {{{1 DXG DOC
+/**
+ * Run the capturing engine in the current process. Starts the capture
+ * threads and writes their events to the logs until all of them have
+ * ended.
+ *
+ * \param _modReg ModuleRegistry containing all used IPs and ports
+ * \param _dev Device to sniff on
+ * \param _config Snaplen, buffer size, timeouts and number of threads
+ * \param _flows Table to store the SYNs in, none if NULL
+ * \param _signatures Signatures to tell the OS of sources, none if NULL
+ **/
+// }}}1 DXG DOC
+void capture(Deception::ModuleRegistry &_modReg, std::string &_dev, const CaptureConfig &_config,
+		Deception::FlowTable *_flows, const Deception::OsSignatures *_signatures)
+{
+	Deception::EventPipeline pipeline;
+	CaptureEngine engine(_config, pipeline, _flows, _signatures);
+	engine.start(_modReg, _dev);
+	// this thread writes the logs for all of them
+	while (engine.isRunning()) {
+		engine.report(::time(NULL));
+		if (pipeline.drain() == 0) {
+			::usleep(10000);
+		}
+	}
+	engine.stop();
+	pipeline.drain();
+	std::string error = engine.getError();
+	if (!error.empty()) {
+		throw Deception::CaptureException(error);
 	}
-	pcap_close(handle);
 	return;
 }
@@ -38,9 +38,289 @@
 #include <pcap.h>
 #include <moduleregistry.h>
 #include <defs.h>
+#include "aggregator.h"
+#include "eventpipeline.h"
+#include "scandetector.h"
+#include "portfilter.h"
+#include "flowtable.h"
+#include "ossignatures.h"
+#include "evidence.h"
+#include "phantom.h"
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <string.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+// {{{1 DXG DOC
+/**
+ * Header fields of a captured packet, filled by parsePacket().
+ * Addresses and ports are in network byte order, the ports are 0 for
+ * protocols without them. The tcp fields are only set for tcp, the icmp
+ * fields only for icmp. tcpOptions points into the captured data and is
+ * only valid as long as it is.
+ */
+// }}}1 DXG DOC
+struct PacketInfo
+{
+	in_addr_t srcIp;			///< source address
+	in_addr_t dstIp;			///< destination address
+	in_port_t srcPort;			///< source port
+	in_port_t dstPort;			///< destination port
+	u_int8_t protocol;			///< ip protocol
+	u_int8_t ttl;				///< ip time to live
+	bool dontFragment;			///< flag, if the ip don't fragment bit is set
+	u_int16_t ipId;				///< ip identification in host byte order
+	u_int8_t icmpType;			///< icmp message type, e.g. ICMP_ECHO
+	u_int8_t icmpCode;			///< icmp message code
+	u_int8_t tcpFlags;			///< tcp flags, TH_SYN etc.
+	u_int32_t seq;				///< tcp sequence number in host byte order
+	u_int32_t ack;				///< tcp acknowledgement number in host byte order
+	u_int16_t window;			///< tcp window in host byte order
+	const u_char *tcpOptions;	///< start of the captured tcp options
+	size_t tcpOptionsLen;		///< length of the captured tcp options
+	const u_char *payload;		///< start of the captured tcp payload
+	size_t payloadCaptured;		///< length of the captured tcp payload
+	size_t payloadLen;			///< length of the tcp payload as sent
+};
+
+/// bytes needed for the headers we parse: ethernet with two vlan tags,
+/// ip and tcp with maximum options
+#define CAPTURE_HEADER_SNAPLEN	(14 + 2 * 4 + 60 + 60)
+
+/// packets classified at once by analyzeBatch(), one bit of a mask each
+#define CAPTURE_BATCH			32
+
+// {{{1 DXG DOC
+/**
+ * Packets collected by a capture thread to be classified at once. The
+ * packets are copied, as the ring slots they come from are handed back
+ * to the kernel before pcap_dispatch() returns.
+ *
+ * The header fields the classification looks at are gathered into one
+ * array per field, so a vector compare tests all packets at once.
+ */
+// }}}1 DXG DOC
+struct PacketBatch
+{
+	unsigned int count;						///< packets in the batch
+	size_t slotSize;						///< bytes reserved per packet
+	u_char *data;							///< the packets, slotSize bytes each
+	struct pcap_pkthdr headers[CAPTURE_BATCH];	///< headers of the packets
+	u_int8_t sane[CAPTURE_BATCH];			///< 1 if the fields below could be read
+	u_int8_t etherHi[CAPTURE_BATCH];		///< high byte of the ethertype
+	u_int8_t etherLo[CAPTURE_BATCH];		///< low byte of the ethertype
+	u_int8_t protocol[CAPTURE_BATCH];		///< ip protocol
+	u_int8_t flags[CAPTURE_BATCH];			///< tcp flags, icmp type for icmp
+	in_addr_t srcIp[CAPTURE_BATCH];			///< source address
+	in_port_t dstPort[CAPTURE_BATCH];		///< destination port, 0 for icmp
+
+	PacketBatch(size_t _snaplen);
+	~PacketBatch();
+	private:
+		// hidden
+		PacketBatch(const PacketBatch &rhs);
+		PacketBatch &operator=(const PacketBatch &rhs);
+};
+
+// {{{1 DXG DOC
+/**
+ * Settings of the capture handle, see pcap_create(3PCAP).
+ *
+ * On Linux, libpcap 1.5 and later capture into a memory mapped
+ * TPACKET_V3 ring of bufferSize bytes, which the kernel fills in blocks.
+ * A small snaplen packs more packets into the ring, so fewer are
+ * dropped under floods.
+ */
+// }}}1 DXG DOC
+struct CaptureConfig
+{
+	int snaplen;				///< bytes captured per packet
+	int bufferSize;				///< size of the kernel ring in bytes, 0 for the default
+	int timeout;				///< milliseconds until a partly filled block is delivered
+	bool immediate;				///< flag, if packets are delivered as soon as they arrive
+	bool promisc;				///< flag, if the device is put into promiscuous mode
+	int workers;				///< number of capture threads, 0 for one per core
+	int scanSources;			///< sources tracked by scan detection, 0 to disable it
+	bool inProcess;				///< flag, if capture runs as threads of the daemon
+	int flows;					///< connections whose SYN is kept for the sessions, 0 for none
+	std::string osdb;			///< file with the OS signatures, none are used if empty
+	bool probes;				///< flag, if udp and icmp probes are reported
+	std::string phantomPorts;	///< ports answered by the PhantomResponder, e.g. "1-1023"
+	time_t statsInterval;		///< seconds between reports of the counters, 0 for none
+	Deception::EvidenceConfig evidence;	///< where packets of interesting flows are kept
+
+	CaptureConfig() :
+		snaplen(CAPTURE_HEADER_SNAPLEN),
+		bufferSize(4 * 1024 * 1024),
+		timeout(100),
+		immediate(false),
+		promisc(true),
+		workers(0),
+		scanSources(16384),
+		inProcess(false),
+		flows(4096),
+		probes(true),
+		statsInterval(300)
+	{ }
+};
+
+/// classifiers counted in CaptureStats::classified
+enum CaptureClass
+{
+	TcpClass,
+	UdpClass,
+	IcmpClass,
+	PhantomClass,
+	CaptureClasses
+};
+
+// {{{1 DXG DOC
+/**
+ * Counters of a capture thread. They are written by the thread only and
+ * read by the owner of the engine without locking, so a report may miss
+ * the batch at hand.
+ */
+// }}}1 DXG DOC
+struct CaptureStats
+{
+	unsigned long received;			///< packets passed by the kernel filter, see pcap_stats(3PCAP)
+	unsigned long dropped;			///< packets dropped for lack of room in the ring
+	unsigned long ifDropped;		///< packets dropped by the device or its driver
+	unsigned long packets;			///< packets handed to analyzeBatch()
+	unsigned long filtered;			///< packets dropped by the batch classifier
+	unsigned long parseErrors;		///< packets parsePacket() could not make sense of
+	unsigned long classified[CaptureClasses];	///< packets looked at by each classifier
+	unsigned long events;			///< events dispatched
+	unsigned long batches;			///< calls of analyzeBatch()
+	u_int64_t batchNanos;	///< time spent in analyzeBatch()
+	u_int64_t maxBatchNanos;	///< longest analyzeBatch(), reset by the owner
+	unsigned long ringPeak;			///< most ring bytes fetched at once, reset by the owner
+
+	CaptureStats()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+};
+
+// {{{1 DXG DOC
+/**
+ * State of a capture thread, passed to analyzePacket() as its user
+ * pointer. Every thread has its own handle, aggregator and scan
+ * detector, so the threads share nothing but the pipeline.
+ */
+// }}}1 DXG DOC
+struct CaptureWorker
+{
+	pcap_t *handle;							///< capture handle of this thread
+	int linkType;							///< link layer type of handle
+	Deception::EventAggregator *aggregator;	///< folds repeated connection requests
+	Deception::ScanDetector *scanDetector;	///< detects port scans, may be NULL
+	const Deception::PortFilter *portFilter;	///< hosts and ports to report, everything if NULL
+	Deception::EventPipeline *pipeline;		///< events go here, written right away if NULL
+	Deception::FlowTable *flowTable;		///< SYNs for the sessions, none are stored if NULL
+	const Deception::OsSignatures *osSignatures;	///< tells the OS of sources, none if NULL
+	Deception::EvidenceRecorder *evidence;	///< keeps the last packets of flows, none if NULL
+	PacketBatch *batch;						///< packets collected by collectPacket()
+	Deception::PhantomResponder *responder;	///< answers phantom ports, none if NULL
+	CaptureStats stats;						///< what the thread has done so far
+	unsigned long ringBytes;				///< ring bytes fetched by the running pcap_dispatch()
+	time_t statsTime;						///< when pcap_stats() has been asked last
+	pthread_t thread;						///< the thread
+	bool started;							///< flag, if thread has been started
+	volatile int *running;					///< counter of running threads
+	std::string error;						///< why the capture loop has ended
+
+	CaptureWorker() :
+		handle(NULL),
+		linkType(DLT_EN10MB),
+		aggregator(NULL),
+		scanDetector(NULL),
+		portFilter(NULL),
+		pipeline(NULL),
+		flowTable(NULL),
+		osSignatures(NULL),
+		evidence(NULL),
+		batch(NULL),
+		responder(NULL),
+		ringBytes(0),
+		statsTime(0),
+		started(false),
+		running(NULL)
+	{ }
+};
+
+// {{{1 DXG DOC
+/**
+ * \class CaptureEngine
+ *
+ * The capture threads with their handles and the snapshot of the
+ * registry they filter with. start() returns once the threads are
+ * running; their events are pushed into the pipeline, which has to be
+ * drained by the owner. So the engine can run in a process of its own
+ * (see capture()) or as threads of the daemon, sharing its pipeline.
+ */
+// }}}1 DXG DOC
+class CaptureEngine
+{
+	public:
+		CaptureEngine(const CaptureConfig &_config, Deception::EventPipeline &_pipeline,
+				Deception::FlowTable *_flows = NULL,
+				const Deception::OsSignatures *_signatures = NULL);
+		~CaptureEngine();
+		void start(Deception::ModuleRegistry &_modReg, std::string &_dev);
+		void stop();
+		bool isRunning() const;
+		std::string getError() const;
+		void report(time_t _now);
+	private:
+		/// counters of CaptureStats exported as metrics
+		enum CaptureMetric
+		{
+			ReceivedMetric,
+			DroppedMetric,
+			IfDroppedMetric,
+			FilteredMetric,
+			ParseErrorMetric,
+			EventMetric,
+			BatchNanosMetric,
+			CaptureMetrics
+		};
+
+		CaptureConfig config;					///< settings of the handles
+		Deception::EventPipeline &pipeline;		///< events go here
+		Deception::PortFilter portFilter;		///< immutable snapshot of the registry
+		Deception::FlowTable *flows;			///< SYNs for the sessions, may be NULL
+		const Deception::OsSignatures *signatures;	///< OS of the sources, may be NULL
+		Deception::EvidenceWriter *evidenceWriter;	///< writes evidence files, may be NULL
+		Deception::SourceMarks sourceMarks;		///< scanners marked by any of the threads
+		std::vector<CaptureWorker> pool;		///< the threads
+		CaptureStats reported;					///< sums of the counters at the last report
+		time_t nextReport;						///< when the counters are reported next
+		time_t published;						///< when the metrics have been updated last
+		int metricIds[CaptureMetrics];			///< ids of the metrics, see CaptureMetric
+		int classIds[CaptureClasses];			///< ids of the classified packets per classifier
+		volatile int running;					///< number of threads still running
+
+		void logStats();
+		CaptureStats sumStats() const;
+		void addMetrics();
+		void publishMetrics();
+		// hidden
+		CaptureEngine(const CaptureEngine &rhs);
+		CaptureEngine &operator=(const CaptureEngine &rhs);
+};
 
 // declare prototypes
-void analyzePacket(u_char* useless, const struct pcap_pkthdr* pkthdr, const u_char* packet);
-void capture(Deception::ModuleRegistry &_modReg, std::string &_dev);
-const char* intToString(unsigned int);
+bool parsePacket(const u_char *packet, bpf_u_int32 caplen, int linkType, PacketInfo &info);
+void parseSynOptions(const PacketInfo &info, Deception::SynFingerprint &syn);
+void analyzePacket(u_char* user, const struct pcap_pkthdr* pkthdr, const u_char* packet);
+void collectPacket(u_char* user, const struct pcap_pkthdr* pkthdr, const u_char* packet);
+void analyzeBatch(CaptureWorker *worker);
+const char* batchClassifierName();
+void capture(Deception::ModuleRegistry &_modReg, std::string &_dev, const CaptureConfig &_config,
+		Deception::FlowTable *_flows = NULL, const Deception::OsSignatures *_signatures = NULL);
+std::string intToString(unsigned int);
 #endif // _PCAP_H
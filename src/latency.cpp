@@ -0,0 +1,367 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file latency.cpp
+ *
+ * Contains the implementation of the latency histograms
+ */
+#include "latency.h"
+#include "metrics.h"
+#include "logging.h"
+
+#include <new>
+#include <sstream>
+
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+extern Deception::Logging globLog;
+
+Deception::Latency globLatency;
+
+/// names of the phases, as in the labels of the summaries
+static const char *phaseNames[] = { "accept_to_start", "start_to_write", "session" };
+/// percentiles exported and logged
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _listener Id of the listener, -1 for none
+ * \param _accepted Monotonic time the connection was accepted
+ */
+// }}}1 DXG DOC
+Deception::Latency::Session::Session(int _listener, const struct timespec &_accepted) :
+	listener(_listener),
+	accepted(_accepted)
+{ // {{{1
+	this->started = _accepted;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Record the time from accept() to now, when the module is about to
+ * be started
+ */
+// }}}1 DXG DOC
+void Deception::Latency::Session::moduleStarted()
+{ // {{{1
+	::clock_gettime(CLOCK_MONOTONIC, &this->started);
+	globLatency.record(this->listener, AcceptToStart, Latency::since(this->accepted));
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Record the time from the start of the module to its first write
+ */
+// }}}1 DXG DOC
+void Deception::Latency::Session::firstOutput()
+{ // {{{1
+	globLatency.record(this->listener, StartToWrite, Latency::since(this->started));
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Constructor, nothing is mapped before init()
+ */
+// }}}1 DXG DOC
+Deception::Latency::Latency() :
+	histograms(NULL),
+	mapSize(0),
+	capacity(0),
+	dumpFlag(0)
+{ // {{{1
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor, unmaps the histograms of this process
+ */
+// }}}1 DXG DOC
+Deception::Latency::~Latency()
+{ // {{{1
+	if (this->histograms != NULL) {
+		::munmap(this->histograms, this->mapSize);
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Map the histograms, has to be called before the session processes
+ * are forked
+ *
+ * \param _listeners Number of listeners, every one takes about 24 KB
+ *
+ * \exception std::bad_alloc Shared memory could not be mapped
+ */
+// }}}1 DXG DOC
+void Deception::Latency::init(size_t _listeners)
+{ // {{{1
+	if (this->histograms != NULL) {
+		return;
+	}
+	this->mapSize = _listeners * Phases * sizeof(Histogram);
+	// anonymous mappings are zeroed, so are all buckets
+	void *mem = ::mmap(NULL, this->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+	this->histograms = static_cast<Histogram*>(mem);
+	this->capacity = _listeners;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Add a listener
+ *
+ * \param _ipaddr Address the listener is bound to
+ * \param _port Port of the listener
+ *
+ * \return Id of the listener, -1 if there is no room or nothing is mapped
+ */
+// }}}1 DXG DOC
+int Deception::Latency::addListener(const std::string &_ipaddr, unsigned int _port)
+{ // {{{1
+	if ((this->histograms == NULL) || (this->addresses.size() >= this->capacity)) {
+		return -1;
+	}
+	this->addresses.push_back(std::make_pair(_ipaddr, _port));
+	return this->addresses.size() - 1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the bucket of a value
+ */
+// }}}1 DXG DOC
+unsigned int Deception::Latency::bucketOf(u_int64_t _value)
+{ // {{{1
+	if (_value < subBuckets) {
+		return _value;
+	}
+	// values of [2^n, 2^(n+1)) share subBuckets / 2 buckets of 2^(n-5)
+	unsigned int shift = 63 - __builtin_clzll(_value) - 5;
+	unsigned int bucket = (subBuckets / 2) * shift + (_value >> shift);
+	return (bucket < buckets) ? bucket : buckets - 1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the highest value counted in a bucket
+ */
+// }}}1 DXG DOC
+u_int64_t Deception::Latency::highestOf(unsigned int _bucket)
+{ // {{{1
+	if (_bucket < subBuckets) {
+		return _bucket;
+	}
+	unsigned int shift = _bucket / (subBuckets / 2) - 1;
+	u_int64_t lowest = static_cast<u_int64_t>(_bucket % (subBuckets / 2) + subBuckets / 2) << shift;
+	return lowest + (static_cast<u_int64_t>(1) << shift) - 1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Record a value
+ *
+ * \param _listener Id of the listener, nothing is done for -1
+ * \param _phase Phase the value was measured for
+ * \param _micros The value in microseconds
+ */
+// }}}1 DXG DOC
+void Deception::Latency::record(int _listener, Phase _phase, u_int64_t _micros)
+{ // {{{1
+	if ((_listener < 0) || (static_cast<size_t>(_listener) >= this->addresses.size())) {
+		return;
+	}
+	Histogram &histogram = this->histograms[_listener * Phases + _phase];
+	__sync_fetch_and_add(&histogram.counts[bucketOf(_micros)], 1);
+	__sync_fetch_and_add(&histogram.sum, _micros);
+	__sync_fetch_and_add(&histogram.count, 1);
+	u_int64_t seen = histogram.max;
+	while (_micros > seen) {
+		u_int64_t previous = __sync_val_compare_and_swap(&histogram.max, seen, _micros);
+		if (previous == seen) {
+			break;
+		}
+		seen = previous;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get a percentile of a histogram, as the highest value of the bucket
+ * it falls into
+ *
+ * \param _listener Id of the listener
+ * \param _phase Phase of the values
+ * \param _quantile Quantile, e.g. 0.99
+ *
+ * \return The percentile in microseconds, 0 without values
+ */
+// }}}1 DXG DOC
+u_int64_t Deception::Latency::percentile(int _listener, Phase _phase, double _quantile) const
+{ // {{{1
+	if ((_listener < 0) || (static_cast<size_t>(_listener) >= this->addresses.size())) {
+		return 0;
+	}
+	const Histogram &histogram = this->histograms[_listener * Phases + _phase];
+	// the buckets may run ahead of the count while values are recorded
+	u_int64_t rank = static_cast<u_int64_t>(_quantile * histogram.count + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+	u_int64_t seen = 0;
+	for (unsigned int b = 0; b < buckets; b++) {
+		seen += histogram.counts[b];
+		if (seen >= rank) {
+			u_int64_t highest = highestOf(b);
+			return (highest < histogram.max) ? highest : histogram.max;
+		}
+	}
+	return histogram.max;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write the percentiles of all listeners as summaries in the text
+ * format of Prometheus 0.0.4
+ *
+ * \return The summaries, empty before init()
+ */
+// }}}1 DXG DOC
+std::string Deception::Latency::format() const
+{ // {{{1
+	if (this->addresses.empty()) {
+		return "";
+	}
+	const char *name = "deceptiond_latency_microseconds";
+	std::ostringstream out;
+	out << "# HELP " << name << " time of the phases of the sessions per listener\n";
+	out << "# TYPE " << name << " summary\n";
+	for (size_t l = 0; l < this->addresses.size(); l++) {
+		std::ostringstream port;
+		port << this->addresses[l].second;
+		for (int p = 0; p < Phases; p++) {
+			std::string labels = Metrics::label("ipaddr", this->addresses[l].first) + ","
+				+ Metrics::label("port", port.str()) + "," + Metrics::label("phase", phaseNames[p]);
+			const Histogram &histogram = this->histograms[l * Phases + p];
+			for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+				out << name << "{" << labels << ",quantile=\"" << quantiles[q] << "\"} ";
+				// there is no percentile of nothing
+				if (histogram.count == 0) {
+					out << "NaN\n";
+				} else {
+					out << this->percentile(l, static_cast<Phase>(p), quantiles[q]) << "\n";
+				}
+			}
+			out << name << "_sum{" << labels << "} " << histogram.sum << "\n";
+			out << name << "_count{" << labels << "} " << histogram.count << "\n";
+		}
+	}
+	return out.str();
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Log the percentiles of all phases with values
+ *
+ * \param _module Name to log with
+ */
+// }}}1 DXG DOC
+void Deception::Latency::dump(std::string &_module) const
+{ // {{{1
+	bool any = false;
+	for (size_t l = 0; l < this->addresses.size(); l++) {
+		for (int p = 0; p < Phases; p++) {
+			const Histogram &histogram = this->histograms[l * Phases + p];
+			if (histogram.count == 0) {
+				continue;
+			}
+			any = true;
+			Phase phase = static_cast<Phase>(p);
+			LOGMSG(_module, Info, "latency of " << this->addresses[l].first << ":"
+					<< this->addresses[l].second << " " << phaseNames[p] << ": "
+					<< histogram.count << " values, p50 " << this->percentile(l, phase, 0.5)
+					<< " us, p90 " << this->percentile(l, phase, 0.9)
+					<< " us, p99 " << this->percentile(l, phase, 0.99)
+					<< " us, p99.9 " << this->percentile(l, phase, 0.999)
+					<< " us, max " << histogram.max << " us, mean "
+					<< (histogram.sum / histogram.count) << " us");
+		}
+	}
+	if (!any) {
+		LOGMSG(_module, Info, "latency: nothing recorded yet");
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Ask for a dump(), safe to be called by a signal handler
+ */
+// }}}1 DXG DOC
+void Deception::Latency::requestDump()
+{ // {{{1
+	this->dumpFlag = 1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check for and clear a request of requestDump()
+ *
+ * \return true if a dump was requested since the last call
+ */
+// }}}1 DXG DOC
+bool Deception::Latency::dumpRequested()
+{ // {{{1
+	if (this->dumpFlag == 0) {
+		return false;
+	}
+	this->dumpFlag = 0;
+	return true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the time passed on the monotonic clock
+ *
+ * \param _start Monotonic time to measure from
+ *
+ * \return Microseconds since _start
+ */
+// }}}1 DXG DOC
+u_int64_t Deception::Latency::since(const struct timespec &_start)
+{ // {{{1
+	struct timespec now;
+	::clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<u_int64_t>(now.tv_sec - _start.tv_sec) * 1000000
+		+ (now.tv_nsec - _start.tv_nsec) / 1000;
+} // }}}1
@@ -0,0 +1,159 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+/**
+ * \file latency.h
+ *
+ * Declares the latency histograms of the decoy listeners.
+ */
+
+// Project Headers
+#include "defs.h"
+#include "outputstream.h"
+
+// C++ Headers
+#include <string>
+#include <vector>
+#include <utility>
+
+// C Headers
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * \class Latency
+ *
+ * Latency histograms per decoy listener, i.e. address and port, for
+ * the phases of a session: from accept() to the start of the module,
+ * from the start of the module to the first byte it writes and the
+ * whole session. The histograms are kept in a shared anonymous mapping
+ * mapped by init() before the first fork, so the session processes
+ * record into the same buckets the daemon reads.
+ *
+ * The buckets are laid out like in HdrHistogram: values below
+ * subBuckets are counted exactly, above every power of two is split
+ * into subBuckets / 2 linear buckets, which keeps the error of a
+ * percentile below 1 / 32 of its value up to hours. A value is
+ * recorded with an atomic add to its bucket, so neither the processes
+ * nor a reader have to lock.
+ *
+ * The percentiles are exported as summaries with format() and logged
+ * with dump(), which the daemon calls after a SIGUSR1.
+ *
+ * \note Listeners have to be added before the first fork, their table
+ * is not shared.
+ */
+// }}}1 DXG DOC
+class Latency
+{ // {{{1
+	public:
+		/// phases of a session measured
+		enum Phase
+		{
+			AcceptToStart,
+			StartToWrite,
+			SessionTime,
+			Phases
+		};
+
+		// {{{2 DXG DOC
+		/**
+		 * Timing of the session of this process, records the first
+		 * write when it is told about it by the output stream of the
+		 * client
+		 */
+		// }}}2 DXG DOC
+		class Session : public OutputObserver
+		{
+			public:
+				Session(int _listener, const struct timespec &_accepted);
+				void moduleStarted();
+				virtual void firstOutput();
+			private:
+				int listener;					///< id of the listener, -1 for none
+				struct timespec accepted;		///< monotonic time of accept()
+				struct timespec started;		///< monotonic time the module was started
+				// hidden
+				Session(const Session &rhs);
+				Session &operator=(const Session &rhs);
+		};
+
+		Latency();
+		~Latency();
+		void init(size_t _listeners = 64);
+		int addListener(const std::string &_ipaddr, unsigned int _port);
+		void record(int _listener, Phase _phase, u_int64_t _micros);
+		u_int64_t percentile(int _listener, Phase _phase, double _quantile) const;
+		std::string format() const;
+		void dump(std::string &_module) const;
+		void requestDump();
+		bool dumpRequested();
+		static u_int64_t since(const struct timespec &_start);
+	private:
+		/// exact buckets at the start, twice the linear buckets per power of two
+		static const unsigned int subBuckets = 64;
+		/// buckets of a histogram, up to 2^36 microseconds
+		static const unsigned int buckets = 1024;
+
+		// {{{2 DXG DOC
+		/**
+		 * One histogram in the mapping
+		 */
+		// }}}2 DXG DOC
+		struct Histogram
+		{
+			volatile u_int64_t counts[buckets];	///< values per bucket
+			volatile u_int64_t count;			///< values recorded
+			volatile u_int64_t sum;				///< sum of the values
+			volatile u_int64_t max;				///< largest value
+		};
+
+		Histogram *histograms;					///< Phases per listener, NULL before init()
+		size_t mapSize;							///< bytes mapped
+		size_t capacity;						///< listeners the mapping holds
+		std::vector<std::pair<std::string, unsigned int> > addresses;	///< address and port per listener
+		volatile sig_atomic_t dumpFlag;			///< set by requestDump()
+
+		static unsigned int bucketOf(u_int64_t _value);
+		static u_int64_t highestOf(unsigned int _bucket);
+		// hidden
+		Latency(const Latency &rhs);
+		Latency &operator=(const Latency &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+
+extern Deception::Latency globLatency;
+
+#endif // _LATENCY_H
@@ -8,24 +8,83 @@
 #include "logging.h"
 #include <iostream>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
 
 // {{{1 DXG DOC
 /**
  * Small function to set filename to log to.
  *
- * \note This has no affect, if logfile is already opened
+ * \note If the logfile is already opened, the new name is used from the
+ * next rotation or reopen on.
  *
  * \param _logFile Filename to log to
  */
 // }}}1 DXG DOC
 void Deception::Logging::setLogFile(std::string _logFile)
 { // {{{1
-	if (this->log.is_open()) {
-		return;
+	this->logFileName = _logFile;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Configure rotation of the logfile. Rotation only takes place once
+ * startRotator() has been called.
+ *
+ * \param _size Rotate when the logfile reaches this many bytes, 0 to disable
+ * \param _interval Rotate when the logfile is this many seconds old, 0 to disable
+ * \param _keep Number of rotated logfiles to keep (logfile.1 ... logfile.n)
+ * \param _compress Compress rotated logfiles with gzip
+ */
+// }}}1 DXG DOC
+void Deception::Logging::setRotation(off_t _size, time_t _interval, int _keep, bool _compress)
+{ // {{{1
+	this->rotateSize = _size;
+	this->rotateInterval = _interval;
+	this->rotateKeep = (_keep > 0) ? _keep : 1;
+	this->rotateCompress = _compress;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the verbosity to log with. Valid levels are "fatalerror",
+ * "error", "info" and "debug", each including the ones before.
+ * A level above LOG_MAX_VERBOSITY is capped, since those call sites
+ * have not been compiled in.
+ *
+ * \param _level Name of the log level
+ *
+ * \retval true If the level is known
+ * \retval false If it is not, the verbosity is left unchanged
+ */
+// }}}1 DXG DOC
+bool Deception::Logging::setLogLevel(const std::string &_level)
+{ // {{{1
+	int newVerbosity;
+	if (_level.compare("fatalerror") == 0) {
+		newVerbosity = LOG_VERBOSITY_FATAL;
+	} else if (_level.compare("error") == 0) {
+		newVerbosity = LOG_VERBOSITY_ERROR;
+	} else if (_level.compare("info") == 0) {
+		newVerbosity = LOG_VERBOSITY_INFO;
+	} else if (_level.compare("debug") == 0) {
+		newVerbosity = LOG_VERBOSITY_DEBUG;
 	} else {
-		this->logFileName = _logFile;
+		return false;
 	}
+	if (newVerbosity > LOG_MAX_VERBOSITY) {
+		newVerbosity = LOG_MAX_VERBOSITY;
+	}
+	this->verbosity = newVerbosity;
+	return true;
 } // }}}1
 
 // {{{1 DXG DOC
@@ -42,23 +101,296 @@ void Deception::Logging::init()
 { // {{{1
 	// open logfile
 	// write mode is to always append at the end of file
-	if ((this->logFileName.length() > 0) && !this->log.is_open()) {
-		try {
-			this->log.open(this->logFileName.c_str(), std::ios::app);
-			// is our stream a bad boy?
-			if (this->log.fail()) {
-				// then throw it right out
-				throw LogFileException("erroneous output stream to logfile!");
-			}
-		} catch (const std::exception& e) {
-			// we'll just catch stl exceptions and pretend that we've thrown our own
-			throw LogFileException(std::string(e.what()));
+	if ((this->logFileName.length() > 0) && (this->fd == -1)) {
+		if ((this->fd = this->openLogFile()) == -1) {
+			throw LogFileException(errno);
 		}
+		this->openedAt = ::time(NULL);
 	} else {
 		throw LogFileException("empty logfile name or log already opened");
 	}
 } // }}}1
 
+// {{{1 DXG DOC
+/**
+ * Open the configured logfile for appending
+ *
+ * \return File descriptor or -1 on error
+ */
+// }}}1 DXG DOC
+int Deception::Logging::openLogFile()
+{ // {{{1
+	int newFd = ::open(this->logFileName.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0640);
+	if (newFd != -1) {
+		// don't leak the logfile into exec()'ed programs
+		::fcntl(newFd, F_SETFD, FD_CLOEXEC);
+	}
+	return newFd;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Start the background thread which rotates and reopens the logfile.
+ * Has to be called after daemonizing, since threads don't survive
+ * fork().
+ *
+ * \exception LogFileException Thread or wakeup pipe could not be created
+ */
+// }}}1 DXG DOC
+void Deception::Logging::startRotator()
+{ // {{{1
+	if (this->rotatorRunning || (this->fd == -1)) {
+		return;
+	}
+	if (::pipe(this->wakeFds) == -1) {
+		throw LogFileException(errno);
+	}
+	// requestReopen() must never block in a signal handler
+	::fcntl(this->wakeFds[1], F_SETFL, ::fcntl(this->wakeFds[1], F_GETFL) | O_NONBLOCK);
+	::fcntl(this->wakeFds[0], F_SETFD, FD_CLOEXEC);
+	::fcntl(this->wakeFds[1], F_SETFD, FD_CLOEXEC);
+	int err = ::pthread_create(&this->rotator, NULL, Logging::rotatorMain, this);
+	if (err != 0) {
+		throw LogFileException(err);
+	}
+	this->rotatorRunning = true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Start a thread in a process forked off the daemon, which follows the
+ * rotations done by the daemon. The rotation thread of the daemon
+ * didn't survive fork(), so this one checks once a second if the
+ * logfile has been moved away and reopens it. Nothing is rotated here.
+ *
+ * \exception LogFileException Thread or wakeup pipe could not be created
+ */
+// }}}1 DXG DOC
+void Deception::Logging::followRotation()
+{ // {{{1
+	// the wakeup pipe was inherited from the rotation thread of the daemon
+	if (this->rotatorRunning) {
+		::close(this->wakeFds[0]);
+		::close(this->wakeFds[1]);
+		this->wakeFds[0] = this->wakeFds[1] = -1;
+		this->rotatorRunning = false;
+	}
+	this->following = true;
+	this->compressAt = 0;
+	this->startRotator();
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Ask the rotation thread to reopen the logfile. Only sets a flag and
+ * writes to a pipe, so it is safe to be called from a signal handler.
+ */
+// }}}1 DXG DOC
+void Deception::Logging::requestReopen()
+{ // {{{1
+	int savedErrno = errno;
+	this->reopenRequested = 1;
+	if (this->wakeFds[1] != -1) {
+		char c = 'r';
+		(void) ::write(this->wakeFds[1], &c, 1);
+	}
+	errno = savedErrno;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Entry point of the rotation thread
+ *
+ * \param _log Logging object to rotate
+ */
+// }}}1 DXG DOC
+void* Deception::Logging::rotatorMain(void *_log)
+{ // {{{1
+	// signals are handled by the main thread
+	sigset_t allSignals;
+	sigfillset(&allSignals);
+	::pthread_sigmask(SIG_BLOCK, &allSignals, NULL);
+	static_cast<Logging*>(_log)->rotatorLoop();
+	return NULL;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Wait for reopen requests and check once a second if the logfile
+ * needs to be rotated.
+ */
+// }}}1 DXG DOC
+void Deception::Logging::rotatorLoop()
+{ // {{{1
+	char drain[64];
+	struct stat stBuf;
+	while (true) {
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(this->wakeFds[0], &readSet);
+		struct timeval timeout = { 1, 0 };
+		if (::select(this->wakeFds[0] + 1, &readSet, NULL, NULL, &timeout) > 0) {
+			(void) ::read(this->wakeFds[0], drain, sizeof(drain));
+		}
+		if (this->reopenRequested) {
+			this->reopenRequested = 0;
+			this->reopen();
+			continue;
+		}
+		if (this->following) {
+			if (this->logFileMoved()) {
+				this->reopen();
+			}
+			continue;
+		}
+		if ((this->compressAt != 0) && (::time(NULL) >= this->compressAt)) {
+			this->compress();
+		}
+		bool doRotate = false;
+		if ((this->rotateSize > 0) && (::fstat(this->fd, &stBuf) == 0)
+				&& (stBuf.st_size >= this->rotateSize)) {
+			doRotate = true;
+		}
+		if ((this->rotateInterval > 0) && (::time(NULL) - this->openedAt >= this->rotateInterval)) {
+			doRotate = true;
+		}
+		if (doRotate) {
+			this->rotate();
+		}
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Report an error of the rotation thread to stderr, including the
+ * current errno. toLog() can't be used from this thread, since the line
+ * buffer and time cache belong to the logging callers.
+ *
+ * \param _what Description of the failed operation
+ */
+// }}}1 DXG DOC
+void Deception::Logging::rotatorError(const char *_what)
+{ // {{{1
+	char buf[256];
+	int len = ::snprintf(buf, sizeof(buf), "[error] Logging (%d): %s: %s\n",
+			static_cast<int>(::getpid()), _what, ::strerror(errno));
+	if (len > 0) {
+		(void) ::write(STDERR_FILENO, buf,
+				(static_cast<size_t>(len) < sizeof(buf)) ? len : sizeof(buf) - 1);
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Open the logfile again and put it in place of the current one.
+ * dup2() replaces the file behind the descriptor atomically, so
+ * concurrent writers either end up in the old or in the new file.
+ */
+// }}}1 DXG DOC
+void Deception::Logging::reopen()
+{ // {{{1
+	int newFd = this->openLogFile();
+	if (newFd == -1) {
+		this->rotatorError("could not reopen logfile");
+		return;
+	}
+	if (::dup2(newFd, this->fd) == -1) {
+		this->rotatorError("could not replace logfile");
+	}
+	::close(newFd);
+	this->openedAt = ::time(NULL);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Rotate the logfile: logfile.n-1 becomes logfile.n and so on, the
+ * current logfile becomes logfile.1 and a new one is opened. If
+ * configured, logfile.1 is compressed afterwards.
+ */
+// }}}1 DXG DOC
+void Deception::Logging::rotate()
+{ // {{{1
+	char from[PATH_MAX], to[PATH_MAX];
+	const char *name = this->logFileName.c_str();
+	const char *exts[] = { "", ".gz" };
+	// logfile.1 is about to become logfile.2, so compress it now
+	if (this->compressAt != 0) {
+		this->compress();
+	}
+	// drop the oldest file and shift the others, rename() replaces
+	// existing targets
+	for (int gz = 0; gz <= 1; gz++) {
+		::snprintf(to, sizeof(to), "%s.%d%s", name, this->rotateKeep, exts[gz]);
+		::unlink(to);
+	}
+	for (int i = this->rotateKeep; i > 1; i--) {
+		for (int gz = 0; gz <= 1; gz++) {
+			::snprintf(from, sizeof(from), "%s.%d%s", name, i - 1, exts[gz]);
+			::snprintf(to, sizeof(to), "%s.%d%s", name, i, exts[gz]);
+			(void) ::rename(from, to);
+		}
+	}
+	::snprintf(to, sizeof(to), "%s.1", name);
+	if (::rename(name, to) == -1) {
+		this->rotatorError("could not rotate logfile");
+		// try again with the next interval
+		this->openedAt = ::time(NULL);
+		return;
+	}
+	this->reopen();
+	if (this->rotateCompress) {
+		// gzip removes logfile.1, give the processes following the
+		// rotation time to reopen first
+		this->compressAt = ::time(NULL) + 2;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Compress logfile.1 with gzip
+ */
+// }}}1 DXG DOC
+void Deception::Logging::compress()
+{ // {{{1
+	char to[PATH_MAX];
+	::snprintf(to, sizeof(to), "%s.1", this->logFileName.c_str());
+	this->compressAt = 0;
+	// compress in a child process, this thread is the only one to wait
+	// for it, so nobody logging is blocked meanwhile
+	char *args[] = { const_cast<char*>("gzip"), const_cast<char*>("-f"), to, NULL };
+	pid_t child = ::fork();
+	if (child == 0) {
+		::execvp(args[0], args);
+		::_exit(EXIT_FAILURE);
+	} else if (child > 0) {
+		int status;
+		// the main loop only reaps the children it forked itself, so
+		// the exit status of gzip ends up here
+		(void) ::waitpid(child, &status, 0);
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check if the logfile has been moved away since it was opened
+ *
+ * \retval true If the name doesn't refer to the open file anymore
+ * \retval false If it still does or the open file can't be checked
+ */
+// }}}1 DXG DOC
+bool Deception::Logging::logFileMoved()
+{ // {{{1
+	struct stat fdBuf, nameBuf;
+	if (::fstat(this->fd, &fdBuf) == -1) {
+		return false;
+	}
+	if (::stat(this->logFileName.c_str(), &nameBuf) == -1) {
+		// renamed, but not yet reopened by the daemon
+		return (errno == ENOENT);
+	}
+	return ((fdBuf.st_dev != nameBuf.st_dev) || (fdBuf.st_ino != nameBuf.st_ino));
+} // }}}1
+
 // {{{1 DXG DOC
 /**
  * Log a message. Logging string looks like this:
@@ -72,29 +404,46 @@ void Deception::Logging::init()
 void Deception::Logging::toLog(std::string &_moduleName, enum logLevels _logLevel, std::string &_message)
 { // {{{1
 
-	std::string logType, logTime;
 	// fetch time
 	// FIXME: make time format configurable
-	// FIXME: replace with stuff from <ctime>?
-	int logLevelLen = sizeof(logTypes) / sizeof(char*);
-	if ((_logLevel < 0) || (_logLevel > logLevelLen)) {
+	int logLevelLen = sizeof(logTypes) / sizeof(logTypes[0]);
+	if ((_logLevel < 0) || (_logLevel >= logLevelLen)) {
 		return;
 	}
-	logType = logTypes[_logLevel];
-	logTime = this->getTime();
-	if (logTime.empty()) {
-		// if we don't have a time, for now just set it to -
-		logTime = "-";
+	// drop messages above the configured verbosity
+	if (!this->isEnabled(_logLevel)) {
+		return;
 	}
+	const std::string &logType = logTypes[_logLevel];
+	char logTime[TimeCache::maxLength];
+	size_t logTimeLen = this->timeCache.now(logTime);
+	char pid[16];
+	int pidLen = ::snprintf(pid, sizeof(pid), " (%d): ", static_cast<int>(::getpid()));
+	// assemble the whole line, so it can be written at once
+	std::string &line = this->lineBuf;
+	line.erase();
+	line.append(logTime, logTimeLen).append(" ").append(logType).append(" ")
+		.append(_moduleName).append(pid, pidLen).append(_message).append("\n");
 	// debug and fatal errors go right out to stderr
 	// in case logfile isn't opened, dump all stuff to stderr
-	if ((_logLevel == Debug) || (_logLevel == FatalError) || !this->log.is_open()) {
-		std::cerr << logTime << " " << logType << " " << _moduleName
-			<< " (" << getpid() << "): " << _message << std::endl;
-	} else {
+	int outFd = this->fd;
+	if ((_logLevel == Debug) || (_logLevel == FatalError) || (outFd == -1)) {
+		outFd = STDERR_FILENO;
+	}
 	// logging stuff goes right out to logfile
-		this->log << logTime << " " << logType << " " << _moduleName
-			<< " (" << getpid() << "): " << _message << std::endl;
+	const char *ptr = line.data();
+	size_t left = line.length();
+	while (left > 0) {
+		ssize_t n = ::write(outFd, ptr, left);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// nowhere left to complain to
+			return;
+		}
+		ptr += n;
+		left -= n;
 	}
 } // }}}1
 
@@ -123,27 +472,9 @@ void Deception::Logging::toLog(std::string &_moduleName, enum logLevels _logLeve
 // }}}1 DXG DOC
 std::string Deception::Logging::getTime()
 { // {{{1
-	time_t pNow;
-	time_t now;
-	struct tm *lTime;
-	char pLogT[30];
-	size_t len;
-	// fetch time
-	// FIXME: make time format configurable
-	// FIXME: replace with stuff from <ctime>?
-	// FIXME: make pLogT static array either dynamic or reasonable in size.
-	// FIXME: make pLogT static array either dynamic or reasonable in size.
-
-	if ((now = ::time(&pNow)) == static_cast<time_t>(-1))
-		return std::string("");
-
-	if ((lTime = ::localtime(&pNow)) == NULL)
-		return std::string("");
-
-	if ((len = ::strftime(pLogT, 30, "%d.%m.%Y %H:%M:%S", lTime)) != 0)
-		return std::string(pLogT);
-
-	return std::string("");
+	char logTime[TimeCache::maxLength];
+	this->timeCache.now(logTime);
+	return std::string(logTime);
 } // }}}1
 
 Deception::Logging globLog;
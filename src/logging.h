@@ -43,15 +43,19 @@
 #include "ioexception.h"
 #include "logfileexception.h"
 #include "exception.h"
+#include "timecache.h"
 
 // C++ Headers
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <exception>
 #include <iostream>
 
 // C Headers
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
 
 
@@ -67,6 +71,55 @@ static const std::string logTypes[] = {
 	"[debug]",
 };
 
+/// verbosity of fatal errors, these are always logged
+#define LOG_VERBOSITY_FATAL	0
+/// verbosity of errors and module errors
+#define LOG_VERBOSITY_ERROR	1
+/// verbosity of info and module info messages
+#define LOG_VERBOSITY_INFO	2
+/// verbosity of debug messages
+#define LOG_VERBOSITY_DEBUG	3
+
+// {{{1 DXG DOC
+/**
+ * Highest verbosity that is compiled into the binary. Call sites using
+ * LOGDEBUG() are removed by the preprocessor if this is below
+ * LOG_VERBOSITY_DEBUG, which is the default for builds without -DDEBUG.
+ */
+// }}}1 DXG DOC
+#ifndef LOG_MAX_VERBOSITY
+#ifdef DEBUG
+#define LOG_MAX_VERBOSITY LOG_VERBOSITY_DEBUG
+#else
+#define LOG_MAX_VERBOSITY LOG_VERBOSITY_INFO
+#endif
+#endif
+
+// {{{1 DXG DOC
+/**
+ * Map a log level to its verbosity. Messages are only written if their
+ * verbosity is not above the one configured at runtime.
+ *
+ * \param _logLevel Loglevel
+ *
+ * \return Verbosity of the log level
+ */
+// }}}1 DXG DOC
+inline int levelVerbosity(enum logLevels _logLevel)
+{
+	switch (_logLevel) {
+		case FatalError:
+			return LOG_VERBOSITY_FATAL;
+		case Error:
+		case ModuleError:
+			return LOG_VERBOSITY_ERROR;
+		case Debug:
+			return LOG_VERBOSITY_DEBUG;
+		default:
+			return LOG_VERBOSITY_INFO;
+	}
+}
+
 // {{{1 DXG DOC
 /**
  * \class Logging
@@ -74,22 +127,105 @@ static const std::string logTypes[] = {
  * \todo	Maybe we can allow for logging via syslog.
  *
  * Central logging and debugging facility.
+ *
+ * Every line is written with a single write(2) to a descriptor opened
+ * with O_APPEND, so the daemon and its forked children can share the
+ * logfile without mixing up lines.
+ *
+ * The logfile can be rotated by size and age. This is done by a
+ * background thread started with startRotator(), which renames the file,
+ * opens a new one and dup2()'s it onto the descriptor in use, so
+ * callers are never blocked and never see a closed descriptor.
+ * requestReopen() only reopens the file, e.g. after an external
+ * logrotate, and is safe to call from a signal handler.
+ *
+ * Other processes forked off the daemon keep writing to the file that
+ * was current when they were forked. Long running ones call
+ * followRotation() to reopen the logfile whenever the daemon has moved
+ * it. Rotated logfiles are compressed a little later, so followers have
+ * reopened before the old file is removed.
 */
 // }}}1 DXG DOC
 class Logging
 { // {{{1
 	private:
-		std::ofstream log;			///< output stream to logfile
+		int fd;						///< descriptor of the logfile, -1 if not opened
 		std::string logFileName;	///< filename to log to
+		int verbosity;				///< runtime verbosity, see levelVerbosity()
+		TimeCache timeCache;		///< formats the timestamp of every line
+		std::string lineBuf;		///< reused buffer to assemble a line in
+		off_t rotateSize;			///< rotate when the logfile reaches this size, 0 to disable
+		time_t rotateInterval;		///< rotate when the logfile is this old in seconds, 0 to disable
+		int rotateKeep;				///< number of rotated logfiles to keep
+		bool rotateCompress;		///< flag, if rotated logfiles are compressed with gzip
+		time_t openedAt;			///< time the current logfile was opened
+		bool rotatorRunning;		///< flag, if the rotation thread has been started
+		pthread_t rotator;			///< rotation thread
+		int wakeFds[2];				///< pipe to wake up the rotation thread
+		volatile sig_atomic_t reopenRequested;	///< set by requestReopen()
+		bool following;				///< flag, if another process rotates the logfile
+		time_t compressAt;			///< time to compress logfile.1, 0 if nothing is pending
 	public:
-		Logging() { }
+		Logging() :
+			fd(-1),
+			verbosity(LOG_MAX_VERBOSITY),
+			rotateSize(0),
+			rotateInterval(0),
+			rotateKeep(5),
+			rotateCompress(false),
+			openedAt(0),
+			rotatorRunning(false),
+			reopenRequested(0),
+			following(false),
+			compressAt(0)
+		{
+			this->wakeFds[0] = this->wakeFds[1] = -1;
+		}
 		~Logging() { }
 		void init();
 		void setLogFile(std::string _logFile);
+		void setRotation(off_t _size, time_t _interval, int _keep, bool _compress);
+		void startRotator();
+		void followRotation();
+		void requestReopen();
+		// {{{2 DXG DOC
+		/**
+		 * Set number of sub-second digits in timestamps
+		 *
+		 * \param _precision 0, 3 or 6
+		 *
+		 * \retval false If the precision is not supported
+		 */
+		// }}}2 DXG DOC
+		bool setTimePrecision(int _precision)
+		{
+			return this->timeCache.setPrecision(_precision);
+		}
+		bool setLogLevel(const std::string &_level);
+		// {{{2 DXG DOC
+		/**
+		 * Check if messages of a log level would be written at all.
+		 * Use this before building expensive log messages.
+		 *
+		 * \param _logLevel Loglevel
+		 */
+		// }}}2 DXG DOC
+		bool isEnabled(enum logLevels _logLevel) const
+		{
+			return (levelVerbosity(_logLevel) <= this->verbosity);
+		}
 		void toLog(std::string &_moduleName, enum logLevels _logLevel, std::string &_message);
 		void toLog(std::string &_moduleName, enum logLevels _logLevel, const char *_message);
 		std::string getTime();
 	private:
+		int openLogFile();
+		void reopen();
+		void rotate();
+		void compress();
+		bool logFileMoved();
+		void rotatorLoop();
+		void rotatorError(const char *_what);
+		static void* rotatorMain(void *_log);
 		// hide the usual candidates
 		// since we're dealing with system ressources allowing copy construction
 		// and assignment is not what we want
@@ -98,4 +234,39 @@ class Logging
 }; // }}}1
 
 DECEPTION_NAMESPACE_END
+
+extern Deception::Logging globLog;
+
+// {{{1 DXG DOC
+/**
+ * Log a message that is built with operator<< only if its level is
+ * enabled, e.g.
+ * \code
+ * LOGMSG(moduleName, ModuleInfo, "recv '" << buf << "' on port " << port);
+ * \endcode
+ * No string is formatted or allocated for disabled levels.
+ */
+// }}}1 DXG DOC
+#define LOGMSG(_module, _level, _args) \
+	do { \
+		if (globLog.isEnabled(_level)) { \
+			std::ostringstream logStream_; \
+			logStream_ << _args; \
+			std::string logStr_ = logStream_.str(); \
+			globLog.toLog(_module, _level, logStr_); \
+		} \
+	} while (0)
+
+// {{{1 DXG DOC
+/**
+ * Same as LOGMSG() with level Debug, but removed completely if
+ * LOG_MAX_VERBOSITY does not include debug messages.
+ */
+// }}}1 DXG DOC
+#if LOG_MAX_VERBOSITY >= LOG_VERBOSITY_DEBUG
+#define LOGDEBUG(_module, _args) LOGMSG(_module, Deception::Debug, _args)
+#else
+#define LOGDEBUG(_module, _args) do { } while (0)
+#endif
+
 #endif // _LOGGING_H
@@ -0,0 +1,432 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file metrics.cpp
+ *
+ * Contains the implementation of the metrics registry
+ */
+#include "metrics.h"
+
+#include <new>
+#include <sstream>
+#include <vector>
+
+#include <string.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+Deception::Metrics globMetrics;
+
+// {{{1 DXG DOC
+/**
+ * Constructor, nothing is mapped before init()
+ */
+// }}}1 DXG DOC
+Deception::Metrics::Metrics() :
+	header(NULL),
+	descriptors(NULL),
+	values(NULL),
+	mapSize(0)
+{ // {{{1
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor, unmaps the registry of this process
+ */
+// }}}1 DXG DOC
+Deception::Metrics::~Metrics()
+{ // {{{1
+	if (this->header != NULL) {
+		::munmap(this->header, this->mapSize);
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Map the registry, has to be called before the processes sharing it
+ * are forked
+ *
+ * \param _metrics Number of metrics, every metric takes about 1.5 KB
+ *
+ * \exception std::bad_alloc Shared memory could not be mapped
+ */
+// }}}1 DXG DOC
+void Deception::Metrics::init(size_t _metrics)
+{ // {{{1
+	if (this->header != NULL) {
+		return;
+	}
+	size_t descriptorOffset = (sizeof(Header) + 63) & ~static_cast<size_t>(63);
+	size_t valueOffset = (descriptorOffset + _metrics * sizeof(Descriptor) + 63) & ~static_cast<size_t>(63);
+	this->mapSize = valueOffset + _metrics * stripes * cells * sizeof(u_int64_t);
+	// anonymous mappings are zeroed, so are all cells
+	void *mem = ::mmap(NULL, this->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+	char *base = static_cast<char*>(mem);
+	this->header = reinterpret_cast<Header*>(base);
+	this->header->capacity = _metrics;
+	this->descriptors = reinterpret_cast<Descriptor*>(base + descriptorOffset);
+	this->values = reinterpret_cast<volatile u_int64_t*>(base + valueOffset);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Register a counter, a value that only grows
+ *
+ * \param _name Name, should end with "_total"
+ * \param _help Description
+ * \param _labels Labels without braces, e.g. "port=\"21\""
+ *
+ * \return Id of the counter, -1 if the registry is full or not mapped
+ */
+// }}}1 DXG DOC
+int Deception::Metrics::addCounter(const std::string &_name, const std::string &_help,
+		const std::string &_labels)
+{ // {{{1
+	return this->registerMetric(Counter, _name, _help, _labels, NULL, 0);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Register a gauge, a value that goes up and down
+ *
+ * \param _name Name
+ * \param _help Description
+ * \param _labels Labels without braces
+ *
+ * \return Id of the gauge, -1 if the registry is full or not mapped
+ */
+// }}}1 DXG DOC
+int Deception::Metrics::addGauge(const std::string &_name, const std::string &_help,
+		const std::string &_labels)
+{ // {{{1
+	return this->registerMetric(Gauge, _name, _help, _labels, NULL, 0);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Register a histogram
+ *
+ * \param _name Name, should end with the unit of the observations
+ * \param _help Description
+ * \param _bounds Inclusive upper bounds of the buckets, ascending
+ * \param _buckets Number of bounds, at most maxBuckets are used
+ * \param _labels Labels without braces
+ *
+ * \return Id of the histogram, -1 if the registry is full or not mapped
+ */
+// }}}1 DXG DOC
+int Deception::Metrics::addHistogram(const std::string &_name, const std::string &_help,
+		const u_int64_t *_bounds, size_t _buckets, const std::string &_labels)
+{ // {{{1
+	return this->registerMetric(Histogram, _name, _help, _labels, _bounds, _buckets);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Claim a descriptor for a metric and fill it in, unless the metric is
+ * registered already
+ *
+ * \return Id of the metric, -1 if the registry is full or not mapped
+ */
+// }}}1 DXG DOC
+int Deception::Metrics::registerMetric(Type _type, const std::string &_name, const std::string &_help,
+		const std::string &_labels, const u_int64_t *_bounds, size_t _buckets)
+{ // {{{1
+	if (this->header == NULL) {
+		return -1;
+	}
+	unsigned int slot;
+	for (;;) {
+		// find() looks at least at the slots claimed so far
+		slot = this->header->count;
+		int id = this->find(_name, _labels);
+		if (id >= 0) {
+			return id;
+		}
+		if (slot >= this->header->capacity) {
+			return -1;
+		}
+		// claim the next slot, unless another process has claimed it
+		// since, which may have been for this metric
+		if (__sync_bool_compare_and_swap(&this->header->count, slot, slot + 1)) {
+			break;
+		}
+	}
+	Descriptor &desc = this->descriptors[slot];
+	desc.type = _type;
+	::strncpy(desc.name, _name.c_str(), sizeof(desc.name) - 1);
+	::strncpy(desc.labels, _labels.c_str(), sizeof(desc.labels) - 1);
+	::strncpy(desc.help, _help.c_str(), sizeof(desc.help) - 1);
+	desc.buckets = (_buckets < maxBuckets) ? _buckets : maxBuckets;
+	for (size_t i = 0; i < desc.buckets; i++) {
+		desc.bounds[i] = _bounds[i];
+	}
+	// readers only look at complete descriptors
+	__sync_synchronize();
+	desc.ready = 1;
+	return slot;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Look up a registered metric
+ *
+ * \return Id of the metric, -1 if it is not registered
+ */
+// }}}1 DXG DOC
+int Deception::Metrics::find(const std::string &_name, const std::string &_labels) const
+{ // {{{1
+	unsigned int count = this->header->count;
+	if (count > this->header->capacity) {
+		count = this->header->capacity;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		const Descriptor &desc = this->descriptors[i];
+		// a slot is filled in after it has been claimed, it may be this
+		// metric; don't wait forever for a process killed meanwhile
+		for (int spins = 0; !desc.ready && (spins < 1000); spins++) {
+			::sched_yield();
+		}
+		if (desc.ready && (_name.compare(desc.name) == 0) && (_labels.compare(desc.labels) == 0)) {
+			return i;
+		}
+	}
+	return -1;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the cells of a metric this process adds to, the stripe of the
+ * cpu it runs on
+ */
+// }}}1 DXG DOC
+volatile u_int64_t* Deception::Metrics::stripe(int _id) const
+{ // {{{1
+	size_t index = 0;
+#if defined(__linux__)
+	int cpu = ::sched_getcpu();
+	if (cpu > 0) {
+		index = cpu & (stripes - 1);
+	}
+#endif
+	return this->values + (_id * stripes + index) * cells;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Add to a counter or gauge
+ *
+ * \param _id Id of the metric, nothing is done for -1
+ * \param _value Value to add, may be negative for gauges
+ */
+// }}}1 DXG DOC
+void Deception::Metrics::add(int _id, int64_t _value)
+{ // {{{1
+	if (_id < 0) {
+		return;
+	}
+	__sync_fetch_and_add(this->stripe(_id), static_cast<u_int64_t>(_value));
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set a gauge, or a counter whose total is kept elsewhere
+ *
+ * \param _id Id of the metric, nothing is done for -1
+ * \param _value New value
+ */
+// }}}1 DXG DOC
+void Deception::Metrics::set(int _id, int64_t _value)
+{ // {{{1
+	if (_id < 0) {
+		return;
+	}
+	this->values[_id * stripes * cells] = static_cast<u_int64_t>(_value);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Count an observation in its bucket of a histogram
+ *
+ * \param _id Id of the histogram, nothing is done for -1
+ * \param _value The observation
+ */
+// }}}1 DXG DOC
+void Deception::Metrics::observe(int _id, u_int64_t _value)
+{ // {{{1
+	if (_id < 0) {
+		return;
+	}
+	const Descriptor &desc = this->descriptors[_id];
+	size_t bucket = 0;
+	while ((bucket < desc.buckets) && (_value > desc.bounds[bucket])) {
+		bucket++;
+	}
+	volatile u_int64_t *cell = this->stripe(_id);
+	__sync_fetch_and_add(cell + bucket, 1);
+	__sync_fetch_and_add(cell + cells - 1, _value);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the value of a counter or gauge, the number of observations of a
+ * histogram
+ *
+ * \param _id Id of the metric
+ *
+ * \return Sum of all stripes, 0 for -1
+ */
+// }}}1 DXG DOC
+int64_t Deception::Metrics::get(int _id) const
+{ // {{{1
+	if (_id < 0) {
+		return 0;
+	}
+	size_t used = (this->descriptors[_id].type == Histogram) ? this->descriptors[_id].buckets + 1 : 1;
+	u_int64_t sum = 0;
+	for (size_t s = 0; s < stripes; s++) {
+		volatile const u_int64_t *cell = this->values + (_id * stripes + s) * cells;
+		for (size_t c = 0; c < used; c++) {
+			sum += cell[c];
+		}
+	}
+	return static_cast<int64_t>(sum);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Build a label for the registration of a metric, escaping the value
+ *
+ * \param _name Name of the label
+ * \param _value Value of the label
+ *
+ * \return E.g. "module=\"dtkScript\""
+ */
+// }}}1 DXG DOC
+std::string Deception::Metrics::label(const std::string &_name, const std::string &_value)
+{ // {{{1
+	std::string result = _name + "=\"";
+	for (size_t i = 0; i < _value.size(); i++) {
+		switch (_value[i]) {
+			case '\\':
+				result += "\\\\";
+				break;
+			case '"':
+				result += "\\\"";
+				break;
+			case '\n':
+				result += "\\n";
+				break;
+			default:
+				result += _value[i];
+				break;
+		}
+	}
+	return result + "\"";
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Write all metrics in the text format of Prometheus 0.0.4. The series
+ * of a name are written together, below one HELP and TYPE line.
+ *
+ * \return The metrics, empty before init()
+ */
+// }}}1 DXG DOC
+std::string Deception::Metrics::format() const
+{ // {{{1
+	if (this->header == NULL) {
+		return "";
+	}
+	static const char *typeNames[] = { "counter", "gauge", "histogram" };
+	unsigned int count = this->header->count;
+	if (count > this->header->capacity) {
+		count = this->header->capacity;
+	}
+	std::ostringstream out;
+	std::vector<bool> written(count, false);
+	for (unsigned int first = 0; first < count; first++) {
+		const Descriptor &head = this->descriptors[first];
+		if (written[first] || !head.ready) {
+			continue;
+		}
+		out << "# HELP " << head.name << " " << head.help << "\n";
+		out << "# TYPE " << head.name << " " << typeNames[head.type] << "\n";
+		for (unsigned int i = first; i < count; i++) {
+			const Descriptor &desc = this->descriptors[i];
+			if (!desc.ready || (::strcmp(desc.name, head.name) != 0)) {
+				continue;
+			}
+			written[i] = true;
+			u_int64_t sums[cells];
+			::memset(sums, 0, sizeof(sums));
+			for (size_t s = 0; s < stripes; s++) {
+				volatile const u_int64_t *cell = this->values + (i * stripes + s) * cells;
+				for (size_t c = 0; c < cells; c++) {
+					sums[c] += cell[c];
+				}
+			}
+			std::string labels = desc.labels;
+			if (desc.type != Histogram) {
+				out << desc.name;
+				if (!labels.empty()) {
+					out << "{" << labels << "}";
+				}
+				if (desc.type == Gauge) {
+					out << " " << static_cast<int64_t>(sums[0]) << "\n";
+				} else {
+					out << " " << sums[0] << "\n";
+				}
+				continue;
+			}
+			// buckets are written cumulative
+			std::string prefix = labels.empty() ? "" : labels + ",";
+			u_int64_t cumulative = 0;
+			for (size_t b = 0; b < desc.buckets; b++) {
+				cumulative += sums[b];
+				out << desc.name << "_bucket{" << prefix << "le=\"" << desc.bounds[b] << "\"} "
+					<< cumulative << "\n";
+			}
+			cumulative += sums[desc.buckets];
+			out << desc.name << "_bucket{" << prefix << "le=\"+Inf\"} " << cumulative << "\n";
+			std::string braced = labels.empty() ? "" : "{" + labels + "}";
+			out << desc.name << "_sum" << braced << " " << sums[cells - 1] << "\n";
+			out << desc.name << "_count" << braced << " " << cumulative << "\n";
+		}
+	}
+	return out.str();
+} // }}}1
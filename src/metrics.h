@@ -0,0 +1,157 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+/**
+ * \file metrics.h
+ *
+ * Declares the registry of counters, gauges and histograms shared by
+ * the daemon and its session processes.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C++ Headers
+#include <string>
+
+// C Headers
+#include <sys/types.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * \class Metrics
+ *
+ * Counters, gauges and histograms with fixed buckets in a shared
+ * anonymous mapping. It is mapped by init() before the first fork, so
+ * the session processes and the capture process update the same cells
+ * as the daemon, and format() writes all of them in the text format of
+ * Prometheus.
+ *
+ * A metric is registered once with its name and labels, which returns
+ * its id; registering it again returns the same id, also if processes
+ * register it at the same time, as slots are claimed one after the
+ * other with a compare and swap. Every metric has a few stripes of
+ * cells, a process adds to the stripe of the cpu it runs on with an
+ * atomic add, so processes on different cores don't fight over a cache
+ * line. The stripes are summed up when formatted. Calls
+ * with the id -1, e.g. before init() or with the registry full, do
+ * nothing, so a missing registry never breaks the caller.
+ *
+ * Histograms count integer observations, e.g. microseconds, in buckets
+ * with inclusive upper bounds; an observation above the last bound
+ * only counts in the implied +Inf bucket.
+ *
+ * \note set() writes the first stripe only, so a metric that is set()
+ * must not be changed with add() as well.
+ */
+// }}}1 DXG DOC
+class Metrics
+{ // {{{1
+	public:
+		/// kinds of metrics
+		enum Type
+		{
+			Counter,
+			Gauge,
+			Histogram
+		};
+
+		/// most buckets of a histogram, without +Inf
+		static const size_t maxBuckets = 16;
+
+		Metrics();
+		~Metrics();
+		void init(size_t _metrics = 256);
+		int addCounter(const std::string &_name, const std::string &_help, const std::string &_labels = "");
+		int addGauge(const std::string &_name, const std::string &_help, const std::string &_labels = "");
+		int addHistogram(const std::string &_name, const std::string &_help, const u_int64_t *_bounds,
+				size_t _buckets, const std::string &_labels = "");
+		void add(int _id, int64_t _value = 1);
+		void set(int _id, int64_t _value);
+		void observe(int _id, u_int64_t _value);
+		int64_t get(int _id) const;
+		std::string format() const;
+		static std::string label(const std::string &_name, const std::string &_value);
+	private:
+		/// stripes of cells per metric, a power of 2
+		static const size_t stripes = 8;
+		/// cells per stripe: the buckets, +Inf and the sum
+		static const size_t cells = maxBuckets + 2;
+
+		// {{{2 DXG DOC
+		/**
+		 * Name, labels and buckets of a metric, written once while it
+		 * is registered
+		 */
+		// }}}2 DXG DOC
+		struct Descriptor
+		{
+			volatile int ready;					///< flag, if the descriptor is complete
+			Type type;							///< kind of the metric
+			char name[64];						///< name, e.g. "deceptiond_accepts_total"
+			char labels[128];					///< labels without braces, e.g. "port=\"21\""
+			char help[128];						///< description
+			size_t buckets;						///< bounds used, histograms only
+			u_int64_t bounds[maxBuckets];		///< upper bounds of the buckets, ascending
+		};
+
+		// {{{2 DXG DOC
+		/**
+		 * Start of the mapping, followed by the descriptors and the
+		 * cells
+		 */
+		// }}}2 DXG DOC
+		struct Header
+		{
+			volatile unsigned int count;		///< descriptors claimed, in order
+			unsigned int capacity;				///< number of descriptors
+		};
+
+		Header *header;							///< the mapping, NULL before init()
+		Descriptor *descriptors;				///< the metrics
+		volatile u_int64_t *values;				///< stripes * cells per metric
+		size_t mapSize;							///< bytes mapped
+
+		int registerMetric(Type _type, const std::string &_name, const std::string &_help,
+				const std::string &_labels, const u_int64_t *_bounds, size_t _buckets);
+		int find(const std::string &_name, const std::string &_labels) const;
+		volatile u_int64_t* stripe(int _id) const;
+		// hidden
+		Metrics(const Metrics &rhs);
+		Metrics &operator=(const Metrics &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+
+extern Deception::Metrics globMetrics;
+
+#endif // _METRICS_H
@@ -43,16 +43,33 @@
 #include "moduleregistry.h"
 #include "moduleloader.h"
 #include "logging.h"
+#include "eventlog.h"
+#include "aggregator.h"
+#include "scandetector.h"
 #include "fw_pcap.h"
+#include "sessionaccounting.h"
 
 #include <xercesc/util/NumberFormatException.hpp>
 
+#include <stdlib.h>
+
 
 const char* OPTION_MODULE		= "module";
 const char* OPTION_MODULEDIR	= "moduledir";
 const char* OPTION_FILENAME		= "filename";
 const char* OPTION_NAME			= "name";
 const char* OPTION_LOGFILE		= "logfile";
+const char* OPTION_LOGLEVEL		= "loglevel";
+const char* OPTION_LOG_PRECISION	= "precision";
+const char* OPTION_LOG_MAXSIZE	= "maxsize";
+const char* OPTION_LOG_INTERVAL	= "interval";
+const char* OPTION_LOG_KEEP		= "keep";
+const char* OPTION_LOG_COMPRESS	= "compress";
+const char* OPTION_EVENTLOG		= "eventlog";
+const char* OPTION_AGGREGATE	= "aggregate";
+const char* OPTION_AGG_WINDOW	= "window";
+const char* OPTION_AGG_RATE		= "rate";
+const char* OPTION_AGG_BURST	= "burst";
 const char* OPTION_PORT			= "port";
 const char* OPTION_PORTNO		= "no";
 const char* OPTION_CHROOT		= "chroot";
@@ -63,12 +80,45 @@ const char* OPTION_IP			= "ipaddr";
 const char* OPTION_OPTION		= "option";
 const char* OPTION_CAPTURE		= "capture";
 const char* OPTION_CAP_ENABLE	= "enable";
+const char* OPTION_CAP_SNAPLEN	= "snaplen";
+const char* OPTION_CAP_BUFFER	= "buffer";
+const char* OPTION_CAP_TIMEOUT	= "timeout";
+const char* OPTION_CAP_IMMEDIATE	= "immediate";
+const char* OPTION_CAP_PROMISC	= "promisc";
+const char* OPTION_CAP_WORKERS	= "workers";
+const char* OPTION_CAP_MODE		= "mode";
+const char* OPTION_CAP_FLOWS		= "flows";
+const char* OPTION_CAP_OSDB		= "osdb";
+const char* OPTION_CAP_PROBES	= "probes";
+const char* OPTION_CAP_PHANTOM	= "phantom";
+const char* OPTION_CAP_STATS	= "stats";
+const char* OPTION_SCAN			= "scan";
+const char* OPTION_SCAN_WINDOW	= "window";
+const char* OPTION_SCAN_PORTS	= "ports";
+const char* OPTION_SCAN_HOSTS	= "hosts";
+const char* OPTION_SCAN_SOURCES	= "sources";
+const char* OPTION_EVIDENCE		= "evidence";
+const char* OPTION_EVI_DIR		= "dir";
+const char* OPTION_EVI_FLOWS	= "flows";
+const char* OPTION_EVI_PACKETS	= "packets";
+const char* OPTION_EVI_MAXSIZE	= "maxsize";
+const char* OPTION_EVI_INTERVAL	= "interval";
+const char* OPTION_EVI_TOTAL	= "total";
+const char* OPTION_EVI_STATES	= "states";
+const char* OPTION_ADMIN		= "admin";
+const char* OPTION_ADM_PORT		= "port";
+const char* OPTION_SESSIONS		= "sessions";
+const char* OPTION_SES_STATS	= "stats";
+const char* OPTION_SES_SOURCES	= "sources";
 
 extern Deception::Logging globLog;
+extern std::string adminIpAddr;
+extern int adminPort;
 extern std::string runUser;
 extern std::string runGroup;
 extern std::string capDevice;
 extern bool enableCapture;
+extern CaptureConfig capConfig;
 
 // define statics
 std::string Deception::ConfigHandler::className = "ConfigHandler";
@@ -103,6 +153,10 @@ void Deception::ConfigHandler::characters(const XMLCh *const chars,
 		// or just our logfile?
 		} else if (this->inLogFile && !this->logFileRead) {
 			this->logFile.append(XMLString::transcode(chars));
+		} else if (this->inLogLevel && !this->logLevelRead) {
+			this->logLevel.append(XMLString::transcode(chars));
+		} else if (this->inEventLog && !this->eventLogRead) {
+			this->eventLog.append(XMLString::transcode(chars));
 		} else if (this->inUser && !this->userRead) {
 			runUser.append(XMLString::transcode(chars));
 		} else if (this->inGroup && !this->groupRead) {
@@ -161,6 +215,10 @@ void Deception::ConfigHandler::startElement(const XMLCh* const uri,
 	} else if ((std::string(XMLString::transcode(qName)).compare(OPTION_LOGFILE) == 0)
 			&& (this->logFile.length() == 0)) {
 		this->inLogFile = true;
+	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_LOGLEVEL) == 0) {
+		this->inLogLevel = true;
+	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_EVENTLOG) == 0) {
+		this->inEventLog = true;
 	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_MODULEDIR) == 0) {
 		this->inModuleDir = true;
 	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_HOST) == 0) {
@@ -224,26 +282,123 @@ void Deception::ConfigHandler::startElement(const XMLCh* const uri,
 				// is this port in any way legal?
 				if ((port < 0) || (port > 65536)) {
 					// otherwise we'll just ignore the crap
-					logMsg.erase();
-					logMsg.append("ignoring configuration port ").append(intToString(port))
-						.append(" from module ").append(this->curModFileName)
-						.append(": out of range");
-					globLog.toLog(this->className, Deception::Debug, logMsg);
+					LOGDEBUG(this->className, "ignoring configuration port " << port
+						<< " from module " << this->curModFileName << ": out of range");
 					continue;
 				}
 
-#ifdef DEBUG
-				logMsg = "adding data for " + this->ipaddr + ":" + intToString(port)
-					+ " with module " + this->curModName;
-				globLog.toLog(this->className, Deception::Debug, logMsg);
-#endif
+				LOGDEBUG(this->className, "adding data for " << this->ipaddr << ":" << port
+					<< " with module " << this->curModName);
 				// add module data to store
 				store.addModule(this->ipaddr, port, this->curModFileName, this->curModName, this->curModOption);
 				this->socketCount++;
 			}
-		} else if (this->inCapture && (std::string(XMLString::transcode(attribs.getQName(i))).compare(OPTION_CAP_ENABLE) == 0)) {
-			if (std::string(XMLString::transcode(attribs.getValue(i))).compare("yes") == 0) {
-				enableCapture = true;
+		} else if (std::string(XMLString::transcode(qName)).compare(OPTION_LOGFILE) == 0) {
+			std::string attrName = XMLString::transcode(attribs.getQName(i));
+			std::string attrValue = XMLString::transcode(attribs.getValue(i));
+			if (attrName.compare(OPTION_LOG_PRECISION) == 0) {
+				// number of sub-second digits in timestamps
+				if (!globLog.setTimePrecision(atoi(attrValue.c_str()))) {
+					logMsg = "ignoring unsupported timestamp precision " + attrValue;
+					globLog.toLog(this->className, Deception::Error, logMsg);
+				}
+			} else if (attrName.compare(OPTION_LOG_MAXSIZE) == 0) {
+				this->rotateSize = this->parseSize(attrValue);
+			} else if (attrName.compare(OPTION_LOG_INTERVAL) == 0) {
+				this->rotateInterval = this->parseInterval(attrValue);
+			} else if (attrName.compare(OPTION_LOG_KEEP) == 0) {
+				this->rotateKeep = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_LOG_COMPRESS) == 0) {
+				this->rotateCompress = (attrValue.compare("yes") == 0);
+			}
+		} else if (std::string(XMLString::transcode(qName)).compare(OPTION_AGGREGATE) == 0) {
+			std::string attrName = XMLString::transcode(attribs.getQName(i));
+			std::string attrValue = XMLString::transcode(attribs.getValue(i));
+			if (attrName.compare(OPTION_AGG_WINDOW) == 0) {
+				this->aggregateWindow = this->parseInterval(attrValue);
+			} else if (attrName.compare(OPTION_AGG_RATE) == 0) {
+				this->aggregateRate = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_AGG_BURST) == 0) {
+				this->aggregateBurst = atoi(attrValue.c_str());
+			}
+		} else if (std::string(XMLString::transcode(qName)).compare(OPTION_SCAN) == 0) {
+			std::string attrName = XMLString::transcode(attribs.getQName(i));
+			std::string attrValue = XMLString::transcode(attribs.getValue(i));
+			if (attrName.compare(OPTION_SCAN_WINDOW) == 0) {
+				this->scanWindow = this->parseInterval(attrValue);
+			} else if (attrName.compare(OPTION_SCAN_PORTS) == 0) {
+				this->scanPorts = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_SCAN_HOSTS) == 0) {
+				this->scanHosts = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_SCAN_SOURCES) == 0) {
+				capConfig.scanSources = atoi(attrValue.c_str());
+			}
+		} else if (std::string(XMLString::transcode(qName)).compare(OPTION_ADMIN) == 0) {
+			std::string attrName = XMLString::transcode(attribs.getQName(i));
+			std::string attrValue = XMLString::transcode(attribs.getValue(i));
+			if (attrName.compare(OPTION_IP) == 0) {
+				adminIpAddr = attrValue;
+			} else if (attrName.compare(OPTION_ADM_PORT) == 0) {
+				adminPort = atoi(attrValue.c_str());
+			}
+		} else if (std::string(XMLString::transcode(qName)).compare(OPTION_SESSIONS) == 0) {
+			std::string attrName = XMLString::transcode(attribs.getQName(i));
+			std::string attrValue = XMLString::transcode(attribs.getValue(i));
+			if (attrName.compare(OPTION_SES_STATS) == 0) {
+				this->sessionInterval = this->parseInterval(attrValue);
+			} else if (attrName.compare(OPTION_SES_SOURCES) == 0) {
+				this->sessionSources = atoi(attrValue.c_str());
+			}
+		} else if (std::string(XMLString::transcode(qName)).compare(OPTION_EVIDENCE) == 0) {
+			std::string attrName = XMLString::transcode(attribs.getQName(i));
+			std::string attrValue = XMLString::transcode(attribs.getValue(i));
+			if (attrName.compare(OPTION_EVI_DIR) == 0) {
+				capConfig.evidence.dir = attrValue;
+			} else if (attrName.compare(OPTION_EVI_FLOWS) == 0) {
+				capConfig.evidence.flows = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_EVI_PACKETS) == 0) {
+				capConfig.evidence.packets = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_EVI_MAXSIZE) == 0) {
+				capConfig.evidence.maxSize = this->parseSize(attrValue);
+			} else if (attrName.compare(OPTION_EVI_INTERVAL) == 0) {
+				capConfig.evidence.interval = this->parseInterval(attrValue);
+			} else if (attrName.compare(OPTION_EVI_TOTAL) == 0) {
+				capConfig.evidence.total = this->parseSize(attrValue);
+			} else if (attrName.compare(OPTION_EVI_STATES) == 0) {
+				// dtk-script states whose sessions are kept
+				Deception::EvidenceRecorder::configureStates(attrValue);
+			}
+		} else if (this->inCapture) {
+			std::string attrName = XMLString::transcode(attribs.getQName(i));
+			std::string attrValue = XMLString::transcode(attribs.getValue(i));
+			if (attrName.compare(OPTION_CAP_ENABLE) == 0) {
+				if (attrValue.compare("yes") == 0) {
+					enableCapture = true;
+				}
+			} else if (attrName.compare(OPTION_CAP_SNAPLEN) == 0) {
+				capConfig.snaplen = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_CAP_BUFFER) == 0) {
+				capConfig.bufferSize = this->parseSize(attrValue);
+			} else if (attrName.compare(OPTION_CAP_TIMEOUT) == 0) {
+				capConfig.timeout = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_CAP_IMMEDIATE) == 0) {
+				capConfig.immediate = (attrValue.compare("yes") == 0);
+			} else if (attrName.compare(OPTION_CAP_PROMISC) == 0) {
+				capConfig.promisc = (attrValue.compare("no") != 0);
+			} else if (attrName.compare(OPTION_CAP_WORKERS) == 0) {
+				capConfig.workers = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_CAP_MODE) == 0) {
+				capConfig.inProcess = (attrValue.compare("thread") == 0);
+			} else if (attrName.compare(OPTION_CAP_FLOWS) == 0) {
+				capConfig.flows = atoi(attrValue.c_str());
+			} else if (attrName.compare(OPTION_CAP_OSDB) == 0) {
+				capConfig.osdb = attrValue;
+			} else if (attrName.compare(OPTION_CAP_PROBES) == 0) {
+				capConfig.probes = (attrValue.compare("no") != 0);
+			} else if (attrName.compare(OPTION_CAP_PHANTOM) == 0) {
+				capConfig.phantomPorts = attrValue;
+			} else if (attrName.compare(OPTION_CAP_STATS) == 0) {
+				capConfig.statsInterval = this->parseInterval(attrValue);
 			}
 		}
 	} // end for
@@ -275,6 +430,26 @@ void Deception::ConfigHandler::endElement(const XMLCh* const uri,
 		this->inLogFile = false;
 		this->logFileRead = true;
 		globLog.setLogFile(this->logFile);
+		globLog.setRotation(this->rotateSize, this->rotateInterval,
+				this->rotateKeep, this->rotateCompress);
+	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_LOGLEVEL) == 0) {
+		this->inLogLevel = false;
+		this->logLevelRead = true;
+		if (!globLog.setLogLevel(this->logLevel)) {
+			std::string logMsg = "ignoring unknown log level '" + this->logLevel + "'";
+			globLog.toLog(this->className, Deception::Error, logMsg);
+		}
+	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_EVENTLOG) == 0) {
+		this->inEventLog = false;
+		this->eventLogRead = true;
+		globEvents.setFile(this->eventLog);
+	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_AGGREGATE) == 0) {
+		Deception::EventAggregator::configure(this->aggregateWindow,
+				this->aggregateRate, this->aggregateBurst);
+	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_SCAN) == 0) {
+		Deception::ScanDetector::configure(this->scanWindow, this->scanPorts, this->scanHosts);
+	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_SESSIONS) == 0) {
+		Deception::SessionAccounting::configure(this->sessionInterval, this->sessionSources);
 	} else if (std::string(XMLString::transcode(qName)).compare(OPTION_USER) == 0) {
 		this->inUser = false;
 		this->userRead = true;
@@ -289,6 +464,60 @@ void Deception::ConfigHandler::endElement(const XMLCh* const uri,
 	return;
 }
 
+//{{{1 DXG DOC
+/**
+ * Convert a size like "512", "100K", "10M" or "1G" to bytes
+ *
+ * \param &str String to convert
+ *
+ * \return Size in bytes, 0 if the string is not a valid size
+ */
+//}}}1 DXG DOC
+off_t Deception::ConfigHandler::parseSize(const std::string &str) const
+{
+	char *end;
+	off_t size = strtol(str.c_str(), &end, 10);
+	if ((end == str.c_str()) || (size < 0)) {
+		return 0;
+	}
+	switch (*end) {
+		case 'g': case 'G':
+			size *= 1024;
+			// fall through
+		case 'm': case 'M':
+			size *= 1024;
+			// fall through
+		case 'k': case 'K':
+			size *= 1024;
+		default:
+			break;
+	}
+	return size;
+}
+
+//{{{1 DXG DOC
+/**
+ * Convert an interval to seconds. Either a number of seconds or one of
+ * "hourly", "daily" or "weekly".
+ *
+ * \param &str String to convert
+ *
+ * \return Interval in seconds, 0 if the string is not a valid interval
+ */
+//}}}1 DXG DOC
+time_t Deception::ConfigHandler::parseInterval(const std::string &str) const
+{
+	if (str.compare("hourly") == 0) {
+		return 3600;
+	} else if (str.compare("daily") == 0) {
+		return 86400;
+	} else if (str.compare("weekly") == 0) {
+		return 7 * 86400;
+	}
+	long interval = atol(str.c_str());
+	return (interval > 0) ? interval : 0;
+}
+
 //{{{1 DXG DOC
 /**
  * Error function to be used for parsing exceptions which could occure
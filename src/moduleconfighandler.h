@@ -92,9 +92,13 @@ class ConfigHandler : public DefaultHandler
 				const XMLCh* const qName);
 		void characters(const XMLCh *const chars, const unsigned int len);
 		bool isWhitespace(const std::string& str) const;
+		off_t parseSize(const std::string& str) const;
+		time_t parseInterval(const std::string& str) const;
 		ConfigHandler() :
 			inModule(false),
 			inLogFile(false),
+			inLogLevel(false),
+			inEventLog(false),
 			inModuleDir(false),
 			inHostList(false),
 			inUser(false),
@@ -102,9 +106,23 @@ class ConfigHandler : public DefaultHandler
 			inCapture(false),
 			mDirRead(false),
 			logFileRead(false),
+			logLevelRead(false),
+			eventLogRead(false),
 			userRead(false),
 			groupRead(false),
 			captureRead(false),
+			rotateSize(0),
+			rotateInterval(0),
+			rotateKeep(5),
+			rotateCompress(false),
+			aggregateWindow(10),
+			aggregateRate(10),
+			aggregateBurst(50),
+			scanWindow(60),
+			scanPorts(20),
+			scanHosts(20),
+			sessionInterval(300),
+			sessionSources(1024),
 			socketCount(0)
 		   	{ }
 		std::string getLogFile() const
@@ -121,8 +139,12 @@ class ConfigHandler : public DefaultHandler
 		std::string user;				///< user name, child processes shall belong to
 		std::string group;				///< group name, child processes shall belong to
 		std::string logFile;			///< file to log to
+		std::string logLevel;			///< verbosity to log with
+		std::string eventLog;			///< file to write JSON events to
 		bool inModule;					///< flag, if ports can be read
 		bool inLogFile;					///< flag, if logfile name can be read
+		bool inLogLevel;				///< flag, if log level can be read
+		bool inEventLog;				///< flag, if event log name can be read
 		bool inModuleDir;				///< flag, if directory name of moduledir can be read
 		bool inHostList;				///< flag, if config reached a list of port for a specific virtual host
 		bool inUser;					///< flag, if user name can now be read
@@ -130,9 +152,23 @@ class ConfigHandler : public DefaultHandler
 		bool inCapture;					///< flag, if capture device can be read
 		bool mDirRead;					///< flag, if module directory has already been read
 		bool logFileRead;				///< flag, if log file has been read
+		bool logLevelRead;				///< flag, if log level has been read
+		bool eventLogRead;				///< flag, if event log name has been read
 		bool userRead;					///< flag, if user name has been read
 		bool groupRead;					///< flag, if group name has been read
 		bool captureRead;				///< flag, if capture device has been read
+		off_t rotateSize;				///< rotate logfile at this size
+		time_t rotateInterval;			///< rotate logfile after this many seconds
+		int rotateKeep;					///< number of rotated logfiles to keep
+		bool rotateCompress;			///< flag, if rotated logfiles are compressed
+		time_t aggregateWindow;			///< window to fold repeated events in
+		unsigned int aggregateRate;		///< raw events per second and source
+		unsigned int aggregateBurst;	///< raw events in a row per source
+		time_t scanWindow;				///< window of the scan detection
+		unsigned int scanPorts;			///< distinct ports that make a vertical scan
+		unsigned int scanHosts;			///< distinct hosts that make a horizontal scan
+		time_t sessionInterval;			///< seconds between reports of the session usage
+		unsigned int sessionSources;	///< sources kept apart in the session reports
 		int socketCount;				///< counter to check, if we don't have more sockets than OPEN_MAX
 };
 
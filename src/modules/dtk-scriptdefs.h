@@ -36,6 +36,7 @@
 // Project Headers
 #include "defs.h"
 #include "logging.h"
+#include "eventlog.h"
 
 //{{{1 DXG DOC
 /**
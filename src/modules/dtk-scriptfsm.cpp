@@ -35,6 +35,8 @@
 
 // Module Headers
 #include "dtk-scriptfsm.h"
+#include "evidence.h"
+#include "metrics.h"
 
 
 DECEPTION_NAMESPACE_USE;
@@ -50,6 +52,7 @@ unsigned int DtkScriptFSM::confDelay = 0;
 std::string  DtkScriptFSM::confDir = "";
 std::string  DtkScriptFSM::confFile = "";
 bool DtkScriptFSM::debug = false;
+int DtkScriptFSM::transitionMetric = -1;
 
 //{{{1 DXG DOC
 /**
@@ -77,6 +80,16 @@ void DtkScriptFSM::changeState(unsigned int stateNum)
 	std::string logMsg = this->confFile + " S" + c;
 	globLog.toLog(moduleName, ModuleInfo, logMsg);
 
+	// following events of this session are in the new state
+	globEvents.setScript(this->confFile.c_str(), stateNum);
+	if (globEvents.isEnabled()) {
+		LogEvent event(moduleName.c_str(), ModuleInfo, "state");
+		globEvents.log(event);
+	}
+	// the capture engine keeps the packets of sessions reaching this state
+	EvidenceRecorder::stateReached(stateNum);
+	globMetrics.add(this->transitionMetric);
+
 	return;
 }
 
@@ -450,17 +463,13 @@ void DtkScriptFSM::parse(void)
 
 	char buf[1024]; // FIXME: static buffer
 	std::string input;
-	std::string logMsg;
 
 	// retrieve the data from the network
 	this->streamIn.getline(buf, 1023, '\n');
 	if (buf[0] == 0) // FIXME: catches EOF / ^D but NOT on solaris !
 		::exit(EXIT_SUCCESS);
 	input = buf;
-	logMsg = "recv '" + input + "'";
-	globLog.toLog(moduleName, Debug, logMsg);
-
-
+	LOGDEBUG(moduleName, "recv '" << buf << "'");
 
 	// FIXME: what is NIL supposed to be acting on ?
 	if (input.compare("\n") == 0) {
@@ -470,8 +479,13 @@ void DtkScriptFSM::parse(void)
 	
 	// log input
 	// XXX: could use some special char parsing (p.e. '\n'->^M)
-	logMsg = this->confFile + "Input '" + input + "'";
-	globLog.toLog(moduleName, ModuleInfo, logMsg);
+	LOGMSG(moduleName, ModuleInfo, this->confFile << "Input '" << buf << "'");
+	if (globEvents.isEnabled()) {
+		LogEvent event(moduleName.c_str(), ModuleInfo, "input");
+		event.payload = input.data();
+		event.payloadLen = input.length();
+		globEvents.log(event);
+	}
 
 	// set up come common variables needed for the match scoring
 	StateTransitionData *entry = NULL;
@@ -573,11 +587,6 @@ void DtkScriptFSM::parse(void)
 //}}}1 DXG DOC
 void DtkScriptFSM::init(std::string dir, std::string file)
 {
-#define DO_PROF
-#ifdef DO_PROF
-	timeval start;
-	gettimeofday(&start, NULL);
-#endif
 	std::string logMsg;
 	// check if the directory is accesible
 	if (access(dir.c_str(), F_OK) < 0) {
@@ -597,6 +606,9 @@ void DtkScriptFSM::init(std::string dir, std::string file)
 		exit(EXIT_FAILURE);
 	}
 	this->confFile = file;
+	// looked up once, not for every state change
+	this->transitionMetric = globMetrics.addCounter("deceptiond_fsm_transitions_total",
+			"state changes of the dtk scripts", Metrics::label("script", this->confFile));
 
 	// loop over all states creating and initializing a new state object
 	for (int i = 0; i < STATECOUNT; i++) {
@@ -607,25 +619,9 @@ void DtkScriptFSM::init(std::string dir, std::string file)
 	// set the starting state of the fsm
 	this->changeState(0);
 
-#ifdef DO_PROF
-    timeval end;
-    gettimeofday(&end, NULL);
-
-    long us = ((end.tv_sec - start.tv_sec) * 1000000)
-      + (end.tv_usec - start.tv_usec);
-
-    //std::cout << "Total time for request = " << us << " us" << " (" << (double) (us/1000000.0) << " s)";
-	char lus[32];
-	snprintf(lus, 32, "%ld", us);
-	char ls[32];
-	snprintf(ls, 32, "%f", (double) (us/1000000.0));
-	logMsg = "initalization of " + this->confFile + " took " + ls + " sec.";
-	globLog.toLog(moduleName, Debug, logMsg);
-#endif
-
 	// START is only run once upon fsm startup.
-	// it is not taken into account for DO_PROF, since START may use a
-	// delay plus initialisation of the fsm is already done at this point.
+	// the daemon times the initialisation plus the first response of
+	// START in its latency histograms of the listener.
 	this->states[0]->dtkSpecial("START");
 
 
@@ -145,6 +145,7 @@ class DtkScriptFSM
 		static unsigned int confMaxLoops;	///< how many times to loop the machine the most
 		static unsigned int confTimeout;	///< when to close the connection due to idle timeout.
 		static bool debug;					///< run in debug mode
+		static int transitionMetric;		///< id of the counter of state changes of confFile
 		StateTransitionTable matchAction;	///< transition table for actions
 		StateTransitionTable matchDtk;		///< transition table for dtk special commands
 		StateTransitionTable matchPattern;	///< transition table for patterns / regex's
@@ -154,6 +155,9 @@ class DtkScriptFSM
 		InputStream &streamIn;
 		OutputStream &streamOut;
 
+		// the microbenchmarks time initState() and parse() on their own
+		friend class FsmBench;
+
 		// hidden
 		DtkScriptFSM(const DtkScriptFSM &rCopy);
 };
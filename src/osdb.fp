@@ -0,0 +1,64 @@
+# OS signatures of SYNs for the capture engine of deceptiond
+#
+# label = OS:flavor
+# sig   = ittl:mss:window,wscale:options:quirks
+#
+# ittl     initial ttl, one of 32, 64, 128 and 255
+# mss      maximum segment size, * for any
+# window   number, mss*N, %N for multiples of N or * for any,
+#          followed by the window scale as number or * for any
+# options  tcp options in order: eol, nop, mss, ws, sok, sack, ts or
+#          ?N for kind N
+# quirks   df, id+, id-, ecn, ts1-, ts2+
+#
+# Signatures with the same ttl and options are tried in the order of
+# this file, so put specific ones first.
+
+label = Linux:3.11+
+sig   = 64:*:mss*20,7:mss,sok,ts,nop,ws:df,id+
+sig   = 64:*:mss*20,10:mss,sok,ts,nop,ws:df,id+
+sig   = 64:*:64240,7:mss,sok,ts,nop,ws:df,id+
+sig   = 64:*:65495,7:mss,sok,ts,nop,ws:df,id+
+
+label = Linux:2.6.x-3.x
+sig   = 64:*:mss*10,*:mss,sok,ts,nop,ws:df,id+
+sig   = 64:*:mss*4,*:mss,sok,ts,nop,ws:df,id+
+
+label = Linux:2.4.x
+sig   = 64:*:mss*4,0:mss,sok,ts,nop,ws:df,id+
+
+label = Windows:7-8
+sig   = 128:*:8192,8:mss,nop,ws,nop,nop,sok:df,id+
+sig   = 128:*:8192,2:mss,nop,ws,nop,nop,sok:df,id+
+
+label = Windows:10+
+sig   = 128:*:64240,8:mss,nop,ws,nop,nop,sok:df,id+
+sig   = 128:*:65535,8:mss,nop,ws,nop,nop,sok:df,id+
+
+label = Windows:XP
+sig   = 128:*:65535,*:mss,nop,nop,sok:df,id+
+sig   = 128:*:64240,*:mss,nop,nop,sok:df,id+
+
+label = MacOS:10.x+
+sig   = 64:*:65535,6:mss,nop,ws,nop,nop,ts,sok,eol:df,id+
+sig   = 64:*:65535,5:mss,nop,ws,nop,nop,ts,sok,eol:df,id+
+
+label = FreeBSD:9.x+
+sig   = 64:*:65535,6:mss,nop,ws,sok,ts:df,id+
+sig   = 64:*:65535,3:mss,nop,ws,sok,ts:df,id+
+
+label = OpenBSD:3.x+
+sig   = 64:*:16384,3:mss,nop,nop,sok,nop,ws,nop,nop,ts:df,id+
+
+label = Solaris:10+
+sig   = 64:*:%8192,*:nop,nop,ts,mss,nop,ws,nop,nop,sok:df,id+
+
+label = nmap:SYN scan
+sig   = 64:1460:1024,*:mss:
+sig   = 64:1460:2048,*:mss:
+sig   = 64:1460:3072,*:mss:
+sig   = 64:1460:4096,*:mss:
+
+label = masscan:SYN scan
+sig   = 255:*:1024,*::
+sig   = 64:*:1024,*::
@@ -0,0 +1,339 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file ossignatures.cpp
+ *
+ * Contains the implementation of the passive OS fingerprinting
+ */
+#include "ossignatures.h"
+#include "logging.h"
+#include "ioexception.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+std::string Deception::OsSignatures::className = "OsSignatures";
+
+/// names of the quirks in signatures, see SynQuirks
+static const struct {
+	const char *name;
+	u_int8_t quirk;
+} quirkNames[] = {
+	{ "df", Deception::QuirkDf },
+	{ "id+", Deception::QuirkIdPlus },
+	{ "id-", Deception::QuirkIdMinus },
+	{ "ecn", Deception::QuirkEcn },
+	{ "ts1-", Deception::QuirkTs1Minus },
+	{ "ts2+", Deception::QuirkTs2Plus }
+};
+
+/// remove blanks at both ends of a string
+static std::string trim(const std::string &_str)
+{
+	std::string::size_type begin = _str.find_first_not_of(" \t\r");
+	if (begin == std::string::npos) {
+		return "";
+	}
+	return _str.substr(begin, _str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+/// split a string at every occurrence of a separator
+static std::vector<std::string> split(const std::string &_str, char _sep)
+{
+	std::vector<std::string> parts;
+	std::string::size_type begin = 0, end;
+	while ((end = _str.find(_sep, begin)) != std::string::npos) {
+		parts.push_back(_str.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	parts.push_back(_str.substr(begin));
+	return parts;
+}
+
+/// parse a decimal number up to _max, false if it is none
+static bool parseNumber(const std::string &_str, unsigned long _max, unsigned long &_num)
+{
+	if (_str.empty() || (_str.find_first_not_of("0123456789") != std::string::npos)) {
+		return false;
+	}
+	_num = ::strtoul(_str.c_str(), NULL, 10);
+	return _num <= _max;
+}
+
+// {{{1 DXG DOC
+/**
+ * Order of the table: by initial ttl and options, so all signatures of
+ * a SYN are next to each other
+ */
+// }}}1 DXG DOC
+bool Deception::OsSignatures::Signature::operator<(const Signature &rhs) const
+{ // {{{1
+	if (this->ittl != rhs.ittl) {
+		return this->ittl < rhs.ittl;
+	}
+	if (this->optionCount != rhs.optionCount) {
+		return this->optionCount < rhs.optionCount;
+	}
+	return ::memcmp(this->options, rhs.options, this->optionCount) < 0;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Constructor, there are no signatures until load() is called
+ */
+// }}}1 DXG DOC
+Deception::OsSignatures::OsSignatures()
+{ // {{{1
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Load signatures from a file and compile them into the table.
+ * Invalid lines are logged and skipped.
+ *
+ * \param _fileName Name of the signature file
+ *
+ * \exception IOException File could not be read
+ */
+// }}}1 DXG DOC
+void Deception::OsSignatures::load(const std::string &_fileName)
+{ // {{{1
+	std::ifstream file(_fileName.c_str());
+	if (!file) {
+		throw IOException(errno);
+	}
+	std::string line;
+	int lineNo = 0;
+	bool haveLabel = false;
+	while (std::getline(file, line)) {
+		lineNo++;
+		line = trim(line);
+		if (line.empty() || (line[0] == '#')) {
+			continue;
+		}
+		std::string::size_type eq = line.find('=');
+		std::string key = (eq != std::string::npos) ? trim(line.substr(0, eq)) : "";
+		std::string value = (eq != std::string::npos) ? trim(line.substr(eq + 1)) : "";
+		if ((key == "label") && !value.empty()) {
+			this->labels.push_back(value);
+			haveLabel = true;
+			continue;
+		}
+		Signature signature;
+		if ((key != "sig") || !haveLabel || !this->parse(value, signature)) {
+			LOGMSG(className, Error, _fileName << ":" << lineNo << ": ignoring invalid line");
+			continue;
+		}
+		signature.label = this->labels.size() - 1;
+		this->table.push_back(signature);
+	}
+	// equal keys keep the order of the file
+	std::stable_sort(this->table.begin(), this->table.end());
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Compile the fields of a signature
+ *
+ * \param _sig Fields of the signature, "ittl:mss:window,wscale:options:quirks"
+ * \param _signature Is filled with the signature
+ *
+ * \retval true If the signature is valid
+ * \retval false Otherwise
+ */
+// }}}1 DXG DOC
+bool Deception::OsSignatures::parse(const std::string &_sig, Signature &_signature) const
+{ // {{{1
+	std::vector<std::string> fields = split(_sig, ':');
+	unsigned long num;
+	if (fields.size() != 5) {
+		return false;
+	}
+	::memset(&_signature, 0, sizeof(_signature));
+
+	if (!parseNumber(fields[0], 255, num) || (initialTtl(num) != num)) {
+		return false;
+	}
+	_signature.ittl = num;
+
+	_signature.anyMss = (fields[1] == "*");
+	if (!_signature.anyMss) {
+		if (!parseNumber(fields[1], 65535, num)) {
+			return false;
+		}
+		_signature.mss = num;
+	}
+
+	std::vector<std::string> window = split(fields[2], ',');
+	if (window.size() != 2) {
+		return false;
+	}
+	if (window[0] == "*") {
+		_signature.windowType = WindowAny;
+	} else if (window[0].compare(0, 4, "mss*") == 0) {
+		_signature.windowType = WindowMss;
+		window[0].erase(0, 4);
+	} else if (window[0][0] == '%') {
+		_signature.windowType = WindowMod;
+		window[0].erase(0, 1);
+	} else {
+		_signature.windowType = WindowExact;
+	}
+	if (_signature.windowType != WindowAny) {
+		if (!parseNumber(window[0], 65535, num)
+				|| ((num == 0) && (_signature.windowType != WindowExact))) {
+			return false;
+		}
+		_signature.window = num;
+	}
+	_signature.anyWscale = (window[1] == "*");
+	if (!_signature.anyWscale) {
+		if (!parseNumber(window[1], 255, num)) {
+			return false;
+		}
+		_signature.wscale = num;
+	}
+
+	if (!fields[3].empty()) {
+		std::vector<std::string> options = split(fields[3], ',');
+		if (options.size() > MAX_SYN_OPTIONS) {
+			return false;
+		}
+		for (size_t i = 0; i < options.size(); i++) {
+			int kind = SynFingerprint::optionKind(options[i].data(), options[i].length());
+			if (kind < 0) {
+				return false;
+			}
+			_signature.options[_signature.optionCount++] = kind;
+		}
+	}
+
+	if (!fields[4].empty()) {
+		std::vector<std::string> quirks = split(fields[4], ',');
+		for (size_t i = 0; i < quirks.size(); i++) {
+			size_t q = 0;
+			while ((q < sizeof(quirkNames) / sizeof(quirkNames[0])) && (quirks[i] != quirkNames[q].name)) {
+				q++;
+			}
+			if (q == sizeof(quirkNames) / sizeof(quirkNames[0])) {
+				return false;
+			}
+			_signature.quirks |= quirkNames[q].quirk;
+		}
+	}
+	return true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Guess the ttl a packet has been sent with
+ *
+ * \param _ttl Ttl of the received packet
+ * \return The next of the common initial ttls 32, 64, 128 and 255
+ */
+// }}}1 DXG DOC
+u_int8_t Deception::OsSignatures::initialTtl(u_int8_t _ttl)
+{ // {{{1
+	if (_ttl <= 32) {
+		return 32;
+	} else if (_ttl <= 64) {
+		return 64;
+	} else if (_ttl <= 128) {
+		return 128;
+	}
+	return 255;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Compare mss and window of a signature with a SYN
+ */
+// }}}1 DXG DOC
+bool Deception::OsSignatures::matchesSyn(const Signature &_signature, const SynFingerprint &_syn) const
+{ // {{{1
+	if (!_signature.anyMss && (_signature.mss != _syn.mss)) {
+		return false;
+	}
+	if (!_signature.anyWscale && (_signature.wscale != _syn.wscale)) {
+		return false;
+	}
+	switch (_signature.windowType) {
+		case WindowExact:
+			return _syn.window == _signature.window;
+		case WindowMss:
+			return (_syn.mss != 0) && (_syn.window == _syn.mss * _signature.window);
+		case WindowMod:
+			return (_syn.window % _signature.window) == 0;
+		default:
+			return true;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Find the operating system that has sent a SYN
+ *
+ * \param _syn The SYN
+ * \param _fuzzy Set to true if the quirks don't match, may be NULL
+ *
+ * \return Label of the signature, NULL if there is none
+ */
+// }}}1 DXG DOC
+const char* Deception::OsSignatures::match(const SynFingerprint &_syn, bool *_fuzzy) const
+{ // {{{1
+	Signature key;
+	key.ittl = initialTtl(_syn.ttl);
+	key.optionCount = _syn.optionCount;
+	::memcpy(key.options, _syn.options, _syn.optionCount);
+	std::vector<Signature>::const_iterator it = std::lower_bound(this->table.begin(), this->table.end(), key);
+	const Signature *fuzzy = NULL;
+	for (; (it != this->table.end()) && !(key < *it); it++) {
+		if (!this->matchesSyn(*it, _syn)) {
+			continue;
+		}
+		if (it->quirks == _syn.quirks) {
+			if (_fuzzy != NULL) {
+				*_fuzzy = false;
+			}
+			return this->labels[it->label].c_str();
+		}
+		if (fuzzy == NULL) {
+			fuzzy = &*it;
+		}
+	}
+	if (fuzzy == NULL) {
+		return NULL;
+	}
+	if (_fuzzy != NULL) {
+		*_fuzzy = true;
+	}
+	return this->labels[fuzzy->label].c_str();
+} // }}}1
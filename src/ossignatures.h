@@ -0,0 +1,146 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _OSSIGNATURES_H
+#define _OSSIGNATURES_H
+
+/**
+ * \file ossignatures.h
+ *
+ * Declares the passive OS fingerprinting of SYNs.
+ */
+
+// Project Headers
+#include "defs.h"
+#include "flowtable.h"
+
+// C++ Headers
+#include <string>
+#include <vector>
+
+// C Headers
+#include <sys/types.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * \class OsSignatures
+ *
+ * Tells the operating system of a client by the SYN it has sent, like
+ * p0f does. The signatures are read from a text file, which consists of
+ * labels, each followed by the signatures of the stacks they stand for:
+ * \code
+ * label = Linux:3.11+
+ * sig = 64:*:mss*20,7:mss,sok,ts,nop,ws:df,id+
+ * \endcode
+ * The fields of a signature are
+ *
+ * - the initial ttl, the ttl of a SYN is rounded up to 32, 64, 128
+ *   or 255
+ * - the mss, * for any
+ * - the window, as number, mss*N, %N for any multiple of N or * for any,
+ *   and the window scale, as number or * for any
+ * - the kinds of the tcp options in order, see
+ *   SynFingerprint::formatOptions()
+ * - the quirks of the headers: df (don't fragment), id+ (df and a
+ *   nonzero ip id), id- (no df and a zero ip id), ecn, ts1- (zero own
+ *   timestamp) and ts2+ (nonzero peer timestamp)
+ *
+ * Lines starting with # are comments.
+ *
+ * The signatures are compiled into a flat table sorted by initial ttl
+ * and options, so a lookup is a binary search and compares a few
+ * entries with the same options. Signatures with equal keys are tried
+ * in the order of the file. If none matches with the quirks, one that
+ * matches without them is taken as fuzzy match.
+ *
+ * \note The labels returned by match() live as long as the object and
+ * load() must not be called any more once they are in use. Lookups
+ * don't modify the object, so any number of threads can match
+ * concurrently.
+ */
+// }}}1 DXG DOC
+class OsSignatures
+{ // {{{1
+	public:
+		OsSignatures();
+		void load(const std::string &_fileName);
+		// {{{2 DXG DOC
+		/**
+		 * Number of signatures loaded
+		 */
+		// }}}2 DXG DOC
+		size_t size() const
+		{
+			return this->table.size();
+		}
+		const char* match(const SynFingerprint &_syn, bool *_fuzzy = NULL) const;
+		static u_int8_t initialTtl(u_int8_t _ttl);
+	private:
+		/// how the window of a signature is compared
+		enum WindowType {
+			WindowAny,						///< any window
+			WindowExact,					///< window equals value
+			WindowMss,						///< window is value times the mss
+			WindowMod						///< window is a multiple of value
+		};
+		// {{{2 DXG DOC
+		/**
+		 * A compiled signature
+		 */
+		// }}}2 DXG DOC
+		struct Signature
+		{
+			u_int8_t ittl;					///< initial ttl
+			u_int8_t optionCount;			///< number of options
+			u_int8_t options[MAX_SYN_OPTIONS];	///< kinds of the options in order
+			u_int8_t quirks;				///< SynQuirks
+			bool anyMss;					///< flag, if any mss matches
+			u_int16_t mss;					///< mss
+			WindowType windowType;			///< how window is compared
+			u_int16_t window;				///< window, factor or divisor
+			bool anyWscale;					///< flag, if any window scale matches
+			u_int8_t wscale;				///< window scale
+			size_t label;					///< index of the label
+
+			bool operator<(const Signature &rhs) const;
+		};
+
+		static std::string className;		///< name for logging
+		std::vector<Signature> table;		///< the signatures, sorted
+		std::vector<std::string> labels;	///< labels of the signatures
+
+		bool parse(const std::string &_sig, Signature &_signature) const;
+		bool matchesSyn(const Signature &_signature, const SynFingerprint &_syn) const;
+		// hidden
+		OsSignatures(const OsSignatures &rhs);
+		OsSignatures &operator=(const OsSignatures &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _OSSIGNATURES_H
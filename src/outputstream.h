@@ -60,6 +60,26 @@
 
 DECEPTION_NAMESPACE_BEGIN
 
+// {{{1 DXG DOC
+/**
+ * \class OutputObserver
+ *
+ * Interface to be told once about the first bytes written to an
+ * OutputBuffer, e.g. to time the first answer to a client.
+ */
+// }}}1 DXG DOC
+class OutputObserver
+{ // {{{1 SOURCE
+	public:
+		virtual ~OutputObserver() {}
+		// {{{2 DXG DOC
+		/**
+		 * Called right after the first successful write
+		 */
+		// }}}2 DXG DOC
+		virtual void firstOutput() = 0;
+}; // }}}1
+
 // {{{1 BEGIN DXG DOC
 /**
  * \class OutputBuffer
@@ -72,11 +92,12 @@ class OutputBuffer : public std::streambuf
 	private:
 		int fd;					///< file descriptor for use in overflow()
 		bool initialized;		///< flag, if buffer is initialized
+		OutputObserver *observer;	///< told about the first write, NULL for none
 	public:
-		OutputBuffer() : fd(-1), initialized(false)
+		OutputBuffer() : fd(-1), initialized(false), observer(NULL)
 		{ // CONSTRUCTOR
 		}
-		OutputBuffer(int _fd) : fd(_fd), initialized(false)
+		OutputBuffer(int _fd) : fd(_fd), initialized(false), observer(NULL)
 		{ // CONSTRUCTOR
 		}
 		// {{{2 DXG DOC
@@ -103,7 +124,31 @@ class OutputBuffer : public std::streambuf
 		{
 			return this->fd;
 		}
+		// {{{2 DXG DOC
+		/**
+		 * Tell an observer about the next successful write, once
+		 *
+		 * \param _observer Observer, NULL for none
+		 */
+		// }}}2 DXG DOC
+		void setObserver(OutputObserver *_observer)
+		{
+			this->observer = _observer;
+		}
 	protected:
+		// {{{2 DXG DOC
+		/**
+		 * Tell the observer about the first write and forget it
+		 */
+		// }}}2 DXG DOC
+		void notifyObserver()
+		{
+			if (this->observer != NULL) {
+				OutputObserver *first = this->observer;
+				this->observer = NULL;
+				first->firstOutput();
+			}
+		}
 		// {{{2 DXG DOC
 		/**
 		 * Overflow function. Derived from std::streambuf. Is called internally. Used
@@ -128,6 +173,7 @@ class OutputBuffer : public std::streambuf
 				if (::write(this->fd, &z, 1) != 1) {
 					return EOF;
 				}
+				this->notifyObserver();
 			}
 			return c;
 		}
@@ -163,6 +209,7 @@ class OutputBuffer : public std::streambuf
 				written -= n;
 				ptr += n;
 			}
+			this->notifyObserver();
 			return size;
 		}
 	private:
@@ -225,6 +272,17 @@ class OutputStream : public std::ostream
 		{
 			return this->outbuf.getFd();
 		}
+		// {{{2 DXG DOC
+		/**
+		 * Tell an observer about the next successful write, once
+		 *
+		 * \param _observer Observer, NULL for none
+		 */
+		// }}}2 DXG DOC
+		void setObserver(OutputObserver *_observer)
+		{
+			this->outbuf.setObserver(_observer);
+		}
 	private:
 		// hide copy constructor and assignment operator
 		OutputStream &operator=(const OutputStream &rhs);
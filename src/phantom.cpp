@@ -0,0 +1,329 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file phantom.cpp
+ *
+ * Contains the implementation of the phantom port responder
+ */
+#include "phantom.h"
+#include "ioexception.h"
+
+#include <sys/socket.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// tcp flags of the replies
+#define PHANTOM_SYN			0x02
+#define PHANTOM_RST			0x04
+#define PHANTOM_ACK			0x10
+// mss and window of the SYN-ACKs, as sent by a linux host
+#define PHANTOM_MSS			1460
+#define PHANTOM_WINDOW		29200
+#define PHANTOM_TTL			64
+// seconds a cookie is valid for, at least
+#define PHANTOM_COOKIE_SHIFT	6
+
+// {{{1 DXG DOC
+/**
+ * Constructor, nothing is sent until open() is called
+ */
+// }}}1 DXG DOC
+Deception::PhantomResponder::PhantomResponder() :
+	sock(-1),
+	queued(0),
+	failed(0)
+{ // {{{1
+	memset(this->secret, 0, sizeof(this->secret));
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor, sends what is queued and closes the socket
+ */
+// }}}1 DXG DOC
+Deception::PhantomResponder::~PhantomResponder()
+{ // {{{1
+	this->flush();
+	if (this->sock != -1) {
+		::close(this->sock);
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Open the raw socket and pick the secret of the cookies
+ *
+ * \exception IOException If there is no raw socket, e.g. without
+ * CAP_NET_RAW
+ */
+// }}}1 DXG DOC
+void Deception::PhantomResponder::open()
+{ // {{{1
+	if ((this->sock = ::socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) == -1) {
+		throw IOException(errno);
+	}
+	// the headers are ours, the kernel only fills in the ip checksum
+	int on = 1;
+	::setsockopt(this->sock, IPPROTO_IP, IP_HDRINCL, &on, sizeof(on));
+	::fcntl(this->sock, F_SETFL, ::fcntl(this->sock, F_GETFL) | O_NONBLOCK);
+
+	int fd = ::open("/dev/urandom", O_RDONLY);
+	if ((fd == -1) || (::read(fd, this->secret, sizeof(this->secret)) != sizeof(this->secret))) {
+		// guessable, but better than none
+		this->secret[0] = ::time(NULL);
+		this->secret[1] = ::getpid();
+		this->secret[2] = reinterpret_cast<size_t>(this) & 0xffffffff;
+		this->secret[3] = ::clock();
+	}
+	if (fd != -1) {
+		::close(fd);
+	}
+} // }}}1
+
+/// mix the bits of a value, the finalizer of murmur3
+static inline u_int32_t mix(u_int32_t _value)
+{
+	_value ^= _value >> 16;
+	_value *= 0x85ebca6bU;
+	_value ^= _value >> 13;
+	_value *= 0xc2b2ae35U;
+	_value ^= _value >> 16;
+	return _value;
+}
+
+// {{{1 DXG DOC
+/**
+ * Compute the cookie of a connection, which is added to the sequence
+ * number of the client
+ *
+ * \param _counter Time divided by the lifetime of a cookie
+ */
+// }}}1 DXG DOC
+u_int32_t Deception::PhantomResponder::cookie(in_addr_t _client, in_port_t _clientPort,
+		in_addr_t _server, in_port_t _serverPort, u_int32_t _counter) const
+{ // {{{1
+	u_int32_t h = mix(this->secret[0] ^ _client);
+	h = mix(h ^ this->secret[1] ^ ((static_cast<u_int32_t>(_clientPort) << 16) | _serverPort));
+	h = mix(h ^ this->secret[2] ^ _server);
+	return mix(h ^ this->secret[3] ^ _counter);
+} // }}}1
+
+/// add 16 bit words to a ones' complement sum
+static u_int32_t sumWords(u_int32_t _sum, const u_char *_data, size_t _len)
+{
+	for (size_t i = 0; i + 1 < _len; i += 2) {
+		_sum += (_data[i] << 8) | _data[i + 1];
+	}
+	if (_len & 1) {
+		_sum += _data[_len - 1] << 8;
+	}
+	return _sum;
+}
+
+/// write a 16 bit value in network byte order
+static inline void writeShort(u_char *_p, u_int16_t _value)
+{
+	_p[0] = _value >> 8;
+	_p[1] = _value & 0xff;
+}
+
+/// write a 32 bit value in network byte order
+static inline void writeLong(u_char *_p, u_int32_t _value)
+{
+	writeShort(_p, _value >> 16);
+	writeShort(_p + 2, _value & 0xffff);
+}
+
+// {{{1 DXG DOC
+/**
+ * Queue a segment from a phantom port to the client. SYNs carry the
+ * mss option.
+ *
+ * \param _seq Sequence number in host byte order
+ * \param _ack Acknowledgement number in host byte order
+ * \param _flags TCP flags
+ */
+// }}}1 DXG DOC
+void Deception::PhantomResponder::reply(in_addr_t _client, in_port_t _clientPort, in_addr_t _server,
+		in_port_t _serverPort, u_int32_t _seq, u_int32_t _ack, u_int8_t _flags)
+{ // {{{1
+	if (this->queued == queueSize) {
+		this->flush();
+	}
+	Reply &reply = this->queue[this->queued++];
+	size_t tcpLen = (_flags & PHANTOM_SYN) ? 24 : 20;
+	reply.length = 20 + tcpLen;
+	memset(reply.packet, 0, reply.length);
+
+	u_char *ip = reply.packet;
+	ip[0] = 0x45;
+	writeShort(ip + 2, reply.length);
+	// don't fragment and no id, like linux
+	ip[6] = 0x40;
+	ip[8] = PHANTOM_TTL;
+	ip[9] = IPPROTO_TCP;
+	memcpy(ip + 12, &_server, sizeof(_server));
+	memcpy(ip + 16, &_client, sizeof(_client));
+
+	u_char *tcp = ip + 20;
+	memcpy(tcp, &_serverPort, sizeof(_serverPort));
+	memcpy(tcp + 2, &_clientPort, sizeof(_clientPort));
+	writeLong(tcp + 4, _seq);
+	writeLong(tcp + 8, _ack);
+	tcp[12] = (tcpLen / 4) << 4;
+	tcp[13] = _flags;
+	if (_flags & PHANTOM_SYN) {
+		writeShort(tcp + 14, PHANTOM_WINDOW);
+		tcp[20] = TCPOPT_MAXSEG;
+		tcp[21] = TCPOLEN_MAXSEG;
+		writeShort(tcp + 22, PHANTOM_MSS);
+	}
+	// pseudo header: addresses, protocol and tcp length
+	u_int32_t sum = sumWords(0, ip + 12, 8) + IPPROTO_TCP + tcpLen;
+	sum = sumWords(sum, tcp, tcpLen);
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	writeShort(tcp + 16, ~sum & 0xffff);
+
+	memset(&reply.to, 0, sizeof(reply.to));
+	reply.to.sin_family = AF_INET;
+	reply.to.sin_addr.s_addr = _client;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Answer a SYN to a phantom port with a SYN-ACK carrying a cookie
+ *
+ * \param _client Address of the client in network byte order
+ * \param _clientPort Port of the client in network byte order
+ * \param _server Phantom address in network byte order
+ * \param _serverPort Phantom port in network byte order
+ * \param _seq Sequence number of the SYN in host byte order
+ * \param _now Current time, e.g. the timestamp of the packet
+ */
+// }}}1 DXG DOC
+void Deception::PhantomResponder::answer(in_addr_t _client, in_port_t _clientPort, in_addr_t _server,
+		in_port_t _serverPort, u_int32_t _seq, time_t _now)
+{ // {{{1
+	u_int32_t counter = static_cast<u_int32_t>(_now >> PHANTOM_COOKIE_SHIFT);
+	u_int32_t isn = this->cookie(_client, _clientPort, _server, _serverPort, counter) + _seq;
+	this->reply(_client, _clientPort, _server, _serverPort, isn, _seq + 1, PHANTOM_SYN | PHANTOM_ACK);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check if a segment completes a handshake begun with answer(), i.e.
+ * if it acknowledges a cookie of this or the last minute. Such a
+ * connection is reset, after the data of the segment.
+ *
+ * \param _seq Sequence number of the segment in host byte order
+ * \param _ack Acknowledgement number of the segment in host byte order
+ * \param _payloadLen Bytes of data in the segment
+ * \param _now Current time, e.g. the timestamp of the packet
+ *
+ * \retval true If the segment carries a valid cookie
+ * \retval false Otherwise, nothing is sent
+ */
+// }}}1 DXG DOC
+bool Deception::PhantomResponder::complete(in_addr_t _client, in_port_t _clientPort, in_addr_t _server,
+		in_port_t _serverPort, u_int32_t _seq, u_int32_t _ack, size_t _payloadLen, time_t _now)
+{ // {{{1
+	u_int32_t counter = static_cast<u_int32_t>(_now >> PHANTOM_COOKIE_SHIFT);
+	// our isn is cookie + client isn, the segment has both plus one
+	u_int32_t offered = _ack - _seq;
+	if ((offered != this->cookie(_client, _clientPort, _server, _serverPort, counter))
+			&& (offered != this->cookie(_client, _clientPort, _server, _serverPort, counter - 1))) {
+		return false;
+	}
+	this->reply(_client, _clientPort, _server, _serverPort, _ack, _seq + _payloadLen,
+			PHANTOM_RST | PHANTOM_ACK);
+	return true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Send the queued replies. Replies the socket buffer has no room for
+ * are dropped and counted.
+ */
+// }}}1 DXG DOC
+void Deception::PhantomResponder::flush()
+{ // {{{1
+	if ((this->queued == 0) || (this->sock == -1)) {
+		this->queued = 0;
+		return;
+	}
+#ifdef __linux__
+	struct mmsghdr messages[queueSize];
+	struct iovec vectors[queueSize];
+	memset(messages, 0, sizeof(messages));
+	for (size_t i = 0; i < this->queued; i++) {
+		vectors[i].iov_base = this->queue[i].packet;
+		vectors[i].iov_len = this->queue[i].length;
+		messages[i].msg_hdr.msg_name = &this->queue[i].to;
+		messages[i].msg_hdr.msg_namelen = sizeof(this->queue[i].to);
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+	size_t sent = 0;
+	while (sent < this->queued) {
+		int result = ::sendmmsg(this->sock, messages + sent, this->queued - sent, 0);
+		if (result <= 0) {
+			if ((result == -1) && (errno == EINTR)) {
+				continue;
+			}
+			break;
+		}
+		sent += result;
+	}
+	this->failed += this->queued - sent;
+#else
+	for (size_t i = 0; i < this->queued; i++) {
+		if (::sendto(this->sock, this->queue[i].packet, this->queue[i].length, 0,
+				reinterpret_cast<struct sockaddr*>(&this->queue[i].to), sizeof(this->queue[i].to)) == -1) {
+			this->failed++;
+		}
+	}
+#endif
+	this->queued = 0;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the number of replies that could not be sent
+ */
+// }}}1 DXG DOC
+unsigned long Deception::PhantomResponder::getFailed() const
+{ // {{{1
+	return this->failed;
+} // }}}1
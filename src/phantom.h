@@ -0,0 +1,125 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _PHANTOM_H
+#define _PHANTOM_H
+
+/**
+ * \file phantom.h
+ *
+ * Declares the responder that answers connection requests to phantom
+ * ports without any socket or state.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C Headers
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * \class PhantomResponder
+ *
+ * Answers SYNs to phantom ports, which no module listens on, with a
+ * SYN-ACK whose sequence number is a SYN cookie: a keyed hash of the
+ * connection and the current minute. Nothing is kept per connection,
+ * so any number of ports on any number of hosts can be emulated. A
+ * segment completing the handshake is recognized by its cookie in
+ * complete(), which answers with a reset; the capture engine logs the
+ * first bytes the client has sent.
+ *
+ * The replies are sent through a raw socket. They are queued and sent
+ * with one system call per batch by flush(), answer() only flushes by
+ * itself once the queue is full.
+ *
+ * The kernel resets connection requests to local addresses without a
+ * listening socket, so the phantom hosts should either not be assigned
+ * to the host, or its resets have to be dropped, e.g. with
+ * \code
+ * iptables -A OUTPUT -p tcp --tcp-flags RST RST -j DROP
+ * \endcode
+ * The responder can be tried in a network namespace, with the capture
+ * engine on one end of a veth pair and the scanner on the other.
+ *
+ * \note An object is not thread-safe, every capture thread needs its
+ * own. The fanout of the capture engine passes all segments of a
+ * connection to the same thread, so each one may have its own secret.
+ */
+// }}}1 DXG DOC
+class PhantomResponder
+{ // {{{1
+	public:
+		PhantomResponder();
+		~PhantomResponder();
+		void open();
+		void answer(in_addr_t _client, in_port_t _clientPort, in_addr_t _server, in_port_t _serverPort,
+				u_int32_t _seq, time_t _now);
+		bool complete(in_addr_t _client, in_port_t _clientPort, in_addr_t _server, in_port_t _serverPort,
+				u_int32_t _seq, u_int32_t _ack, size_t _payloadLen, time_t _now);
+		void flush();
+		unsigned long getFailed() const;
+	private:
+		/// replies sent with one system call
+		static const size_t queueSize = 32;
+		/// ip and tcp header with the mss option
+		static const size_t replySize = 20 + 24;
+		// {{{2 DXG DOC
+		/**
+		 * A reply waiting to be sent
+		 */
+		// }}}2 DXG DOC
+		struct Reply
+		{
+			u_char packet[replySize];		///< ip packet
+			size_t length;					///< bytes used in packet
+			struct sockaddr_in to;			///< the client
+		};
+
+		int sock;							///< raw socket, -1 if not open
+		u_int32_t secret[4];				///< key of the cookies
+		Reply queue[queueSize];				///< replies to send
+		size_t queued;						///< number of entries in queue
+		unsigned long failed;				///< replies that could not be sent
+
+		u_int32_t cookie(in_addr_t _client, in_port_t _clientPort, in_addr_t _server,
+				in_port_t _serverPort, u_int32_t _counter) const;
+		void reply(in_addr_t _client, in_port_t _clientPort, in_addr_t _server, in_port_t _serverPort,
+				u_int32_t _seq, u_int32_t _ack, u_int8_t _flags);
+		// test/phantommain.cpp checks the queued replies
+		friend class PhantomTest;
+		// hidden
+		PhantomResponder(const PhantomResponder &rhs);
+		PhantomResponder &operator=(const PhantomResponder &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _PHANTOM_H
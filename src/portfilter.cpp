@@ -0,0 +1,271 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file portfilter.cpp
+ *
+ * Contains the implementation of the capture filter
+ */
+#include "portfilter.h"
+
+#include <algorithm>
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+std::string Deception::PortFilter::className = "PortFilter";
+
+// {{{1 DXG DOC
+/**
+ * Add a listening port
+ *
+ * \param _host Address in network byte order
+ * \param _port Port in host byte order
+ */
+// }}}1 DXG DOC
+void Deception::PortFilter::add(in_addr_t _host, in_port_t _port)
+{ // {{{1
+	Host key;
+	key.addr = _host;
+	std::vector<Host>::iterator host = std::lower_bound(this->hosts.begin(), this->hosts.end(), key);
+	if ((host == this->hosts.end()) || (host->addr != _host)) {
+		host = this->hosts.insert(host, key);
+		host->ports.resize(portWords, 0);
+	}
+	host->ports[_port >> 5] |= 1U << (_port & 31);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Add all hosts and ports of a registry
+ *
+ * \param _registry Registry with "ip:port" entries
+ */
+// }}}1 DXG DOC
+void Deception::PortFilter::add(ModuleRegistry &_registry)
+{ // {{{1
+	ModuleRegistry::ModuleRegistryMapIterator mPtr = _registry.begin();
+	ModuleRegistry::ModuleRegistryMapIterator mEnd = _registry.end();
+	for (; mPtr != mEnd; mPtr++) {
+		// FIXME: do something useful in case of 0.0.0.0
+		std::string ipAddr = _registry.getIpAddr((*mPtr).first);
+		struct in_addr addr;
+		if (::inet_pton(AF_INET, ipAddr.c_str(), &addr) != 1) {
+			LOGMSG(className, Error, "ignoring invalid address " << ipAddr);
+			continue;
+		}
+		this->add(addr.s_addr, _registry.getPort((*mPtr).first));
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Find a host by its address
+ *
+ * \return The host, NULL if it is not configured
+ */
+// }}}1 DXG DOC
+const Deception::PortFilter::Host* Deception::PortFilter::find(in_addr_t _addr) const
+{ // {{{1
+	// usually there are only a few hosts, so this is cheap
+	size_t low = 0, high = this->hosts.size();
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (this->hosts[mid].addr < _addr) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if ((low < this->hosts.size()) && (this->hosts[low].addr == _addr)) {
+		return &this->hosts[low];
+	}
+	return NULL;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check if a connection request should be reported
+ *
+ * \param _dst Destination address in network byte order
+ * \param _dstPort Destination port in network byte order
+ *
+ * \retval true If the host is configured and nothing listens on the port
+ * \retval false Otherwise
+ */
+// }}}1 DXG DOC
+bool Deception::PortFilter::matches(in_addr_t _dst, in_port_t _dstPort) const
+{ // {{{1
+	const Host *host = this->find(_dst);
+	if (host == NULL) {
+		return false;
+	}
+	in_port_t port = ntohs(_dstPort);
+	return (host->ports[port >> 5] & (1U << (port & 31))) == 0;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check if a host is configured
+ *
+ * \param _addr Address in network byte order
+ */
+// }}}1 DXG DOC
+bool Deception::PortFilter::hasHost(in_addr_t _addr) const
+{ // {{{1
+	return this->find(_addr) != NULL;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the addresses of all configured hosts
+ *
+ * \return Addresses in network byte order
+ */
+// }}}1 DXG DOC
+std::vector<in_addr_t> Deception::PortFilter::addresses() const
+{ // {{{1
+	std::vector<in_addr_t> addrs;
+	addrs.reserve(this->hosts.size());
+	for (size_t i = 0; i < this->hosts.size(); i++) {
+		addrs.push_back(this->hosts[i].addr);
+	}
+	return addrs;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Add phantom ports, see PhantomResponder
+ *
+ * \param _ranges Ports and port ranges like "1-1023,8080"
+ *
+ * \retval true If all ranges could be parsed
+ * \retval false Otherwise, the ranges before the bad one are added
+ */
+// }}}1 DXG DOC
+bool Deception::PortFilter::addPhantoms(const std::string &_ranges)
+{ // {{{1
+	std::string::size_type begin = 0;
+	while (begin < _ranges.length()) {
+		std::string::size_type end = _ranges.find(',', begin);
+		if (end == std::string::npos) {
+			end = _ranges.length();
+		}
+		std::string range = _ranges.substr(begin, end - begin);
+		begin = end + 1;
+		char *rest;
+		unsigned long low = ::strtoul(range.c_str(), &rest, 10);
+		unsigned long high = low;
+		if (*rest == '-') {
+			high = ::strtoul(rest + 1, &rest, 10);
+		}
+		if ((*rest != '\0') || (low == 0) || (low > high) || (high > 65535)) {
+			return false;
+		}
+		if (this->phantomPorts.empty()) {
+			this->phantomPorts.resize(portWords, 0);
+		}
+		for (unsigned long port = low; port <= high; port++) {
+			this->phantomPorts[port >> 5] |= 1U << (port & 31);
+		}
+		this->phantomRanges.push_back(std::make_pair(static_cast<unsigned int>(low),
+					static_cast<unsigned int>(high)));
+	}
+	return true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Check if a port is a phantom port
+ *
+ * \param _dstPort Port in network byte order
+ */
+// }}}1 DXG DOC
+bool Deception::PortFilter::isPhantom(in_port_t _dstPort) const
+{ // {{{1
+	if (this->phantomPorts.empty()) {
+		return false;
+	}
+	in_port_t port = ntohs(_dstPort);
+	return (this->phantomPorts[port >> 5] & (1U << (port & 31))) != 0;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Build the BPF expression that passes SYNs, and all segments to
+ * phantom ports, to the configured hosts. The ports are left to
+ * matches().
+ *
+ * \param _allPackets Pass all tcp packets from and to the hosts instead,
+ * e.g. to keep evidence of their flows
+ * \param _probes Pass udp and icmp packets as well, no module listens on
+ * them
+ *
+ * \return Filter expression for pcap_compile()
+ */
+// }}}1 DXG DOC
+std::string Deception::PortFilter::expression(bool _allPackets, bool _probes) const
+{ // {{{1
+	// syn set and ack not set; tcp[] only matches the first fragment
+	// and honours ip options
+	std::string filterRule = _allPackets ? "tcp" : "tcp[13] & 18 == 2";
+	bool alternatives = false;
+	for (size_t i = 0; !_allPackets && (i < this->phantomRanges.size()); i++) {
+		// handshakes with phantom ports are completed by acks
+		char range[48];
+		if (this->phantomRanges[i].first == this->phantomRanges[i].second) {
+			::snprintf(range, sizeof(range), " or tcp dst port %u", this->phantomRanges[i].first);
+		} else {
+			::snprintf(range, sizeof(range), " or tcp dst portrange %u-%u",
+					this->phantomRanges[i].first, this->phantomRanges[i].second);
+		}
+		filterRule.append(range);
+		alternatives = true;
+	}
+	if (_probes) {
+		filterRule.append(" or udp or icmp");
+		alternatives = true;
+	}
+	if (alternatives) {
+		filterRule = "(" + filterRule + ")";
+	}
+	const char *direction = _allPackets ? "host " : "dst host ";
+	if (this->hosts.empty()) {
+		return filterRule;
+	}
+	filterRule.append(" and (");
+	for (size_t i = 0; i < this->hosts.size(); i++) {
+		char addr[INET_ADDRSTRLEN];
+		::inet_ntop(AF_INET, &this->hosts[i].addr, addr, sizeof(addr));
+		if (i > 0) {
+			filterRule.append(" or ");
+		}
+		filterRule.append(direction).append(addr);
+	}
+	filterRule.append(")");
+	return filterRule;
+} // }}}1
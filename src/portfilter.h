@@ -0,0 +1,116 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _PORTFILTER_H
+#define _PORTFILTER_H
+
+/**
+ * \file portfilter.h
+ *
+ * Declares the filter that decides which connection requests the
+ * capture engine reports.
+ */
+
+// Project Headers
+#include "defs.h"
+#include "moduleregistry.h"
+
+// C++ Headers
+#include <string>
+#include <vector>
+#include <utility>
+
+// C Headers
+#include <sys/types.h>
+#include <netinet/in.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * \class PortFilter
+ *
+ * The capture engine reports connection requests to the configured
+ * hosts on ports that no module listens on; requests to listening ports
+ * are logged by the daemon itself. The filter is split in two parts:
+ *
+ * - expression() is a BPF filter that only passes SYNs to the
+ *   configured hosts. Its length depends on the number of hosts, not
+ *   on the number of ports.
+ * - matches() checks the destination port against a bitmap of all
+ *   65536 ports per host, which takes constant time however many ports
+ *   are configured. UDP and ICMP probes only need hasHost(), no
+ *   module listens on them.
+ *
+ * Phantom ports are answered by the PhantomResponder on all hosts, if
+ * no module listens on them. The expression passes every segment to
+ * them, so the handshakes can be completed.
+ *
+ * The filter is immutable once set up and may be shared by threads.
+ */
+// }}}1 DXG DOC
+class PortFilter
+{ // {{{1
+	public:
+		void add(in_addr_t _host, in_port_t _port);
+		void add(ModuleRegistry &_registry);
+		bool matches(in_addr_t _dst, in_port_t _dstPort) const;
+		bool hasHost(in_addr_t _addr) const;
+		std::vector<in_addr_t> addresses() const;
+		bool addPhantoms(const std::string &_ranges);
+		bool isPhantom(in_port_t _dstPort) const;
+		std::string expression(bool _allPackets = false, bool _probes = false) const;
+	private:
+		/// number of 32 bit words in a bitmap of all ports
+		static const size_t portWords = 65536 / 32;
+		// {{{2 DXG DOC
+		/**
+		 * A configured host and its listening ports
+		 */
+		// }}}2 DXG DOC
+		struct Host
+		{
+			in_addr_t addr;					///< address in network byte order
+			std::vector<u_int32_t> ports;	///< bitmap of listening ports
+
+			/// order by address for the binary search
+			bool operator<(const Host &rhs) const
+			{
+				return this->addr < rhs.addr;
+			}
+		};
+
+		static std::string className;		///< name for logging
+		std::vector<Host> hosts;			///< hosts, sorted by address
+		std::vector<u_int32_t> phantomPorts;	///< bitmap of phantom ports, empty if none
+		std::vector<std::pair<unsigned int, unsigned int> > phantomRanges;	///< phantom port ranges
+
+		const Host* find(in_addr_t _addr) const;
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _PORTFILTER_H
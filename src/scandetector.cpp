@@ -0,0 +1,272 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file scandetector.cpp
+ *
+ * Contains the implementation of the port scan detection
+ */
+#include "scandetector.h"
+#include "eventpipeline.h"
+
+#include <new>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+time_t Deception::ScanDetector::window = 60;
+unsigned int Deception::ScanDetector::portThreshold = 20;
+unsigned int Deception::ScanDetector::hostThreshold = 20;
+unsigned int Deception::ScanDetector::portBitsNeeded =
+	Deception::ScanDetector::bitsNeeded(20, Deception::ScanDetector::portBits);
+unsigned int Deception::ScanDetector::hostBitsNeeded =
+	Deception::ScanDetector::bitsNeeded(20, Deception::ScanDetector::hostBits);
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _module Name to report scans with
+ * \param _sources Number of sources to keep track of, rounded up to a
+ * power of 2. Every source takes about 200 bytes.
+ */
+// }}}1 DXG DOC
+Deception::ScanDetector::ScanDetector(const std::string &_module, size_t _sources) :
+	module(_module)
+{ // {{{1
+	size_t size = probes;
+	while (size < _sources) {
+		size <<= 1;
+	}
+	this->mask = size - 1;
+	this->table = static_cast<Source*>(::calloc(size, sizeof(Source)));
+	if (this->table == NULL) {
+		throw std::bad_alloc();
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Destructor
+ */
+// }}}1 DXG DOC
+Deception::ScanDetector::~ScanDetector()
+{ // {{{1
+	::free(this->table);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the thresholds used by all detectors
+ *
+ * \param _window Length of the window in seconds
+ * \param _ports Distinct ports on few hosts that make a vertical scan
+ * \param _hosts Distinct hosts that make a horizontal scan
+ */
+// }}}1 DXG DOC
+void Deception::ScanDetector::configure(time_t _window, unsigned int _ports, unsigned int _hosts)
+{ // {{{1
+	window = (_window > 0) ? _window : 1;
+	portThreshold = (_ports > 1) ? _ports : 2;
+	hostThreshold = (_hosts > 1) ? _hosts : 2;
+	portBitsNeeded = bitsNeeded(portThreshold, portBits);
+	hostBitsNeeded = bitsNeeded(hostThreshold, hostBits);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Mix all bits of a value, the low bits are used as index
+ */
+// }}}1 DXG DOC
+u_int32_t Deception::ScanDetector::hash(u_int32_t _value)
+{ // {{{1
+	_value ^= _value >> 16;
+	_value *= 0x85ebca6bU;
+	_value ^= _value >> 13;
+	_value *= 0xc2b2ae35U;
+	_value ^= _value >> 16;
+	return _value;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Expected number of bits set in a bitmap after adding a number of
+ * distinct values, i.e. the inverse of estimate()
+ *
+ * \param _values Number of distinct values
+ * \param _bits Size of the bitmap
+ */
+// }}}1 DXG DOC
+unsigned int Deception::ScanDetector::bitsNeeded(unsigned int _values, unsigned int _bits)
+{ // {{{1
+	double set = _bits * (1.0 - ::exp(-static_cast<double>(_values) / _bits));
+	unsigned int needed = static_cast<unsigned int>(::ceil(set));
+	return (needed < _bits) ? needed : _bits;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Estimate the number of distinct values added to a bitmap
+ *
+ * \param _set Number of bits set
+ * \param _bits Size of the bitmap
+ */
+// }}}1 DXG DOC
+unsigned long Deception::ScanDetector::estimate(unsigned int _set, unsigned int _bits)
+{ // {{{1
+	if (_set >= _bits) {
+		// saturated, this is the best we can tell
+		_set = _bits - 1;
+	}
+	return static_cast<unsigned long>(-::log(static_cast<double>(_bits - _set) / _bits) * _bits + 0.5);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Find the state of a source. If there is none, a new one is set up in
+ * a free slot, or in place of the source seen least recently.
+ */
+// }}}1 DXG DOC
+Deception::ScanDetector::Source* Deception::ScanDetector::find(in_addr_t _src, time_t _now)
+{ // {{{1
+	size_t pos = hash(_src) & this->mask;
+	Source *victim = NULL;
+	for (size_t i = 0; i < probes; i++) {
+		Source *slot = &this->table[(pos + i) & this->mask];
+		if (!slot->used) {
+			if (victim == NULL || victim->used) {
+				victim = slot;
+			}
+			continue;
+		}
+		if (slot->src == _src) {
+			if (_now - slot->first >= window) {
+				// start a new window
+				::memset(slot, 0, sizeof(*slot));
+				slot->used = true;
+				slot->src = _src;
+				slot->first = _now;
+			}
+			return slot;
+		}
+		if ((victim == NULL) || (victim->used && (slot->last < victim->last))) {
+			victim = slot;
+		}
+	}
+	::memset(victim, 0, sizeof(*victim));
+	victim->used = true;
+	victim->src = _src;
+	victim->first = _now;
+	return victim;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Start loading the slot of a source into the cache, e.g. for a batch
+ * of packets before the first of them is observed
+ *
+ * \param _src Source address in network byte order
+ */
+// }}}1 DXG DOC
+void Deception::ScanDetector::prefetch(in_addr_t _src) const
+{ // {{{1
+	__builtin_prefetch(&this->table[hash(_src) & this->mask], 1);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Account a connection request or probe
+ *
+ * \param _src Source address in network byte order
+ * \param _dst Destination address in network byte order
+ * \param _dstPort Destination port in network byte order, the type of
+ * ICMP messages
+ * \param _now Current time, e.g. the timestamp of the packet
+ * \param _event Is filled with the scan event, if true is returned
+ * \param _protocol IP protocol of the request
+ *
+ * \retval true If the source has just been detected as scanner
+ * \retval false Otherwise
+ */
+// }}}1 DXG DOC
+bool Deception::ScanDetector::observe(in_addr_t _src, in_addr_t _dst, in_port_t _dstPort,
+		time_t _now, PipelineEvent &_event, u_int8_t _protocol)
+{ // {{{1
+	Source *source = this->find(_src, _now);
+	source->last = _now;
+	source->packets++;
+	if (source->reported) {
+		// once per window is enough
+		return false;
+	}
+
+	u_int32_t bit = hash((static_cast<u_int32_t>(_protocol) << 16) | _dstPort) & (portBits - 1);
+	u_int32_t word = bit >> 5;
+	u_int32_t flag = 1U << (bit & 31);
+	bool changed = false;
+	if ((source->ports[word] & flag) == 0) {
+		source->ports[word] |= flag;
+		source->portsSet++;
+		changed = true;
+	}
+	bit = hash(_dst) & (hostBits - 1);
+	word = bit >> 5;
+	flag = 1U << (bit & 31);
+	if ((source->hosts[word] & flag) == 0) {
+		source->hosts[word] |= flag;
+		source->hostsSet++;
+		changed = true;
+	}
+	if (!changed) {
+		return false;
+	}
+
+	bool manyPorts = (source->portsSet >= portBitsNeeded);
+	bool manyHosts = (source->hostsSet >= hostBitsNeeded);
+	if (!manyPorts && !manyHosts) {
+		return false;
+	}
+	source->reported = true;
+
+	_event = PipelineEvent(this->module.c_str(), Info, "scan");
+	_event.kind = PipelineEvent::Scan;
+	if (manyPorts && manyHosts) {
+		_event.scanType = "block";
+	} else if (manyPorts) {
+		_event.scanType = "vertical";
+	} else {
+		_event.scanType = "horizontal";
+	}
+	_event.text = _event.scanType;
+	_event.srcIp = _src;
+	_event.count = source->packets;
+	_event.window = window;
+	_event.ports = estimate(source->portsSet, portBits);
+	_event.hosts = estimate(source->hostsSet, hostBits);
+	_event.rate = source->packets / (_now - source->first + 1);
+	return true;
+} // }}}1
@@ -0,0 +1,138 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _SCANDETECTOR_H
+#define _SCANDETECTOR_H
+
+/**
+ * \file scandetector.h
+ *
+ * Declares the port scan detection of the capture engine.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C++ Headers
+#include <string>
+
+// C Headers
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+struct PipelineEvent;
+
+// {{{1 DXG DOC
+/**
+ * \class ScanDetector
+ *
+ * Keeps per source state about the connection requests it has sent
+ * within a window and reports a source once as scanner, when it has
+ * tried enough distinct ports or hosts:
+ *
+ * - vertical: many ports on few hosts
+ * - horizontal: few ports on many hosts
+ * - block: many ports on many hosts
+ *
+ * Distinct ports and hosts are counted with small bitmaps (linear
+ * counting): every port or host sets one bit chosen by a hash, and the
+ * number of distinct values is estimated from the number of bits set.
+ * The thresholds are converted to numbers of bits once in configure(),
+ * so a packet costs a hash lookup and two bit operations. Ports of
+ * different protocols count as distinct, an ICMP type counts as port.
+ *
+ * The sources live in an open addressing table of fixed size. A lookup
+ * probes a few slots; if the source is not found and none of them is
+ * free, the source seen least recently is replaced, so the memory used
+ * never grows, whatever the number of (spoofed) sources. A window
+ * starts with the first packet of a source and is reset once it has
+ * passed.
+ *
+ * \note An object is not thread-safe, every capture thread needs its own.
+ * The capture engine passes all requests of a source to the same
+ * thread, unless its fanout has to fall back to a hash of the flow.
+ */
+// }}}1 DXG DOC
+class ScanDetector
+{ // {{{1
+	public:
+		ScanDetector(const std::string &_module, size_t _sources = 16384);
+		~ScanDetector();
+		static void configure(time_t _window, unsigned int _ports, unsigned int _hosts);
+		bool observe(in_addr_t _src, in_addr_t _dst, in_port_t _dstPort, time_t _now,
+				PipelineEvent &_event, u_int8_t _protocol = IPPROTO_TCP);
+		void prefetch(in_addr_t _src) const;
+	private:
+		/// bits of the port bitmap
+		static const unsigned int portBits = 1024;
+		/// bits of the host bitmap
+		static const unsigned int hostBits = 256;
+		/// slots probed per lookup
+		static const size_t probes = 8;
+		// {{{2 DXG DOC
+		/**
+		 * State of a source within the current window
+		 */
+		// }}}2 DXG DOC
+		struct Source
+		{
+			in_addr_t src;						///< source address
+			bool used;							///< flag, if the slot is in use
+			bool reported;						///< flag, if the scan has been reported
+			unsigned short portsSet;			///< bits set in ports
+			unsigned short hostsSet;			///< bits set in hosts
+			time_t first;						///< start of the window
+			time_t last;						///< last packet
+			unsigned long packets;				///< packets within the window
+			u_int32_t ports[portBits / 32];		///< bitmap of destination ports
+			u_int32_t hosts[hostBits / 32];		///< bitmap of destination hosts
+		};
+
+		static time_t window;					///< length of the window in seconds
+		static unsigned int portThreshold;		///< distinct ports of a vertical scan
+		static unsigned int hostThreshold;		///< distinct hosts of a horizontal scan
+		static unsigned int portBitsNeeded;		///< bits set for portThreshold ports
+		static unsigned int hostBitsNeeded;		///< bits set for hostThreshold hosts
+
+		std::string module;						///< name to report scans with
+		Source *table;							///< the sources
+		size_t mask;							///< number of slots - 1, a power of 2 - 1
+
+		static u_int32_t hash(u_int32_t _value);
+		static unsigned int bitsNeeded(unsigned int _values, unsigned int _bits);
+		static unsigned long estimate(unsigned int _set, unsigned int _bits);
+		Source* find(in_addr_t _src, time_t _now);
+		// hidden
+		ScanDetector(const ScanDetector &rhs);
+		ScanDetector &operator=(const ScanDetector &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _SCANDETECTOR_H
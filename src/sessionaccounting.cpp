@@ -0,0 +1,382 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file sessionaccounting.cpp
+ *
+ * Contains the implementation of the accounting of session processes
+ */
+#include "sessionaccounting.h"
+#include "logging.h"
+#include "metrics.h"
+#include "latency.h"
+
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include <errno.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+extern Deception::Logging globLog;
+
+time_t Deception::SessionAccounting::interval = 300;
+size_t Deception::SessionAccounting::maxSources = 1024;
+
+/// upper bounds of the buckets of session durations in milliseconds
+static const u_int64_t durationBounds[] = { 10, 50, 100, 500, 1000, 5000, 10000, 30000, 60000, 300000 };
+
+/// cost and name of an entry of a report
+typedef std::pair<u_int64_t, std::string> RankedUsage;
+
+// {{{1 DXG DOC
+/**
+ * Format the entries with the most cpu time of a window
+ *
+ * \param _ranked Cpu time and name of all entries, sorted on return
+ * \param _count Number of entries to format
+ *
+ * \return E.g. "dtkScript 1.20s/34, ftp 0.31s/2"
+ */
+// }}}1 DXG DOC
+static std::string topUsage(std::vector<RankedUsage> &_ranked, size_t _count)
+{
+	_count = std::min(_count, _ranked.size());
+	std::partial_sort(_ranked.begin(), _ranked.begin() + _count, _ranked.end(),
+			std::greater<RankedUsage>());
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(2);
+	for (size_t i = 0; i < _count; i++) {
+		if (i > 0) {
+			out << ", ";
+		}
+		out << _ranked[i].second << " " << (_ranked[i].first / 1000000.0) << "s";
+	}
+	return (_count > 0) ? out.str() : "none";
+}
+
+// {{{1 DXG DOC
+/**
+ * Add the usage of other sessions
+ *
+ * \param _other Usage to add
+ */
+// }}}1 DXG DOC
+void Deception::SessionAccounting::Usage::add(const Usage &_other)
+{ // {{{1
+	this->sessions += _other.sessions;
+	this->cpuMicros += _other.cpuMicros;
+	this->wallMicros += _other.wallMicros;
+	this->maxRss = std::max(this->maxRss, _other.maxRss);
+	this->voluntary += _other.voluntary;
+	this->involuntary += _other.involuntary;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _module Name to log with
+ */
+// }}}1 DXG DOC
+Deception::SessionAccounting::SessionAccounting(const std::string &_module) :
+	module(_module),
+	nextReport(0)
+{ // {{{1
+	this->activeMetric = globMetrics.addGauge("deceptiond_sessions_active", "session processes running");
+	this->durationMetric = globMetrics.addHistogram("deceptiond_session_duration_milliseconds",
+			"wall time of the session processes", durationBounds,
+			sizeof(durationBounds) / sizeof(durationBounds[0]));
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the window of the reports
+ *
+ * \param _interval Seconds between reports, 0 for none
+ * \param _sources Sources kept apart per window, the others are summed
+ * up as one
+ */
+// }}}1 DXG DOC
+void Deception::SessionAccounting::configure(time_t _interval, size_t _sources)
+{ // {{{1
+	interval = _interval;
+	maxSources = _sources;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Remember a forked session process
+ *
+ * \param _pid Process id of the child
+ * \param _sessionModule Name of the module serving the session
+ * \param _srcIp Address of the client
+ * \param _port Port of the session, in network byte order
+ * \param _listener Listener of the latency histograms, -1 for none
+ */
+// }}}1 DXG DOC
+void Deception::SessionAccounting::started(pid_t _pid, const std::string &_sessionModule,
+		in_addr_t _srcIp, in_port_t _port, int _listener)
+{ // {{{1
+	Session &session = this->running[_pid];
+	session.module = _sessionModule;
+	session.srcIp = _srcIp;
+	session.port = _port;
+	session.listener = _listener;
+	::clock_gettime(CLOCK_MONOTONIC, &session.start);
+	globMetrics.set(this->activeMetric, this->running.size());
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Reap a child of the main loop that is no session, e.g. the capture
+ * process, when it exits
+ *
+ * \param _pid Process id of the child
+ */
+// }}}1 DXG DOC
+void Deception::SessionAccounting::adopt(pid_t _pid)
+{ // {{{1
+	this->adopted.insert(_pid);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Reap all sessions and adopted children that have exited and account
+ * for their resources. Never blocks.
+ *
+ * \return Number of children reaped
+ */
+// }}}1 DXG DOC
+unsigned int Deception::SessionAccounting::reap()
+{ // {{{1
+	unsigned int reaped = 0;
+	int status;
+	struct rusage usage;
+	for (;;) {
+		// look at the next exited child without reaping it
+		siginfo_t info;
+		info.si_pid = 0;
+		if ((::waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1) || (info.si_pid == 0)) {
+			break;
+		}
+		pid_t pid = info.si_pid;
+		if ((this->running.find(pid) == this->running.end())
+				&& (this->adopted.find(pid) == this->adopted.end())) {
+			// a child of another thread, which waits for it itself. until
+			// then waitid() keeps returning it, so ask for ours one by one.
+			reaped += this->reapEach();
+			break;
+		}
+		if (::wait4(pid, &status, WNOHANG, &usage) != pid) {
+			break;
+		}
+		this->account(pid, status, usage);
+		reaped++;
+	}
+	return reaped;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Reap the sessions and adopted children that have exited with one
+ * wait4() each, for when another exited child hides them from reap()
+ *
+ * \return Number of children reaped
+ */
+// }}}1 DXG DOC
+unsigned int Deception::SessionAccounting::reapEach()
+{ // {{{1
+	std::vector<pid_t> pids(this->adopted.begin(), this->adopted.end());
+	for (std::map<pid_t, Session>::iterator it = this->running.begin(); it != this->running.end(); ++it) {
+		pids.push_back(it->first);
+	}
+	unsigned int reaped = 0;
+	int status;
+	struct rusage usage;
+	for (size_t i = 0; i < pids.size(); i++) {
+		if (::wait4(pids[i], &status, WNOHANG, &usage) == pids[i]) {
+			this->account(pids[i], status, usage);
+			reaped++;
+		}
+	}
+	return reaped;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Attribute the resources of an exited child to its session
+ *
+ * \param _pid Process id of the child
+ * \param _status Exit status as of wait(2)
+ * \param _usage Resources used by the child
+ */
+// }}}1 DXG DOC
+void Deception::SessionAccounting::account(pid_t _pid, int _status, const struct rusage &_usage)
+{ // {{{1
+	std::map<pid_t, Session>::iterator it = this->running.find(_pid);
+	if (it == this->running.end()) {
+		// an adopted child like the capture process
+		LOGDEBUG(this->module, "child " << _pid << " exited with return code " << _status);
+		this->adopted.erase(_pid);
+		return;
+	}
+	const Session &session = it->second;
+	struct timespec now;
+	::clock_gettime(CLOCK_MONOTONIC, &now);
+	Usage used;
+	used.sessions = 1;
+	used.cpuMicros = static_cast<u_int64_t>(_usage.ru_utime.tv_sec + _usage.ru_stime.tv_sec) * 1000000
+		+ _usage.ru_utime.tv_usec + _usage.ru_stime.tv_usec;
+	used.wallMicros = static_cast<u_int64_t>(now.tv_sec - session.start.tv_sec) * 1000000
+		+ (now.tv_nsec - session.start.tv_nsec) / 1000;
+	used.maxRss = _usage.ru_maxrss;
+	used.voluntary = _usage.ru_nvcsw;
+	used.involuntary = _usage.ru_nivcsw;
+
+	char srcIp[INET_ADDRSTRLEN];
+	::inet_ntop(AF_INET, &session.srcIp, srcIp, sizeof(srcIp));
+	LOGDEBUG(this->module, "session " << _pid << " of " << session.module << " on port "
+			<< ntohs(session.port) << " from " << srcIp << " exited with "
+			<< (WIFSIGNALED(_status) ? "signal " : "status ")
+			<< (WIFSIGNALED(_status) ? WTERMSIG(_status) : WEXITSTATUS(_status))
+			<< ": cpu " << used.cpuMicros << " us, wall " << used.wallMicros << " us, max rss "
+			<< used.maxRss << " kB, context switches " << used.voluntary << "/" << used.involuntary);
+
+	this->byModule[session.module].add(used);
+	this->byPort[session.port].add(used);
+	// the others end up as INADDR_ANY
+	in_addr_t source = session.srcIp;
+	if ((this->bySource.size() >= maxSources) && (this->bySource.find(source) == this->bySource.end())) {
+		source = INADDR_ANY;
+	}
+	this->bySource[source].add(used);
+	this->window.add(used);
+	this->total.add(used);
+
+	std::map<std::string, ModuleMetrics>::iterator metrics = this->moduleMetrics.find(session.module);
+	if (metrics == this->moduleMetrics.end()) {
+		std::string labels = Metrics::label("module", session.module);
+		ModuleMetrics ids;
+		ids.sessions = globMetrics.addCounter("deceptiond_sessions_total", "sessions ended", labels);
+		ids.cpu = globMetrics.addCounter("deceptiond_session_cpu_microseconds_total",
+				"user and system time of the sessions", labels);
+		metrics = this->moduleMetrics.insert(std::make_pair(session.module, ids)).first;
+	}
+	globMetrics.add(metrics->second.sessions);
+	globMetrics.add(metrics->second.cpu, used.cpuMicros);
+	globMetrics.observe(this->durationMetric, used.wallMicros / 1000);
+	globLatency.record(session.listener, Latency::SessionTime, used.wallMicros);
+	this->running.erase(it);
+	globMetrics.set(this->activeMetric, this->running.size());
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Log the usage of the window once it has passed and start a new one.
+ * Has to be called regularly.
+ *
+ * \param _now Current time
+ */
+// }}}1 DXG DOC
+void Deception::SessionAccounting::report(time_t _now)
+{ // {{{1
+	if (interval == 0) {
+		return;
+	}
+	if (this->nextReport == 0) {
+		this->nextReport = _now + interval;
+		return;
+	}
+	if (_now < this->nextReport) {
+		return;
+	}
+	this->nextReport = _now + interval;
+	if (this->window.sessions == 0) {
+		return;
+	}
+
+	std::vector<RankedUsage> modules;
+	for (std::map<std::string, Usage>::const_iterator it = this->byModule.begin();
+			it != this->byModule.end(); ++it) {
+		modules.push_back(RankedUsage(it->second.cpuMicros, it->first));
+	}
+	std::vector<RankedUsage> ports;
+	for (std::map<in_port_t, Usage>::const_iterator it = this->byPort.begin();
+			it != this->byPort.end(); ++it) {
+		std::ostringstream port;
+		port << ntohs(it->first);
+		ports.push_back(RankedUsage(it->second.cpuMicros, port.str()));
+	}
+	std::vector<RankedUsage> sources;
+	for (std::map<in_addr_t, Usage>::const_iterator it = this->bySource.begin();
+			it != this->bySource.end(); ++it) {
+		char srcIp[INET_ADDRSTRLEN];
+		::inet_ntop(AF_INET, &it->first, srcIp, sizeof(srcIp));
+		sources.push_back(RankedUsage(it->second.cpuMicros,
+				(it->first == INADDR_ANY) ? std::string("other") : std::string(srcIp)));
+	}
+
+	const Usage &used = this->window;
+	LOGMSG(this->module, Info, "sessions: " << used.sessions << " ended, " << this->running.size()
+			<< " running, cpu " << (used.cpuMicros / 1000) << " ms, wall "
+			<< (used.wallMicros / used.sessions / 1000) << " ms per session, max rss " << used.maxRss
+			<< " kB, context switches " << used.voluntary << "/" << used.involuntary
+			<< "; most cpu by module: " << topUsage(modules, 3)
+			<< "; by port: " << topUsage(ports, 3)
+			<< "; by source: " << topUsage(sources, 3));
+
+	this->byModule.clear();
+	this->byPort.clear();
+	this->bySource.clear();
+	this->window = Usage();
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the usage of all sessions reaped so far
+ *
+ * \return The sums
+ */
+// }}}1 DXG DOC
+const Deception::SessionAccounting::Usage& Deception::SessionAccounting::getTotal() const
+{ // {{{1
+	return this->total;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Get the number of session processes not reaped yet
+ *
+ * \return Number of sessions
+ */
+// }}}1 DXG DOC
+size_t Deception::SessionAccounting::getRunning() const
+{ // {{{1
+	return this->running.size();
+} // }}}1
@@ -0,0 +1,169 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _SESSIONACCOUNTING_H
+#define _SESSIONACCOUNTING_H
+
+/**
+ * \file sessionaccounting.h
+ *
+ * Declares the accounting of the resources used by the session
+ * processes.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C++ Headers
+#include <string>
+#include <map>
+#include <set>
+
+// C Headers
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * \class SessionAccounting
+ *
+ * Keeps track of the forked session processes and reaps them with
+ * wait4(2), which reports the resources a child has used: cpu time,
+ * largest resident set and context switches. Together with the wall
+ * time since the fork, they are attributed to the module, the port and
+ * the source of the session.
+ *
+ * The sums per module, port and source are kept for a window of
+ * configure()d seconds. report() logs the most expensive of each and
+ * starts a new window, so the log tells which scripts and ports cost
+ * the most under load. Sources beyond the configured number are summed
+ * up as "other", so a flood of sources does not grow the tables.
+ *
+ * The running sessions, the duration of the sessions and the sessions
+ * and cpu time per module are exported as metrics as well, the
+ * durations per listener are recorded in the latency histograms.
+ *
+ * \note Children of the main loop are only reaped by reap(), so SIGCHLD
+ * must not be handled with waitpid(2) elsewhere. reap() leaves alone
+ * the children it does not know of, like the compressing child of the
+ * log rotator, which waits for it itself; other children of the main
+ * loop have to be adopt()ed.
+ */
+// }}}1 DXG DOC
+class SessionAccounting
+{ // {{{1
+	public:
+		// {{{2 DXG DOC
+		/**
+		 * Resources used by one or more sessions
+		 */
+		// }}}2 DXG DOC
+		struct Usage
+		{
+			unsigned long sessions;				///< number of sessions
+			u_int64_t cpuMicros;		///< user and system time
+			u_int64_t wallMicros;		///< time from fork to exit
+			long maxRss;						///< largest resident set in kilobytes
+			unsigned long voluntary;			///< context switches while waiting
+			unsigned long involuntary;			///< context switches by preemption
+
+			Usage() :
+				sessions(0),
+				cpuMicros(0),
+				wallMicros(0),
+				maxRss(0),
+				voluntary(0),
+				involuntary(0)
+			{ }
+			void add(const Usage &_other);
+		};
+
+		SessionAccounting(const std::string &_module);
+		static void configure(time_t _interval, size_t _sources);
+		void started(pid_t _pid, const std::string &_sessionModule, in_addr_t _srcIp, in_port_t _port,
+				int _listener = -1);
+		void adopt(pid_t _pid);
+		unsigned int reap();
+		void report(time_t _now);
+		const Usage& getTotal() const;
+		size_t getRunning() const;
+	private:
+		// {{{2 DXG DOC
+		/**
+		 * A running session process
+		 */
+		// }}}2 DXG DOC
+		struct Session
+		{
+			std::string module;					///< module serving the session
+			in_addr_t srcIp;					///< address of the client
+			in_port_t port;						///< port of the session, in network byte order
+			struct timespec start;				///< monotonic time of the fork
+			int listener;						///< listener of the latency histograms, -1 for none
+		};
+
+		// {{{2 DXG DOC
+		/**
+		 * Ids of the metrics of a module
+		 */
+		// }}}2 DXG DOC
+		struct ModuleMetrics
+		{
+			int sessions;						///< counter of the sessions
+			int cpu;							///< counter of the cpu time
+		};
+
+		static time_t interval;					///< seconds between reports, 0 for none
+		static size_t maxSources;				///< sources kept apart per window
+
+		std::string module;						///< name to log with
+		std::map<pid_t, Session> running;		///< sessions not reaped yet
+		std::set<pid_t> adopted;				///< other children to reap
+		std::map<std::string, Usage> byModule;	///< usage per module within the window
+		std::map<in_port_t, Usage> byPort;		///< usage per port within the window
+		std::map<in_addr_t, Usage> bySource;	///< usage per source within the window
+		Usage window;							///< usage of all sessions within the window
+		Usage total;							///< usage of all sessions so far
+		time_t nextReport;						///< end of the window, 0 if not started
+		int activeMetric;						///< id of the gauge of running sessions
+		int durationMetric;						///< id of the histogram of the wall times
+		std::map<std::string, ModuleMetrics> moduleMetrics;	///< ids of the metrics per module
+
+		void account(pid_t _pid, int _status, const struct rusage &_usage);
+		unsigned int reapEach();
+		// hidden
+		SessionAccounting(const SessionAccounting &rhs);
+		SessionAccounting &operator=(const SessionAccounting &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _SESSIONACCOUNTING_H
@@ -33,33 +33,43 @@
  */
 #include <signals.h>
 #include <logging.h>
+#include <eventlog.h>
 #include <fw_pcap.h>
+#include <latency.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/signalfd.h>
+#define HAVE_SIGNALFD
+#endif
 
 extern Deception::Logging globLog;
 extern std::string logName;
 
+#ifndef HAVE_SIGNALFD
+// written to by chldHandler(), read by the main loop
+static int childPipe[2] = { -1, -1 };
+#endif
+
 // {{{1 DXG DOC
 /**
- * Handler for SIGCHLD, just calls waitpidto fetch all exited child
- * processes.
+ * Handler for SIGCHLD where there is no signalfd, it wakes up the main
+ * loop through the pipe of openChildEvents(). The children are reaped
+ * there, so wait4() still has their resource usage.
  *
  * \param signalNo Signal number
  */
+// }}}1 DXG DOC
 void chldHandler(int signalNo)
 {
-	pid_t pid;
-	int stat;
-	std::string logMsg;
-	// wait for any child process
-	// if no child has exited, we'll just return to
-	// the caller, hence WNOHANG
-	while ((pid = waitpid(-1, &stat, WNOHANG)) > 0)
-	{
-#ifdef DEBUG
-		logMsg.append("child ").append(intToString(pid)).append(" exited with return code ").append(intToString(stat));
-		globLog.toLog(logName, Deception::Debug, logMsg);
+#ifndef HAVE_SIGNALFD
+	int savedErrno = errno;
+	// a full pipe has a wakeup pending anyway
+	(void) ::write(childPipe[1], "c", 1);
+	errno = savedErrno;
 #endif
-	}
 	return;
 }
 
@@ -73,6 +83,35 @@ void alrmHandler(int signalNo)
 	return;
 }
 
+// {{{1 DXG DOC
+/**
+ * Handler for SIGHUP, asks the logging facility and the event log to
+ * reopen their files.
+ *
+ * \param signalNo Signal number
+ */
+// }}}1 DXG DOC
+void hupHandler(int signalNo)
+{
+	globLog.requestReopen();
+	globEvents.requestReopen();
+	return;
+}
+
+// {{{1 DXG DOC
+/**
+ * Handler for SIGUSR1, asks the main loop to log the latency
+ * histograms.
+ *
+ * \param signalNo Signal number
+ */
+// }}}1 DXG DOC
+void usr1Handler(int signalNo)
+{
+	globLatency.requestDump();
+	return;
+}
+
 // {{{1 DXG DOC
 /**
  * Function to set signal handlers, brought to you by W.R.Stevens
@@ -104,3 +143,89 @@ sigFunc * setSigHandler(int signalNo, sigFunc *function)
 	return(oldAction.sa_handler);
 }
 
+// {{{1 DXG DOC
+/**
+ * Get exits of child processes delivered as a readable descriptor, so
+ * the main loop can wait for them with select() like for connections.
+ * On Linux SIGCHLD is blocked and read from a signalfd, so it never
+ * interrupts a system call. Elsewhere chldHandler() writes to a pipe.
+ * Has to be called before any thread is started, they inherit the
+ * blocked signal.
+ *
+ * \return Descriptor to select() for reading
+ *
+ * \exception Deception::Exception The descriptor could not be created
+ */
+// }}}1 DXG DOC
+int openChildEvents()
+{
+#ifdef HAVE_SIGNALFD
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	if (::sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+		throw Deception::Exception(errno);
+	}
+	int fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd == -1) {
+		throw Deception::Exception(errno);
+	}
+	return fd;
+#else
+	if (::pipe(childPipe) == -1) {
+		throw Deception::Exception(errno);
+	}
+	for (int i = 0; i < 2; i++) {
+		::fcntl(childPipe[i], F_SETFL, ::fcntl(childPipe[i], F_GETFL) | O_NONBLOCK);
+		::fcntl(childPipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	setSigHandler(SIGCHLD, chldHandler);
+	return childPipe[0];
+#endif
+}
+
+// {{{1 DXG DOC
+/**
+ * Consume the pending child events, the children still have to be
+ * reaped with wait4(2)
+ *
+ * \param fd Descriptor returned by openChildEvents()
+ */
+// }}}1 DXG DOC
+void readChildEvents(int fd)
+{
+#ifdef HAVE_SIGNALFD
+	// several exits may be folded into one signal
+	struct signalfd_siginfo info[8];
+#else
+	char info[64];
+#endif
+	while (::read(fd, info, sizeof(info)) > 0) {
+	}
+	return;
+}
+
+// {{{1 DXG DOC
+/**
+ * Undo openChildEvents() in a forked child, so the module it runs sees
+ * SIGCHLD as usual
+ *
+ * \param fd Descriptor returned by openChildEvents()
+ */
+// }}}1 DXG DOC
+void closeChildEvents(int fd)
+{
+	::close(fd);
+#ifdef HAVE_SIGNALFD
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	::sigprocmask(SIG_UNBLOCK, &mask, NULL);
+#else
+	::close(childPipe[1]);
+	childPipe[0] = childPipe[1] = -1;
+	setSigHandler(SIGCHLD, SIG_DFL);
+#endif
+	return;
+}
+
@@ -49,5 +49,10 @@ typedef void sigFunc(int);
 
 void chldHandler(int signalNo);
 void alrmHandler(int signalNo);
+void hupHandler(int signalNo);
+void usr1Handler(int signalNo);
 sigFunc * setSigHandler(int signalNo, sigFunc *function);
+int openChildEvents();
+void readChildEvents(int fd);
+void closeChildEvents(int fd);
 #endif
@@ -61,7 +61,7 @@ DECEPTION_NAMESPACE_BEGIN
  *
  */
 // }}}1
-Socket::Socket() : connected(false), listening(false), port(-1), servIpAddr("")
+Socket::Socket() : connected(false), listening(false), port(-1), servIpAddr(""), hasSynFingerprint(false)
 { // DEFAULT CONSTRUCTOR
 	this->timeOut.tv_sec = 10;
 	this->timeOut.tv_usec = 0;
@@ -74,7 +74,7 @@ Socket::Socket() : connected(false), listening(false), port(-1), servIpAddr("")
  * \param _port Port number to bind to
  */
 // }}}1
-Socket::Socket(int _port) : connected(false), listening(false), port(_port), servIpAddr("")
+Socket::Socket(int _port) : connected(false), listening(false), port(_port), servIpAddr(""), hasSynFingerprint(false)
 { // CONSTRUCTOR
 	this->timeOut.tv_sec = 10;
 	this->timeOut.tv_usec = 0;
@@ -88,7 +88,7 @@ Socket::Socket(int _port) : connected(false), listening(false), port(_port), ser
  * \param _port Port number to bind to
  */
 // }}}1
-Socket::Socket(std::string _ipaddr, int _port) : connected(false), listening(false), port(_port), servIpAddr(_ipaddr)
+Socket::Socket(std::string _ipaddr, int _port) : connected(false), listening(false), port(_port), servIpAddr(_ipaddr), hasSynFingerprint(false)
 { // CONSTRUCTOR
 	this->timeOut.tv_sec = 10;
 	this->timeOut.tv_usec = 0;
@@ -172,6 +172,8 @@ void Socket::doAccept()
 		this->input.setTimeout(this->timeOut.tv_sec, this->timeOut.tv_usec);
 		this->output.doInit(this->clientFd);
 		this->connected = true;
+		this->hasSynFingerprint = false;
+		this->clientOs.erase();
 	}
 	// create streams
 	// set flags
@@ -308,6 +310,74 @@ std::string Socket::getClientAddress() const
 }
 
 // {{{1
+/**
+ * Fetch the client's address and port of the current connection
+ *
+ * \return client's socket address
+ */
+const struct sockaddr_in& Socket::getClientSockAddr() const
+{
+	return this->clientAddress;
+}
+
+/**
+ * Fetch the local address and port of the current connection. Unlike
+ * the configured ip address this is never INADDR_ANY.
+ *
+ * \return local socket address, zeroed in case of errors
+ */
+struct sockaddr_in Socket::getLocalSockAddr() const
+{
+	struct sockaddr_in localAddress;
+	socklen_t size = sizeof(localAddress);
+	if (::getsockname(this->clientFd, reinterpret_cast<struct sockaddr*>(&localAddress), &size) == -1) {
+		bzero(&localAddress, sizeof(localAddress));
+	}
+	return localAddress;
+}
+
+/**
+ * Attach the SYN of the current connection, as seen by the capture
+ * engine
+ *
+ * \param _syn Fingerprint of the SYN
+ */
+void Socket::setSynFingerprint(const SynFingerprint &_syn)
+{
+	this->synFingerprint = _syn;
+	this->hasSynFingerprint = true;
+}
+
+/**
+ * Fetch the SYN of the current connection
+ *
+ * \return fingerprint of the SYN, NULL if it is unknown
+ */
+const SynFingerprint* Socket::getSynFingerprint() const
+{
+	return this->hasSynFingerprint ? &this->synFingerprint : NULL;
+}
+
+/**
+ * Set the operating system of the client, as told by its SYN
+ *
+ * \param _os Label of the OS signature
+ */
+void Socket::setClientOs(const std::string &_os)
+{
+	this->clientOs = _os;
+}
+
+/**
+ * Fetch the operating system of the client, e.g. to choose a banner
+ *
+ * \return label of the OS signature, empty if it is unknown
+ */
+const std::string& Socket::getClientOs() const
+{
+	return this->clientOs;
+}
+
 /**
  * Creates a socket for use with the rest of the member functions
  * and set some necessary socket options
@@ -45,6 +45,7 @@
 #include "defs.h"
 #include "inputstream.h"
 #include "outputstream.h"
+#include "flowtable.h"
 
 #ifdef Darwin
 typedef int socklen_t;
@@ -114,6 +115,12 @@ class Socket
 		std::string getIpAddrPort() const;
 		void setPort(int _port);
 		std::string getClientAddress() const;
+		const struct sockaddr_in& getClientSockAddr() const;
+		struct sockaddr_in getLocalSockAddr() const;
+		void setSynFingerprint(const SynFingerprint &_syn);
+		const SynFingerprint* getSynFingerprint() const;
+		void setClientOs(const std::string &_os);
+		const std::string& getClientOs() const;
 		void setTimeout(long sec, long msec)
 		{
 			this->timeOut.tv_sec = sec;
@@ -134,6 +141,9 @@ class Socket
 		int backLog;						///< backlog for ::listen(2)
 		struct timeval timeOut;				///< input timeout
 		std::string servIpAddr;				///< ip address to bind to
+		SynFingerprint synFingerprint;		///< SYN of the client connection
+		bool hasSynFingerprint;				///< flag, if synFingerprint is known
+		std::string clientOs;				///< operating system of the client, empty if unknown
 		void doSocket();
 		void doBind();
 		void doListen();
@@ -0,0 +1,147 @@
+// Checks the segments of the phantom port responder without sending
+// them: the checksum of a SYN-ACK against a known vector, the cookies
+// complete() accepts and rejects, and sequence numbers wrapping around.
+// Usage: phantommain
+
+#include <iostream>
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "phantom.h"
+
+DECEPTION_NAMESPACE_BEGIN
+
+class PhantomTest
+{
+	public:
+		PhantomTest() :
+			failures(0)
+		{
+			// no raw socket is opened, so the secret is zero and nothing is sent
+			this->client = inet_addr("192.168.1.2");
+			this->server = inet_addr("10.0.0.1");
+			this->clientPort = htons(40000);
+			this->serverPort = htons(80);
+		}
+
+		int run()
+		{
+			this->checksum();
+			this->cookies();
+			this->wraparound();
+			std::cout << this->failures << " failures" << std::endl;
+			return (this->failures == 0) ? 0 : 1;
+		}
+
+	private:
+		PhantomResponder responder;
+		in_addr_t client;
+		in_addr_t server;
+		in_port_t clientPort;
+		in_port_t serverPort;
+		int failures;
+
+		void check(bool _ok, const char *_what)
+		{
+			if (!_ok) {
+				std::cerr << "failed: " << _what << std::endl;
+				this->failures++;
+			}
+		}
+
+		static unsigned int readShort(const u_char *p)
+		{
+			return (p[0] << 8) | p[1];
+		}
+
+		static u_int32_t readLong(const u_char *p)
+		{
+			return (static_cast<u_int32_t>(readShort(p)) << 16) | readShort(p + 2);
+		}
+
+		/// the last queued segment, its tcp header
+		const u_char *last()
+		{
+			return this->responder.queue[this->responder.queued - 1].packet + 20;
+		}
+
+		void checksum()
+		{
+			this->responder.queued = 0;
+			this->responder.reply(this->client, this->clientPort, this->server, this->serverPort,
+					0x12345678, 0x9abcdef1, 0x12);
+			const PhantomResponder::Reply &reply = this->responder.queue[0];
+			const u_char *tcp = reply.packet + 20;
+			this->check(reply.length == 44, "SYN-ACK carries the mss option");
+			this->check(readShort(reply.packet + 2) == 44, "ip length");
+			this->check((tcp[13] == 0x12) && (readShort(tcp + 22) == 1460), "SYN-ACK flags and mss");
+			// computed independently from the same header
+			this->check(readShort(tcp + 16) == 0xdb6f, "tcp checksum of the known SYN-ACK");
+
+			// a receiver sums to all ones, checksum included
+			u_int32_t sum = readShort(reply.packet + 12) + readShort(reply.packet + 14)
+				+ readShort(reply.packet + 16) + readShort(reply.packet + 18) + IPPROTO_TCP + 24;
+			for (size_t i = 0; i < 24; i += 2) {
+				sum += readShort(tcp + i);
+			}
+			while (sum >> 16) {
+				sum = (sum & 0xffff) + (sum >> 16);
+			}
+			this->check(sum == 0xffff, "tcp checksum verifies");
+		}
+
+		/// send a SYN and check the ack of the handshake
+		bool handshake(u_int32_t _seq, time_t _synTime, time_t _ackTime, u_int32_t _flip)
+		{
+			this->responder.queued = 0;
+			this->responder.answer(this->client, this->clientPort, this->server, this->serverPort,
+					_seq, _synTime);
+			u_int32_t isn = readLong(this->last() + 4);
+			this->check(readLong(this->last() + 8) == _seq + 1, "SYN-ACK acknowledges the SYN");
+			bool accepted = this->responder.complete(this->client, this->clientPort, this->server,
+					this->serverPort, _seq + 1, (isn + 1) ^ _flip, 5, _ackTime);
+			if (accepted) {
+				const u_char *rst = this->last();
+				this->check((rst[13] == 0x14) && (this->responder.queued == 2), "handshake is reset");
+				this->check(readLong(rst + 4) == isn + 1, "reset continues our sequence");
+				this->check(readLong(rst + 8) == _seq + 1 + 5, "reset acknowledges the data");
+			} else {
+				this->check(this->responder.queued == 1, "nothing is sent for a bad cookie");
+			}
+			return accepted;
+		}
+
+		void cookies()
+		{
+			// start of a cookie period, counter is 1000000000 >> 6
+			time_t now = 15625000 << 6;
+			this->check(this->handshake(0x12345678, now, now, 0), "cookie of the counter");
+			this->check(this->handshake(0x12345678, now, now + 64, 0), "cookie of the counter - 1");
+			this->check(this->handshake(0x12345678, now, now + 127, 0), "cookie at the end of counter - 1");
+			this->check(!this->handshake(0x12345678, now, now + 128, 0), "cookie of the counter - 2");
+			this->check(!this->handshake(0x12345678, now, now, 1), "flipped ack");
+			this->check(!this->handshake(0x12345678, now, now, 0x80000000), "flipped high bit of ack");
+		}
+
+		void wraparound()
+		{
+			time_t now = 15625000 << 6;
+			// the ack of the SYN wraps
+			this->check(this->handshake(0xffffffff, now, now, 0), "client sequence wraps");
+			// our isn wraps
+			u_int32_t cookie = this->responder.cookie(this->client, this->clientPort, this->server,
+					this->serverPort, 15625000);
+			this->check(this->handshake(0xffffffff - cookie, now, now, 0), "our sequence wraps to zero");
+			this->check(this->handshake(0 - cookie, now, now, 0), "our isn is zero");
+			this->check(!this->handshake(0xffffffff - cookie, now, now, 1), "wrapped sequence with flipped ack");
+		}
+};
+
+DECEPTION_NAMESPACE_END
+
+int main(int argc, char **argv)
+{
+	Deception::PhantomTest test;
+	return test.run();
+}
@@ -0,0 +1,109 @@
+// Checks that the compact capture filter (BPF expression plus port
+// bitmap) passes the same packets as the naive expression with one
+// clause per host and port. Usage: portfiltermain [hosts] [ports per host]
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <pcap.h>
+
+#include "portfilter.h"
+
+using namespace Deception;
+
+static bool compile(pcap_t *handle, const std::string &expr, struct bpf_program &prog, int optimize)
+{
+	if (pcap_compile(handle, &prog, const_cast<char*>(expr.c_str()), optimize, 0) == -1) {
+		std::cerr << "pcap_compile: " << pcap_geterr(handle) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int hostCount = (argc > 1) ? atoi(argv[1]) : 4;
+	int portCount = (argc > 2) ? atoi(argv[2]) : 2000;
+	srand(4711);
+
+	PortFilter filter;
+	std::vector<in_addr_t> hosts;
+	std::vector<std::vector<unsigned int> > ports(hostCount);
+	std::string naive;
+	for (int h = 0; h < hostCount; h++) {
+		in_addr_t addr = htonl(0x0a000001 + h);
+		hosts.push_back(addr);
+		char ip[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+		if (h > 0) {
+			naive.append(" or ");
+		}
+		naive.append("(dst host ").append(ip);
+		for (int p = 0; p < portCount; p++) {
+			unsigned int port = 1 + rand() % 65535;
+			ports[h].push_back(port);
+			filter.add(addr, port);
+			char clause[32];
+			snprintf(clause, sizeof(clause), " and not dst port %u", port);
+			naive.append(clause);
+		}
+		naive.append(")");
+	}
+	naive = "(" + naive + ") and tcp[13] & 18 == 2";
+
+	pcap_t *handle = pcap_open_dead(DLT_EN10MB, 128);
+	struct bpf_program naiveProg, compactProg;
+	// optimizing thousands of clauses takes ages
+	if (!compile(handle, naive, naiveProg, 0) || !compile(handle, filter.expression(), compactProg, 1)) {
+		return 1;
+	}
+	std::cout << "naive filter: " << naiveProg.bf_len << " instructions, compact filter: "
+		<< compactProg.bf_len << " instructions" << std::endl;
+
+	u_char packet[14 + 20 + 20];
+	struct pcap_pkthdr header;
+	memset(&header, 0, sizeof(header));
+	header.caplen = header.len = sizeof(packet);
+	int mismatches = 0;
+	for (int i = 0; i < 200000; i++) {
+		memset(packet, 0, sizeof(packet));
+		packet[12] = 0x08;
+		u_char *ip = packet + 14;
+		u_char *tcp = ip + 20;
+		ip[0] = 0x45;
+		ip[9] = (rand() % 8) ? IPPROTO_TCP : IPPROTO_UDP;
+		// mostly configured hosts, some others
+		in_addr_t dst = (rand() % 4) ? hosts[rand() % hostCount] : htonl(0x0a000001 + hostCount + rand() % 4);
+		memcpy(ip + 16, &dst, 4);
+		// half of the ports are listening ones
+		unsigned int port = 1 + rand() % 65535;
+		if ((rand() % 2) && (dst == hosts[0])) {
+			port = ports[0][rand() % portCount];
+		}
+		tcp[2] = port >> 8;
+		tcp[3] = port & 0xff;
+		tcp[12] = 0x50;
+		tcp[13] = rand() & 0x3f;
+
+		bool expected = pcap_offline_filter(&naiveProg, &header, packet) != 0;
+		in_port_t dstPort = htons(port);
+		bool got = (pcap_offline_filter(&compactProg, &header, packet) != 0)
+			&& filter.matches(dst, dstPort);
+		if (expected != got) {
+			if (mismatches++ < 10) {
+				std::cerr << "mismatch for port " << port << " flags " << int(tcp[13])
+					<< ": naive " << expected << ", compact " << got << std::endl;
+			}
+		}
+	}
+	pcap_freecode(&naiveProg);
+	pcap_freecode(&compactProg);
+	pcap_close(handle);
+	std::cout << mismatches << " mismatches" << std::endl;
+	return (mismatches == 0) ? 0 : 1;
+}
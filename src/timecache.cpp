@@ -0,0 +1,157 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * \file timecache.cpp
+ *
+ * Contains the implementation of the timestamp cache
+ */
+#include "timecache.h"
+
+#include <string.h>
+#include <stdio.h>
+
+// {{{1 DXG DOC
+/**
+ * Constructor
+ *
+ * \param _precision Number of sub-second digits, see setPrecision()
+ */
+// }}}1 DXG DOC
+Deception::TimeCache::TimeCache(int _precision) : precision(0), cachedSec(-1), cachedLen(0)
+{ // {{{1
+	this->cached[0] = '\0';
+	this->setPrecision(_precision);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Set the number of sub-second digits to append to every timestamp.
+ *
+ * \param _precision 0 for none, 3 for milliseconds or 6 for microseconds
+ *
+ * \retval true If the precision is supported
+ * \retval false If it is not, the precision is left unchanged
+ */
+// }}}1 DXG DOC
+bool Deception::TimeCache::setPrecision(int _precision)
+{ // {{{1
+	if ((_precision != 0) && (_precision != 3) && (_precision != 6)) {
+		return false;
+	}
+	this->precision = _precision;
+	return true;
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Fetch the current wall clock time as cheap as the platform allows
+ *
+ * \param _tv Is set to the current time
+ * \param _precision Sub-second digits that are needed, the coarse
+ * clock is only good for up to milliseconds
+ */
+// }}}1 DXG DOC
+void Deception::TimeCache::getTime(struct timeval &_tv, int _precision)
+{ // {{{1
+#if defined(CLOCK_REALTIME_COARSE)
+	struct timespec ts;
+	clockid_t clock = (_precision > 3) ? CLOCK_REALTIME : CLOCK_REALTIME_COARSE;
+	if (::clock_gettime(clock, &ts) == 0) {
+		_tv.tv_sec = ts.tv_sec;
+		_tv.tv_usec = ts.tv_nsec / 1000;
+		return;
+	}
+#endif
+	if (::gettimeofday(&_tv, NULL) != 0) {
+		_tv.tv_sec = ::time(NULL);
+		_tv.tv_usec = 0;
+	}
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Format the current time
+ *
+ * \param _buf Buffer of at least TimeCache::maxLength bytes
+ *
+ * \return Length of the timestamp, without terminating '\0'
+ */
+// }}}1 DXG DOC
+size_t Deception::TimeCache::now(char *_buf)
+{ // {{{1
+	struct timeval tv;
+	getTime(tv, this->precision);
+	return this->format(tv, _buf);
+} // }}}1
+
+// {{{1 DXG DOC
+/**
+ * Format a given time, e.g. the timestamp of a captured packet.
+ * If the time can't be converted, "-" is used instead.
+ *
+ * \param _tv Time to format
+ * \param _buf Buffer of at least TimeCache::maxLength bytes
+ *
+ * \return Length of the timestamp, without terminating '\0'
+ */
+// }}}1 DXG DOC
+size_t Deception::TimeCache::format(const struct timeval &_tv, char *_buf)
+{ // {{{1
+	time_t sec = _tv.tv_sec;
+	if (sec != this->cachedSec) {
+		// the second changed, so the text has to be rebuilt
+		struct tm lTime;
+		this->cachedLen = 0;
+		if (::localtime_r(&sec, &lTime) != NULL) {
+			this->cachedLen = ::strftime(this->cached, maxLength, "%d.%m.%Y %H:%M:%S", &lTime);
+		}
+		if (this->cachedLen == 0) {
+			// don't cache failures
+			_buf[0] = '-';
+			_buf[1] = '\0';
+			return 1;
+		}
+		this->cachedSec = sec;
+	}
+	::memcpy(_buf, this->cached, this->cachedLen);
+	size_t len = this->cachedLen;
+	if (this->precision > 0) {
+		long frac = _tv.tv_usec;
+		if (this->precision == 3) {
+			frac /= 1000;
+		}
+		// write the digits backwards, that's cheaper than snprintf()
+		_buf[len] = '.';
+		for (int i = this->precision; i > 0; i--) {
+			_buf[len + i] = '0' + (frac % 10);
+			frac /= 10;
+		}
+		len += this->precision + 1;
+	}
+	_buf[len] = '\0';
+	return len;
+} // }}}1
@@ -0,0 +1,106 @@
+// Copyright (c) 2003, Alexis Hildebrandt, Mathias Meyer
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// * Neither the name of the authors nor the names of its contributors may
+//   be used to endorse or promote products derived from this software without
+//   specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _TIMECACHE_H
+#define _TIMECACHE_H
+
+/**
+ * \file timecache.h
+ *
+ * Declares a small cache for textual timestamps and the cheap clock
+ * behind it.
+ */
+
+// Project Headers
+#include "defs.h"
+
+// C Headers
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+
+DECEPTION_NAMESPACE_BEGIN
+
+// {{{1 DXG DOC
+/**
+ * \class TimeCache
+ *
+ * Formats timestamps as "05.04.2003 18:08:48", optionally followed by
+ * milliseconds or microseconds. localtime() and strftime() are only
+ * called when the second changes, all other calls just copy the cached
+ * text and append the fraction.
+ *
+ * The current time is taken from CLOCK_REALTIME_COARSE where
+ * available, which is served from the vDSO on linux without a
+ * syscall. Its resolution is a clock tick, so for microsecond precision
+ * the regular CLOCK_REALTIME is used instead.
+ *
+ * Logging owns the one instance of a process, every text line goes
+ * through it: the capture threads hand their events to the main loop
+ * through the EventPipeline, which logs them. The event log writes
+ * seconds and microseconds as numbers, there is no text to cache, so it
+ * only takes the clock from getTime().
+ *
+ * \note An object is not thread-safe, every thread formatting
+ * timestamps needs its own.
+ */
+// }}}1 DXG DOC
+class TimeCache
+{ // {{{1
+	public:
+		/// maximum length of a formatted timestamp including '\0'
+		static const size_t maxLength = 32;
+
+		TimeCache(int _precision = 0);
+		~TimeCache() { }
+		bool setPrecision(int _precision);
+		// {{{2 DXG DOC
+		/**
+		 * Fetch number of sub-second digits
+		 *
+		 * \return 0, 3 or 6
+		 */
+		// }}}2 DXG DOC
+		int getPrecision() const
+		{
+			return this->precision;
+		}
+		size_t now(char *_buf);
+		size_t format(const struct timeval &_tv, char *_buf);
+		static void getTime(struct timeval &_tv, int _precision = 0);
+	private:
+		int precision;					///< number of sub-second digits
+		time_t cachedSec;				///< second the cached text belongs to
+		char cached[maxLength];			///< formatted text of cachedSec
+		size_t cachedLen;				///< length of cached text
+		// copying is harmless, but there is no use for it
+		TimeCache(const TimeCache &rhs);
+		TimeCache &operator=(const TimeCache &rhs);
+}; // }}}1
+
+DECEPTION_NAMESPACE_END
+#endif // _TIMECACHE_H